@@ -925,6 +925,50 @@ static void test_geohash_point_as_int(void)
 	CU_ASSERT_EQUAL(gh, rs);
 }
 
+static void test_sfc_keys(void)
+{
+	uint32_t x, y;
+	uint64_t key, minkey = UINT64_MAX, maxkey = 0;
+	char seen[64];
+	GBOX extent, box;
+
+	/* Z-order interleaves x on even bits and y on odd bits */
+	CU_ASSERT_EQUAL(zorder_xy_to_key(1, 0), 1);
+	CU_ASSERT_EQUAL(zorder_xy_to_key(0, 1), 2);
+	CU_ASSERT_EQUAL(zorder_xy_to_key(3, 3), 15);
+
+	/* Hilbert curve starts at the origin and ends at the lower right */
+	CU_ASSERT_EQUAL(hilbert_xy_to_key(0, 0), 0);
+	CU_ASSERT_EQUAL(hilbert_xy_to_key(0x7FFFFFFF, 0), 0x3FFFFFFFFFFFFFFFULL);
+
+	/* An aligned 8x8 block of cells is a contiguous run of the curve */
+	memset(seen, 0, sizeof(seen));
+	for ( x = 0; x < 8; x++ )
+	{
+		for ( y = 0; y < 8; y++ )
+		{
+			key = hilbert_xy_to_key(x, y);
+			if ( key < minkey ) minkey = key;
+			if ( key > maxkey ) maxkey = key;
+			if ( key < 64 ) seen[key] = 1;
+		}
+	}
+	CU_ASSERT_EQUAL(minkey, 0);
+	CU_ASSERT_EQUAL(maxkey, 63);
+	CU_ASSERT(memchr(seen, 0, sizeof(seen)) == NULL);
+
+	/* Box keys use the box center, clamped to the extent */
+	extent.xmin = extent.ymin = 0;
+	extent.xmax = extent.ymax = 10;
+	box.xmin = box.ymin = -20;
+	box.xmax = box.ymax = 10;
+	CU_ASSERT_EQUAL(gbox_hilbert_key(&box, &extent), 0);
+	CU_ASSERT_EQUAL(gbox_zorder_key(&box, &extent), 0);
+	box.xmin = box.ymin = box.xmax = box.ymax = 5;
+	CU_ASSERT_EQUAL(gbox_hilbert_key(&box, &extent), 0x2000000000000000ULL);
+	CU_ASSERT_EQUAL(gbox_zorder_key(&box, &extent), 0x3000000000000000ULL);
+}
+
 static void test_lwgeom_simplify(void)
 {
 		LWGEOM *l;
@@ -1205,6 +1249,7 @@ void algorithms_suite_setup(void)
 	PG_ADD_TEST(suite,test_geohash_precision);
 	PG_ADD_TEST(suite,test_geohash);
 	PG_ADD_TEST(suite,test_geohash_point_as_int);
+	PG_ADD_TEST(suite,test_sfc_keys);
 	PG_ADD_TEST(suite,test_isclosed);
 	PG_ADD_TEST(suite,test_lwgeom_simplify);
 	PG_ADD_TEST(suite,test_lw_arc_center);
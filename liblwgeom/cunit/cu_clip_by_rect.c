@@ -18,7 +18,6 @@
 
 static void test_lwgeom_clip_by_rect(void)
 {
-#if POSTGIS_GEOS_VERSION >= 35
 	LWGEOM *in, *out;
 	const char *wkt;
 	char *tmp;
@@ -65,8 +64,89 @@ static void test_lwgeom_clip_by_rect(void)
 	//tmp = lwgeom_to_ewkt(out); printf("%s\n", tmp); lwfree(tmp);
 	CU_ASSERT(lwgeom_is_empty(out));
 	lwgeom_free(out); lwgeom_free(in);
+}
+
+static void do_rectclip_test(const char *wkt, double xmin, double ymin,
+                             double xmax, double ymax, const char *expected)
+{
+	LWGEOM *in, *out;
+	GBOX box;
+	char *tmp;
+
+	gbox_init(&box);
+	box.xmin = xmin; box.ymin = ymin;
+	box.xmax = xmax; box.ymax = ymax;
 
-#endif /* POSTGIS_GEOS_VERSION >= 35 */
+	in = lwgeom_from_wkt(wkt, LW_PARSER_CHECK_NONE);
+	out = lwgeom_rectclip(in, &box);
+	if ( ! expected )
+	{
+		CU_ASSERT_PTR_NULL(out);
+		lwgeom_free(in);
+		return;
+	}
+	CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+	tmp = lwgeom_to_ewkt(out);
+	if ( strcmp(expected, tmp) )
+		printf("\nExp:  %s\nObt:  %s\n", expected, tmp);
+	CU_ASSERT_STRING_EQUAL(expected, tmp);
+	lwfree(tmp); lwgeom_free(out); lwgeom_free(in);
+}
+
+static void test_lwgeom_rectclip(void)
+{
+	/* Polygon crossing one side, holes inside the box are kept */
+	do_rectclip_test("POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,2 3,3 3,3 2,2 2))",
+	                 1, -1, 11, 11,
+	                 "POLYGON((1 0,10 0,10 10,1 10,1 0),(2 2,2 3,3 3,3 2,2 2))");
+	/* Holes crossing the box are left to GEOS */
+	do_rectclip_test("POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,2 3,3 3,3 2,2 2))",
+	                 2.5, -1, 11, 11, NULL);
+	/* Box inside a hole */
+	do_rectclip_test("POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,8 2,8 8,2 8,2 2))",
+	                 4, 4, 6, 6, "POLYGON EMPTY");
+	/* Holes outside the box are dropped */
+	do_rectclip_test("POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,2 3,3 3,3 2,2 2))",
+	                 4, 4, 11, 11,
+	                 "POLYGON((4 4,10 4,10 10,4 10,4 4))");
+	/* Shell collapsing onto the box sides gives an empty */
+	do_rectclip_test("POLYGON((0 0,20 0,20 1,1 1,1 20,0 20,0 0))",
+	                 5, 5, 10, 10, "POLYGON EMPTY");
+	/* Concave ring entering the box twice is left to GEOS */
+	do_rectclip_test("POLYGON((0 0,10 0,10 10,7 10,7 3,3 3,3 10,0 10,0 0))",
+	                 1, 5, 9, 12, NULL);
+	/* Concave ring entering the box once */
+	do_rectclip_test("POLYGON((0 0,10 0,10 10,0 10,0 6,5 6,5 4,0 4,0 0))",
+	                 3, 3, 7, 7, "POLYGON((3 3,7 3,7 7,3 7,3 6,5 6,5 4,3 4,3 3))");
+	/* Shell around the box */
+	do_rectclip_test("POLYGON((0 0,10 0,10 10,0 10,0 0))",
+	                 2, 2, 5, 5, "POLYGON((2 2,2 5,5 5,5 2,2 2))");
+	/* Bow-tie is left to GEOS */
+	do_rectclip_test("POLYGON((0 0,10 10,0 10,10 0,0 0))",
+	                 2, 2, 8, 8, NULL);
+	/* M values are interpolated on the cut */
+	do_rectclip_test("POLYGON M((0 0 0,10 0 10,10 10 20,0 10 30,0 0 0))",
+	                 5, -1, 11, 11,
+	                 "POLYGONM((5 0 5,10 0 10,10 10 20,5 10 25,5 0 5))");
+	/* Z values are interpolated on the cut */
+	do_rectclip_test("LINESTRING Z(0 0 0,10 10 10)",
+	                 2, 2, 5, 5, "LINESTRING(2 2 2,5 5 5)");
+	/* Line leaving and re-entering the box */
+	do_rectclip_test("LINESTRING(0 5,3 5,3 20,6 20,6 5,10 5)",
+	                 2, 0, 8, 10,
+	                 "MULTILINESTRING((2 5,3 5,3 10),(6 10,6 5,8 5))");
+	/* Single survivor of a multi comes back as a single */
+	do_rectclip_test("MULTILINESTRING((0 5,10 5),(20 20,30 30))",
+	                 2, 0, 8, 10, "LINESTRING(2 5,8 5)");
+	/* Points on the boundary are not inside */
+	do_rectclip_test("MULTIPOINT(0 0,2 2,3 3)",
+	                 2, 2, 5, 5, "POINT(3 3)");
+	/* Collections keep the non-empty members */
+	do_rectclip_test("GEOMETRYCOLLECTION(POINT(3 3),LINESTRING(0 5,10 5),POLYGON((0 0,1 0,1 1,0 0)))",
+	                 2, 2, 8, 8,
+	                 "GEOMETRYCOLLECTION(POINT(3 3),LINESTRING(2 5,8 5))");
+	/* Curves are left to GEOS */
+	do_rectclip_test("CIRCULARSTRING(0 0,1 1,2 0)", 0, 0, 1, 1, NULL);
 }
 
 /*
@@ -77,4 +157,5 @@ void clip_by_rect_suite_setup(void)
 {
 	CU_pSuite suite = CU_add_suite("clip_by_rectangle", NULL, NULL);
 	PG_ADD_TEST(suite, test_lwgeom_clip_by_rect);
+	PG_ADD_TEST(suite, test_lwgeom_rectclip);
 }
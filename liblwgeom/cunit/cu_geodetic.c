@@ -1155,6 +1155,153 @@ static void test_lwpoly_covers_point2d(void)
 	
 }
 
+static void test_plane_sides(void)
+{
+	POINT3D n, p;
+	POINT2D pt;
+	double x[EDGE_BLOCK_SIZE], y[EDGE_BLOCK_SIZE], z[EDGE_BLOCK_SIZE];
+	int sides[EDGE_BLOCK_SIZE];
+	int k;
+
+	/* Plane of the meridian through 10 E, with points on, near and off it */
+	pt.x = 10.0; pt.y = 0.0;
+	ll2cart(&pt, &p);
+	n.x = -p.y; n.y = p.x; n.z = 0.0;
+	for ( k = 0; k < EDGE_BLOCK_SIZE; k++ )
+	{
+		pt.x = 10.0 + (k % 3 - 1) * ldexp(1.0, -(k % 48));
+		pt.y = -80.0 + 2.5 * k;
+		ll2cart(&pt, &p);
+		x[k] = p.x; y[k] = p.y; z[k] = p.z;
+	}
+	plane_sides(&n, x, y, z, EDGE_BLOCK_SIZE, sides);
+	for ( k = 0; k < EDGE_BLOCK_SIZE; k++ )
+	{
+		p.x = x[k]; p.y = y[k]; p.z = z[k];
+		CU_ASSERT_EQUAL(sides[k], dot_product_side(&n, &p));
+	}
+}
+
+static void test_ptarray_contains_point_sphere_blocks(void)
+{
+	LWPOLY *poly;
+	POINTARRAY *pa;
+	POINT4D p;
+	POINT2D pt_to_test, pt_outside;
+	int k;
+
+	/* Square with repeated vertices, so edges straddle the blocks the */
+	/* ring is walked in, and zero length edges fall on block boundaries */
+	pa = ptarray_construct_empty(0, 0, 4 * EDGE_BLOCK_SIZE);
+	p.z = p.m = 0.0;
+	for ( k = 0; k < 3 * EDGE_BLOCK_SIZE; k++ )
+	{
+		int side = k * 4 / (3 * EDGE_BLOCK_SIZE);
+		double t = (k % (3 * EDGE_BLOCK_SIZE / 4)) / (3.0 * EDGE_BLOCK_SIZE / 4);
+		p.x = side == 0 ? -10 + 20 * t : (side == 1 ? 10 : (side == 2 ? 10 - 20 * t : -10));
+		p.y = side == 0 ? -10 : (side == 1 ? -10 + 20 * t : (side == 2 ? 10 : 10 - 20 * t));
+		ptarray_append_point(pa, &p, LW_TRUE);
+		if ( k % 7 == 0 )
+			ptarray_append_point(pa, &p, LW_TRUE);
+	}
+	p.x = -10; p.y = -10;
+	ptarray_append_point(pa, &p, LW_TRUE);
+	CU_ASSERT(pa->npoints > 3 * EDGE_BLOCK_SIZE);
+
+	poly = lwpoly_construct_empty(SRID_UNKNOWN, 0, 0);
+	lwpoly_add_ring(poly, pa);
+	pt_outside.x = 0.0;
+	pt_outside.y = 45.0;
+
+	pt_to_test.x = 0.0; pt_to_test.y = 0.0;
+	CU_ASSERT_EQUAL(ptarray_contains_point_sphere(pa, &pt_outside, &pt_to_test), LW_TRUE);
+	pt_to_test.x = 9.9; pt_to_test.y = -9.5;
+	CU_ASSERT_EQUAL(ptarray_contains_point_sphere(pa, &pt_outside, &pt_to_test), LW_TRUE);
+	pt_to_test.x = 10.5; pt_to_test.y = 0.0;
+	CU_ASSERT_EQUAL(ptarray_contains_point_sphere(pa, &pt_outside, &pt_to_test), LW_FALSE);
+	pt_to_test.x = -20.0; pt_to_test.y = 5.0;
+	CU_ASSERT_EQUAL(ptarray_contains_point_sphere(pa, &pt_outside, &pt_to_test), LW_FALSE);
+	/* On a vertex, and on the stab line through one */
+	pt_to_test.x = 10.0; pt_to_test.y = 10.0;
+	CU_ASSERT_EQUAL(ptarray_contains_point_sphere(pa, &pt_outside, &pt_to_test), LW_TRUE);
+	pt_to_test.x = 0.0; pt_to_test.y = 5.0;
+	CU_ASSERT_EQUAL(ptarray_contains_point_sphere(pa, &pt_outside, &pt_to_test), LW_TRUE);
+	lwpoly_free(poly);
+}
+
+static void test_ptarray_calculate_gbox_geodetic_blocks(void)
+{
+	POINTARRAY *pa;
+	POINT4D p;
+	POINT3D A1, A2;
+	GBOX gbox, edge_gbox, expected;
+	int k;
+
+	/* Spiral over both poles, with steps along the equator and the */
+	/* meridians and repeated points, across several blocks */
+	pa = ptarray_construct_empty(0, 0, 8 * EDGE_BLOCK_SIZE);
+	p.z = p.m = 0.0;
+	for ( k = 0; k < 5 * EDGE_BLOCK_SIZE + 3; k++ )
+	{
+		p.x = -180.0 + fmod(37.0 * k, 360.0);
+		p.y = 89.0 * sin(0.07 * k);
+		if ( k % 11 == 0 ) p.y = 0.0;
+		if ( k % 13 == 0 ) p.x = 90.0;
+		ptarray_append_point(pa, &p, LW_TRUE);
+		if ( k % 9 == 0 )
+			ptarray_append_point(pa, &p, LW_TRUE);
+	}
+
+	/* The box of the edges, one at a time */
+	gbox_init(&expected);
+	for ( k = 0; k < pa->npoints - 1; k++ )
+	{
+		ll2cart(getPoint2d_cp(pa, k), &A1);
+		ll2cart(getPoint2d_cp(pa, k+1), &A2);
+		edge_calculate_gbox(&A1, &A2, &edge_gbox);
+		if ( k == 0 )
+		{
+			expected = edge_gbox;
+			expected.flags = gflags(0, 0, 1);
+		}
+		else
+			gbox_merge(&edge_gbox, &expected);
+	}
+
+	gbox.flags = gflags(0, 0, 1);
+	CU_ASSERT_EQUAL(ptarray_calculate_gbox_geodetic(pa, &gbox), LW_SUCCESS);
+	CU_ASSERT_DOUBLE_EQUAL(gbox.xmin, expected.xmin, 1e-15);
+	CU_ASSERT_DOUBLE_EQUAL(gbox.xmax, expected.xmax, 1e-15);
+	CU_ASSERT_DOUBLE_EQUAL(gbox.ymin, expected.ymin, 1e-15);
+	CU_ASSERT_DOUBLE_EQUAL(gbox.ymax, expected.ymax, 1e-15);
+	CU_ASSERT_DOUBLE_EQUAL(gbox.zmin, expected.zmin, 1e-15);
+	CU_ASSERT_DOUBLE_EQUAL(gbox.zmax, expected.zmax, 1e-15);
+	ptarray_free(pa);
+
+	/* Short edge away from the axes is bounded by its ends, edges */
+	/* over a pole or along the equator are not */
+	pa = ptarray_construct_empty(0, 0, 4);
+	p.x = 10.0; p.y = 40.0; ptarray_append_point(pa, &p, LW_TRUE);
+	p.x = 11.0; p.y = 41.0; ptarray_append_point(pa, &p, LW_TRUE);
+	p.x = -169.0; p.y = 80.0; ptarray_append_point(pa, &p, LW_TRUE);
+	p.x = -160.0; p.y = 0.0; ptarray_append_point(pa, &p, LW_TRUE);
+	p.x = -150.0; p.y = 0.0; ptarray_append_point(pa, &p, LW_TRUE);
+	{
+		double x[5], y[5], z[5];
+		int flags[4];
+		for ( k = 0; k < 5; k++ )
+		{
+			ll2cart(getPoint2d_cp(pa, k), &A1);
+			x[k] = A1.x; y[k] = A1.y; z[k] = A1.z;
+		}
+		edge_extrema_flags(x, y, z, 5, flags);
+		CU_ASSERT_EQUAL(flags[0], 0);
+		CU_ASSERT_EQUAL(flags[1], 1);
+		CU_ASSERT_EQUAL(flags[3], 1);
+	}
+	ptarray_free(pa);
+}
+
 static void test_ptarray_contains_point_sphere_iowa(void)
 {
 	LWGEOM *lwg = lwgeom_from_wkt(iowa_data, LW_PARSER_CHECK_NONE);
@@ -1339,11 +1486,133 @@ static void test_spheroid_distance(void)
 
 }
 
+static void test_spheroid_distance_bounds(void)
+{
+	GEOGRAPHIC_POINT g1, g2;
+	double d, d_sphere, lo, hi;
+	int lat1, lat2, lon2;
+	SPHEROID s;
+
+	/* Init to WGS84 */
+	spheroid_init(&s, 6378137.0, 6356752.314245179498);
+	spheroid_distance_bounds(&s, &lo, &hi);
+	CU_ASSERT(lo < 1.0 && lo > 0.99);
+	CU_ASSERT(hi > 1.0 && hi < 1.01);
+
+	/* Spheroid distance stays within the bounds of the sphere distance */
+	for ( lat1 = -85; lat1 <= 85; lat1 += 17 )
+	for ( lat2 = -89; lat2 <= 89; lat2 += 19 )
+	for ( lon2 = 0; lon2 <= 170; lon2 += 10 )
+	{
+		/* Far apart */
+		point_set(0.0, lat1, &g1);
+		point_set(lon2, lat2, &g2);
+		d = spheroid_distance(&g1, &g2, &s);
+		d_sphere = s.radius * sphere_distance(&g1, &g2);
+		CU_ASSERT(d >= lo * d_sphere);
+		CU_ASSERT(d <= hi * d_sphere);
+		/* Close by */
+		point_set(lon2 * 0.001, lat1 + lat2 * 0.001, &g2);
+		d = spheroid_distance(&g1, &g2, &s);
+		d_sphere = s.radius * sphere_distance(&g1, &g2);
+		CU_ASSERT(d >= lo * d_sphere);
+		CU_ASSERT(d <= hi * d_sphere);
+	}
+}
+
+static void test_lwgeom_dwithin_spheroid(void)
+{
+	LWGEOM *lwg1, *lwg2;
+	double d, tolerance;
+	int i;
+	SPHEROID s;
+	const char *wkt[][2] = {
+		{ "POINT(-4 1)", "POINT(-4 -1)" },
+		{ "POINT(10 60)", "POINT(11 60.5)" },
+		{ "POINT(-4 1)", "LINESTRING(-10 -5, -5 0, 5 0, 10 -5)" },
+		{ "LINESTRING(-30 80, -20 75, -10 73)", "LINESTRING(-10 65, -5 70, 5 70, 10 65)" },
+		{ "POLYGON((0 0, 1 0, 1 1, 0 1, 0 0))", "POINT(0.5 1.2)" }
+	};
+
+	/* Init to WGS84 */
+	spheroid_init(&s, 6378137.0, 6356752.314245179498);
+
+	/* Same answer as the full spheroid calculation, on and around the distance */
+	for ( i = 0; i < 5; i++ )
+	{
+		double f;
+		lwg1 = lwgeom_from_wkt(wkt[i][0], LW_PARSER_CHECK_NONE);
+		lwg2 = lwgeom_from_wkt(wkt[i][1], LW_PARSER_CHECK_NONE);
+		d = lwgeom_distance_spheroid(lwg1, lwg2, &s, 0.0);
+		for ( f = 0.5; f < 1.5; f += 0.0025 )
+		{
+			tolerance = f * d;
+			CU_ASSERT_EQUAL(lwgeom_dwithin_spheroid(lwg1, lwg2, &s, tolerance), lwgeom_distance_spheroid(lwg1, lwg2, &s, tolerance) <= tolerance);
+		}
+		lwgeom_free(lwg1);
+		lwgeom_free(lwg2);
+	}
+
+	/* Empty input */
+	lwg1 = lwgeom_from_wkt("POINT EMPTY", LW_PARSER_CHECK_NONE);
+	lwg2 = lwgeom_from_wkt("POINT(0 0)", LW_PARSER_CHECK_NONE);
+	CU_ASSERT_EQUAL(lwgeom_dwithin_spheroid(lwg1, lwg2, &s, 10.0), -1);
+	lwgeom_free(lwg1);
+	lwgeom_free(lwg2);
+}
+
+static void test_ptarray_distance_matrix_spheroid(void)
+{
+	LWLINE *line1, *line2;
+	GEOGRAPHIC_POINT g1, g2;
+	const POINT2D *p1, *p2;
+	double matrix[12];
+	int i, j;
+	SPHEROID s;
+
+	line1 = lwgeom_as_lwline(lwgeom_from_wkt("LINESTRING(-4 1, 10 60, 0 90, 179.5 -30)", LW_PARSER_CHECK_NONE));
+	line2 = lwgeom_as_lwline(lwgeom_from_wkt("LINESTRING(-4 -1, 10 60, -179.5 30)", LW_PARSER_CHECK_NONE));
+
+	/* Init to WGS84, every cell matches the pairwise calculation exactly */
+	spheroid_init(&s, 6378137.0, 6356752.314245179498);
+	CU_ASSERT_EQUAL(ptarray_distance_matrix_spheroid(line1->points, line2->points, &s, matrix), LW_SUCCESS);
+	for ( i = 0; i < 4; i++ )
+	{
+		p1 = getPoint2d_cp(line1->points, i);
+		geographic_point_init(p1->x, p1->y, &g1);
+		for ( j = 0; j < 3; j++ )
+		{
+			p2 = getPoint2d_cp(line2->points, j);
+			geographic_point_init(p2->x, p2->y, &g2);
+			CU_ASSERT_EQUAL(matrix[i * 3 + j], spheroid_distance(&g1, &g2, &s));
+		}
+	}
+	CU_ASSERT_EQUAL(matrix[1 * 3 + 1], 0.0);
+
+	/* And on the sphere */
+	s.a = s.b = s.radius;
+	CU_ASSERT_EQUAL(ptarray_distance_matrix_spheroid(line1->points, line2->points, &s, matrix), LW_SUCCESS);
+	for ( i = 0; i < 4; i++ )
+	{
+		p1 = getPoint2d_cp(line1->points, i);
+		geographic_point_init(p1->x, p1->y, &g1);
+		for ( j = 0; j < 3; j++ )
+		{
+			p2 = getPoint2d_cp(line2->points, j);
+			geographic_point_init(p2->x, p2->y, &g2);
+			CU_ASSERT_EQUAL(matrix[i * 3 + j], s.radius * sphere_distance(&g1, &g2));
+		}
+	}
+
+	lwline_free(line1);
+	lwline_free(line2);
+}
+
 static void test_spheroid_area(void)
 {
 	LWGEOM *lwg;
 	GBOX gbox;
-	double a1, a2;
+	double a1, a2, a3;
 	SPHEROID s;
 
 	/* Init to WGS84 */
@@ -1373,11 +1642,8 @@ static void test_spheroid_area(void)
 	a1 = lwgeom_area_sphere(lwg, &s);
 	CU_ASSERT_DOUBLE_EQUAL(a1, 12341436880.106982993974659, 0.1);
 	/* spheroid: Planimeter -E -p 20 -r --input-string "3 -2;4 -2;4 -1;3 -1" */
-#if PROJ_GEODESIC
-	// printf("XXXXX %d\n", PJ_VERSION);
 	a2 = lwgeom_area_spheroid(lwg, &s);
 	CU_ASSERT_DOUBLE_EQUAL(a2, 12286884908.946891319597874, 0.1);
-#endif
 	lwgeom_free(lwg);
 
 	/* One-degree square */
@@ -1387,10 +1653,8 @@ static void test_spheroid_area(void)
 	a1 = lwgeom_area_sphere(lwg, &s);
 	CU_ASSERT_DOUBLE_EQUAL(a1, 12360265021.368023059138681, 0.1);
 	/* spheroid: Planimeter -E -p 20 --input-string "2 8.5;1 8.5;1 9.5;2 9.5" */
-#if PROJ_GEODESIC
 	a2 = lwgeom_area_spheroid(lwg, &s);
 	CU_ASSERT_DOUBLE_EQUAL(a2, 12305128751.042900673161556, 0.1);
-#endif
 	lwgeom_free(lwg);
 
 	/* One-degree square *near* the antimeridian */
@@ -1400,10 +1664,8 @@ static void test_spheroid_area(void)
 	a1 = lwgeom_area_sphere(lwg, &s);
 	CU_ASSERT_DOUBLE_EQUAL(a1, 12360265021.368023059138681, 0.1);
 	/* spheroid: Planimeter -E -p 20 -r --input-string "2 179.5;1 179.5;1 178.5;2 178.5" */
-#if PROJ_GEODESIC
 	a2 = lwgeom_area_spheroid(lwg, &s);
 	CU_ASSERT_DOUBLE_EQUAL(a2, 12305128751.042900673161556, 0.1);
-#endif
 	lwgeom_free(lwg);
 
 	/* One-degree square *across* the antimeridian */
@@ -1413,10 +1675,56 @@ static void test_spheroid_area(void)
 	a1 = lwgeom_area_sphere(lwg, &s);
 	CU_ASSERT_DOUBLE_EQUAL(a1, 12360265021.368023059138681, 0.1);
 	/* spheroid: Planimeter -E -p 20 --input-string "2 179.5;1 179.5;1 -179.5;2 -179.5" */
-#if PROJ_GEODESIC
 	a2 = lwgeom_area_spheroid(lwg, &s);
 	CU_ASSERT_DOUBLE_EQUAL(a2, 12305128751.042900673161556, 0.1);
-#endif
+	lwgeom_free(lwg);
+
+	/* One-degree square *across* the equator is the sum of its halves */
+	lwg = lwgeom_from_wkt("POLYGON((0 -0.5,0 0.5,1 0.5,1 -0.5,0 -0.5))", LW_PARSER_CHECK_NONE);
+	a1 = lwgeom_area_spheroid(lwg, &s);
+	lwgeom_free(lwg);
+	lwg = lwgeom_from_wkt("POLYGON((0 -0.5,0 0,1 0,1 -0.5,0 -0.5))", LW_PARSER_CHECK_NONE);
+	a2 = lwgeom_area_spheroid(lwg, &s);
+	lwgeom_free(lwg);
+	lwg = lwgeom_from_wkt("POLYGON((0 0,0 0.5,1 0.5,1 0,0 0))", LW_PARSER_CHECK_NONE);
+	a3 = lwgeom_area_spheroid(lwg, &s);
+	CU_ASSERT_DOUBLE_EQUAL(a1, a2 + a3, 0.1);
+	CU_ASSERT_DOUBLE_EQUAL(a2, a3, 0.1);
+	/* spheroid: Planimeter -E -p 20 --input-string "-0.5 0;0.5 0;0.5 1;-0.5 1" */
+	CU_ASSERT_DOUBLE_EQUAL(a1, 12309234582.502958, 0.1);
+	lwgeom_free(lwg);
+
+	/* Halves of a square split at the equator have an edge along it */
+	lwg = lwgeom_from_wkt("POLYGON((0 -1,0 1,1 1,1 -1,0 -1))", LW_PARSER_CHECK_NONE);
+	a1 = lwgeom_area_spheroid(lwg, &s);
+	lwgeom_free(lwg);
+	lwg = lwgeom_from_wkt("POLYGON((0 -1,0 0,1 0,1 -1,0 -1))", LW_PARSER_CHECK_NONE);
+	a2 = lwgeom_area_spheroid(lwg, &s);
+	lwgeom_free(lwg);
+	lwg = lwgeom_from_wkt("POLYGON((0 0,0 1,1 1,1 0,0 0))", LW_PARSER_CHECK_NONE);
+	a3 = lwgeom_area_spheroid(lwg, &s);
+	lwgeom_free(lwg);
+	CU_ASSERT(isfinite(a2));
+	CU_ASSERT(isfinite(a3));
+	CU_ASSERT_DOUBLE_EQUAL(a2, a3, 0.1);
+	CU_ASSERT_DOUBLE_EQUAL(a1, a2 + a3, 0.1);
+
+	/* Cap around the north pole is four times one of its sectors */
+	lwg = lwgeom_from_wkt("POLYGON((0 80,90 80,180 80,-90 80,0 80))", LW_PARSER_CHECK_NONE);
+	a1 = lwgeom_area_spheroid(lwg, &s);
+	lwgeom_free(lwg);
+	lwg = lwgeom_from_wkt("POLYGON((0 80,90 80,0 90,0 80))", LW_PARSER_CHECK_NONE);
+	a2 = lwgeom_area_spheroid(lwg, &s);
+	/* spheroid: Planimeter -E -p 20 --input-string "80 0;80 90;80 180;80 -90" */
+	/* (Vincenty's inverse is good to ~1e-11 relative on an area this size) */
+	CU_ASSERT_DOUBLE_EQUAL(a1, 2507270031169.875, 100.0);
+	CU_ASSERT_DOUBLE_EQUAL(a1, 4.0 * a2, 1.0);
+	lwgeom_free(lwg);
+
+	/* And the same around the south pole */
+	lwg = lwgeom_from_wkt("POLYGON((0 -80,-90 -80,180 -80,90 -80,0 -80))", LW_PARSER_CHECK_NONE);
+	a3 = lwgeom_area_spheroid(lwg, &s);
+	CU_ASSERT_DOUBLE_EQUAL(a3, a1, 1.0);
 	lwgeom_free(lwg);
 }
 
@@ -1598,6 +1906,9 @@ void geodetic_suite_setup(void)
 	PG_ADD_TEST(suite, test_lwgeom_check_geodetic);
 	PG_ADD_TEST(suite, test_gserialized_from_lwgeom);
 	PG_ADD_TEST(suite, test_spheroid_distance);
+	PG_ADD_TEST(suite, test_spheroid_distance_bounds);
+	PG_ADD_TEST(suite, test_lwgeom_dwithin_spheroid);
+	PG_ADD_TEST(suite, test_ptarray_distance_matrix_spheroid);
 	PG_ADD_TEST(suite, test_spheroid_area);
 	PG_ADD_TEST(suite, test_lwpoly_covers_point2d);
 	PG_ADD_TEST(suite, test_gbox_utils);
@@ -1606,4 +1917,7 @@ void geodetic_suite_setup(void)
 	PG_ADD_TEST(suite, test_lwgeom_segmentize_sphere);
 	PG_ADD_TEST(suite, test_ptarray_contains_point_sphere);
 	PG_ADD_TEST(suite, test_ptarray_contains_point_sphere_iowa);
+	PG_ADD_TEST(suite, test_plane_sides);
+	PG_ADD_TEST(suite, test_ptarray_contains_point_sphere_blocks);
+	PG_ADD_TEST(suite, test_ptarray_calculate_gbox_geodetic_blocks);
 }
@@ -1154,6 +1154,58 @@ void test_gserialized_peek_gbox_p_gets_correct_box(void)
 	}
 }
 
+void test_gserialized_peek_first_point(void);
+void test_gserialized_peek_first_point(void)
+{
+	uint32_t i;
+	POINT4D pt;
+
+	char *ewkt[] =
+	{
+		"POINT (2.2945672355 48.85822923236)",
+		"POINT Z (2.2945672355 48.85822923236 15)",
+		"POINT M (2.2945672355 48.85822923236 12)",
+		"POINT ZM (2.2945672355 48.85822923236 12 2)"
+	};
+
+	for ( i = 0; i < (sizeof ewkt/sizeof(char*)); i++ )
+	{
+		LWGEOM* geom = lwgeom_from_wkt(ewkt[i], LW_PARSER_CHECK_NONE);
+		POINT4D pt_from_lwgeom = getPoint4d(((LWPOINT*)geom)->point, 0);
+		GSERIALIZED* gser;
+
+		/* With and without a stored box in front of the coordinates */
+		lwgeom_add_bbox(geom);
+		gser = gserialized_from_lwgeom(geom, NULL);
+		CU_ASSERT_TRUE(gserialized_has_bbox(gser));
+		CU_ASSERT_EQUAL(gserialized_peek_first_point(gser, &pt), LW_SUCCESS);
+		CU_ASSERT_TRUE(memcmp(&pt, &pt_from_lwgeom, sizeof(POINT4D)) == 0);
+		lwfree(gser);
+
+		lwgeom_drop_bbox(geom);
+		gser = gserialized_from_lwgeom(geom, NULL);
+		CU_ASSERT_FALSE(gserialized_has_bbox(gser));
+		CU_ASSERT_EQUAL(gserialized_peek_first_point(gser, &pt), LW_SUCCESS);
+		CU_ASSERT_TRUE(memcmp(&pt, &pt_from_lwgeom, sizeof(POINT4D)) == 0);
+		lwfree(gser);
+
+		lwgeom_free(geom);
+	}
+
+	/* Empties and non-points are refused */
+	{
+		char *fail[] = { "POINT EMPTY", "MULTIPOINT ((1 2))", "LINESTRING (1 2, 3 4)" };
+		for ( i = 0; i < (sizeof fail/sizeof(char*)); i++ )
+		{
+			LWGEOM* geom = lwgeom_from_wkt(fail[i], LW_PARSER_CHECK_NONE);
+			GSERIALIZED* gser = gserialized_from_lwgeom(geom, NULL);
+			CU_ASSERT_EQUAL(gserialized_peek_first_point(gser, &pt), LW_FAILURE);
+			lwfree(gser);
+			lwgeom_free(geom);
+		}
+	}
+}
+
 void test_gserialized_peek_gbox_p_fails_for_unsupported_cases(void);
 void test_gserialized_peek_gbox_p_fails_for_unsupported_cases(void)
 {
@@ -1224,5 +1276,6 @@ void libgeom_suite_setup(void)
 	PG_ADD_TEST(suite, test_gserialized_peek_gbox_p_no_box_when_empty);
 	PG_ADD_TEST(suite, test_gserialized_peek_gbox_p_gets_correct_box);
 	PG_ADD_TEST(suite, test_gserialized_peek_gbox_p_fails_for_unsupported_cases);
+	PG_ADD_TEST(suite, test_gserialized_peek_first_point);
 	PG_ADD_TEST(suite, test_gbox_same_2d);
 }
@@ -294,6 +294,37 @@ static void out_geojson_test_geoms(void)
 	    "lwgeom_to_geojson: 'MultiSurface' geometry type not supported");
 }
 
+static void do_geojson_buf_test(char * in, char * srs, int precision, int has_bbox)
+{
+	LWGEOM *g;
+	char *h, *buf;
+	size_t size, len;
+
+	g = lwgeom_from_wkt(in, LW_PARSER_CHECK_NONE);
+	h = lwgeom_to_geojson(g, srs, precision, has_bbox);
+	size = lwgeom_to_geojson_size(g, srs, precision, has_bbox);
+	buf = lwalloc(size);
+	len = lwgeom_to_geojson_buf(g, srs, buf, precision, has_bbox);
+
+	CU_ASSERT_STRING_EQUAL(buf, h);
+	CU_ASSERT_EQUAL(len, strlen(h));
+	CU_ASSERT(len < size);
+
+	lwgeom_free(g);
+	lwfree(buf);
+	lwfree(h);
+}
+
+static void out_geojson_test_buf(void)
+{
+	do_geojson_buf_test("POINT(1 2)", NULL, 0, 0);
+	do_geojson_buf_test("POINT EMPTY", NULL, 0, 0);
+	do_geojson_buf_test("LINESTRING(0 0,1.123456789 2.5)", "EPSG:4326", 3, 1);
+	do_geojson_buf_test("POLYGON Z((0 0 1,0 1 2,1 1 3,0 0 1))", NULL, 15, 1);
+	do_geojson_buf_test("MULTIPOLYGON(((0 0,0 1,1 1,0 0)),((2 2,2 3,3 3,2 2)))", "EPSG:4326", 0, 0);
+	do_geojson_buf_test("GEOMETRYCOLLECTION(POINT(0 1),LINESTRING(2 3,4 5))", NULL, 1, 1);
+}
+
 /*
 ** Used by test harness to register the tests in this file.
 */
@@ -306,4 +337,5 @@ void out_geojson_suite_setup(void)
 	PG_ADD_TEST(suite, out_geojson_test_srid);
 	PG_ADD_TEST(suite, out_geojson_test_bbox);
 	PG_ADD_TEST(suite, out_geojson_test_geoms);
+	PG_ADD_TEST(suite, out_geojson_test_buf);
 }
@@ -18,6 +18,7 @@
 #include "liblwgeom_internal.h"
 #include "lwgeodetic.h"
 #include "lwgeodetic_tree.h"
+#include "lwgeodetic_cells.h"
 #include "cu_tester.h"
 
 
@@ -38,6 +39,21 @@ static void test_tree_circ_create(void)
 	{
 		CU_ASSERT(c->num_nodes  == ( 4 % CIRC_NODE_SIZE ? 1 : 0 ) + 4 / CIRC_NODE_SIZE);
 	}
+
+	/* Leaves carry the geocentric ends of their edge */
+	if ( CIRC_NODE_SIZE > 4 )
+	{
+		GEOGRAPHIC_POINT gp;
+		POINT3D q;
+		CU_ASSERT(c->pts != NULL);
+		CU_ASSERT(c->nodes[2]->q1 == &(c->pts[2]));
+		CU_ASSERT(c->nodes[2]->q2 == &(c->pts[3]));
+		geographic_point_init(180, 89, &gp);
+		geog2cart(&gp, &q);
+		CU_ASSERT_DOUBLE_EQUAL(c->nodes[2]->q2->x, q.x, 1e-15);
+		CU_ASSERT_DOUBLE_EQUAL(c->nodes[2]->q2->y, q.y, 1e-15);
+		CU_ASSERT_DOUBLE_EQUAL(c->nodes[2]->q2->z, q.z, 1e-15);
+	}
 		
 	circ_tree_free(c);
 	lwline_free(g);
@@ -378,6 +394,365 @@ static void test_tree_circ_distance_threshold(void)
 	
 }
 
+static void test_tree_circ_distance_dwithin(void)
+{
+	LWGEOM *lwg1, *lwg2;
+	CIRC_NODE *c1, *c2;
+	SPHEROID s;
+	double d, d1, threshold;
+
+	spheroid_init(&s, WGS84_MAJOR_AXIS, WGS84_MINOR_AXIS);
+
+	lwg1 = lwgeom_from_wkt("LINESTRING(0 0,0.5 0.1,1 0,1.5 0.1,2 0,2.5 0.1,3 0,3.5 0.1,4 0,4.5 0.1,5 0)", LW_PARSER_CHECK_NONE);
+	lwg2 = lwgeom_from_wkt("POLYGON((0 1,5 1,5 2,0 2,0 1))", LW_PARSER_CHECK_NONE);
+	c1 = lwgeom_calculate_circ_tree(lwg1);
+	c2 = lwgeom_calculate_circ_tree(lwg2);
+	d = lwgeom_distance_spheroid(lwg1, lwg2, &s, 0);
+
+	/* Under the true distance the traversal cannot stop early */
+	threshold = 0.5 * d;
+	d1 = circ_tree_distance_tree(c1, c2, &s, threshold);
+	CU_ASSERT_DOUBLE_EQUAL(d1, d, 0.001);
+
+	/* Just over the true distance, some pair under the threshold is enough */
+	threshold = 1.1 * d;
+	d1 = circ_tree_distance_tree(c1, c2, &s, threshold);
+	CU_ASSERT(d1 >= d - 0.001);
+	CU_ASSERT(d1 <= threshold);
+
+	/* Far over the true distance, the root nodes alone prove it */
+	threshold = 2000000.0;
+	d1 = circ_tree_distance_tree(c1, c2, &s, threshold);
+	CU_ASSERT(d1 >= d - 0.001);
+	CU_ASSERT(d1 <= threshold);
+
+	circ_tree_free(c1);
+	circ_tree_free(c2);
+	lwgeom_free(lwg1);
+	lwgeom_free(lwg2);
+}
+
+static void test_tree_cell_geometry(void)
+{
+	POINT3D p, c, v[4];
+	POINT2D pt;
+	uint32_t i, j, ci, cj;
+	int face, level, k;
+
+	/* Face centers */
+	pt.x = 0; pt.y = 0;
+	ll2cart(&pt, &p);
+	CU_ASSERT_EQUAL(cell_from_point(&p, &i, &j), 0);
+	pt.x = 90; pt.y = 0;
+	ll2cart(&pt, &p);
+	CU_ASSERT_EQUAL(cell_from_point(&p, &i, &j), 1);
+	pt.x = 0; pt.y = 90;
+	ll2cart(&pt, &p);
+	CU_ASSERT_EQUAL(cell_from_point(&p, &i, &j), 2);
+	pt.x = 180; pt.y = 0;
+	ll2cart(&pt, &p);
+	CU_ASSERT_EQUAL(cell_from_point(&p, &i, &j), 3);
+	pt.x = -90; pt.y = 0;
+	ll2cart(&pt, &p);
+	CU_ASSERT_EQUAL(cell_from_point(&p, &i, &j), 4);
+	pt.x = 0; pt.y = -90;
+	ll2cart(&pt, &p);
+	CU_ASSERT_EQUAL(cell_from_point(&p, &i, &j), 5);
+
+	/* A point lies in the cells holding it at every level */
+	pt.x = -122.3; pt.y = 47.6;
+	ll2cart(&pt, &p);
+	face = cell_from_point(&p, &i, &j);
+	for ( level = 0; level <= CELL_MAX_LEVEL; level += 5 )
+	{
+		ci = i >> (CELL_MAX_LEVEL - level);
+		cj = j >> (CELL_MAX_LEVEL - level);
+		/* The center of the cell is in the cell */
+		cell_center(face, level, ci, cj, &c);
+		CU_ASSERT_EQUAL(cell_from_point(&c, &i, &j), face);
+		CU_ASSERT_EQUAL(i >> (CELL_MAX_LEVEL - level), ci);
+		CU_ASSERT_EQUAL(j >> (CELL_MAX_LEVEL - level), cj);
+		/* And the point is inside all four sides, counter-clockwise */
+		cell_vertices(face, level, ci, cj, v);
+		for ( k = 0; k < 4; k++ )
+		{
+			POINT3D n;
+			unit_normal(&(v[k]), &(v[(k+1)%4]), &n);
+			CU_ASSERT(dot_product(&n, &p) >= 0.0);
+		}
+		face = cell_from_point(&p, &i, &j);
+	}
+}
+
+static void test_tree_cell_index_pip(void)
+{
+	const char *wkt[] =
+	{
+		/* Polygon with a hole */
+		"POLYGON((-10 -10,10 -10,10 10,-10 10,-10 -10),(-5 -5,-5 5,5 5,5 -5,-5 -5))",
+		/* Across the antimeridian */
+		"POLYGON((170 40,-170 40,-170 50,170 50,170 40))",
+		/* Around the north pole */
+		"POLYGON((0 60,90 60,180 60,-90 60,0 60))",
+		/* Islands */
+		"MULTIPOLYGON(((0 0,1 0,1 1,0 1,0 0)),((2 2,3 2,3 3,2 3,2 2)),((-20 -30,-10 -30,-15 -20,-20 -30)))"
+	};
+	LWGEOM *lwg, *lwpt;
+	CELL_INDEX *index;
+	POINT2D pt;
+	int n, x, y, rv, exact;
+	int tested = 0, undecided = 0;
+
+	for ( n = 0; n < 4; n++ )
+	{
+		lwg = lwgeom_from_wkt(wkt[n], LW_PARSER_CHECK_NONE);
+		index = lwgeom_calculate_cell_index(lwg);
+		CU_ASSERT(index != NULL);
+		for ( x = -180; x < 180; x += 2 )
+		{
+			for ( y = -89; y < 90; y += 2 )
+			{
+				pt.x = x + 0.37;
+				pt.y = y + 0.61;
+				rv = cell_index_contains_point(index, &pt);
+				if ( rv < 0 )
+				{
+					undecided++;
+					continue;
+				}
+				lwpt = (LWGEOM*)lwpoint_make2d(SRID_UNKNOWN, pt.x, pt.y);
+				exact = lwgeom_covers_lwgeom_sphere(lwg, lwpt);
+				CU_ASSERT_EQUAL(rv, exact);
+				lwgeom_free(lwpt);
+				tested++;
+			}
+		}
+		cell_index_free(index);
+		lwgeom_free(lwg);
+	}
+	CU_ASSERT(undecided < tested / 10000);
+
+	/* On the boundary, either inside or handed back to the exact test */
+	lwg = lwgeom_from_wkt(wkt[0], LW_PARSER_CHECK_NONE);
+	index = lwgeom_calculate_cell_index(lwg);
+	pt.x = 10; pt.y = 10;
+	CU_ASSERT_NOT_EQUAL(cell_index_contains_point(index, &pt), LW_FALSE);
+	pt.x = 10; pt.y = 3;
+	CU_ASSERT_NOT_EQUAL(cell_index_contains_point(index, &pt), LW_FALSE);
+	pt.x = -5; pt.y = 0;
+	CU_ASSERT_NOT_EQUAL(cell_index_contains_point(index, &pt), LW_FALSE);
+	/* Inside the hole */
+	pt.x = 0; pt.y = 0;
+	CU_ASSERT_EQUAL(cell_index_contains_point(index, &pt), LW_FALSE);
+	pt.x = 7; pt.y = 7;
+	CU_ASSERT_EQUAL(cell_index_contains_point(index, &pt), LW_TRUE);
+	cell_index_free(index);
+	lwgeom_free(lwg);
+
+	/* Only polygons get an index */
+	lwg = lwgeom_from_wkt("LINESTRING(0 0,1 1)", LW_PARSER_CHECK_NONE);
+	CU_ASSERT(lwgeom_calculate_cell_index(lwg) == NULL);
+	lwgeom_free(lwg);
+}
+
+static void test_tree_cell_index_dense(void)
+{
+	LWPOLY *poly;
+	LWGEOM *lwpt;
+	POINTARRAY *pa;
+	CELL_INDEX *index;
+	POINT4D p;
+	POINT2D pt;
+	int k, rv, exact, undecided = 0;
+	const int npoints = 5000;
+
+	/* A wiggly ring of many short edges */
+	pa = ptarray_construct_empty(0, 0, npoints + 1);
+	p.z = p.m = 0.0;
+	for ( k = 0; k < npoints; k++ )
+	{
+		double a = 2.0 * M_PI * k / npoints;
+		double r = 10.0 + 0.5 * sin(97.0 * a);
+		p.x = 20.0 + r * cos(a);
+		p.y = -35.0 + r * sin(a);
+		ptarray_append_point(pa, &p, LW_TRUE);
+	}
+	p = *((POINT4D*)getPoint_internal(pa, 0));
+	p.z = p.m = 0.0;
+	ptarray_append_point(pa, &p, LW_TRUE);
+	poly = lwpoly_construct_empty(SRID_UNKNOWN, 0, 0);
+	lwpoly_add_ring(poly, pa);
+
+	index = lwgeom_calculate_cell_index(lwpoly_as_lwgeom(poly));
+	CU_ASSERT(index->num_edges == npoints);
+	for ( k = 0; k < 5000; k++ )
+	{
+		pt.x = 20.0 + 12.0 * sin(k * 0.7);
+		pt.y = -35.0 + 12.0 * cos(k * 1.3);
+		rv = cell_index_contains_point(index, &pt);
+		if ( rv < 0 )
+		{
+			undecided++;
+			continue;
+		}
+		lwpt = (LWGEOM*)lwpoint_make2d(SRID_UNKNOWN, pt.x, pt.y);
+		exact = lwgeom_covers_lwgeom_sphere(lwpoly_as_lwgeom(poly), lwpt);
+		CU_ASSERT_EQUAL(rv, exact);
+		lwgeom_free(lwpt);
+	}
+	CU_ASSERT(undecided < 5);
+
+	cell_index_free(index);
+	lwpoly_free(poly);
+}
+
+static void test_tree_cell_ids(void)
+{
+	POINT3D p;
+	POINT2D pt;
+	uint64_t id, leaf;
+	uint32_t i, j;
+	int face, level, k;
+
+	/* Face cells have only the marker bit under the face */
+	CU_ASSERT_EQUAL(cell_id_from_face_ij(0, 0, 0, 0), UINT64_C(1) << 60);
+	CU_ASSERT_EQUAL(cell_id_from_face_ij(5, 0, 0, 0), (UINT64_C(5) << 61) | (UINT64_C(1) << 60));
+	CU_ASSERT_EQUAL(cell_id_range_min(UINT64_C(1) << 60), 1);
+	CU_ASSERT_EQUAL(cell_id_range_max(UINT64_C(1) << 60), (UINT64_C(1) << 61) - 1);
+
+	/* Not cell ids */
+	CU_ASSERT_EQUAL(cell_id_level(0), -1);
+	CU_ASSERT_EQUAL(cell_id_level(UINT64_C(1) << 59), -1);
+	CU_ASSERT_EQUAL(cell_id_level((UINT64_C(6) << 61) | 1), -1);
+	CU_ASSERT_EQUAL(cell_id_level(UINT64_C(5) << 61), -1);
+
+	/* Round trip through the id */
+	for ( k = 0; k < 100; k++ )
+	{
+		int f = k % CELL_NUM_FACES, l = k % (CELL_MAX_LEVEL + 1);
+		uint32_t mask = ((uint32_t)1 << l) - 1;
+		uint32_t ci = (uint32_t)(2654435761u * (k + 1)) & mask;
+		uint32_t cj = (uint32_t)(40503u * (k + 7) * (k + 3)) & mask;
+		id = cell_id_from_face_ij(f, l, ci, cj);
+		face = cell_id_to_face_ij(id, &level, &i, &j);
+		CU_ASSERT_EQUAL(face, f);
+		CU_ASSERT_EQUAL(level, l);
+		CU_ASSERT_EQUAL(i, ci);
+		CU_ASSERT_EQUAL(j, cj);
+	}
+
+	/* The leaf of a point is in the range of the cells above it */
+	pt.x = -122.3; pt.y = 47.6;
+	ll2cart(&pt, &p);
+	leaf = cell_id_from_point(&p, CELL_MAX_LEVEL);
+	CU_ASSERT_EQUAL(cell_id_level(leaf), CELL_MAX_LEVEL);
+	CU_ASSERT_EQUAL(cell_id_range_min(leaf), leaf);
+	CU_ASSERT_EQUAL(cell_id_range_max(leaf), leaf);
+	for ( level = 0; level < CELL_MAX_LEVEL; level++ )
+	{
+		id = cell_id_from_point(&p, level);
+		CU_ASSERT_EQUAL(cell_id_level(id), level);
+		CU_ASSERT(cell_id_range_min(id) <= leaf && leaf <= cell_id_range_max(id));
+		/* And in the range of just one of the four children */
+		face = cell_id_to_face_ij(id, &k, &i, &j);
+		for ( k = 0; k < 4; k++ )
+		{
+			uint64_t child = cell_id_from_face_ij(face, level + 1, 2*i + (k & 1), 2*j + (k >> 1));
+			CU_ASSERT(cell_id_range_min(id) <= cell_id_range_min(child));
+			CU_ASSERT(cell_id_range_max(child) <= cell_id_range_max(id));
+			CU_ASSERT_EQUAL(cell_id_range_min(child) <= leaf && leaf <= cell_id_range_max(child),
+			                child == cell_id_from_point(&p, level + 1));
+		}
+	}
+}
+
+static int cell_covering_has(const uint64_t *cells, int num_cells, const POINT2D *pt)
+{
+	POINT3D p;
+	uint64_t leaf;
+	int k;
+	ll2cart(pt, &p);
+	leaf = cell_id_from_point(&p, CELL_MAX_LEVEL);
+	for ( k = 0; k < num_cells; k++ )
+	{
+		if ( cell_id_range_min(cells[k]) <= leaf && leaf <= cell_id_range_max(cells[k]) )
+			return LW_TRUE;
+	}
+	return LW_FALSE;
+}
+
+static void test_tree_cell_covering(void)
+{
+	const char *wkt[] =
+	{
+		"POLYGON((-10 -10,10 -10,10 10,-10 10,-10 -10),(-5 -5,-5 5,5 5,5 -5,-5 -5))",
+		"POLYGON((170 40,-170 40,-170 50,170 50,170 40))",
+		"LINESTRING(-60 -20,30 10,100 80)",
+		"MULTIPOINT(0 0,0.001 0.001,45 45)"
+	};
+	const double distance[] = { 0.0, 0.01, 0.03 };
+	SPHEROID s;
+	uint64_t *cells;
+	POINT2D pt;
+	int w, d, k, x, y, num_cells, missed;
+
+	spheroid_init(&s, 1.0, 1.0);
+
+	for ( w = 0; w < 4; w++ )
+	{
+		LWGEOM *lwg = lwgeom_from_wkt(wkt[w], LW_PARSER_CHECK_NONE);
+		for ( d = 0; d < 3; d++ )
+		{
+			num_cells = lwgeom_cell_covering(lwg, distance[d], 8, CELL_MAX_LEVEL, &cells);
+			CU_ASSERT(num_cells > 0 && num_cells <= 8);
+			for ( k = 1; k < num_cells; k++ )
+				CU_ASSERT(cells[k-1] < cells[k]);
+			/* Everything within the distance is covered */
+			missed = 0;
+			for ( x = -180; x < 180; x += 2 )
+			{
+				for ( y = -89; y < 90; y += 2 )
+				{
+					LWGEOM *lwpt;
+					pt.x = x + 0.37;
+					pt.y = y + 0.61;
+					lwpt = (LWGEOM*)lwpoint_make2d(SRID_UNKNOWN, pt.x, pt.y);
+					if ( lwgeom_distance_spheroid(lwpt, lwg, &s, 0.0) <= distance[d] &&
+					     ! cell_covering_has(cells, num_cells, &pt) )
+						missed++;
+					lwgeom_free(lwpt);
+				}
+			}
+			CU_ASSERT_EQUAL(missed, 0);
+			lwfree(cells);
+		}
+		lwgeom_free(lwg);
+	}
+
+	/* A point is covered by one leaf, given enough levels */
+	{
+		LWGEOM *lwg = lwgeom_from_wkt("POINT(-122.3 47.6)", LW_PARSER_CHECK_NONE);
+		POINT3D p;
+		pt.x = -122.3; pt.y = 47.6;
+		ll2cart(&pt, &p);
+		num_cells = lwgeom_cell_covering(lwg, 0.0, 8, 12, &cells);
+		CU_ASSERT(num_cells >= 1 && num_cells <= 8);
+		CU_ASSERT(cell_covering_has(cells, num_cells, &pt));
+		for ( k = 0; k < num_cells; k++ )
+			CU_ASSERT_EQUAL(cell_id_level(cells[k]), 12);
+		lwfree(cells);
+		lwgeom_free(lwg);
+	}
+
+	/* Nothing to cover */
+	{
+		LWGEOM *lwg = lwgeom_from_wkt("POLYGON EMPTY", LW_PARSER_CHECK_NONE);
+		CU_ASSERT_EQUAL(lwgeom_cell_covering(lwg, 0.0, 8, CELL_MAX_LEVEL, &cells), 0);
+		CU_ASSERT(cells == NULL);
+		lwgeom_free(lwg);
+	}
+}
+
 /*
 ** Used by test harness to register the tests in this file.
 */
@@ -390,4 +765,10 @@ void tree_suite_setup(void)
 	PG_ADD_TEST(suite, test_tree_circ_pip2);
 	PG_ADD_TEST(suite, test_tree_circ_distance);
 	PG_ADD_TEST(suite, test_tree_circ_distance_threshold);
+	PG_ADD_TEST(suite, test_tree_circ_distance_dwithin);
+	PG_ADD_TEST(suite, test_tree_cell_geometry);
+	PG_ADD_TEST(suite, test_tree_cell_index_pip);
+	PG_ADD_TEST(suite, test_tree_cell_index_dense);
+	PG_ADD_TEST(suite, test_tree_cell_ids);
+	PG_ADD_TEST(suite, test_tree_cell_covering);
 }
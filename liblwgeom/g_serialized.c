@@ -164,6 +164,27 @@ int gserialized_is_empty(const GSERIALIZED *g)
 	return isempty;
 }
 
+int gserialized_peek_first_point(const GSERIALIZED *g, POINT4D *out_point)
+{
+	uint32_t *ptr = (uint32_t*)(g->data);
+	double *dptr;
+	int i = 0;
+
+	if ( FLAGS_GET_BBOX(g->flags) )
+		ptr += (gbox_serialized_size(g->flags) / sizeof(uint32_t));
+
+	/* Points only, <pointtype><npoints> then the ordinates */
+	if ( ptr[0] != POINTTYPE || ptr[1] == 0 )
+		return LW_FAILURE;
+
+	dptr = (double*)(ptr + 2);
+	out_point->x = dptr[i++];
+	out_point->y = dptr[i++];
+	out_point->z = FLAGS_GET_Z(g->flags) ? dptr[i++] : 0.0;
+	out_point->m = FLAGS_GET_M(g->flags) ? dptr[i++] : 0.0;
+	return LW_SUCCESS;
+}
+
 char* gserialized_to_string(const GSERIALIZED *g)
 {
 	return lwgeom_to_wkt(lwgeom_from_gserialized(g), WKT_ISO, 12, 0);
@@ -266,6 +266,12 @@ int lwgeom_geohash_precision(GBOX bbox, GBOX *bounds);
 char *geohash_point(double longitude, double latitude, int precision);
 void decode_geohash_bbox(char *geohash, double *lat, double *lon, int precision);
 
+/*
+* Space filling curves
+*/
+uint64_t hilbert_xy_to_key(uint32_t x, uint32_t y);
+uint64_t zorder_xy_to_key(uint32_t x, uint32_t y);
+
 /*
 * Point comparisons
 */
@@ -326,6 +332,12 @@ int ptarray_has_z(const POINTARRAY *pa);
 int ptarray_has_m(const POINTARRAY *pa);
 double ptarray_signed_area(const POINTARRAY *pa);
 
+/*
+* Clipping by rectangle
+*/
+LWGEOM *lwgeom_rectclip(const LWGEOM *geom, const GBOX *box);
+LWGEOM *lwgeom_clip_by_rect_geos(const LWGEOM *geom1, double x0, double y0, double x1, double y1);
+
 /*
 * Clone support
 */
@@ -879,6 +879,137 @@ char *lwgeom_geohash(const LWGEOM *lwgeom, int precision)
 }
 
 
+/*
+** Space filling curve keys. Both curves are evaluated on a grid of
+** SFC_CELLS x SFC_CELLS cells spanning the supplied extent, so that the
+** resulting key uses at most 62 bits and can be stored in a (signed) int8
+** without ever going negative.
+*/
+#define SFC_BITS 31
+#define SFC_CELLS ((uint32_t)1 << SFC_BITS)
+
+/*
+** Quantize an ordinate into the [0, SFC_CELLS-1] grid along one axis
+** of the extent. Values outside the extent are clamped to the edges.
+*/
+static uint32_t
+sfc_quantize(double val, double min, double max)
+{
+	double cell;
+
+	if ( ! (max > min) )
+		return 0;
+
+	cell = (val - min) / (max - min) * SFC_CELLS;
+
+	if ( ! (cell > 0.0) )
+		return 0;
+	if ( cell >= SFC_CELLS )
+		return SFC_CELLS - 1;
+
+	return (uint32_t)cell;
+}
+
+/*
+** Spread the low 32 bits of an integer out over the even bits of a
+** 64 bit integer.
+*/
+static uint64_t
+sfc_spread_bits(uint64_t v)
+{
+	v &= 0x00000000FFFFFFFFULL;
+	v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+	v = (v | (v << 8))  & 0x00FF00FF00FF00FFULL;
+	v = (v | (v << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+	v = (v | (v << 2))  & 0x3333333333333333ULL;
+	v = (v | (v << 1))  & 0x5555555555555555ULL;
+	return v;
+}
+
+/*
+** Z-order (Morton) key of a grid cell: x bits land on the even
+** positions, y bits on the odd ones.
+*/
+uint64_t
+zorder_xy_to_key(uint32_t x, uint32_t y)
+{
+	return sfc_spread_bits(x) | (sfc_spread_bits(y) << 1);
+}
+
+/*
+** Hilbert curve key of a grid cell, for a curve of order SFC_BITS.
+** Iterative form of the classic xy2d, rotating the quadrant at each
+** level as we walk down from the most significant bit.
+*/
+uint64_t
+hilbert_xy_to_key(uint32_t x, uint32_t y)
+{
+	uint64_t key = 0;
+	uint32_t s, rx, ry, t;
+
+	x &= SFC_CELLS - 1;
+	y &= SFC_CELLS - 1;
+
+	for ( s = SFC_CELLS >> 1; s > 0; s >>= 1 )
+	{
+		rx = (x & s) > 0;
+		ry = (y & s) > 0;
+		key += (uint64_t)s * (uint64_t)s * ((3 * rx) ^ ry);
+
+		/* Rotate the quadrant so the next level is in canonical order */
+		if ( ry == 0 )
+		{
+			if ( rx == 1 )
+			{
+				x = (SFC_CELLS - 1) - x;
+				y = (SFC_CELLS - 1) - y;
+			}
+			t = x;
+			x = y;
+			y = t;
+		}
+	}
+	return key;
+}
+
+/*
+** Find the grid cell holding the center of the box within the extent.
+*/
+static void
+gbox_sfc_cell(const GBOX *gbox, const GBOX *extent, uint32_t *x, uint32_t *y)
+{
+	double cx = gbox->xmin + (gbox->xmax - gbox->xmin) / 2.0;
+	double cy = gbox->ymin + (gbox->ymax - gbox->ymin) / 2.0;
+
+	*x = sfc_quantize(cx, extent->xmin, extent->xmax);
+	*y = sfc_quantize(cy, extent->ymin, extent->ymax);
+}
+
+/*
+** Return the Hilbert curve key of the center of the box, on a
+** 2^31 x 2^31 grid over the extent.
+*/
+uint64_t
+gbox_hilbert_key(const GBOX *gbox, const GBOX *extent)
+{
+	uint32_t x, y;
+	gbox_sfc_cell(gbox, extent, &x, &y);
+	return hilbert_xy_to_key(x, y);
+}
+
+/*
+** Return the Z-order (Morton) key of the center of the box, on a
+** 2^31 x 2^31 grid over the extent.
+*/
+uint64_t
+gbox_zorder_key(const GBOX *gbox, const GBOX *extent)
+{
+	uint32_t x, y;
+	gbox_sfc_cell(gbox, extent, &x, &y);
+	return zorder_xy_to_key(x, y);
+}
+
+
 
 
 
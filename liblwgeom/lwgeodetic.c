@@ -408,7 +408,7 @@ static void cart2ll(const POINT3D *p, POINT2D *g)
 * Calculate the dot product of two unit vectors
 * (-1 == opposite, 0 == orthogonal, 1 == identical)
 */
-static double dot_product(const POINT3D *p1, const POINT3D *p2)
+double dot_product(const POINT3D *p1, const POINT3D *p2)
 {
 	return (p1->x*p2->x) + (p1->y*p2->y) + (p1->z*p2->z);
 }
@@ -416,7 +416,7 @@ static double dot_product(const POINT3D *p1, const POINT3D *p2)
 /**
 * Calculate the cross product of two vectors
 */
-static void cross_product(const POINT3D *a, const POINT3D *b, POINT3D *n)
+void cross_product(const POINT3D *a, const POINT3D *b, POINT3D *n)
 {
 	n->x = a->y * b->z - a->z * b->y;
 	n->y = a->z * b->x - a->x * b->z;
@@ -1437,6 +1437,36 @@ int edge_calculate_gbox(const POINT3D *A1, const POINT3D *A2, GBOX *gbox)
 	return LW_SUCCESS;
 }
 
+/**
+* Flag the edges of a block of points on the unit sphere, stored as
+* separate x, y and z arrays, that may reach further along an axis
+* than their end points. Edge i runs from point i to point i+1.
+*
+* Along an arc shorter than half a great circle each coordinate is a
+* sinusoid with at most one turning point, so the coordinate has an
+* extreme between the ends only if it grows at one end of the arc and
+* shrinks at the other. The directions of travel at the ends are
+* A2 - (A1.A2)A1 and (A1.A2)A2 - A1. Edges flagged zero have the box
+* of their end points, the rest (including degenerate and antipodal
+* edges, and any with a coordinate that does not change at an end)
+* need edge_calculate_gbox. The loop has no branches, so the compiler
+* can run it over several edges at once.
+*/
+void
+edge_extrema_flags(const double *x, const double *y, const double *z, int npoints, int *flags)
+{
+	int i;
+
+	for ( i = 0; i < npoints - 1; i++ )
+	{
+		double d = x[i] * x[i+1] + y[i] * y[i+1] + z[i] * z[i+1];
+		double tx = (x[i+1] - d * x[i]) * (d * x[i+1] - x[i]);
+		double ty = (y[i+1] - d * y[i]) * (d * y[i+1] - y[i]);
+		double tz = (z[i+1] - d * z[i]) * (d * z[i+1] - z[i]);
+		flags[i] = !(tx > 0.0) | !(ty > 0.0) | !(tz > 0.0);
+	}
+}
+
 void lwpoly_pt_outside(const LWPOLY *poly, POINT2D *pt_outside)
 {	
 	/* Make sure we have boxes */
@@ -2309,6 +2339,42 @@ double lwgeom_distance_spheroid(const LWGEOM *lwgeom1, const LWGEOM *lwgeom2, co
 
 }
 
+int lwgeom_dwithin_spheroid(const LWGEOM *lwgeom1, const LWGEOM *lwgeom2, const SPHEROID *spheroid, double tolerance)
+{
+	SPHEROID sphere;
+	double distance, lo, hi;
+
+	/* Already on a sphere, nothing to bound */
+	if ( spheroid->a == spheroid->b )
+	{
+		distance = lwgeom_distance_spheroid(lwgeom1, lwgeom2, spheroid, tolerance);
+		if ( distance < 0.0 )
+			return -1;
+		return distance <= tolerance;
+	}
+
+	/* Sphere distance, allowed to stop as soon as it proves the answer */
+	spheroid_distance_bounds(spheroid, &lo, &hi);
+	sphere = *spheroid;
+	sphere.a = sphere.b = spheroid->radius;
+	distance = lwgeom_distance_spheroid(lwgeom1, lwgeom2, &sphere, tolerance / hi);
+	if ( distance < 0.0 )
+		return -1;
+
+	LWDEBUGF(4, "sphere distance %.8g, spheroid distance within [%.8g, %.8g]", distance, lo * distance, hi * distance);
+
+	if ( hi * distance <= tolerance )
+		return LW_TRUE;
+	if ( lo * distance > tolerance )
+		return LW_FALSE;
+
+	/* Too close to call, do the spheroid calculation */
+	distance = lwgeom_distance_spheroid(lwgeom1, lwgeom2, spheroid, tolerance);
+	if ( distance < 0.0 )
+		return -1;
+	return distance <= tolerance;
+}
+
 
 int lwgeom_covers_lwgeom_sphere(const LWGEOM *lwgeom1, const LWGEOM *lwgeom2)
 {
@@ -2485,11 +2551,12 @@ int getPoint2d_p_ro(const POINTARRAY *pa, int n, POINT2D **point)
 
 int ptarray_calculate_gbox_geodetic(const POINTARRAY *pa, GBOX *gbox)
 {
-	int i;
-	int first = LW_TRUE;
+	int i, k, n;
 	const POINT2D *p;
 	POINT3D A1, A2;
 	GBOX edge_gbox;
+	double x[EDGE_BLOCK_SIZE], y[EDGE_BLOCK_SIZE], z[EDGE_BLOCK_SIZE];
+	int extrema[EDGE_BLOCK_SIZE];
 
 	assert(gbox);
 	assert(pa);
@@ -2499,40 +2566,61 @@ int ptarray_calculate_gbox_geodetic(const POINTARRAY *pa, GBOX *gbox)
 
 	if ( pa->npoints == 0 ) return LW_FAILURE;
 
+	p = getPoint2d_cp(pa, 0);
+	ll2cart(p, &A1);
+	gbox->xmin = gbox->xmax = A1.x;
+	gbox->ymin = gbox->ymax = A1.y;
+	gbox->zmin = gbox->zmax = A1.z;
+
 	if ( pa->npoints == 1 )
-	{
-		p = getPoint2d_cp(pa, 0);
-		ll2cart(p, &A1);
-		gbox->xmin = gbox->xmax = A1.x;
-		gbox->ymin = gbox->ymax = A1.y;
-		gbox->zmin = gbox->zmax = A1.z;
 		return LW_SUCCESS;
-	}
 
-	p = getPoint2d_cp(pa, 0);
-	ll2cart(p, &A1);
-	
+	/* Convert the points a block at a time, the last point of */
+	/* each block starting the next one */
+	x[0] = A1.x; y[0] = A1.y; z[0] = A1.z;
+	n = 1;
 	for ( i = 1; i < pa->npoints; i++ )
 	{
-		
 		p = getPoint2d_cp(pa, i);
 		ll2cart(p, &A2);
-		
-		edge_calculate_gbox(&A1, &A2, &edge_gbox);
+		x[n] = A2.x; y[n] = A2.y; z[n] = A2.z;
+		n++;
 
-		/* Initialize the box */
-		if ( first )
+		if ( n < EDGE_BLOCK_SIZE && i < pa->npoints - 1 )
+			continue;
+
+		/* Most edges are bounded by their end points */
+		for ( k = 1; k < n; k++ )
 		{
-			gbox_duplicate(&edge_gbox, gbox);
-			first = LW_FALSE;
+			gbox->xmin = FP_MIN(gbox->xmin, x[k]);
+			gbox->xmax = FP_MAX(gbox->xmax, x[k]);
+			gbox->ymin = FP_MIN(gbox->ymin, y[k]);
+			gbox->ymax = FP_MAX(gbox->ymax, y[k]);
+			gbox->zmin = FP_MIN(gbox->zmin, z[k]);
+			gbox->zmax = FP_MAX(gbox->zmax, z[k]);
 		}
-		/* Expand the box where necessary */
-		else
+
+		/* The rest may bulge past them, near the poles or the */
+		/* axes, so work out their extrema the slow way */
+		edge_extrema_flags(x, y, z, n, extrema);
+		for ( k = 0; k < n - 1; k++ )
 		{
-			gbox_merge(&edge_gbox, gbox);
+			if ( ! extrema[k] )
+				continue;
+
+			A1.x = x[k];   A1.y = y[k];   A1.z = z[k];
+			A2.x = x[k+1]; A2.y = y[k+1]; A2.z = z[k+1];
+			edge_calculate_gbox(&A1, &A2, &edge_gbox);
+			gbox->xmin = FP_MIN(gbox->xmin, edge_gbox.xmin);
+			gbox->xmax = FP_MAX(gbox->xmax, edge_gbox.xmax);
+			gbox->ymin = FP_MIN(gbox->ymin, edge_gbox.ymin);
+			gbox->ymax = FP_MAX(gbox->ymax, edge_gbox.ymax);
+			gbox->zmin = FP_MIN(gbox->zmin, edge_gbox.zmin);
+			gbox->zmax = FP_MAX(gbox->zmax, edge_gbox.zmax);
 		}
-		
-		A1 = A2;
+
+		x[0] = x[n-1]; y[0] = y[n-1]; z[0] = z[n-1];
+		n = 1;
 	}
 
 	return LW_SUCCESS;
@@ -3080,7 +3168,7 @@ point_in_cone(const POINT3D *A1, const POINT3D *A2, const POINT3D *P)
 /**
 * Utility function for ptarray_contains_point_sphere()
 */
-static int
+int
 point3d_equals(const POINT3D *p1, const POINT3D *p2)
 {
 	return FP_EQUALS(p1->x, p2->x) && FP_EQUALS(p1->y, p2->y) && FP_EQUALS(p1->z, p2->z);
@@ -3090,7 +3178,7 @@ point3d_equals(const POINT3D *p1, const POINT3D *p2)
 * Utility function for edge_intersects(), signum with a tolerance
 * in determining if the value is zero.
 */
-static int
+int
 dot_product_side(const POINT3D *p, const POINT3D *q)
 {
 	double dp = dot_product(p, q);
@@ -3101,6 +3189,25 @@ dot_product_side(const POINT3D *p, const POINT3D *q)
 	return dp < 0.0 ? -1 : 1;
 }
 
+/**
+* Sides of a block of points, stored as separate x, y and z arrays,
+* relative to the plane through the origin with normal n. Each side
+* is what dot_product_side(n, point) gives, but the loop has no
+* branches, so the compiler can run it over several points at once.
+*/
+void
+plane_sides(const POINT3D *n, const double *x, const double *y, const double *z, int npoints, int *sides)
+{
+	const double nx = n->x, ny = n->y, nz = n->z;
+	int i;
+
+	for ( i = 0; i < npoints; i++ )
+	{
+		double dp = nx * x[i] + ny * y[i] + nz * z[i];
+		sides[i] = (dp > FP_TOLERANCE) - (dp < -FP_TOLERANCE);
+	}
+}
+
 /**
 * Returns non-zero if edges A and B interact. The type of interaction is given in the
 * return value with the bitmask elements defined above.
@@ -3214,9 +3321,13 @@ edge_intersects(const POINT3D *A1, const POINT3D *A2, const POINT3D *B1, const P
 int ptarray_contains_point_sphere(const POINTARRAY *pa, const POINT2D *pt_outside, const POINT2D *pt_to_test)
 {
 	POINT3D S1, S2; /* Stab line end points */
+	POINT3D SN; /* Normal to the stab line plane */
 	POINT3D E1, E2; /* Edge end points (3-space) */
 	POINT2D p; /* Edge end points (lon/lat) */
-	int count = 0, i, inter;
+	double x[EDGE_BLOCK_SIZE], y[EDGE_BLOCK_SIZE], z[EDGE_BLOCK_SIZE];
+	int sides[EDGE_BLOCK_SIZE];
+	int count = 0, i, k, n, inter;
+	int e1_side;
 
 	/* Null input, not enough points for a ring? You ain't closed! */
 	if ( ! pa || pa->npoints < 4 )
@@ -3225,67 +3336,93 @@ int ptarray_contains_point_sphere(const POINTARRAY *pa, const POINT2D *pt_outsid
 	/* Set up our stab line */
 	ll2cart(pt_to_test, &S1);
 	ll2cart(pt_outside, &S2);
+	unit_normal(&S1, &S2, &SN);
 
 	/* Initialize first point */
 	getPoint2d_p(pa, 0, &p);
 	ll2cart(&p, &E1);
+	e1_side = dot_product_side(&SN, &E1);
 
-	/* Walk every edge and see if the stab line hits it */
-	for ( i = 1; i < pa->npoints; i++ )
+	/* Walk every edge, a block of edge ends at a time */
+	for ( i = 1; i < pa->npoints; i += n )
 	{
-		LWDEBUGF(4, "testing edge (%d)", i);
-		LWDEBUGF(4, "  start point == POINT(%.12g %.12g)", p.x, p.y);
-
-		/* Read next point. */
-		getPoint2d_p(pa, i, &p);
-		ll2cart(&p, &E2);
-
-		/* Skip over too-short edges. */
-		if ( point3d_equals(&E1, &E2) )
+		n = FP_MIN(EDGE_BLOCK_SIZE, pa->npoints - i);
+		for ( k = 0; k < n; k++ )
 		{
-			continue;
+			ll2cart(getPoint2d_cp(pa, i + k), &E2);
+			x[k] = E2.x;
+			y[k] = E2.y;
+			z[k] = E2.z;
 		}
-		
-		/* Our test point is on an edge end! Point is "in ring" by our definition */
-		if ( point3d_equals(&S1, &E1) )
+
+		/* What side of the stab line plane the edge ends fall */
+		plane_sides(&SN, x, y, z, n, sides);
+
+		for ( k = 0; k < n; k++ )
 		{
-			return LW_TRUE;
-		}
-		
-		/* Calculate relationship between stab line and edge */
-		inter = edge_intersects(&S1, &S2, &E1, &E2);
+			LWDEBUGF(4, "testing edge (%d)", i + k);
+
+			E2.x = x[k];
+			E2.y = y[k];
+			E2.z = z[k];
+
+			/* Skip over too-short edges. */
+			if ( point3d_equals(&E1, &E2) )
+			{
+				continue;
+			}
 		
-		/* We have some kind of interaction... */
-		if ( inter & PIR_INTERSECTS )
-		{
-			/* If the stabline is touching the edge, that implies the test point */
-			/* is on the edge, so we're done, the point is in (on) the ring. */
-			if ( (inter & PIR_A_TOUCH_RIGHT) || (inter & PIR_A_TOUCH_LEFT) )
+			/* Our test point is on an edge end! Point is "in ring" by our definition */
+			if ( point3d_equals(&S1, &E1) )
 			{
 				return LW_TRUE;
 			}
-			
-			/* It's a touching interaction, disregard all the left-side ones. */
-			/* It's a co-linear intersection, ignore those. */
-			if ( inter & PIR_B_TOUCH_RIGHT || inter & PIR_COLINEAR )
+
+			/* Both ends on one side of the stab line plane. The edge can */
+			/* only be missed, or co-linear, which is not counted either. */
+			if ( e1_side == sides[k] && e1_side != 0 )
 			{
-				/* Do nothing, to avoid double counts. */
-				LWDEBUGF(4,"    edge (%d) crossed, disregarding to avoid double count", i, count);
+				LWDEBUGF(4,"    edge (%d) did not cross", i + k);
+				E1 = E2;
+				continue;
+			}
+		
+			/* Calculate relationship between stab line and edge */
+			inter = edge_intersects(&S1, &S2, &E1, &E2);
+		
+			/* We have some kind of interaction... */
+			if ( inter & PIR_INTERSECTS )
+			{
+				/* If the stabline is touching the edge, that implies the test point */
+				/* is on the edge, so we're done, the point is in (on) the ring. */
+				if ( (inter & PIR_A_TOUCH_RIGHT) || (inter & PIR_A_TOUCH_LEFT) )
+				{
+					return LW_TRUE;
+				}
+			
+				/* It's a touching interaction, disregard all the left-side ones. */
+				/* It's a co-linear intersection, ignore those. */
+				if ( inter & PIR_B_TOUCH_RIGHT || inter & PIR_COLINEAR )
+				{
+					/* Do nothing, to avoid double counts. */
+					LWDEBUGF(4,"    edge (%d) crossed, disregarding to avoid double count", i + k, count);
+				}
+				else
+				{
+					/* Increment crossingn count. */
+					count++;
+					LWDEBUGF(4,"    edge (%d) crossed, count == %d", i + k, count);
+				}
 			}
 			else
 			{
-				/* Increment crossingn count. */
-				count++;
-				LWDEBUGF(4,"    edge (%d) crossed, count == %d", i, count);
+				LWDEBUGF(4,"    edge (%d) did not cross", i + k);
 			}
-		}
-		else
-		{
-			LWDEBUGF(4,"    edge (%d) did not cross", i);
-		}
 		
-		/* Increment to next edge */
-		E1 = E2;
+			/* Increment to next edge */
+			E1 = E2;
+			e1_side = sides[k];
+		}
 	}
 
 	LWDEBUGF(4,"final count == %d", count);
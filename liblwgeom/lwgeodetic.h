@@ -91,6 +91,12 @@ typedef struct
 #define PIR_B_TOUCH_RIGHT   0x10
 #define PIR_B_TOUCH_LEFT  0x20
 
+/**
+* Number of edge ends converted to geocentric coordinates and
+* tested at a time by the ring walks and box calculations.
+*/
+#define EDGE_BLOCK_SIZE 64
+
 
 /*
 * Geodetic calculations
@@ -130,7 +136,13 @@ int crosses_dateline(const GEOGRAPHIC_POINT *s, const GEOGRAPHIC_POINT *e);
 void point_shift(GEOGRAPHIC_POINT *p, double shift);
 double longitude_radians_normalize(double lon);
 double latitude_radians_normalize(double lat);
+double dot_product(const POINT3D *p1, const POINT3D *p2);
+void cross_product(const POINT3D *a, const POINT3D *b, POINT3D *n);
 void vector_sum(const POINT3D *a, const POINT3D *b, POINT3D *n);
+int point3d_equals(const POINT3D *p1, const POINT3D *p2);
+int dot_product_side(const POINT3D *p, const POINT3D *q);
+void plane_sides(const POINT3D *n, const double *x, const double *y, const double *z, int npoints, int *sides);
+void edge_extrema_flags(const double *x, const double *y, const double *z, int npoints, int *flags);
 double vector_angle(const POINT3D* v1, const POINT3D* v2);
 void vector_rotate(const POINT3D* v1, const POINT3D* v2, double angle, POINT3D* n);
 void normalize(POINT3D *p);
@@ -142,6 +154,7 @@ void ll2cart(const POINT2D *g, POINT3D *p);
 ** Prototypes for spheroid functions.
 */
 double spheroid_distance(const GEOGRAPHIC_POINT *a, const GEOGRAPHIC_POINT *b, const SPHEROID *spheroid);
+void spheroid_distance_bounds(const SPHEROID *s, double *lo, double *hi);
 double spheroid_direction(const GEOGRAPHIC_POINT *r, const GEOGRAPHIC_POINT *s, const SPHEROID *spheroid);
 int spheroid_project(const GEOGRAPHIC_POINT *r, const SPHEROID *spheroid, double distance, double azimuth, GEOGRAPHIC_POINT *g);
 
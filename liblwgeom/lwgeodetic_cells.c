@@ -0,0 +1,796 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include "liblwgeom_internal.h"
+#include "lwgeodetic_cells.h"
+#include "lwgeodetic_tree.h"
+#include "lwgeom_log.h"
+
+/**
+* Leaves of a cell index hold at most this many edges, unless
+* they are at the deepest level of the index.
+*/
+#define CELL_INDEX_LEAF_EDGES 8
+#define CELL_INDEX_MAX_LEVEL 20
+
+/**
+* Edges closer than this (radians) to a cell are kept in the cell,
+* so rounding never leaves out an edge that crosses it.
+*/
+#define CELL_INDEX_MARGIN 1e-9
+
+
+/**
+* Face of the cube a point projects onto, and the coordinates of
+* the projection on that face, in [-1, 1].
+*/
+static int
+cell_face_uv(const POINT3D *p, double *u, double *v)
+{
+	double ax = fabs(p->x), ay = fabs(p->y), az = fabs(p->z);
+	int face;
+
+	if ( ax >= ay && ax >= az )
+		face = p->x < 0 ? 3 : 0;
+	else if ( ay >= az )
+		face = p->y < 0 ? 4 : 1;
+	else
+		face = p->z < 0 ? 5 : 2;
+
+	switch ( face )
+	{
+	case 0:
+		*u = p->y / p->x;
+		*v = p->z / p->x;
+		break;
+	case 1:
+		*u = -p->x / p->y;
+		*v = p->z / p->y;
+		break;
+	case 2:
+		*u = -p->x / p->z;
+		*v = -p->y / p->z;
+		break;
+	case 3:
+		*u = p->z / p->x;
+		*v = p->y / p->x;
+		break;
+	case 4:
+		*u = p->z / p->y;
+		*v = -p->x / p->y;
+		break;
+	default:
+		*u = -p->y / p->z;
+		*v = -p->x / p->z;
+		break;
+	}
+	return face;
+}
+
+/**
+* Face coordinates are stretched, so that cells near the corners
+* of a face are not much smaller than cells at its center.
+*/
+static inline double
+cell_uv_to_st(double u)
+{
+	if ( u >= 0.0 )
+		return 0.5 * sqrt(1.0 + 3.0 * u);
+	return 1.0 - 0.5 * sqrt(1.0 - 3.0 * u);
+}
+
+static inline double
+cell_st_to_uv(double s)
+{
+	if ( s >= 0.5 )
+		return (4.0 * s * s - 1.0) / 3.0;
+	return (1.0 - 4.0 * (1.0 - s) * (1.0 - s)) / 3.0;
+}
+
+/**
+* Point on the unit sphere at stretched coordinates s, t of a face.
+*/
+static void
+cell_face_st_to_point(int face, double s, double t, POINT3D *p)
+{
+	double u = cell_st_to_uv(s);
+	double v = cell_st_to_uv(t);
+
+	switch ( face )
+	{
+	case 0:
+		p->x = 1.0; p->y = u; p->z = v;
+		break;
+	case 1:
+		p->x = -u; p->y = 1.0; p->z = v;
+		break;
+	case 2:
+		p->x = -u; p->y = -v; p->z = 1.0;
+		break;
+	case 3:
+		p->x = -1.0; p->y = -v; p->z = -u;
+		break;
+	case 4:
+		p->x = v; p->y = -1.0; p->z = -u;
+		break;
+	default:
+		p->x = v; p->y = u; p->z = -1.0;
+		break;
+	}
+	normalize(p);
+}
+
+static inline uint32_t
+cell_st_to_ij(double s)
+{
+	double max = (double)((uint32_t)1 << CELL_MAX_LEVEL);
+	double ij = floor(s * max);
+	if ( ij < 0.0 )
+		return 0;
+	if ( ij >= max )
+		return ((uint32_t)1 << CELL_MAX_LEVEL) - 1;
+	return (uint32_t)ij;
+}
+
+int
+cell_from_point(const POINT3D *p, uint32_t *i, uint32_t *j)
+{
+	double u, v;
+	int face = cell_face_uv(p, &u, &v);
+	*i = cell_st_to_ij(cell_uv_to_st(u));
+	*j = cell_st_to_ij(cell_uv_to_st(v));
+	return face;
+}
+
+void
+cell_center(int face, int level, uint32_t i, uint32_t j, POINT3D *center)
+{
+	cell_face_st_to_point(face, ldexp(i + 0.5, -level), ldexp(j + 0.5, -level), center);
+}
+
+void
+cell_vertices(int face, int level, uint32_t i, uint32_t j, POINT3D *vertices)
+{
+	double s0 = ldexp(i, -level), s1 = ldexp(i + 1, -level);
+	double t0 = ldexp(j, -level), t1 = ldexp(j + 1, -level);
+	cell_face_st_to_point(face, s0, t0, &(vertices[0]));
+	cell_face_st_to_point(face, s1, t0, &(vertices[1]));
+	cell_face_st_to_point(face, s1, t1, &(vertices[2]));
+	cell_face_st_to_point(face, s0, t1, &(vertices[3]));
+}
+
+/**
+* Center of a cell and the angle from it to the farthest corner,
+* the radius of the smallest cap around the center holding the cell.
+*/
+static double
+cell_cap(int face, int level, uint32_t i, uint32_t j, POINT3D *center)
+{
+	POINT3D vertices[4];
+	double radius = 0.0;
+	int k;
+
+	cell_center(face, level, i, j, center);
+	cell_vertices(face, level, i, j, vertices);
+	for ( k = 0; k < 4; k++ )
+		radius = FP_MAX(radius, vector_angle(center, &(vertices[k])));
+	return radius;
+}
+
+/**
+* Spread the low 30 bits of v out to the even bits of the result.
+*/
+static uint64_t
+cell_id_spread(uint32_t v)
+{
+	uint64_t x = v;
+	x = (x | (x << 16)) & UINT64_C(0x0000FFFF0000FFFF);
+	x = (x | (x << 8)) & UINT64_C(0x00FF00FF00FF00FF);
+	x = (x | (x << 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+	x = (x | (x << 2)) & UINT64_C(0x3333333333333333);
+	x = (x | (x << 1)) & UINT64_C(0x5555555555555555);
+	return x;
+}
+
+static uint32_t
+cell_id_gather(uint64_t x)
+{
+	x &= UINT64_C(0x5555555555555555);
+	x = (x | (x >> 1)) & UINT64_C(0x3333333333333333);
+	x = (x | (x >> 2)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+	x = (x | (x >> 4)) & UINT64_C(0x00FF00FF00FF00FF);
+	x = (x | (x >> 8)) & UINT64_C(0x0000FFFF0000FFFF);
+	x = (x | (x >> 16)) & UINT64_C(0x00000000FFFFFFFF);
+	return (uint32_t)x;
+}
+
+uint64_t
+cell_id_from_face_ij(int face, int level, uint32_t i, uint32_t j)
+{
+	uint64_t pos = cell_id_spread(i) | (cell_id_spread(j) << 1);
+	int shift = 2 * (CELL_MAX_LEVEL - level);
+	return ((uint64_t)face << 61) | (pos << (shift + 1)) | ((uint64_t)1 << shift);
+}
+
+int
+cell_id_level(uint64_t id)
+{
+	int shift = 0;
+
+	if ( (id >> 61) >= CELL_NUM_FACES || ! (id & UINT64_C(0x1FFFFFFFFFFFFFFF)) )
+		return -1;
+	while ( ! ((id >> shift) & 1) )
+		shift++;
+	if ( shift % 2 )
+		return -1;
+	return CELL_MAX_LEVEL - shift / 2;
+}
+
+int
+cell_id_to_face_ij(uint64_t id, int *level, uint32_t *i, uint32_t *j)
+{
+	uint64_t pos;
+	int shift;
+
+	*level = cell_id_level(id);
+	if ( *level < 0 )
+		return -1;
+	shift = 2 * (CELL_MAX_LEVEL - *level) + 1;
+	pos = (id & UINT64_C(0x1FFFFFFFFFFFFFFF)) >> shift;
+	*i = cell_id_gather(pos);
+	*j = cell_id_gather(pos >> 1);
+	return (int)(id >> 61);
+}
+
+uint64_t
+cell_id_from_point(const POINT3D *p, int level)
+{
+	uint32_t i, j;
+	int face = cell_from_point(p, &i, &j);
+	return cell_id_from_face_ij(face, level, i >> (CELL_MAX_LEVEL - level), j >> (CELL_MAX_LEVEL - level));
+}
+
+uint64_t
+cell_id_range_min(uint64_t id)
+{
+	return id - (id & (~id + 1)) + 1;
+}
+
+uint64_t
+cell_id_range_max(uint64_t id)
+{
+	return id + (id & (~id + 1)) - 1;
+}
+
+
+/**
+* Whether the edge from a to b comes within angle r of point p, all
+* on the unit sphere, given sin(r) and the squared chord 4 sin^2(r/2),
+* for r less than a right angle. Edges with (nearly) antipodal ends
+* have no defined path, so they are taken to be everywhere.
+*/
+static int
+cell_edge_within(const POINT3D *p, const POINT3D *a, const POINT3D *b, double sin_r, double chord2_r)
+{
+	POINT3D n, t;
+	double nn;
+
+	cross_product(a, b, &n);
+	nn = sqrt(dot_product(&n, &n));
+	if ( nn > FP_TOLERANCE )
+	{
+		/* The closest point on the great circle is inside the edge */
+		cross_product(a, p, &t);
+		if ( dot_product(&t, &n) >= 0.0 )
+		{
+			cross_product(p, b, &t);
+			if ( dot_product(&t, &n) >= 0.0 )
+				return fabs(dot_product(p, &n)) <= sin_r * nn;
+		}
+	}
+	else if ( dot_product(a, b) < 0.0 )
+	{
+		return LW_TRUE;
+	}
+
+	/* Otherwise the closest point is an end */
+	return POW2(p->x - a->x) + POW2(p->y - a->y) + POW2(p->z - a->z) <= chord2_r ||
+	       POW2(p->x - b->x) + POW2(p->y - b->y) + POW2(p->z - b->z) <= chord2_r;
+}
+
+/**
+* Parity of the number of edges crossed walking from q to p,
+* over the listed edges, or all of them if edges is NULL.
+* Returns -1 if the walk touches an edge or passes through a
+* vertex, when parity does not settle containment.
+*/
+static int
+cell_index_crossings(const CELL_INDEX *index, const POINT3D *q, const POINT3D *p, const int *edges, int num_edges)
+{
+	int k, e, inter, count = 0;
+
+	if ( point3d_equals(q, p) )
+		return 0;
+
+	for ( k = 0; k < num_edges; k++ )
+	{
+		e = edges ? edges[k] : k;
+		inter = edge_intersects(q, p, &(index->pts[2*e]), &(index->pts[2*e+1]));
+		if ( inter & PIR_INTERSECTS )
+		{
+			if ( inter != PIR_INTERSECTS )
+				return -1;
+			count++;
+		}
+	}
+	return count % 2;
+}
+
+static int
+cell_index_add_nodes(CELL_INDEX *index, int num_nodes)
+{
+	int first = index->num_nodes;
+	if ( index->num_nodes + num_nodes > index->max_nodes )
+	{
+		while ( index->num_nodes + num_nodes > index->max_nodes )
+			index->max_nodes *= 2;
+		index->nodes = lwrealloc(index->nodes, sizeof(CELL_NODE) * index->max_nodes);
+	}
+	index->num_nodes += num_nodes;
+	return first;
+}
+
+static void
+cell_index_add_edges(CELL_INDEX *index, const int *edges, int num_edges)
+{
+	if ( index->num_edge_ids + num_edges > index->max_edge_ids )
+	{
+		while ( index->num_edge_ids + num_edges > index->max_edge_ids )
+			index->max_edge_ids *= 2;
+		index->edge_ids = lwrealloc(index->edge_ids, sizeof(int) * index->max_edge_ids);
+	}
+	memcpy(index->edge_ids + index->num_edge_ids, edges, sizeof(int) * num_edges);
+	index->num_edge_ids += num_edges;
+}
+
+/**
+* Fill in a cell from the edges that may cross its parent (all
+* edges if edges is NULL), splitting it while it holds too many.
+* The containment of the center comes from the parent center and
+* the crossings between them, and from the outside point when
+* that walk is not conclusive.
+*/
+static void
+cell_index_build(CELL_INDEX *index, int node, int face, int level, uint32_t i, uint32_t j,
+                 const int *edges, int num_edges, const POINT3D *parent, int parent_status, const POINT3D *outside)
+{
+	POINT3D center;
+	double radius, sin_r, chord2_r;
+	int *cell_edges;
+	int num_cell_edges = 0;
+	int status = -1;
+	int children, k, e;
+
+	radius = cell_cap(face, level, i, j, &center) + CELL_INDEX_MARGIN;
+	sin_r = sin(radius);
+	chord2_r = POW2(2.0 * sin(radius / 2.0));
+
+	/* Edges that come inside the circle around the cell may cross it */
+	cell_edges = lwalloc(sizeof(int) * FP_MAX(num_edges, 1));
+	for ( k = 0; k < num_edges; k++ )
+	{
+		e = edges ? edges[k] : k;
+		if ( cell_edge_within(&center, &(index->pts[2*e]), &(index->pts[2*e+1]), sin_r, chord2_r) )
+			cell_edges[num_cell_edges++] = e;
+	}
+
+	/* The parent center is a corner of the cell, only its edges can cross the way */
+	if ( parent && parent_status >= 0 )
+	{
+		k = cell_index_crossings(index, parent, &center, cell_edges, num_cell_edges);
+		if ( k >= 0 )
+			status = parent_status ^ k;
+	}
+	if ( status < 0 )
+		status = cell_index_crossings(index, outside, &center, NULL, index->num_edges);
+
+	index->nodes[node].center = center;
+	index->nodes[node].status = status;
+
+	if ( num_cell_edges <= CELL_INDEX_LEAF_EDGES || level == CELL_INDEX_MAX_LEVEL )
+	{
+		index->nodes[node].children = -1;
+		index->nodes[node].edges = index->num_edge_ids;
+		index->nodes[node].num_edges = num_cell_edges;
+		cell_index_add_edges(index, cell_edges, num_cell_edges);
+	}
+	else
+	{
+		children = cell_index_add_nodes(index, 4);
+		index->nodes[node].children = children;
+		index->nodes[node].edges = 0;
+		index->nodes[node].num_edges = 0;
+		for ( k = 0; k < 4; k++ )
+		{
+			cell_index_build(index, children + k, face, level + 1, 2*i + (k & 1), 2*j + (k >> 1),
+			                 cell_edges, num_cell_edges, &center, status, outside);
+		}
+	}
+	lwfree(cell_edges);
+}
+
+static void
+cell_index_add_rings(CELL_INDEX *index, const LWPOLY *poly)
+{
+	POINT3D p1, p2;
+	int r, k;
+
+	for ( r = 0; r < poly->nrings; r++ )
+	{
+		const POINTARRAY *pa = poly->rings[r];
+		if ( pa->npoints < 4 )
+			continue;
+		ll2cart(getPoint2d_cp(pa, 0), &p1);
+		for ( k = 1; k < pa->npoints; k++ )
+		{
+			ll2cart(getPoint2d_cp(pa, k), &p2);
+			/* Skip over too-short edges, as ptarray_contains_point_sphere */
+			if ( ! point3d_equals(&p1, &p2) )
+			{
+				index->pts[2*index->num_edges] = p1;
+				index->pts[2*index->num_edges+1] = p2;
+				index->num_edges++;
+			}
+			p1 = p2;
+		}
+	}
+}
+
+/**
+* Build a cell index over a polygon or multipolygon. Containment
+* is by the parity of the rings around a point, which is the same
+* as lwgeom_covers_lwgeom_sphere as long as the parts of a
+* multipolygon do not overlap. Returns NULL for other types.
+*/
+CELL_INDEX*
+lwgeom_calculate_cell_index(const LWGEOM *lwgeom)
+{
+	CELL_INDEX *index;
+	POINT2D pt_outside;
+	POINT3D outside;
+	int face, k;
+
+	if ( ! lwgeom || lwgeom_is_empty(lwgeom) )
+		return NULL;
+	if ( lwgeom->type != POLYGONTYPE && lwgeom->type != MULTIPOLYGONTYPE )
+		return NULL;
+
+	index = lwalloc(sizeof(CELL_INDEX));
+	memset(index, 0, sizeof(CELL_INDEX));
+
+	if ( lwgeom->bbox )
+		index->gbox = *(lwgeom->bbox);
+	else
+		lwgeom_calculate_gbox_geodetic(lwgeom, &(index->gbox));
+	gbox_pt_outside(&(index->gbox), &pt_outside);
+	ll2cart(&pt_outside, &outside);
+
+	index->pts = lwalloc(sizeof(POINT3D) * 2 * FP_MAX(lwgeom_count_vertices(lwgeom), 1));
+	if ( lwgeom->type == POLYGONTYPE )
+	{
+		cell_index_add_rings(index, (LWPOLY*)lwgeom);
+	}
+	else
+	{
+		const LWMPOLY *mpoly = (LWMPOLY*)lwgeom;
+		for ( k = 0; k < mpoly->ngeoms; k++ )
+			cell_index_add_rings(index, mpoly->geoms[k]);
+	}
+
+	index->max_nodes = 64;
+	index->nodes = lwalloc(sizeof(CELL_NODE) * index->max_nodes);
+	index->max_edge_ids = 64;
+	index->edge_ids = lwalloc(sizeof(int) * index->max_edge_ids);
+	cell_index_add_nodes(index, CELL_NUM_FACES);
+
+	for ( face = 0; face < CELL_NUM_FACES; face++ )
+		cell_index_build(index, face, face, 0, 0, 0, NULL, index->num_edges, NULL, -1, &outside);
+
+	LWDEBUGF(3, "cell index of %d edges has %d nodes and %d edge references", index->num_edges, index->num_nodes, index->num_edge_ids);
+	return index;
+}
+
+void
+cell_index_free(CELL_INDEX *index)
+{
+	if ( ! index )
+		return;
+	lwfree(index->pts);
+	lwfree(index->nodes);
+	lwfree(index->edge_ids);
+	lwfree(index);
+}
+
+/**
+* Returns LW_TRUE if the polygon covers the point, LW_FALSE if it
+* does not, and -1 when the point is too close to the boundary to
+* tell without lwgeom_covers_lwgeom_sphere. Points in cells away
+* from the boundary are answered by the cell lookup alone, the
+* others by walking from the center of their cell.
+*/
+int
+cell_index_contains_point(const CELL_INDEX *index, const POINT2D *pt)
+{
+	GEOGRAPHIC_POINT gpt;
+	POINT3D p;
+	const CELL_NODE *node;
+	uint32_t i, j;
+	int level = 0;
+	int crossings;
+
+	/* Point not in box? Done! */
+	geographic_point_init(pt->x, pt->y, &gpt);
+	geog2cart(&gpt, &p);
+	if ( ! gbox_contains_point3d(&(index->gbox), &p) )
+		return LW_FALSE;
+
+	ll2cart(pt, &p);
+	node = &(index->nodes[cell_from_point(&p, &i, &j)]);
+	while ( node->children >= 0 )
+	{
+		level++;
+		node = &(index->nodes[node->children +
+		                      ((i >> (CELL_MAX_LEVEL - level)) & 1) +
+		                      2 * ((j >> (CELL_MAX_LEVEL - level)) & 1)]);
+	}
+
+	if ( node->status < 0 || ! node->num_edges )
+		return node->status;
+
+	crossings = cell_index_crossings(index, &(node->center), &p, index->edge_ids + node->edges, node->num_edges);
+	if ( crossings < 0 )
+		return -1;
+	return node->status ^ crossings;
+}
+
+
+/**
+* Shape to cover: a tree of the geometry, trees of the rings when it
+* is a (multi)polygon, the angle around it to cover as well, and a
+* point moved to the center of each cell in turn.
+*/
+typedef struct
+{
+	CIRC_NODE *tree;
+	CIRC_NODE **rings;
+	int num_rings;
+	double distance;
+	SPHEROID sphere;
+	POINTARRAY *pa;
+} CELL_COVERING_SHAPE;
+
+#define CELL_DISJOINT 0
+#define CELL_PARTIAL 1
+#define CELL_INSIDE 2
+
+/**
+* Whether a cell is away from the shape, entirely inside it, or
+* may be either. The test is on the cap around the cell, so cells
+* only near the shape may be taken for partial, never the reverse.
+*/
+static int
+cell_covering_classify(CELL_COVERING_SHAPE *shape, uint64_t id)
+{
+	POINT3D center;
+	GEOGRAPHIC_POINT g;
+	POINT4D p4d = {0.0, 0.0, 0.0, 0.0};
+	CIRC_NODE *node;
+	uint32_t i, j;
+	double radius, d;
+	int face, level, k;
+	int rv = CELL_PARTIAL;
+
+	face = cell_id_to_face_ij(id, &level, &i, &j);
+	radius = cell_cap(face, level, i, j, &center) + CELL_INDEX_MARGIN;
+	cart2geog(&center, &g);
+	p4d.x = rad2deg(g.lon);
+	p4d.y = rad2deg(g.lat);
+	ptarray_set_point4d(shape->pa, 0, &p4d);
+	node = circ_tree_new(shape->pa);
+	node->geom_type = POINTTYPE;
+
+	d = circ_tree_distance_tree(node, shape->tree, &(shape->sphere), radius + shape->distance);
+	if ( d > radius + shape->distance )
+	{
+		rv = CELL_DISJOINT;
+	}
+	else if ( d + radius <= shape->distance )
+	{
+		rv = CELL_INSIDE;
+	}
+	else if ( d == 0.0 && shape->num_rings )
+	{
+		/* Center inside the polygon, and the boundary beyond the cell */
+		rv = CELL_INSIDE;
+		for ( k = 0; k < shape->num_rings && rv == CELL_INSIDE; k++ )
+		{
+			d = circ_tree_distance_tree(node, shape->rings[k], &(shape->sphere), radius - shape->distance);
+			if ( d < radius - shape->distance )
+				rv = CELL_PARTIAL;
+		}
+	}
+	circ_tree_free(node);
+	return rv;
+}
+
+static void
+cell_covering_add_rings(CELL_COVERING_SHAPE *shape, const LWPOLY *poly)
+{
+	CIRC_NODE *node;
+	int r;
+
+	for ( r = 0; r < poly->nrings; r++ )
+	{
+		node = circ_tree_new(poly->rings[r]);
+		if ( node )
+			shape->rings[shape->num_rings++] = node;
+	}
+}
+
+static int
+cell_id_cmp(const void *a, const void *b)
+{
+	uint64_t ia = *((const uint64_t*)a);
+	uint64_t ib = *((const uint64_t*)b);
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+/**
+* Cells covering everything within distance (radians) of a geometry,
+* in increasing id order. Cells are split breadth first, as long as
+* the covering stays within max_cells (or the number of faces the
+* geometry touches, if more) and the cells above max_level. Returns
+* the number of cells, allocated into *cells, or 0 for an empty
+* geometry.
+*/
+int
+lwgeom_cell_covering(const LWGEOM *lwgeom, double distance, int max_cells, int max_level, uint64_t **cells)
+{
+	CELL_COVERING_SHAPE shape;
+	uint64_t *queue, *result;
+	uint64_t children[4];
+	int *queue_status;
+	int child_status[4];
+	int capacity, head = 0, count = 0, num_cells = 0;
+	int face, level, k, n;
+	uint32_t i, j;
+
+	*cells = NULL;
+	if ( ! lwgeom || lwgeom_is_empty(lwgeom) )
+		return 0;
+
+	memset(&shape, 0, sizeof(CELL_COVERING_SHAPE));
+	shape.tree = lwgeom_calculate_circ_tree(lwgeom);
+	if ( ! shape.tree )
+		return 0;
+	shape.distance = FP_MAX(distance, 0.0);
+	spheroid_init(&(shape.sphere), 1.0, 1.0);
+	shape.pa = ptarray_construct(0, 0, 1);
+
+	/* Only areas have an inside to cover whole cells of */
+	if ( lwgeom->type == POLYGONTYPE || lwgeom->type == MULTIPOLYGONTYPE )
+	{
+		if ( lwgeom->type == POLYGONTYPE )
+		{
+			shape.rings = lwalloc(sizeof(CIRC_NODE*) * ((LWPOLY*)lwgeom)->nrings);
+			cell_covering_add_rings(&shape, (LWPOLY*)lwgeom);
+		}
+		else
+		{
+			const LWMPOLY *mpoly = (LWMPOLY*)lwgeom;
+			n = 0;
+			for ( k = 0; k < mpoly->ngeoms; k++ )
+				n += mpoly->geoms[k]->nrings;
+			shape.rings = lwalloc(sizeof(CIRC_NODE*) * FP_MAX(n, 1));
+			for ( k = 0; k < mpoly->ngeoms; k++ )
+				cell_covering_add_rings(&shape, mpoly->geoms[k]);
+		}
+	}
+
+	max_cells = FP_MAX(max_cells, 1);
+	max_level = FP_MIN(FP_MAX(max_level, 0), CELL_MAX_LEVEL);
+
+	/* The queue and the result together never hold more than this */
+	capacity = FP_MAX(max_cells, CELL_NUM_FACES) + 4;
+	queue = lwalloc(sizeof(uint64_t) * capacity);
+	queue_status = lwalloc(sizeof(int) * capacity);
+	result = lwalloc(sizeof(uint64_t) * capacity);
+
+	for ( face = 0; face < CELL_NUM_FACES; face++ )
+	{
+		uint64_t id = cell_id_from_face_ij(face, 0, 0, 0);
+		int status = cell_covering_classify(&shape, id);
+		if ( status != CELL_DISJOINT )
+		{
+			queue[count] = id;
+			queue_status[count++] = status;
+		}
+	}
+
+	while ( count )
+	{
+		uint64_t id = queue[head];
+		int status = queue_status[head];
+		head = (head + 1) % capacity;
+		count--;
+
+		face = cell_id_to_face_ij(id, &level, &i, &j);
+		if ( status == CELL_INSIDE || level == max_level )
+		{
+			result[num_cells++] = id;
+			continue;
+		}
+
+		/* The children covering the shape are enough to replace the cell */
+		n = 0;
+		for ( k = 0; k < 4; k++ )
+		{
+			children[n] = cell_id_from_face_ij(face, level + 1, 2*i + (k & 1), 2*j + (k >> 1));
+			child_status[n] = cell_covering_classify(&shape, children[n]);
+			if ( child_status[n] != CELL_DISJOINT )
+				n++;
+		}
+
+		if ( n > 1 && num_cells + count + n > max_cells )
+		{
+			result[num_cells++] = id;
+			continue;
+		}
+		for ( k = 0; k < n; k++ )
+		{
+			int tail = (head + count) % capacity;
+			queue[tail] = children[k];
+			queue_status[tail] = child_status[k];
+			count++;
+		}
+	}
+
+	qsort(result, num_cells, sizeof(uint64_t), cell_id_cmp);
+
+	LWDEBUGF(3, "covered with %d cells", num_cells);
+
+	circ_tree_free(shape.tree);
+	for ( k = 0; k < shape.num_rings; k++ )
+		circ_tree_free(shape.rings[k]);
+	if ( shape.rings )
+		lwfree(shape.rings);
+	ptarray_free(shape.pa);
+	lwfree(queue);
+	lwfree(queue_status);
+
+	if ( ! num_cells )
+	{
+		lwfree(result);
+		return 0;
+	}
+	*cells = result;
+	return num_cells;
+}
@@ -0,0 +1,111 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+
+#ifndef _LWGEODETIC_CELLS_H
+#define _LWGEODETIC_CELLS_H 1
+
+#include "lwgeodetic.h"
+
+/**
+* Sphere cells are the quadtrees of the six faces of the cube
+* around the sphere, projected onto it from the center. Each
+* face is split into 2^level by 2^level cells, with the face
+* coordinates stretched so cells are close to equal in area.
+* Cell sides are great circle arcs.
+*/
+#define CELL_NUM_FACES 6
+#define CELL_MAX_LEVEL 30
+
+/**
+* Face and coordinates of the leaf cell holding a point on the
+* unit sphere, 0 <= i, j < 2^CELL_MAX_LEVEL. The coordinates of
+* the cell holding the point at a lower level are i, j shifted
+* right by CELL_MAX_LEVEL - level.
+*/
+int cell_from_point(const POINT3D *p, uint32_t *i, uint32_t *j);
+
+/**
+* Center and corners (counter-clockwise) of a cell on the unit sphere.
+*/
+void cell_center(int face, int level, uint32_t i, uint32_t j, POINT3D *center);
+void cell_vertices(int face, int level, uint32_t i, uint32_t j, POINT3D *vertices);
+
+/**
+* Cell ids pack a cell into 64 bits that sort the way btree indexes
+* want: the face in the top three bits, then two bits per level
+* for the child taken at that level (i bit low, j bit high), then a
+* marker bit. The ids of all the cells inside a cell, down to the
+* leaves, fall between cell_id_range_min and cell_id_range_max of
+* that cell, so a cell of a covering is one range of leaf ids.
+*/
+uint64_t cell_id_from_face_ij(int face, int level, uint32_t i, uint32_t j);
+uint64_t cell_id_from_point(const POINT3D *p, int level);
+
+/**
+* Face of a cell, its level and its coordinates at that level, or
+* -1 if the id is not a cell id.
+*/
+int cell_id_to_face_ij(uint64_t id, int *level, uint32_t *i, uint32_t *j);
+int cell_id_level(uint64_t id);
+uint64_t cell_id_range_min(uint64_t id);
+uint64_t cell_id_range_max(uint64_t id);
+
+int lwgeom_cell_covering(const LWGEOM *lwgeom, double distance, int max_cells, int max_level, uint64_t **cells);
+
+/**
+* A cell of a prepared polygon. The status tells whether the center
+* of the cell is inside the polygon, or -1 if that could not be
+* decided. Leaves list the polygon edges that may cross them; a leaf
+* without edges is entirely inside or entirely outside.
+*/
+typedef struct
+{
+	POINT3D center;
+	int status;
+	int children;
+	int edges;
+	int num_edges;
+} CELL_NODE;
+
+/**
+* Cell covering of a polygon, for repeated point-in-polygon tests.
+* The first CELL_NUM_FACES nodes are the faces, children follow in
+* blocks of four, ordered by (i, j) bits as 00, 10, 01, 11. Edge ends
+* are stored on the unit sphere, two points per edge.
+*/
+typedef struct
+{
+	GBOX gbox;
+	POINT3D *pts;
+	int num_edges;
+	CELL_NODE *nodes;
+	int num_nodes;
+	int max_nodes;
+	int *edge_ids;
+	int num_edge_ids;
+	int max_edge_ids;
+} CELL_INDEX;
+
+CELL_INDEX* lwgeom_calculate_cell_index(const LWGEOM *lwgeom);
+void cell_index_free(CELL_INDEX *index);
+int cell_index_contains_point(const CELL_INDEX *index, const POINT2D *pt);
+
+#endif /* _LWGEODETIC_CELLS_H */
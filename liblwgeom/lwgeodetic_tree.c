@@ -44,7 +44,8 @@ circ_node_is_leaf(const CIRC_NODE* node)
 
 /**
 * Recurse from top of node tree and free all children.
-* does not free underlying point array.
+* does not free underlying point array, only the geocentric
+* copies of its points.
 */
 void
 circ_tree_free(CIRC_NODE* node)
@@ -56,6 +57,7 @@ circ_tree_free(CIRC_NODE* node)
 		circ_tree_free(node->nodes[i]);
 
 	if ( node->nodes ) lwfree(node->nodes);
+	if ( node->pts ) lwfree(node->pts);
 	lwfree(node);
 }
 
@@ -64,10 +66,10 @@ circ_tree_free(CIRC_NODE* node)
 * Create a new leaf node, storing pointers back to the end points for later.
 */
 static CIRC_NODE*
-circ_node_leaf_new(const POINTARRAY* pa, int i)
+circ_node_leaf_new(const POINTARRAY* pa, const POINT3D* pts, int i)
 {
 	POINT2D *p1, *p2;
-	POINT3D q1, q2, c;
+	POINT3D c;
 	GEOGRAPHIC_POINT g1, g2, gc;
 	CIRC_NODE *node;
 	double diameter;
@@ -89,11 +91,12 @@ circ_node_leaf_new(const POINTARRAY* pa, int i)
 	node = lwalloc(sizeof(CIRC_NODE));
 	node->p1 = p1;
 	node->p2 = p2;
+	node->q1 = &(pts[i]);
+	node->q2 = &(pts[i+1]);
+	node->pts = NULL;
 	
-	/* Convert ends to X/Y/Z, sum, and normalize to get mid-point */
-	geog2cart(&g1, &q1);
-	geog2cart(&g2, &q2);
-	vector_sum(&q1, &q2, &c);
+	/* Sum X/Y/Z of the ends, and normalize to get mid-point */
+	vector_sum(node->q1, node->q2, &c);
 	normalize(&c);
 	cart2geog(&c, &gc);
 	node->center = gc;
@@ -118,10 +121,12 @@ circ_node_leaf_new(const POINTARRAY* pa, int i)
 * Return a point node (zero radius, referencing one point)
 */
 static CIRC_NODE*
-circ_node_leaf_point_new(const POINTARRAY* pa)
+circ_node_leaf_point_new(const POINTARRAY* pa, const POINT3D* pts)
 {
 	CIRC_NODE* tree = lwalloc(sizeof(CIRC_NODE));
 	tree->p1 = tree->p2 = (POINT2D*)getPoint_internal(pa, 0);
+	tree->q1 = tree->q2 = &(pts[0]);
+	tree->pts = NULL;
 	geographic_point_init(tree->p1->x, tree->p1->y, &(tree->center));
 	tree->radius = 0.0;
 	tree->nodes = NULL;
@@ -335,6 +340,9 @@ circ_node_internal_new(CIRC_NODE** c, int num_nodes)
 	node = lwalloc(sizeof(CIRC_NODE));
 	node->p1 = NULL;
 	node->p2 = NULL;
+	node->q1 = NULL;
+	node->q2 = NULL;
+	node->pts = NULL;
 	node->center = new_center;
 	node->radius = new_radius;
 	node->num_nodes = num_nodes;
@@ -357,14 +365,30 @@ circ_tree_new(const POINTARRAY* pa)
 	CIRC_NODE **nodes;
 	CIRC_NODE *node;
 	CIRC_NODE *tree;
+	POINT3D *pts;
 
 	/* Can't do anything with no points */
 	if ( pa->npoints < 1 )
 		return NULL;
 		
+	/* Convert every vertex to X/Y/Z once, the leaves and all later */
+	/* edge tests against this tree read them from here */
+	pts = lwalloc(sizeof(POINT3D) * pa->npoints);
+	for ( i = 0; i < pa->npoints; i++ )
+	{
+		const POINT2D *p = getPoint2d_cp(pa, i);
+		GEOGRAPHIC_POINT g;
+		geographic_point_init(p->x, p->y, &g);
+		geog2cart(&g, &(pts[i]));
+	}
+
 	/* Special handling for a single point */
 	if ( pa->npoints == 1 )
-		return circ_node_leaf_point_new(pa);
+	{
+		tree = circ_node_leaf_point_new(pa, pts);
+		tree->pts = pts;
+		return tree;
+	}
 		
 	/* First create a flat list of nodes, one per edge. */
 	num_edges = pa->npoints - 1;
@@ -372,7 +396,7 @@ circ_tree_new(const POINTARRAY* pa)
 	j = 0;
 	for ( i = 0; i < num_edges; i++ )
 	{
-		node = circ_node_leaf_new(pa, i);
+		node = circ_node_leaf_new(pa, pts, i);
 		if ( node ) /* Not zero length? */
 			nodes[j++] = node;
 	}
@@ -380,7 +404,9 @@ circ_tree_new(const POINTARRAY* pa)
 	/* Special case: only zero-length edges. Make a point node. */
 	if ( j == 0 ) {
 		lwfree(nodes);
-		return circ_node_leaf_point_new(pa);
+		tree = circ_node_leaf_point_new(pa, pts);
+		tree->pts = pts;
+		return tree;
 	}
 
 	/* Merge the node list pairwise up into a tree */
@@ -389,6 +415,8 @@ circ_tree_new(const POINTARRAY* pa)
 	/* Free the old list structure, leaving the tree in place */
 	lwfree(nodes);
 
+	/* The top node owns the geocentric points */
+	tree->pts = pts;
 	return tree;
 }
 
@@ -477,21 +505,26 @@ int circ_tree_get_point(const CIRC_NODE* node, POINT2D* pt)
 * KNOWN PROBLEM: Grazings (think of a sharp point, just touching the
 *   stabline) will be counted for one, which will throw off the count.
 */
-int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POINT2D* pt_outside, int* on_boundary)
+static int
+circ_tree_contains_point_internal(const CIRC_NODE* node, const GEOGRAPHIC_EDGE* stab_edge, const POINT3D* S1, const POINT3D* S2, const POINT3D* SN, int* on_boundary)
 {
 	GEOGRAPHIC_POINT closest;
-	GEOGRAPHIC_EDGE stab_edge, edge;
-	POINT3D S1, S2, E1, E2;
 	double d;
 	int i, c;
 	
-	/* Construct a stabline edge from our "inside" to our known outside point */
-	geographic_point_init(pt->x, pt->y, &(stab_edge.start));
-	geographic_point_init(pt_outside->x, pt_outside->y, &(stab_edge.end));
-	geog2cart(&(stab_edge.start), &S1);
-	geog2cart(&(stab_edge.end), &S2);
-	
 	LWDEBUG(3, "entered");
+
+	/*
+	* An edge with both ends on one side of the stab line plane is
+	* missed or co-linear, neither counts, so leaves can be dropped
+	* on two dot products before the distance to their center.
+	*/
+	if ( circ_node_is_leaf(node) && node->q1 != node->q2 )
+	{
+		int side = dot_product_side(SN, node->q1);
+		if ( side != 0 && side == dot_product_side(SN, node->q2) )
+			return 0;
+	}
 	
 	/*
 	* If the stabline doesn't cross within the radius of a node, there's no
@@ -499,7 +532,7 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 	*/
 		
 	LWDEBUGF(3, "working on node %p, edge_num %d, radius %g, center POINT(%g %g)", node, node->edge_num, node->radius, rad2deg(node->center.lon), rad2deg(node->center.lat));
-	d = edge_distance_to_point(&stab_edge, &(node->center), &closest);
+	d = edge_distance_to_point(stab_edge, &(node->center), &closest);
 	LWDEBUGF(3, "edge_distance_to_point=%g, node_radius=%g", d, node->radius);
 	if ( FP_LTEQ(d, node->radius) )
 	{
@@ -510,12 +543,7 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 		{
 			int inter;
 			LWDEBUGF(3, "leaf node calculation (edge %d)", node->edge_num);
-			geographic_point_init(node->p1->x, node->p1->y, &(edge.start));
-			geographic_point_init(node->p2->x, node->p2->y, &(edge.end));
-			geog2cart(&(edge.start), &E1);
-			geog2cart(&(edge.end), &E2);
-			
-			inter = edge_intersects(&S1, &S2, &E1, &E2);
+			inter = edge_intersects(S1, S2, node->q1, node->q2);
 			
 			if ( inter & PIR_INTERSECTS )
 			{
@@ -543,7 +571,7 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 			{
 				LWDEBUG(3,"internal node calculation");
 				LWDEBUGF(3," calling circ_tree_contains_point on child %d!", i);
-				c += circ_tree_contains_point(node->nodes[i], pt, pt_outside, on_boundary);
+				c += circ_tree_contains_point_internal(node->nodes[i], stab_edge, S1, S2, SN, on_boundary);
 			}
 			return c % 2;
 		}
@@ -556,6 +584,22 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 	return 0;
 }
 
+int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POINT2D* pt_outside, int* on_boundary)
+{
+	GEOGRAPHIC_EDGE stab_edge;
+	POINT3D S1, S2, SN;
+
+	/* Construct a stabline edge from our "inside" to our known outside point, */
+	/* once for the whole descent */
+	geographic_point_init(pt->x, pt->y, &(stab_edge.start));
+	geographic_point_init(pt_outside->x, pt_outside->y, &(stab_edge.end));
+	geog2cart(&(stab_edge.start), &S1);
+	geog2cart(&(stab_edge.end), &S2);
+	unit_normal(&S1, &S2, &SN);
+
+	return circ_tree_contains_point_internal(node, &stab_edge, &S1, &S2, &SN, on_boundary);
+}
+
 static double
 circ_node_min_distance(const CIRC_NODE* n1, const CIRC_NODE* n2)
 {
@@ -595,6 +639,13 @@ circ_tree_distance_tree(const CIRC_NODE* n1, const CIRC_NODE* n2, const SPHEROID
 	}
 	else
 	{
+		/* Under the threshold even at the largest stretch the spheroid */
+		/* can apply, so the spheroid distance is not of interest */
+		double lo, hi;
+		double d = spheroid->radius * sphere_distance(&closest1, &closest2);
+		spheroid_distance_bounds(spheroid, &lo, &hi);
+		if ( hi * d < threshold )
+			return d;
 		return spheroid_distance(&closest1, &closest2, spheroid);		
 	}
 }
@@ -629,6 +680,20 @@ circ_tree_distance_tree_internal(const CIRC_NODE* n1, const CIRC_NODE* n2, doubl
 	if( max < *max_dist )
 		*max_dist = max;
 
+	/* Every point of one node is within the threshold of every point of the */
+	/* other, so any pair of vertices proves the threshold, no need to descend. */
+	if( max < threshold )
+	{
+		POINT2D pt1, pt2;
+		circ_tree_get_point(n1, &pt1);
+		circ_tree_get_point(n2, &pt2);
+		LWDEBUGF(4, "max %.8g under threshold, accepting pair %p, %p", max, n1, n2);
+		geographic_point_init(pt1.x, pt1.y, closest1);
+		geographic_point_init(pt2.x, pt2.y, closest2);
+		*min_dist = sphere_distance(closest1, closest2);
+		return *min_dist;
+	}
+
 	/* Polygon on one side, primitive type on the other. Check for point-in-polygon */
 	/* short circuit. */
 	if ( n1->geom_type == POLYGONTYPE && n2->geom_type && ! lwtype_is_collection(n2->geom_type) )
@@ -707,16 +772,11 @@ circ_tree_distance_tree_internal(const CIRC_NODE* n1, const CIRC_NODE* n2, doubl
 		{
 			GEOGRAPHIC_EDGE e1, e2;
 			GEOGRAPHIC_POINT g;
-			POINT3D A1, A2, B1, B2;
 			geographic_point_init(n1->p1->x, n1->p1->y, &(e1.start));
 			geographic_point_init(n1->p2->x, n1->p2->y, &(e1.end));
 			geographic_point_init(n2->p1->x, n2->p1->y, &(e2.start));
 			geographic_point_init(n2->p2->x, n2->p2->y, &(e2.end));
-			geog2cart(&(e1.start), &A1);
-			geog2cart(&(e1.end), &A2);
-			geog2cart(&(e2.start), &B1);
-			geog2cart(&(e2.end), &B2);
-			if ( edge_intersects(&A1, &A2, &B1, &B2) )
+			if ( edge_intersects(n1->q1, n1->q2, n2->q1, n2->q2) )
 			{
 				d = 0.0;
 				edge_intersection(&e1, &e2, &g);
@@ -748,6 +808,9 @@ circ_tree_distance_tree_internal(const CIRC_NODE* n1, const CIRC_NODE* n2, doubl
 			{
 				d = circ_tree_distance_tree_internal(n1->nodes[i], n2, threshold, min_dist, max_dist, closest1, closest2);
 				d_min = FP_MIN(d_min, d);
+				/* Threshold proven, skip the remaining siblings */
+				if( *min_dist < threshold || *min_dist == 0.0 )
+					break;
 			}
 		}
 		else if ( n2->geom_type && lwtype_is_collection(n2->geom_type) )
@@ -756,6 +819,9 @@ circ_tree_distance_tree_internal(const CIRC_NODE* n1, const CIRC_NODE* n2, doubl
 			{
 				d = circ_tree_distance_tree_internal(n1, n2->nodes[i], threshold, min_dist, max_dist, closest1, closest2);
 				d_min = FP_MIN(d_min, d);
+				/* Threshold proven, skip the remaining siblings */
+				if( *min_dist < threshold || *min_dist == 0.0 )
+					break;
 			}
 		}
 		else if ( ! circ_node_is_leaf(n1) )
@@ -764,6 +830,9 @@ circ_tree_distance_tree_internal(const CIRC_NODE* n1, const CIRC_NODE* n2, doubl
 			{
 				d = circ_tree_distance_tree_internal(n1->nodes[i], n2, threshold, min_dist, max_dist, closest1, closest2);
 				d_min = FP_MIN(d_min, d);
+				/* Threshold proven, skip the remaining siblings */
+				if( *min_dist < threshold || *min_dist == 0.0 )
+					break;
 			}
 		}
 		else if ( ! circ_node_is_leaf(n2) )
@@ -772,6 +841,9 @@ circ_tree_distance_tree_internal(const CIRC_NODE* n1, const CIRC_NODE* n2, doubl
 			{
 				d = circ_tree_distance_tree_internal(n1, n2->nodes[i], threshold, min_dist, max_dist, closest1, closest2);
 				d_min = FP_MIN(d_min, d);
+				/* Threshold proven, skip the remaining siblings */
+				if( *min_dist < threshold || *min_dist == 0.0 )
+					break;
 			}
 		}
 		else
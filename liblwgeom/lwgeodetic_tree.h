@@ -32,6 +32,8 @@
 
 /**
 * Note that p1 and p2 are pointers into an independent POINTARRAY, do not free them.
+* q1 and q2 are the same points on the unit sphere, pointing into the geocentric
+* array computed once per POINTARRAY and owned (pts) by the top node built for it.
 */
 typedef struct circ_node
 {
@@ -44,6 +46,9 @@ typedef struct circ_node
     POINT2D pt_outside;
 	POINT2D* p1;
 	POINT2D* p2;
+	const POINT3D* q1;
+	const POINT3D* q2;
+	POINT3D* pts;
 } CIRC_NODE;
 
 void circ_tree_print(const CIRC_NODE* node, int depth);
@@ -2027,8 +2027,9 @@ lwgeom_subdivide_recursive(const LWGEOM *geom, int maxvertices, int depth, LWCOL
 		subbox2.xmin -= FP_TOLERANCE;
 	}
 		
-	clipped1 = lwgeom_clip_by_rect(geom, subbox1.xmin, subbox1.ymin, subbox1.xmax, subbox1.ymax);
-	clipped2 = lwgeom_clip_by_rect(geom, subbox2.xmin, subbox2.ymin, subbox2.xmax, subbox2.ymax);
+	/* Pieces must stay valid, which only GEOS guarantees */
+	clipped1 = lwgeom_clip_by_rect_geos(geom, subbox1.xmin, subbox1.ymin, subbox1.xmax, subbox1.ymax);
+	clipped2 = lwgeom_clip_by_rect_geos(geom, subbox2.xmin, subbox2.ymin, subbox2.xmax, subbox2.ymax);
 	
 	if ( clipped1 )
 	{
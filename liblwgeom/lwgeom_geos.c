@@ -1044,8 +1044,31 @@ lwgeom_union(const LWGEOM *geom1, const LWGEOM *geom2)
 	return result;
 }
 
+/**
+ * Clip a geometry by a rectangle. Uses the native clipper, falling back
+ * on GEOSClipByRect for inputs it does not handle.
+ */
 LWGEOM *
 lwgeom_clip_by_rect(const LWGEOM *geom1, double x0, double y0, double x1, double y1)
+{
+	LWGEOM *result;
+	GBOX box;
+
+	memset(&box, 0, sizeof(GBOX));
+	box.xmin = FP_MIN(x0, x1);
+	box.xmax = FP_MAX(x0, x1);
+	box.ymin = FP_MIN(y0, y1);
+	box.ymax = FP_MAX(y0, y1);
+
+	result = lwgeom_rectclip(geom1, &box);
+	if ( result )
+		return result;
+
+	return lwgeom_clip_by_rect_geos(geom1, x0, y0, x1, y1);
+}
+
+LWGEOM *
+lwgeom_clip_by_rect_geos(const LWGEOM *geom1, double x0, double y0, double x1, double y1)
 {
 #if POSTGIS_GEOS_VERSION < 35
 	lwerror("The GEOS version this postgis binary "
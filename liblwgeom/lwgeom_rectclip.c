@@ -0,0 +1,749 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+#include "../postgis_config.h"
+/*#define POSTGIS_DEBUG_LEVEL 4*/
+#include "liblwgeom_internal.h"
+#include "lwgeom_log.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Native clipping of geometries against an axis aligned rectangle.
+ *
+ * Lines are clipped segment by segment (Liang-Barsky), polygon rings
+ * against each side of the rectangle in turn (Sutherland-Hodgman).
+ * Clipped rings are closed and keep their orientation, rings left
+ * without area are dropped, and a polygon whose shell is dropped is
+ * dropped with its holes. Z and M are interpolated on the new
+ * vertices.
+ *
+ * Sutherland-Hodgman joins the pieces of a concave ring that enters
+ * the rectangle more than once along the rectangle sides, which is
+ * not a valid ring. So rings are only clipped that way when they are
+ * convex or enter the rectangle once, without going around it or
+ * doubling back along its sides while outside, and holes only when
+ * they are entirely inside or outside the rectangle. Polygons with
+ * any other ring are left to GEOS.
+ */
+
+enum rectclip_side {
+	RECTCLIP_LEFT,
+	RECTCLIP_RIGHT,
+	RECTCLIP_BOTTOM,
+	RECTCLIP_TOP
+};
+
+typedef struct
+{
+	POINT4D *points;
+	uint32_t npoints;
+	uint32_t maxpoints;
+}
+RECTCLIP_BUFFER;
+
+static void
+rectclip_buffer_append(RECTCLIP_BUFFER *buf, const POINT4D *pt)
+{
+	/* Skip repeated points, they come from vertices on a side */
+	if ( buf->npoints > 0 &&
+	     buf->points[buf->npoints-1].x == pt->x &&
+	     buf->points[buf->npoints-1].y == pt->y )
+		return;
+
+	if ( buf->npoints == buf->maxpoints )
+	{
+		buf->maxpoints *= 2;
+		buf->points = lwrealloc(buf->points, buf->maxpoints * sizeof(POINT4D));
+	}
+	buf->points[buf->npoints++] = *pt;
+}
+
+static inline int
+rectclip_inside(const POINT4D *pt, const GBOX *box, enum rectclip_side side)
+{
+	switch ( side )
+	{
+		case RECTCLIP_LEFT: return pt->x >= box->xmin;
+		case RECTCLIP_RIGHT: return pt->x <= box->xmax;
+		case RECTCLIP_BOTTOM: return pt->y >= box->ymin;
+		default: return pt->y <= box->ymax;
+	}
+}
+
+/*
+ * Point where segment p-q crosses the line of a side. The coordinate
+ * on the side is set exactly, the others are interpolated.
+ */
+static void
+rectclip_intersection(POINT4D *p, POINT4D *q, const GBOX *box,
+                      enum rectclip_side side, POINT4D *out)
+{
+	double c;
+
+	switch ( side )
+	{
+		case RECTCLIP_LEFT:
+		case RECTCLIP_RIGHT:
+			c = side == RECTCLIP_LEFT ? box->xmin : box->xmax;
+			interpolate_point4d(p, q, out, (c - p->x) / (q->x - p->x));
+			out->x = c;
+			break;
+		default:
+			c = side == RECTCLIP_BOTTOM ? box->ymin : box->ymax;
+			interpolate_point4d(p, q, out, (c - p->y) / (q->y - p->y));
+			out->y = c;
+			break;
+	}
+}
+
+/*
+ * Liang-Barsky: find the part t0 to t1 of segment p-q inside the
+ * rectangle. Returns LW_FALSE if no part of it is.
+ */
+static int
+rectclip_segment(const POINT4D *p, const POINT4D *q, const GBOX *box,
+                 double *t0, double *t1)
+{
+	double dx = q->x - p->x;
+	double dy = q->y - p->y;
+	double pk[4], qk[4];
+	int k;
+
+	pk[0] = -dx; qk[0] = p->x - box->xmin;
+	pk[1] = dx;  qk[1] = box->xmax - p->x;
+	pk[2] = -dy; qk[2] = p->y - box->ymin;
+	pk[3] = dy;  qk[3] = box->ymax - p->y;
+
+	*t0 = 0.0;
+	*t1 = 1.0;
+	for ( k = 0; k < 4; k++ )
+	{
+		double r;
+		if ( pk[k] == 0.0 )
+		{
+			/* Parallel to this side, and outside of it */
+			if ( qk[k] < 0.0 )
+				return LW_FALSE;
+			continue;
+		}
+		r = qk[k] / pk[k];
+		if ( pk[k] < 0.0 )
+		{
+			if ( r > *t1 ) return LW_FALSE;
+			else if ( r > *t0 ) *t0 = r;
+		}
+		else
+		{
+			if ( r < *t0 ) return LW_FALSE;
+			else if ( r < *t1 ) *t1 = r;
+		}
+	}
+	return LW_TRUE;
+}
+
+/**
+* Return LW_TRUE if every edge of the closed buffer runs along a
+* side of the box. Self-intersecting inputs (bow-ties) can have zero
+* signed area too, but they always cross the box interior.
+*/
+static int
+rectclip_on_sides(const RECTCLIP_BUFFER *buf, const GBOX *box)
+{
+	const POINT4D *p, *q;
+	uint32_t i;
+
+	for ( i = 0; i < buf->npoints; i++ )
+	{
+		p = &buf->points[i];
+		q = &buf->points[(i + 1) % buf->npoints];
+		if ( ! ((p->x == box->xmin && q->x == box->xmin) ||
+		        (p->x == box->xmax && q->x == box->xmax) ||
+		        (p->y == box->ymin && q->y == box->ymin) ||
+		        (p->y == box->ymax && q->y == box->ymax)) )
+			return LW_FALSE;
+	}
+	return LW_TRUE;
+}
+
+/* How a polygon ring meets the rectangle */
+enum rectclip_ring_kind {
+	RECTCLIP_RING_INSIDE,  /* Within the rectangle, kept as is */
+	RECTCLIP_RING_OUTSIDE, /* Clear of the rectangle */
+	RECTCLIP_RING_AROUND,  /* Clear of the rectangle, enclosing it */
+	RECTCLIP_RING_CLIPPED, /* Clipped by Sutherland-Hodgman */
+	RECTCLIP_RING_COMPLEX  /* Left to GEOS */
+};
+
+static inline int
+rectclip_in_box(const POINT4D *pt, const GBOX *box)
+{
+	return pt->x >= box->xmin && pt->x <= box->xmax &&
+	       pt->y >= box->ymin && pt->y <= box->ymax;
+}
+
+static int
+rectclip_is_convex(const RECTCLIP_BUFFER *buf)
+{
+	const POINT4D *a, *b, *c;
+	double cross;
+	uint32_t i;
+	int sign = 0, s;
+
+	for ( i = 0; i < buf->npoints; i++ )
+	{
+		a = &buf->points[i];
+		b = &buf->points[(i + 1) % buf->npoints];
+		c = &buf->points[(i + 2) % buf->npoints];
+		cross = (b->x - a->x) * (c->y - b->y) - (b->y - a->y) * (c->x - b->x);
+		if ( cross == 0.0 )
+			continue;
+		s = cross > 0.0 ? 1 : -1;
+		if ( ! sign )
+			sign = s;
+		else if ( s != sign )
+			return LW_FALSE;
+	}
+	return LW_TRUE;
+}
+
+/* Crossing number test of the rectangle center against a ring clear of it */
+static int
+rectclip_encloses(const RECTCLIP_BUFFER *buf, const GBOX *box)
+{
+	double cx = (box->xmin + box->xmax) / 2.0;
+	double cy = (box->ymin + box->ymax) / 2.0;
+	const POINT4D *p, *q;
+	uint32_t i;
+	int inside = LW_FALSE;
+
+	for ( i = 0; i < buf->npoints; i++ )
+	{
+		p = &buf->points[i];
+		q = &buf->points[(i + 1) % buf->npoints];
+		if ( (p->y > cy) != (q->y > cy) &&
+		     cx < p->x + (cy - p->y) * (q->x - p->x) / (q->y - p->y) )
+			inside = ! inside;
+	}
+	return inside;
+}
+
+static inline double
+rectclip_angle(const POINT4D *pt, const GBOX *box)
+{
+	return atan2(pt->y - (box->ymin + box->ymax) / 2.0,
+	             pt->x - (box->xmin + box->xmax) / 2.0);
+}
+
+static inline double
+rectclip_turn(double from, double to)
+{
+	double d = to - from;
+	while ( d > M_PI ) d -= 2.0 * M_PI;
+	while ( d <= -M_PI ) d += 2.0 * M_PI;
+	return d;
+}
+
+/*
+ * Sort a ring out into one of the rectclip_ring_kinds, from its
+ * vertices with the closing one left off.
+ */
+static int
+rectclip_ring_kind(const RECTCLIP_BUFFER *buf, const GBOX *box)
+{
+	uint32_t i, j, n = buf->npoints;
+	uint32_t entry = 0, exit = 0;
+	double t0, t1, entry_t = 0.0, exit_t = 0.0;
+	double sweep, angle, prev;
+	int entries = 0, outside = LW_FALSE;
+	POINT4D pt;
+
+	for ( i = 0; i < n; i++ )
+	{
+		const POINT4D *p = &buf->points[i];
+		const POINT4D *q = &buf->points[(i + 1) % n];
+		int p_in = rectclip_in_box(p, box);
+
+		if ( ! p_in )
+			outside = LW_TRUE;
+		if ( ! rectclip_segment(p, q, box, &t0, &t1) )
+			continue;
+		if ( ! p_in )
+		{
+			entries++;
+			entry = i;
+			entry_t = t0;
+		}
+		if ( ! rectclip_in_box(q, box) )
+		{
+			exit = i;
+			exit_t = t1;
+		}
+	}
+
+	if ( ! outside )
+		return RECTCLIP_RING_INSIDE;
+	/* Nothing with area can be left of a ring cut by a flat rectangle */
+	if ( box->xmin == box->xmax || box->ymin == box->ymax )
+		return RECTCLIP_RING_COMPLEX;
+	if ( ! entries )
+		return rectclip_encloses(buf, box) ? RECTCLIP_RING_AROUND : RECTCLIP_RING_OUTSIDE;
+	if ( rectclip_is_convex(buf) )
+		return RECTCLIP_RING_CLIPPED;
+	if ( entries > 1 )
+		return RECTCLIP_RING_COMPLEX;
+
+	/*
+	 * One trip outside, from the exit point back to the entry point.
+	 * Going all the way around the rectangle would make the clipped
+	 * ring run over its own sides.
+	 */
+	interpolate_point4d(&buf->points[exit], &buf->points[(exit + 1) % n], &pt, exit_t);
+	prev = rectclip_angle(&pt, box);
+	sweep = 0.0;
+	for ( j = (exit + 1) % n; ; j = (j + 1) % n )
+	{
+		angle = rectclip_angle(&buf->points[j], box);
+		sweep += rectclip_turn(prev, angle);
+		prev = angle;
+		if ( j == entry )
+			break;
+	}
+	interpolate_point4d(&buf->points[entry], &buf->points[(entry + 1) % n], &pt, entry_t);
+	sweep += rectclip_turn(prev, rectclip_angle(&pt, box));
+
+	return fabs(sweep) < 2.0 * M_PI ? RECTCLIP_RING_CLIPPED : RECTCLIP_RING_COMPLEX;
+}
+
+/*
+ * Return LW_TRUE if the clipped ring goes back on itself along a side
+ * of the rectangle, which Sutherland-Hodgman does for a ring doubling
+ * back while outside.
+ */
+static int
+rectclip_has_spike(const RECTCLIP_BUFFER *buf, const GBOX *box)
+{
+	const POINT4D *a, *b, *c;
+	uint32_t i;
+
+	for ( i = 0; i < buf->npoints; i++ )
+	{
+		a = &buf->points[i];
+		b = &buf->points[(i + 1) % buf->npoints];
+		c = &buf->points[(i + 2) % buf->npoints];
+		if ( ((a->x == box->xmin || a->x == box->xmax) && a->x == b->x && b->x == c->x &&
+		      (b->y - a->y) * (c->y - b->y) < 0.0) ||
+		     ((a->y == box->ymin || a->y == box->ymax) && a->y == b->y && b->y == c->y &&
+		      (b->x - a->x) * (c->x - b->x) < 0.0) )
+			return LW_TRUE;
+	}
+	return LW_FALSE;
+}
+
+static POINTARRAY *
+rectclip_box_ring(const GBOX *box, int hasz, int hasm)
+{
+	POINTARRAY *ring = ptarray_construct_empty(hasz, hasm, 5);
+	POINT4D pt;
+
+	pt.z = pt.m = 0.0;
+	pt.x = box->xmin; pt.y = box->ymin;
+	ptarray_append_point(ring, &pt, LW_TRUE);
+	pt.y = box->ymax;
+	ptarray_append_point(ring, &pt, LW_TRUE);
+	pt.x = box->xmax;
+	ptarray_append_point(ring, &pt, LW_TRUE);
+	pt.y = box->ymin;
+	ptarray_append_point(ring, &pt, LW_TRUE);
+	pt.x = box->xmin;
+	ptarray_append_point(ring, &pt, LW_TRUE);
+	return ring;
+}
+
+/*
+ * Clip a ring against the rectangle, setting kind to how it meets the
+ * rectangle. Returns a closed ring, or NULL when nothing with area is
+ * left or the ring is not one Sutherland-Hodgman can clip.
+ */
+static POINTARRAY *
+ptarray_rectclip_ring(const POINTARRAY *pa, const GBOX *box, int *kind)
+{
+	RECTCLIP_BUFFER in, out, tmp;
+	POINTARRAY *ring;
+	POINT4D p, q, x;
+	uint32_t i, n;
+	int side;
+
+	*kind = RECTCLIP_RING_OUTSIDE;
+	n = pa->npoints;
+	if ( n > 1 && ptarray_is_closed_2d(pa) )
+		n--;
+	if ( n < 3 )
+		return NULL;
+
+	in.maxpoints = out.maxpoints = 2 * n + 8;
+	in.points = lwalloc(in.maxpoints * sizeof(POINT4D));
+	out.points = lwalloc(out.maxpoints * sizeof(POINT4D));
+	in.npoints = 0;
+	for ( i = 0; i < n; i++ )
+	{
+		getPoint4d_p(pa, i, &p);
+		rectclip_buffer_append(&in, &p);
+	}
+	while ( in.npoints > 1 &&
+	        in.points[0].x == in.points[in.npoints-1].x &&
+	        in.points[0].y == in.points[in.npoints-1].y )
+		in.npoints--;
+
+	ring = NULL;
+	*kind = in.npoints < 3 ? RECTCLIP_RING_OUTSIDE : rectclip_ring_kind(&in, box);
+	switch ( *kind )
+	{
+		case RECTCLIP_RING_INSIDE:
+			ring = ptarray_clone_deep(pa);
+			break;
+		case RECTCLIP_RING_AROUND:
+			ring = rectclip_box_ring(box, FLAGS_GET_Z(pa->flags), FLAGS_GET_M(pa->flags));
+			break;
+		case RECTCLIP_RING_CLIPPED:
+			for ( side = RECTCLIP_LEFT; side <= RECTCLIP_TOP && in.npoints > 0; side++ )
+			{
+				out.npoints = 0;
+				p = in.points[in.npoints-1];
+				for ( i = 0; i < in.npoints; i++ )
+				{
+					q = in.points[i];
+					if ( rectclip_inside(&q, box, side) )
+					{
+						if ( ! rectclip_inside(&p, box, side) )
+						{
+							rectclip_intersection(&p, &q, box, side, &x);
+							rectclip_buffer_append(&out, &x);
+						}
+						rectclip_buffer_append(&out, &q);
+					}
+					else if ( rectclip_inside(&p, box, side) )
+					{
+						rectclip_intersection(&p, &q, box, side, &x);
+						rectclip_buffer_append(&out, &x);
+					}
+					p = q;
+				}
+				/* The ring wraps around, last may repeat first */
+				while ( out.npoints > 1 &&
+				        out.points[0].x == out.points[out.npoints-1].x &&
+				        out.points[0].y == out.points[out.npoints-1].y )
+					out.npoints--;
+				tmp = in; in = out; out = tmp;
+			}
+
+			if ( in.npoints >= 3 && rectclip_has_spike(&in, box) )
+			{
+				*kind = RECTCLIP_RING_COMPLEX;
+			}
+			else if ( in.npoints >= 3 )
+			{
+				ring = ptarray_construct_empty(FLAGS_GET_Z(pa->flags),
+				                               FLAGS_GET_M(pa->flags), in.npoints + 1);
+				for ( i = 0; i < in.npoints; i++ )
+					ptarray_append_point(ring, &in.points[i], LW_TRUE);
+				ptarray_append_point(ring, &in.points[0], LW_TRUE);
+				/* Rings collapsed onto the rectangle sides have no area */
+				if ( ptarray_signed_area(ring) == 0.0 && rectclip_on_sides(&in, box) )
+				{
+					ptarray_free(ring);
+					ring = NULL;
+				}
+			}
+			break;
+		default:
+			break;
+	}
+
+	lwfree(in.points);
+	lwfree(out.points);
+	return ring;
+}
+
+static void
+rectclip_add_line(LWCOLLECTION *col, RECTCLIP_BUFFER *run, const POINTARRAY *pa, int srid)
+{
+	POINTARRAY *line;
+	uint32_t i;
+
+	if ( run->npoints >= 2 )
+	{
+		line = ptarray_construct_empty(FLAGS_GET_Z(pa->flags),
+		                               FLAGS_GET_M(pa->flags), run->npoints);
+		for ( i = 0; i < run->npoints; i++ )
+			ptarray_append_point(line, &run->points[i], LW_TRUE);
+		lwcollection_add_lwgeom(col, lwline_as_lwgeom(lwline_construct(srid, NULL, line)));
+	}
+	run->npoints = 0;
+}
+
+/*
+ * Clip a line against the rectangle, adding the parts inside it to
+ * col as lines.
+ */
+static void
+ptarray_rectclip_line(const POINTARRAY *pa, const GBOX *box, LWCOLLECTION *col, int srid)
+{
+	RECTCLIP_BUFFER run;
+	POINT4D p, q, a, b;
+	uint32_t i;
+
+	run.maxpoints = 16;
+	run.points = lwalloc(run.maxpoints * sizeof(POINT4D));
+	run.npoints = 0;
+
+	for ( i = 1; i < pa->npoints; i++ )
+	{
+		double t0, t1;
+
+		getPoint4d_p(pa, i-1, &p);
+		getPoint4d_p(pa, i, &q);
+
+		if ( ! rectclip_segment(&p, &q, box, &t0, &t1) )
+		{
+			rectclip_add_line(col, &run, pa, srid);
+			continue;
+		}
+
+		if ( t0 > 0.0 )
+		{
+			/* Entering the rectangle, starts a new part */
+			rectclip_add_line(col, &run, pa, srid);
+			interpolate_point4d(&p, &q, &a, t0);
+		}
+		else
+			a = p;
+
+		if ( t1 < 1.0 )
+			interpolate_point4d(&p, &q, &b, t1);
+		else
+			b = q;
+
+		rectclip_buffer_append(&run, &a);
+		rectclip_buffer_append(&run, &b);
+
+		/* Leaving the rectangle, ends the part */
+		if ( t1 < 1.0 )
+			rectclip_add_line(col, &run, pa, srid);
+	}
+	rectclip_add_line(col, &run, pa, srid);
+
+	lwfree(run.points);
+}
+
+static inline int
+rectclip_point_inside(const POINTARRAY *pa, const GBOX *box)
+{
+	const POINT2D *pt = getPoint2d_cp(pa, 0);
+	/* Points on the boundary are left out, as GEOSClipByRect does */
+	return pt->x > box->xmin && pt->x < box->xmax &&
+	       pt->y > box->ymin && pt->y < box->ymax;
+}
+
+/*
+ * Reduce a collection of clipped parts to the type GEOSClipByRect
+ * would return: empty, a single geometry, or a multi geometry.
+ */
+static LWGEOM *
+rectclip_result(LWCOLLECTION *col, uint8_t multitype, const LWGEOM *geom)
+{
+	LWGEOM *result;
+
+	if ( col->ngeoms == 0 )
+	{
+		lwcollection_free(col);
+		return lwgeom_construct_empty(geom->type, geom->srid,
+		                              FLAGS_GET_Z(geom->flags),
+		                              FLAGS_GET_M(geom->flags));
+	}
+	if ( col->ngeoms == 1 )
+	{
+		result = col->geoms[0];
+		col->ngeoms = 0;
+		lwcollection_free(col);
+		return result;
+	}
+	col->type = multitype;
+	return lwcollection_as_lwgeom(col);
+}
+
+/*
+ * Clip a polygon, adding what is left of it to col. Returns LW_FAILURE
+ * if one of its rings has to go through GEOS.
+ */
+static int
+lwpoly_rectclip(const LWPOLY *poly, const GBOX *box, LWCOLLECTION *col)
+{
+	LWPOLY *out;
+	POINTARRAY *ring;
+	uint32_t i;
+	int kind;
+
+	if ( lwpoly_is_empty(poly) )
+		return LW_SUCCESS;
+
+	ring = ptarray_rectclip_ring(poly->rings[0], box, &kind);
+	if ( kind == RECTCLIP_RING_COMPLEX )
+		return LW_FAILURE;
+	if ( ! ring )
+		return LW_SUCCESS;
+
+	out = lwpoly_construct_empty(poly->srid, FLAGS_GET_Z(poly->flags),
+	                             FLAGS_GET_M(poly->flags));
+	lwpoly_add_ring(out, ring);
+	for ( i = 1; i < poly->nrings; i++ )
+	{
+		ring = ptarray_rectclip_ring(poly->rings[i], box, &kind);
+		if ( kind == RECTCLIP_RING_INSIDE )
+		{
+			lwpoly_add_ring(out, ring);
+			continue;
+		}
+		if ( ring )
+			ptarray_free(ring);
+		if ( kind == RECTCLIP_RING_OUTSIDE )
+			continue;
+		lwpoly_free(out);
+		/* The rectangle is inside the hole */
+		if ( kind == RECTCLIP_RING_AROUND )
+			return LW_SUCCESS;
+		/* A hole crossing the sides would touch the clipped shell */
+		return LW_FAILURE;
+	}
+	lwcollection_add_lwgeom(col, lwpoly_as_lwgeom(out));
+	return LW_SUCCESS;
+}
+
+/**
+ * Clip a geometry by a rectangle without going through GEOS.
+ *
+ * Handles points, lines, polygons, their multi versions and
+ * collections of those. Returns NULL for any other input, and for
+ * polygons with rings it cannot clip into valid ones, so that the
+ * caller can fall back on GEOS.
+ */
+LWGEOM *
+lwgeom_rectclip(const LWGEOM *geom, const GBOX *box)
+{
+	LWCOLLECTION *col, *in;
+	LWGEOM *part;
+	GBOX gbox;
+	uint32_t i;
+	int hasz = FLAGS_GET_Z(geom->flags);
+	int hasm = FLAGS_GET_M(geom->flags);
+
+	switch ( geom->type )
+	{
+		case POINTTYPE:
+		case MULTIPOINTTYPE:
+		case LINETYPE:
+		case MULTILINETYPE:
+		case POLYGONTYPE:
+		case MULTIPOLYGONTYPE:
+		case COLLECTIONTYPE:
+			break;
+		default:
+			return NULL;
+	}
+
+	if ( lwgeom_is_empty(geom) )
+		return lwgeom_clone_deep(geom);
+
+	/* Whole geometry inside or outside of the rectangle */
+	lwgeom_calculate_gbox(geom, &gbox);
+	if ( ! gbox_overlaps_2d(&gbox, box) )
+		return lwgeom_construct_empty(geom->type, geom->srid, hasz, hasm);
+	if ( geom->type != POINTTYPE && geom->type != MULTIPOINTTYPE &&
+	     gbox_contains_2d(box, &gbox) )
+		return lwgeom_clone_deep(geom);
+
+	col = lwcollection_construct_empty(COLLECTIONTYPE, geom->srid, hasz, hasm);
+
+	switch ( geom->type )
+	{
+		case POINTTYPE:
+			if ( rectclip_point_inside(((LWPOINT*)geom)->point, box) )
+				lwcollection_add_lwgeom(col, lwgeom_clone_deep(geom));
+			return rectclip_result(col, MULTIPOINTTYPE, geom);
+
+		case MULTIPOINTTYPE:
+			in = (LWCOLLECTION*)geom;
+			for ( i = 0; i < in->ngeoms; i++ )
+			{
+				LWPOINT *pt = (LWPOINT*)in->geoms[i];
+				if ( ! lwpoint_is_empty(pt) && rectclip_point_inside(pt->point, box) )
+					lwcollection_add_lwgeom(col, lwgeom_clone_deep(in->geoms[i]));
+			}
+			return rectclip_result(col, MULTIPOINTTYPE, geom);
+
+		case LINETYPE:
+			ptarray_rectclip_line(((LWLINE*)geom)->points, box, col, geom->srid);
+			return rectclip_result(col, MULTILINETYPE, geom);
+
+		case MULTILINETYPE:
+			in = (LWCOLLECTION*)geom;
+			for ( i = 0; i < in->ngeoms; i++ )
+				ptarray_rectclip_line(((LWLINE*)in->geoms[i])->points, box, col, geom->srid);
+			return rectclip_result(col, MULTILINETYPE, geom);
+
+		case POLYGONTYPE:
+			if ( ! lwpoly_rectclip((LWPOLY*)geom, box, col) )
+			{
+				lwcollection_free(col);
+				return NULL;
+			}
+			return rectclip_result(col, MULTIPOLYGONTYPE, geom);
+
+		case MULTIPOLYGONTYPE:
+			in = (LWCOLLECTION*)geom;
+			for ( i = 0; i < in->ngeoms; i++ )
+			{
+				if ( ! lwpoly_rectclip((LWPOLY*)in->geoms[i], box, col) )
+				{
+					lwcollection_free(col);
+					return NULL;
+				}
+			}
+			return rectclip_result(col, MULTIPOLYGONTYPE, geom);
+
+		default:
+			in = (LWCOLLECTION*)geom;
+			for ( i = 0; i < in->ngeoms; i++ )
+			{
+				part = lwgeom_rectclip(in->geoms[i], box);
+				if ( ! part )
+				{
+					lwcollection_free(col);
+					return NULL;
+				}
+				if ( lwgeom_is_empty(part) )
+					lwgeom_free(part);
+				else
+					lwcollection_add_lwgeom(col, part);
+			}
+			return lwcollection_as_lwgeom(col);
+	}
+}
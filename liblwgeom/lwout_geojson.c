@@ -28,13 +28,20 @@
 #include <string.h>	/* strlen */
 #include <assert.h>
 
-static char *asgeojson_point(const LWPOINT *point, char *srs, GBOX *bbox, int precision);
-static char *asgeojson_line(const LWLINE *line, char *srs, GBOX *bbox, int precision);
-static char *asgeojson_poly(const LWPOLY *poly, char *srs, GBOX *bbox, int precision);
-static char * asgeojson_multipoint(const LWMPOINT *mpoint, char *srs, GBOX *bbox, int precision);
-static char * asgeojson_multiline(const LWMLINE *mline, char *srs, GBOX *bbox, int precision);
-static char * asgeojson_multipolygon(const LWMPOLY *mpoly, char *srs, GBOX *bbox, int precision);
-static char * asgeojson_collection(const LWCOLLECTION *col, char *srs, GBOX *bbox, int precision);
+static size_t asgeojson_point_size(const LWPOINT *point, char *srs, GBOX *bbox, int precision);
+static size_t asgeojson_point_buf(const LWPOINT *point, char *srs, char *output, GBOX *bbox, int precision);
+static size_t asgeojson_line_size(const LWLINE *line, char *srs, GBOX *bbox, int precision);
+static size_t asgeojson_line_buf(const LWLINE *line, char *srs, char *output, GBOX *bbox, int precision);
+static size_t asgeojson_poly_size(const LWPOLY *poly, char *srs, GBOX *bbox, int precision);
+static size_t asgeojson_poly_buf(const LWPOLY *poly, char *srs, char *output, GBOX *bbox, int precision);
+static size_t asgeojson_multipoint_size(const LWMPOINT *mpoint, char *srs, GBOX *bbox, int precision);
+static size_t asgeojson_multipoint_buf(const LWMPOINT *mpoint, char *srs, char *output, GBOX *bbox, int precision);
+static size_t asgeojson_multiline_size(const LWMLINE *mline, char *srs, GBOX *bbox, int precision);
+static size_t asgeojson_multiline_buf(const LWMLINE *mline, char *srs, char *output, GBOX *bbox, int precision);
+static size_t asgeojson_multipolygon_size(const LWMPOLY *mpoly, char *srs, GBOX *bbox, int precision);
+static size_t asgeojson_multipolygon_buf(const LWMPOLY *mpoly, char *srs, char *output, GBOX *bbox, int precision);
+static size_t asgeojson_collection_size(const LWCOLLECTION *col, char *srs, GBOX *bbox, int precision);
+static size_t asgeojson_collection_buf(const LWCOLLECTION *col, char *srs, char *output, GBOX *bbox, int precision);
 static size_t asgeojson_geom_size(const LWGEOM *geom, GBOX *bbox, int precision);
 static size_t asgeojson_geom_buf(const LWGEOM *geom, char *output, GBOX *bbox, int precision);
 
@@ -46,6 +53,61 @@ static size_t pointArray_geojson_size(POINTARRAY *pa, int precision);
  */
 char *
 lwgeom_to_geojson(const LWGEOM *geom, char *srs, int precision, int has_bbox)
+{
+	char *output;
+
+	output = lwalloc(lwgeom_to_geojson_size(geom, srs, precision, has_bbox));
+	lwgeom_to_geojson_buf(geom, srs, output, precision, has_bbox);
+
+	return output;
+}
+
+/**
+ * Takes a GEOMETRY and returns the space its GeoJson representation
+ * needs, terminating null included, for lwgeom_to_geojson_buf
+ */
+size_t
+lwgeom_to_geojson_size(const LWGEOM *geom, char *srs, int precision, int has_bbox)
+{
+	int type = geom->type;
+	/* Only the presence of a bbox matters for sizing */
+	GBOX tmp;
+	GBOX *bbox = has_bbox ? &tmp : NULL;
+
+	if ( precision > OUT_MAX_DOUBLE_PRECISION ) precision = OUT_MAX_DOUBLE_PRECISION;
+
+	switch (type)
+	{
+	case POINTTYPE:
+		return asgeojson_point_size((LWPOINT*)geom, srs, bbox, precision);
+	case LINETYPE:
+		return asgeojson_line_size((LWLINE*)geom, srs, bbox, precision);
+	case POLYGONTYPE:
+		return asgeojson_poly_size((LWPOLY*)geom, srs, bbox, precision);
+	case MULTIPOINTTYPE:
+		return asgeojson_multipoint_size((LWMPOINT*)geom, srs, bbox, precision);
+	case MULTILINETYPE:
+		return asgeojson_multiline_size((LWMLINE*)geom, srs, bbox, precision);
+	case MULTIPOLYGONTYPE:
+		return asgeojson_multipolygon_size((LWMPOLY*)geom, srs, bbox, precision);
+	case COLLECTIONTYPE:
+		return asgeojson_collection_size((LWCOLLECTION*)geom, srs, bbox, precision);
+	default:
+		lwerror("lwgeom_to_geojson: '%s' geometry type not supported",
+		        lwtype_name(type));
+	}
+
+	/* Never get here */
+	return 0;
+}
+
+/**
+ * Takes a GEOMETRY and writes its GeoJson representation to output,
+ * which must hold lwgeom_to_geojson_size bytes. Returns the length
+ * written, terminating null excluded.
+ */
+size_t
+lwgeom_to_geojson_buf(const LWGEOM *geom, char *srs, char *output, int precision, int has_bbox)
 {
 	int type = geom->type;
 	GBOX *bbox = NULL;
@@ -59,31 +121,31 @@ lwgeom_to_geojson(const LWGEOM *geom, char *srs, int precision, int has_bbox)
 		   the GeoJSON expects a cartesian bounding box */
 		lwgeom_calculate_gbox_cartesian(geom, &tmp);
 		bbox = &tmp;
-	}		
+	}
 
 	switch (type)
 	{
 	case POINTTYPE:
-		return asgeojson_point((LWPOINT*)geom, srs, bbox, precision);
+		return asgeojson_point_buf((LWPOINT*)geom, srs, output, bbox, precision);
 	case LINETYPE:
-		return asgeojson_line((LWLINE*)geom, srs, bbox, precision);
+		return asgeojson_line_buf((LWLINE*)geom, srs, output, bbox, precision);
 	case POLYGONTYPE:
-		return asgeojson_poly((LWPOLY*)geom, srs, bbox, precision);
+		return asgeojson_poly_buf((LWPOLY*)geom, srs, output, bbox, precision);
 	case MULTIPOINTTYPE:
-		return asgeojson_multipoint((LWMPOINT*)geom, srs, bbox, precision);
+		return asgeojson_multipoint_buf((LWMPOINT*)geom, srs, output, bbox, precision);
 	case MULTILINETYPE:
-		return asgeojson_multiline((LWMLINE*)geom, srs, bbox, precision);
+		return asgeojson_multiline_buf((LWMLINE*)geom, srs, output, bbox, precision);
 	case MULTIPOLYGONTYPE:
-		return asgeojson_multipolygon((LWMPOLY*)geom, srs, bbox, precision);
+		return asgeojson_multipolygon_buf((LWMPOLY*)geom, srs, output, bbox, precision);
 	case COLLECTIONTYPE:
-		return asgeojson_collection((LWCOLLECTION*)geom, srs, bbox, precision);
+		return asgeojson_collection_buf((LWCOLLECTION*)geom, srs, output, bbox, precision);
 	default:
 		lwerror("lwgeom_to_geojson: '%s' geometry type not supported",
 		        lwtype_name(type));
 	}
 
 	/* Never get here */
-	return NULL;
+	return 0;
 }
 
 
@@ -197,17 +259,6 @@ asgeojson_point_buf(const LWPOINT *point, char *srs, char *output, GBOX *bbox, i
 	return (ptr-output);
 }
 
-static char *
-asgeojson_point(const LWPOINT *point, char *srs, GBOX *bbox, int precision)
-{
-	char *output;
-	int size;
-
-	size = asgeojson_point_size(point, srs, bbox, precision);
-	output = lwalloc(size);
-	asgeojson_point_buf(point, srs, output, bbox, precision);
-	return output;
-}
 
 
 
@@ -244,18 +295,6 @@ asgeojson_line_buf(const LWLINE *line, char *srs, char *output, GBOX *bbox, int
 	return (ptr-output);
 }
 
-static char *
-asgeojson_line(const LWLINE *line, char *srs, GBOX *bbox, int precision)
-{
-	char *output;
-	int size;
-
-	size = asgeojson_line_size(line, srs, bbox, precision);
-	output = lwalloc(size);
-	asgeojson_line_buf(line, srs, output, bbox, precision);
-
-	return output;
-}
 
 
 
@@ -306,18 +345,6 @@ asgeojson_poly_buf(const LWPOLY *poly, char *srs, char *output, GBOX *bbox, int
 	return (ptr-output);
 }
 
-static char *
-asgeojson_poly(const LWPOLY *poly, char *srs, GBOX *bbox, int precision)
-{
-	char *output;
-	int size;
-
-	size = asgeojson_poly_size(poly, srs, bbox, precision);
-	output = lwalloc(size);
-	asgeojson_poly_buf(poly, srs, output, bbox, precision);
-
-	return output;
-}
 
 
 
@@ -370,18 +397,6 @@ asgeojson_multipoint_buf(const LWMPOINT *mpoint, char *srs, char *output, GBOX *
 	return (ptr - output);
 }
 
-static char *
-asgeojson_multipoint(const LWMPOINT *mpoint, char *srs, GBOX *bbox, int precision)
-{
-	char *output;
-	int size;
-
-	size = asgeojson_multipoint_size(mpoint, srs, bbox, precision);
-	output = lwalloc(size);
-	asgeojson_multipoint_buf(mpoint, srs, output, bbox, precision);
-
-	return output;
-}
 
 
 
@@ -438,18 +453,6 @@ asgeojson_multiline_buf(const LWMLINE *mline, char *srs, char *output, GBOX *bbo
 	return (ptr - output);
 }
 
-static char *
-asgeojson_multiline(const LWMLINE *mline, char *srs, GBOX *bbox, int precision)
-{
-	char *output;
-	int size;
-
-	size = asgeojson_multiline_size(mline, srs, bbox, precision);
-	output = lwalloc(size);
-	asgeojson_multiline_buf(mline, srs, output, bbox, precision);
-
-	return output;
-}
 
 
 
@@ -515,18 +518,6 @@ asgeojson_multipolygon_buf(const LWMPOLY *mpoly, char *srs, char *output, GBOX *
 	return (ptr - output);
 }
 
-static char *
-asgeojson_multipolygon(const LWMPOLY *mpoly, char *srs, GBOX *bbox, int precision)
-{
-	char *output;
-	int size;
-
-	size = asgeojson_multipolygon_size(mpoly, srs, bbox, precision);
-	output = lwalloc(size);
-	asgeojson_multipolygon_buf(mpoly, srs, output, bbox, precision);
-
-	return output;
-}
 
 
 
@@ -581,18 +572,6 @@ asgeojson_collection_buf(const LWCOLLECTION *col, char *srs, char *output, GBOX
 	return (ptr - output);
 }
 
-static char *
-asgeojson_collection(const LWCOLLECTION *col, char *srs, GBOX *bbox, int precision)
-{
-	char *output;
-	int size;
-
-	size = asgeojson_collection_size(col, srs, bbox, precision);
-	output = lwalloc(size);
-	asgeojson_collection_buf(col, srs, output, bbox, precision);
-
-	return output;
-}
 
 
 
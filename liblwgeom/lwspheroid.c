@@ -45,6 +45,21 @@ void spheroid_init(SPHEROID *s, double a, double b)
 	s->radius = (2.0 * a + b ) / 3.0;
 }
 
+/**
+* Bounds on the ratio of the spheroid distance to the distance on the
+* sphere of average radius, between the same two points. Along any path
+* the spheroid stretches the sphere by between the smallest radius of
+* curvature, a(1-e^2) on the meridian at the equator, and the largest,
+* a/sqrt(1-e^2) at the poles, over the sphere radius. The bounds are padded
+* a little to absorb rounding in the distance calculations.
+*/
+void spheroid_distance_bounds(const SPHEROID *s, double *lo, double *hi)
+{
+	double e_sq = (s->a * s->a - s->b * s->b) / (s->a * s->a);
+	*lo = (1.0 - 1e-6) * s->a * (1.0 - e_sq) / s->radius;
+	*hi = (1.0 + 1e-6) * s->a / sqrt(1.0 - e_sq) / s->radius;
+}
+
 #if ! PROJ_GEODESIC
 static double spheroid_mu2(double alpha, const SPHEROID *s)
 {
@@ -169,6 +184,10 @@ static double ptarray_area_spheroid(const POINTARRAY *pa, const SPHEROID *sphero
 #else /* ! PROJ_GEODESIC */
 /* Below use pre-version 2.2 geodesic functions */
 
+static double spheroid_distance_reduced(const GEOGRAPHIC_POINT *a, const GEOGRAPHIC_POINT *b,
+                                        double sin_u1, double cos_u1, double sin_u2, double cos_u2,
+                                        const SPHEROID *spheroid);
+
 /**
 * Computes the shortest distance along the surface of the spheroid
 * between two points. Based on Vincenty's formula for the geodetic
@@ -185,18 +204,8 @@ static double ptarray_area_spheroid(const POINTARRAY *pa, const SPHEROID *sphero
 */
 double spheroid_distance(const GEOGRAPHIC_POINT *a, const GEOGRAPHIC_POINT *b, const SPHEROID *spheroid)
 {
-	double lambda = (b->lon - a->lon);
-	double f = spheroid->f;
 	double omf = 1 - spheroid->f;
 	double u1, u2;
-	double cos_u1, cos_u2;
-	double sin_u1, sin_u2;
-	double big_a, big_b, delta_sigma;
-	double alpha, sin_alpha, cos_alphasq, c;
-	double sigma, sin_sigma, cos_sigma, cos2_sigma_m, sqrsin_sigma, last_lambda, omega;
-	double cos_lambda, sin_lambda;
-	double distance;
-	int i = 0;
 
 	/* Same point => zero distance */
 	if ( geographic_point_equals(a, b) )
@@ -205,11 +214,28 @@ double spheroid_distance(const GEOGRAPHIC_POINT *a, const GEOGRAPHIC_POINT *b, c
 	}
 
 	u1 = atan(omf * tan(a->lat));
-	cos_u1 = cos(u1);
-	sin_u1 = sin(u1);
 	u2 = atan(omf * tan(b->lat));
-	cos_u2 = cos(u2);
-	sin_u2 = sin(u2);
+	return spheroid_distance_reduced(a, b, sin(u1), cos(u1), sin(u2), cos(u2), spheroid);
+}
+
+/**
+* Vincenty iteration of spheroid_distance, starting from the sine and
+* cosine of the reduced latitudes of the two points, so callers measuring
+* one point against many can compute those once per point.
+*/
+static double spheroid_distance_reduced(const GEOGRAPHIC_POINT *a, const GEOGRAPHIC_POINT *b,
+                                        double sin_u1, double cos_u1, double sin_u2, double cos_u2,
+                                        const SPHEROID *spheroid)
+{
+	double lambda = (b->lon - a->lon);
+	double f = spheroid->f;
+	double u2;
+	double big_a, big_b, delta_sigma;
+	double alpha, sin_alpha, cos_alphasq, c;
+	double sigma, sin_sigma, cos_sigma, cos2_sigma_m, sqrsin_sigma, last_lambda, omega;
+	double cos_lambda, sin_lambda;
+	double distance;
+	int i = 0;
 
 	omega = lambda;
 	do
@@ -412,225 +438,423 @@ int spheroid_project(const GEOGRAPHIC_POINT *r, const SPHEROID *spheroid, double
 }
 
 
-static inline double spheroid_prime_vertical_radius_of_curvature(double latitude, const SPHEROID *spheroid)
-{
-	return spheroid->a / (sqrt(1.0 - spheroid->e_sq * POW2(sin(latitude))));
-}
-
-static inline double spheroid_parallel_arc_length(double latitude, double deltaLongitude, const SPHEROID *spheroid)
-{
-	return spheroid_prime_vertical_radius_of_curvature(latitude, spheroid)
-	       * cos(latitude)
-	       * deltaLongitude;
-}
-
+/**
+* Order of the series for the area between a geodesic and the equator.
+*/
+#define SPHEROID_AREA_ORDER 6
 
 /**
-* Computes the area on the spheroid of a box bounded by meridians and
-* parallels. The box is defined by two points, the South West corner
-* and the North East corner. Formula based on Bagratuni 1967.
-*
-* @param southWestCorner - lower left corner of bounding box.
-* @param northEastCorner - upper right corner of bounding box.
-* @return area in square meters.
+* Coefficients of the series I4 of Karney (2013) eq. 59-60, truncated at
+* sixth order: for each term l, for each power j >= l of k^2, the
+* polynomial in e'^2 (constant term first) multiplying k^2j.
 */
-static double spheroid_boundingbox_area(const GEOGRAPHIC_POINT *southWestCorner, const GEOGRAPHIC_POINT *northEastCorner, const SPHEROID *spheroid)
+static const double spheroid_area_coeffs[] =
 {
-	double z0 = (northEastCorner->lon - southWestCorner->lon) * POW2(spheroid->b) / 2.0;
-	double e = sqrt(spheroid->e_sq);
-	double sinPhi1 = sin(southWestCorner->lat);
-	double sinPhi2 = sin(northEastCorner->lat);
-	double t1p1 = sinPhi1 / (1.0 - spheroid->e_sq * sinPhi1 * sinPhi1);
-	double t1p2 = sinPhi2 / (1.0 - spheroid->e_sq * sinPhi2 * sinPhi2);
-	double oneOver2e = 1.0 / (2.0 * e);
-	double t2p1 = oneOver2e * log((1.0 + e * sinPhi1) / (1.0 - e * sinPhi1));
-	double t2p2 = oneOver2e * log((1.0 + e * sinPhi2) / (1.0 - e * sinPhi2));
-	return z0 * (t1p2 + t2p2) - z0 * (t1p1 + t2p1);
-}
+	/* l = 0 */
+	2.0/3, -1.0/15, 4.0/105, -8.0/315, 64.0/3465, -128.0/9009,
+	-1.0/20, 1.0/35, -2.0/105, 16.0/1155, -32.0/3003,
+	1.0/42, -1.0/63, 8.0/693, -80.0/9009,
+	-1.0/72, 1.0/99, -10.0/1287,
+	1.0/110, -1.0/143,
+	-1.0/156,
+	/* l = 1 */
+	1.0/180, -1.0/315, 2.0/945, -16.0/10395, 32.0/27027,
+	-1.0/252, 1.0/378, -4.0/2079, 40.0/27027,
+	1.0/360, -1.0/495, 2.0/1287,
+	-1.0/495, 2.0/1287,
+	5.0/3276,
+	/* l = 2 */
+	1.0/2100, -1.0/3150, 4.0/17325, -8.0/45045,
+	-1.0/1800, 1.0/2475, -2.0/6435,
+	1.0/1925, -2.0/5005,
+	-1.0/2184,
+	/* l = 3 */
+	1.0/17640, -1.0/24255, 2.0/63063,
+	-1.0/10780, 1.0/14014,
+	5.0/45864,
+	/* l = 4 */
+	1.0/124740, -1.0/162162,
+	-1.0/58968,
+	/* l = 5 */
+	1.0/792792
+};
 
 /**
-* This function doesn't work for edges crossing the dateline or in the southern
-* hemisphere. Points are pre-conditioned in ptarray_area_spheroid.
+* Evaluate the e'^2 polynomials of spheroid_area_coeffs for a spheroid,
+* leaving one number per (l, j) pair in coeffs, in the same order.
 */
-static double spheroid_striparea(const GEOGRAPHIC_POINT *a, const GEOGRAPHIC_POINT *b, double latitude_min, const SPHEROID *spheroid)
+static void spheroid_area_coeffs_init(const SPHEROID *spheroid, double *coeffs)
 {
-	GEOGRAPHIC_POINT A, B, mL, nR;
-	double deltaLng, baseArea, topArea;
-	double bE, tE, ratio, sign;
-
-	A = *a;
-	B = *b;
-
-	mL.lat = latitude_min;
-	mL.lon = FP_MIN(A.lon, B.lon);
-	nR.lat = FP_MIN(A.lat, B.lat);
-	nR.lon = FP_MAX(A.lon, B.lon);
-	LWDEBUGF(4, "mL (%.12g %.12g)", mL.lat, mL.lon);
-	LWDEBUGF(4, "nR (%.12g %.12g)", nR.lat, nR.lon);
-	baseArea = spheroid_boundingbox_area(&mL, &nR, spheroid);
-	LWDEBUGF(4, "baseArea %.12g", baseArea);
-
-	mL.lat = FP_MIN(A.lat, B.lat);
-	mL.lon = FP_MIN(A.lon, B.lon);
-	nR.lat = FP_MAX(A.lat, B.lat);
-	nR.lon = FP_MAX(A.lon, B.lon);
-	LWDEBUGF(4, "mL (%.12g %.12g)", mL.lat, mL.lon);
-	LWDEBUGF(4, "nR (%.12g %.12g)", nR.lat, nR.lon);
-	topArea = spheroid_boundingbox_area(&mL, &nR, spheroid);
-	LWDEBUGF(4, "topArea %.12g", topArea);
-
-	deltaLng = B.lon - A.lon;
-	LWDEBUGF(4, "deltaLng %.12g", deltaLng);
-	bE = spheroid_parallel_arc_length(A.lat, deltaLng, spheroid);
-	tE = spheroid_parallel_arc_length(B.lat, deltaLng, spheroid);
-	LWDEBUGF(4, "bE %.12g", bE);
-	LWDEBUGF(4, "tE %.12g", tE);
-
-	ratio = (bE + tE)/tE;
-	sign = signum(B.lon - A.lon);
-	return (baseArea + topArea / ratio) * sign;
+	const double *c = spheroid_area_coeffs;
+	double ep2 = spheroid->e_sq / (1.0 - spheroid->e_sq);
+	int l, j, i, n = 0;
+
+	for ( l = 0; l < SPHEROID_AREA_ORDER; l++ )
+	{
+		for ( j = l; j < SPHEROID_AREA_ORDER; j++ )
+		{
+			double p = 0.0;
+			for ( i = SPHEROID_AREA_ORDER - 1 - j; i >= 0; i-- )
+				p = p * ep2 + c[i];
+			c += SPHEROID_AREA_ORDER - j;
+			coeffs[n++] = p;
+		}
+	}
 }
 
-static double ptarray_area_spheroid(const POINTARRAY *pa, const SPHEROID *spheroid)
+/**
+* Signed area between the geodesic from a to b and the equator, Karney
+* (2013) eq. 58, on the auxiliary sphere solution of Vincenty's inverse
+* method. The azimuth difference uses the excess of the trapezoid on the
+* auxiliary sphere and the series is evaluated on the difference of the
+* arc lengths, both of which stay accurate on short edges where the
+* individual terms nearly cancel. The sines and cosines of the reduced
+* latitudes of the ends are passed in, so a ring computes them once per
+* vertex.
+*/
+static double spheroid_edge_area(const GEOGRAPHIC_POINT *a, const GEOGRAPHIC_POINT *b,
+                                 double sin_u1, double cos_u1, double sin_u2, double cos_u2,
+                                 const SPHEROID *spheroid, const double *coeffs, double c2)
 {
-	GEOGRAPHIC_POINT a, b;
-	POINT2D p;
-	int i;
-	double area = 0.0;
-	GBOX gbox2d;
-	int in_south = LW_FALSE;
-	double delta_lon_tolerance;
-	double latitude_min;
-
-	gbox2d.flags = gflags(0, 0, 0);
-
-	/* Return zero on non-sensical inputs */
-	if ( ! pa || pa->npoints < 4 )
+	double f = spheroid->f;
+	double ep2 = spheroid->e_sq / (1.0 - spheroid->e_sq);
+	double omega, lambda, last_lambda;
+	double sin_lambda, cos_lambda;
+	double sigma, sin_sigma, cos_sigma, sin_alpha, cos_alphasq, cos2_sigma_m, c;
+	double sin_alpha1, cos_alpha1, sin_alpha2, cos_alpha2, sin_alpha0, cos_alpha0, norm;
+	double sin_sigma1, cos_sigma1, alpha12, k2, k2j, series, cl;
+	double sin_m, sin_m_prev, cos2_m, sin_h, cos_h, sin_h_prev, cos2_h, tmp;
+	int i = 0, l, j, n = 0;
+
+	/* Longitude difference, the short way around */
+	omega = b->lon - a->lon;
+	if ( omega > M_PI )
+		omega -= 2.0 * M_PI;
+	else if ( omega < -M_PI )
+		omega += 2.0 * M_PI;
+
+	/* Same point => no area */
+	if ( omega == 0.0 && a->lat == b->lat )
 		return 0.0;
 
-	/* Get the raw min/max values for the latitudes */
-	ptarray_calculate_gbox_cartesian(pa, &gbox2d);
-
-	if ( signum(gbox2d.ymin) != signum(gbox2d.ymax) )
-		lwerror("ptarray_area_spheroid: cannot handle ptarray that crosses equator");
+	/*
+	* Longitude on the auxiliary sphere, converged to full precision.
+	* Start from the short line estimate of Karney (2013) eq. 48, which
+	* saves iterations on the short edges dense rings are made of.
+	*/
+	tmp = POW2(sin_u1 + sin_u2);
+	tmp = tmp > 0.0 ? tmp / (tmp + POW2(cos_u1 + cos_u2)) : 0.0;
+	lambda = omega / ((1.0 - f) * sqrt(1.0 + ep2 * tmp));
+	do
+	{
+		sin_lambda = sin(lambda);
+		cos_lambda = cos(lambda);
+		sin_sigma = sqrt(POW2(cos_u2 * sin_lambda) +
+		                 POW2(cos_u1 * sin_u2 - sin_u1 * cos_u2 * cos_lambda));
+		if ( sin_sigma == 0.0 )
+			return 0.0;
+		cos_sigma = sin_u1 * sin_u2 + cos_u1 * cos_u2 * cos_lambda;
+		sigma = atan2(sin_sigma, cos_sigma);
+		sin_alpha = cos_u1 * cos_u2 * sin_lambda / sin_sigma;
+		cos_alphasq = 1.0 - POW2(sin_alpha);
+		/* Equatorial line, cos2_sigma_m is indeterminate and unused */
+		cos2_sigma_m = cos_alphasq != 0.0 ? cos_sigma - 2.0 * sin_u1 * sin_u2 / cos_alphasq : 0.0;
+		c = (f / 16.0) * cos_alphasq * (4.0 + f * (4.0 - 3.0 * cos_alphasq));
+		last_lambda = lambda;
+		lambda = omega + (1.0 - c) * f * sin_alpha * (sigma + c * sin_sigma *
+		         (cos2_sigma_m + c * cos_sigma * (-1.0 + 2.0 * POW2(cos2_sigma_m))));
+		i++;
+	}
+	while ( (i < 100) && (fabs(lambda - last_lambda) > 1.0e-15) );
 
-	/* Geodetic bbox < 0.0 implies geometry is entirely in southern hemisphere */
-	if ( gbox2d.ymax < 0.0 )
-		in_south = LW_TRUE;
+	/* Carry the last step into the sine and cosine, to first order if converged */
+	tmp = lambda - last_lambda;
+	if ( fabs(tmp) <= 1.0e-15 )
+	{
+		sin_lambda += cos_lambda * tmp;
+		cos_lambda -= (sin_lambda - cos_lambda * tmp) * tmp;
+	}
+	else
+	{
+		sin_lambda = sin(lambda);
+		cos_lambda = cos(lambda);
+	}
 
-	LWDEBUGF(4, "gbox2d.ymax %.12g", gbox2d.ymax);
+	/* Azimuths at both ends, and at the equator crossing */
+	sin_alpha1 = cos_u2 * sin_lambda;
+	cos_alpha1 = cos_u1 * sin_u2 - sin_u1 * cos_u2 * cos_lambda;
+	sin_sigma = sqrt(POW2(sin_alpha1) + POW2(cos_alpha1));
+	cos_sigma = sin_u1 * sin_u2 + cos_u1 * cos_u2 * cos_lambda;
+	sin_alpha1 /= sin_sigma;
+	cos_alpha1 /= sin_sigma;
+	sin_alpha2 = cos_u1 * sin_lambda;
+	cos_alpha2 = cos_u1 * sin_u2 * cos_lambda - sin_u1 * cos_u2;
+	norm = sqrt(POW2(sin_alpha2) + POW2(cos_alpha2));
+	sin_alpha2 /= norm;
+	cos_alpha2 /= norm;
+	sin_alpha0 = sin_alpha1 * cos_u1;
+	cos_alpha0 = sqrt(POW2(cos_alpha1) + POW2(sin_alpha1 * sin_u1));
+
+	if ( fabs(lambda) < 0.75 * M_PI && sin_u2 - sin_u1 < 1.75 )
+	{
+		/* tan(alpha12/2) = tan(lambda/2) * (tan(u1/2) + tan(u2/2)) / (1 + tan(u1/2) * tan(u2/2)) */
+		alpha12 = 2.0 * atan2(sin_lambda * (sin_u1 * (1.0 + cos_u2) + sin_u2 * (1.0 + cos_u1)),
+		                      (1.0 + cos_lambda) * (sin_u1 * sin_u2 + (1.0 + cos_u1) * (1.0 + cos_u2)));
+	}
+	else
+	{
+		alpha12 = atan2(sin_alpha2 * cos_alpha1 - cos_alpha2 * sin_alpha1,
+		                cos_alpha2 * cos_alpha1 + sin_alpha2 * sin_alpha1);
+	}
 
-	/* Tolerance for strip area calculation */
-	if ( in_south )
+	/*
+	* I4(sigma2) - I4(sigma1), as a sum of products of sines of odd
+	* multiples of the half arc and of the arc midpoint, measured from
+	* the equator crossing
+	*/
+	norm = sqrt(POW2(sin_u1) + POW2(cos_alpha1 * cos_u1));
+	if ( norm > 0.0 )
 	{
-		delta_lon_tolerance = (90.0 / (fabs(gbox2d.ymin) / 8.0) - 2.0) / 10000.0;
-		latitude_min = deg2rad(fabs(gbox2d.ymax));
+		sin_sigma1 = sin_u1 / norm;
+		cos_sigma1 = cos_alpha1 * cos_u1 / norm;
 	}
 	else
 	{
-		delta_lon_tolerance = (90.0 / (fabs(gbox2d.ymax) / 8.0) - 2.0) / 10000.0;
-		latitude_min = deg2rad(gbox2d.ymin);
+		/* Heading along the equator, from the equator */
+		sin_sigma1 = 0.0;
+		cos_sigma1 = 1.0;
+	}
+	cos_h = sqrt((1.0 + cos_sigma) / 2.0);
+	sin_h = cos_h > 0.0 ? sin_sigma / (2.0 * cos_h) : 1.0;
+	sin_m = sin_sigma1 * cos_h + cos_sigma1 * sin_h;
+	k2 = ep2 * POW2(cos_alpha0);
+
+	/* sin((2l+1)x) by the recurrence s(l+1) = 2 cos(2x) s(l) - s(l-1) */
+	sin_m_prev = -sin_m;
+	cos2_m = 2.0 * (1.0 - 2.0 * POW2(sin_m));
+	sin_h_prev = -sin_h;
+	cos2_h = 2.0 * cos_sigma;
+
+	series = 0.0;
+	for ( l = 0; l < SPHEROID_AREA_ORDER; l++ )
+	{
+		cl = 0.0;
+		k2j = 1.0;
+		for ( j = 0; j < l; j++ )
+			k2j *= k2;
+		for ( j = l; j < SPHEROID_AREA_ORDER; j++ )
+		{
+			cl += k2j * coeffs[n++];
+			k2j *= k2;
+		}
+		series += cl * sin_m * sin_h;
+
+		tmp = sin_m;
+		sin_m = cos2_m * sin_m - sin_m_prev;
+		sin_m_prev = tmp;
+		tmp = sin_h;
+		sin_h = cos2_h * sin_h - sin_h_prev;
+		sin_h_prev = tmp;
 	}
 
-	/* Initialize first point */
-	getPoint2d_p(pa, 0, &p);
-	geographic_point_init(p.x, p.y, &a);
+	return c2 * alpha12 - 2.0 * spheroid->e_sq * POW2(spheroid->a) * cos_alpha0 * sin_alpha0 * series;
+}
 
+/**
+* Area of a ring on the spheroid, in one pass over its edges: the sum of
+* the signed areas between each edge and the equator, corrected by half
+* the spheroid when the ring goes around a pole. Karney (2013), section 6.
+*/
+static double ptarray_area_spheroid(const POINTARRAY *pa, const SPHEROID *spheroid)
+{
+	GEOGRAPHIC_POINT a, b;
+	const POINT2D *p;
+	double coeffs[SPHEROID_AREA_ORDER * (SPHEROID_AREA_ORDER + 1) / 2];
+	double omf = 1 - spheroid->f;
+	double tan_u, sin_ua, cos_ua, sin_ub, cos_ub;
+	double e, c2, area0, delta;
+	double area = 0.0;
+	int crossings = 0;
+	int i;
+
+	/* Return zero on non-sensical inputs */
+	if ( ! pa || pa->npoints < 4 )
+		return 0.0;
+
+	/* Authalic radius squared, the sphere of the same area */
+	e = sqrt(spheroid->e_sq);
+	c2 = e > 0.0 ? (POW2(spheroid->a) + POW2(spheroid->b) * atanh(e) / e) / 2.0 : POW2(spheroid->a);
+	area0 = 4.0 * M_PI * c2;
+	spheroid_area_coeffs_init(spheroid, coeffs);
+
+	p = getPoint2d_cp(pa, 0);
+	geographic_point_init(p->x, p->y, &a);
+	/* Reduced latitude, tan(u) = (1 - f) tan(lat) */
+	tan_u = omf * tan(a.lat);
+	cos_ua = 1.0 / sqrt(1.0 + POW2(tan_u));
+	sin_ua = tan_u * cos_ua;
 	for ( i = 1; i < pa->npoints; i++ )
 	{
-		GEOGRAPHIC_POINT a1, b1;
-		double strip_area = 0.0;
-		double delta_lon = 0.0;
-		LWDEBUGF(4, "edge #%d", i);
+		p = getPoint2d_cp(pa, i);
+		geographic_point_init(p->x, p->y, &b);
+		tan_u = omf * tan(b.lat);
+		cos_ub = 1.0 / sqrt(1.0 + POW2(tan_u));
+		sin_ub = tan_u * cos_ub;
+		area += spheroid_edge_area(&a, &b, sin_ua, cos_ua, sin_ub, cos_ub, spheroid, coeffs, c2);
+
+		/* Count crossings of the prime meridian, to detect rings around a pole */
+		delta = b.lon - a.lon;
+		if ( delta > M_PI )
+			delta -= 2.0 * M_PI;
+		else if ( delta < -M_PI )
+			delta += 2.0 * M_PI;
+		if ( a.lon <= 0.0 && b.lon > 0.0 && delta > 0.0 )
+			crossings++;
+		else if ( b.lon <= 0.0 && a.lon > 0.0 && delta < 0.0 )
+			crossings--;
 
-		getPoint2d_p(pa, i, &p);
-		geographic_point_init(p.x, p.y, &b);
-
-		a1 = a;
-		b1 = b;
+		a = b;
+		sin_ua = sin_ub;
+		cos_ua = cos_ub;
+	}
 
-		/* Flip into north if in south */
-		if ( in_south )
-		{
-			a1.lat = -1.0 * a1.lat;
-			b1.lat = -1.0 * b1.lat;
-		}
+	if ( crossings & 1 )
+		area += (area < 0.0 ? 1.0 : -1.0) * area0 / 2.0;
 
-		LWDEBUGF(4, "in_south %d", in_south);
+	/* Smallest of the two areas the ring divides the spheroid into */
+	if ( area > area0 / 2.0 )
+		area -= area0;
+	else if ( area <= -area0 / 2.0 )
+		area += area0;
 
-		LWDEBUGF(4, "crosses_dateline(a, b) %d", crosses_dateline(&a, &b) );
+	LWDEBUGF(4, "ptarray_area_spheroid: area %.12g", area);
+	return fabs(area);
+}
+#endif /* else ! PROJ_GEODESIC */
 
-		if ( crosses_dateline(&a, &b) )
-		{
-			double shift;
+/**
+* Fill matrix, row major with pa1->npoints rows of pa2->npoints columns,
+* with the distances in spheroid units between every vertex of pa1 and
+* every vertex of pa2. Per-point trigonometry (and for GeographicLib the
+* geodesic setup) is done once per vertex instead of once per pair, the
+* results are identical to calling sphere_distance or spheroid_distance
+* pair by pair.
+*
+* @return LW_SUCCESS, or LW_FAILURE if interrupted.
+*/
+int ptarray_distance_matrix_spheroid(const POINTARRAY *pa1, const POINTARRAY *pa2, const SPHEROID *spheroid, double *matrix)
+{
+	int i, j;
+	int n1 = pa1->npoints;
+	int n2 = pa2->npoints;
+	int use_sphere = (spheroid->a == spheroid->b ? 1 : 0);
+	const POINT2D *p;
+	GEOGRAPHIC_POINT g1;
+	GEOGRAPHIC_POINT *g2;
+	double sin1, cos1;
+	double *sin2, *cos2;
+#if PROJ_GEODESIC
+	struct geod_geodesic gd;
+	double lat1, lon1, s12;
+	double *lat2, *lon2;
+#else
+	double omf = 1 - spheroid->f;
+	double u;
+#endif
 
-			if ( a1.lon > 0.0 )
-				shift = (M_PI - a1.lon) + 0.088; /* About 5deg more */
-			else
-				shift = (M_PI - b1.lon) + 0.088; /* About 5deg more */
+	if ( n1 == 0 || n2 == 0 )
+		return LW_SUCCESS;
 
-			LWDEBUGF(4, "shift: %.8g", shift);
-			LWDEBUGF(4, "before shift a1(%.8g %.8g) b1(%.8g %.8g)", a1.lat, a1.lon, b1.lat, b1.lon);
-			point_shift(&a1, shift);
-			point_shift(&b1, shift);
-			LWDEBUGF(4, "after shift a1(%.8g %.8g) b1(%.8g %.8g)", a1.lat, a1.lon, b1.lat, b1.lon);
+	g2 = lwalloc(n2 * sizeof(GEOGRAPHIC_POINT));
+	sin2 = lwalloc(2 * n2 * sizeof(double));
+	cos2 = sin2 + n2;
+#if PROJ_GEODESIC
+	/* The geodesic solver takes degrees, not latitude terms */
+	geod_init(&gd, spheroid->a, spheroid->f);
+	lat2 = sin2;
+	lon2 = cos2;
+#endif
 
+	/* Second array: geographic coordinates and latitude terms, once */
+	for ( j = 0; j < n2; j++ )
+	{
+		p = getPoint2d_cp(pa2, j);
+		geographic_point_init(p->x, p->y, &(g2[j]));
+		if ( use_sphere )
+		{
+			sin2[j] = sin(g2[j].lat);
+			cos2[j] = cos(g2[j].lat);
 		}
+		else
+		{
+#if PROJ_GEODESIC
+			lat2[j] = g2[j].lat * 180.0 / M_PI;
+			lon2[j] = g2[j].lon * 180.0 / M_PI;
+#else
+			u = atan(omf * tan(g2[j].lat));
+			sin2[j] = sin(u);
+			cos2[j] = cos(u);
+#endif
+		}
+	}
 
+	for ( i = 0; i < n1; i++ )
+	{
+		double *row = matrix + (size_t)i * n2;
 
-		delta_lon = fabs(b1.lon - a1.lon);
-
-		LWDEBUGF(4, "a1(%.18g %.18g) b1(%.18g %.18g)", a1.lat, a1.lon, b1.lat, b1.lon);
-		LWDEBUGF(4, "delta_lon %.18g", delta_lon);
-		LWDEBUGF(4, "delta_lon_tolerance %.18g", delta_lon_tolerance);
+		p = getPoint2d_cp(pa1, i);
+		geographic_point_init(p->x, p->y, &g1);
 
-		if ( delta_lon > 0.0 )
+		if ( use_sphere )
 		{
-			if ( delta_lon < delta_lon_tolerance )
+			/* Same arithmetic as sphere_distance(g1, g2[j]) */
+			sin1 = sin(g1.lat);
+			cos1 = cos(g1.lat);
+			for ( j = 0; j < n2; j++ )
 			{
-				strip_area = spheroid_striparea(&a1, &b1, latitude_min, spheroid);
-				LWDEBUGF(4, "strip_area %.12g", strip_area);
-				area += strip_area;
+				double d_lon = g2[j].lon - g1.lon;
+				double cos_d_lon = cos(d_lon);
+				double a1 = POW2(cos2[j] * sin(d_lon));
+				double a2 = POW2(cos1 * sin2[j] - sin1 * cos2[j] * cos_d_lon);
+				double b = sin1 * sin2[j] + cos1 * cos2[j] * cos_d_lon;
+				row[j] = spheroid->radius * atan2(sqrt(a1 + a2), b);
 			}
-			else
+		}
+		else
+		{
+#if PROJ_GEODESIC
+			lat1 = g1.lat * 180.0 / M_PI;
+			lon1 = g1.lon * 180.0 / M_PI;
+			for ( j = 0; j < n2; j++ )
 			{
-				GEOGRAPHIC_POINT p, q;
-				double step = floor(delta_lon / delta_lon_tolerance);
-				double distance = spheroid_distance(&a1, &b1, spheroid);
-				double pDistance = 0.0;
-				int j = 0;
-				LWDEBUGF(4, "step %.18g", step);
-				LWDEBUGF(4, "distance %.18g", distance);
-				step = distance / step;
-				LWDEBUGF(4, "step %.18g", step);
-				p = a1;
-				while (pDistance < (distance - step * 1.01))
-				{
-					double azimuth = spheroid_direction(&p, &b1, spheroid);
-					j++;
-					LWDEBUGF(4, "  iteration %d", j);
-					LWDEBUGF(4, "  azimuth %.12g", azimuth);
-					pDistance = pDistance + step;
-					LWDEBUGF(4, "  pDistance %.12g", pDistance);
-					spheroid_project(&p, spheroid, step, azimuth, &q);
-					strip_area = spheroid_striparea(&p, &q, latitude_min, spheroid);
-					LWDEBUGF(4, "  strip_area %.12g", strip_area);
-					area += strip_area;
-					LWDEBUGF(4, "  area %.12g", area);
-					p.lat = q.lat;
-					p.lon = q.lon;
-				}
-				strip_area = spheroid_striparea(&p, &b1, latitude_min, spheroid);
-				area += strip_area;
+				geod_inverse(&gd, lat1, lon1, lat2[j], lon2[j], &s12, 0, 0);
+				row[j] = s12;
 			}
+#else
+			u = atan(omf * tan(g1.lat));
+			sin1 = sin(u);
+			cos1 = cos(u);
+			for ( j = 0; j < n2; j++ )
+			{
+				if ( geographic_point_equals(&g1, &(g2[j])) )
+					row[j] = 0.0;
+				else
+					row[j] = spheroid_distance_reduced(&g1, &(g2[j]), sin1, cos1, sin2[j], cos2[j], spheroid);
+			}
+#endif
 		}
 
-		/* B gets incremented in the next loop, so we save the value here */
-		a = b;
+		LW_ON_INTERRUPT({
+			lwfree(g2);
+			lwfree(sin2);
+			return LW_FAILURE;
+		});
 	}
-	return fabs(area);
+
+	lwfree(g2);
+	lwfree(sin2);
+	return LW_SUCCESS;
 }
-#endif /* else ! PROJ_GEODESIC */
 
 /**
 * Calculate the area of an LWGEOM. Anything except POLYGON, MULTIPOLYGON
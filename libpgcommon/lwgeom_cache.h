@@ -26,6 +26,7 @@
 #define RTREE_CACHE_ENTRY 2
 #define CIRC_CACHE_ENTRY 3
 #define RECT_CACHE_ENTRY 4
+#define CELL_CACHE_ENTRY 5
 
 #define NUM_CACHE_ENTRIES 16
 
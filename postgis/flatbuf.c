@@ -0,0 +1,147 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+#include "flatbuf.h"
+
+void flatbuf_pad_to(StringInfo b, uint32_t pos)
+{
+	if (b->len >= pos)
+		return;
+	enlargeStringInfo(b, pos - b->len);
+	memset(b->data + b->len, 0, pos - b->len);
+	b->len = pos;
+	b->data[b->len] = '\0';
+}
+
+/** Append size bytes of value, little endian */
+void flatbuf_put(StringInfo b, uint64_t value, int size)
+{
+	int i;
+	enlargeStringInfo(b, size);
+	for (i = 0; i < size; i++)
+		b->data[b->len++] = (char) ((value >> (8 * i)) & 0xFF);
+	b->data[b->len] = '\0';
+}
+
+void flatbuf_put_double(StringInfo b, double d)
+{
+	uint64_t value;
+	memcpy(&value, &d, sizeof(value));
+	flatbuf_put(b, value, 8);
+}
+
+/** Point the uoffset at pos to target */
+void flatbuf_patch(StringInfo b, uint32_t pos, uint32_t target)
+{
+	uint32_t value = target - pos;
+	int i;
+	for (i = 0; i < 4; i++)
+		b->data[pos + i] = (char) ((value >> (8 * i)) & 0xFF);
+}
+
+struct flatbuf_field *flatbuf_field_add(struct flatbuf_field *fields, int *n,
+	uint16_t id, uint8_t size, uint64_t value)
+{
+	struct flatbuf_field *field = &fields[(*n)++];
+	field->id = id;
+	field->size = size;
+	field->value = value;
+	field->pos = 0;
+	return field;
+}
+
+/**
+ * Write a vtable and its table, largest fields first. Sets the
+ * position of each field and returns the position of the table.
+ */
+uint32_t flatbuf_table(StringInfo b, struct flatbuf_field *fields, int n)
+{
+	uint32_t vt_pos, vt_size, table_pos, cur;
+	uint16_t nslots = 0, off;
+	bool has8 = false;
+	int i, j, size;
+
+	for (i = 0; i < n; i++) {
+		nslots = Max(nslots, fields[i].id + 1);
+		if (fields[i].size == 8)
+			has8 = true;
+	}
+
+	vt_size = 4 + 2 * nslots;
+	vt_pos = flatbuf_align(b->len, 2);
+	table_pos = flatbuf_align(vt_pos + vt_size, 4);
+	if (has8 && (table_pos + 4) % 8)
+		table_pos += 4;
+
+	cur = table_pos + 4;
+	for (size = 8; size >= 1; size /= 2)
+		for (i = 0; i < n; i++)
+			if (fields[i].size == size) {
+				cur = flatbuf_align(cur, size);
+				fields[i].pos = cur;
+				cur += size;
+			}
+
+	flatbuf_pad_to(b, vt_pos);
+	flatbuf_put(b, vt_size, 2);
+	flatbuf_put(b, cur - table_pos, 2);
+	for (j = 0; j < nslots; j++) {
+		off = 0;
+		for (i = 0; i < n; i++)
+			if (fields[i].id == j)
+				off = fields[i].pos - table_pos;
+		flatbuf_put(b, off, 2);
+	}
+
+	flatbuf_pad_to(b, table_pos);
+	flatbuf_put(b, table_pos - vt_pos, 4);
+	for (size = 8; size >= 1; size /= 2)
+		for (i = 0; i < n; i++)
+			if (fields[i].size == size) {
+				flatbuf_pad_to(b, fields[i].pos);
+				flatbuf_put(b, fields[i].value, size);
+			}
+	flatbuf_pad_to(b, cur);
+
+	return table_pos;
+}
+
+/**
+ * Start a vector of count elements of size bytes, the elements are
+ * to be appended next. Returns the position of the vector.
+ */
+uint32_t flatbuf_vector(StringInfo b, uint32_t count, int size)
+{
+	uint32_t pos = flatbuf_align(b->len, 4);
+	if (size == 8 && (pos + 4) % 8)
+		pos += 4;
+	flatbuf_pad_to(b, pos);
+	flatbuf_put(b, count, 4);
+	return pos;
+}
+
+uint32_t flatbuf_string(StringInfo b, const char *s)
+{
+	size_t len = strlen(s);
+	uint32_t pos = flatbuf_vector(b, len, 1);
+	appendBinaryStringInfo(b, s, len);
+	flatbuf_put(b, 0, 1);
+	return pos;
+}
@@ -0,0 +1,65 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+/**
+ * @file flatbuf.h
+ *
+ * Minimal flatbuffers builder shared by the FlatGeobuf and Arrow IPC
+ * writers. Buffers are written front to back: tables come first,
+ * followed by the strings, vectors and subtables they point forward to,
+ * whose offsets are patched in with flatbuf_patch once written.
+ */
+
+#ifndef FLATBUF_H_
+#define FLATBUF_H_ 1
+
+#include "postgres.h"
+#include "lib/stringinfo.h"
+
+/** Maximum number of fields in a single table */
+#define FLATBUF_MAX_FIELDS 8
+
+/**
+ * A table field, either a scalar value or an offset to an object
+ * written after the table and patched in with flatbuf_patch.
+ */
+struct flatbuf_field {
+	uint16_t id;
+	uint8_t size;
+	uint64_t value;
+	uint32_t pos;
+};
+
+static inline uint32_t flatbuf_align(uint32_t pos, uint32_t align)
+{
+	return (pos + align - 1) & ~(align - 1);
+}
+
+void flatbuf_pad_to(StringInfo b, uint32_t pos);
+void flatbuf_put(StringInfo b, uint64_t value, int size);
+void flatbuf_put_double(StringInfo b, double d);
+void flatbuf_patch(StringInfo b, uint32_t pos, uint32_t target);
+struct flatbuf_field *flatbuf_field_add(struct flatbuf_field *fields, int *n,
+	uint16_t id, uint8_t size, uint64_t value);
+uint32_t flatbuf_table(StringInfo b, struct flatbuf_field *fields, int n);
+uint32_t flatbuf_vector(StringInfo b, uint32_t count, int size);
+uint32_t flatbuf_string(StringInfo b, const char *s);
+
+#endif
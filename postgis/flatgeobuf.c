@@ -0,0 +1,682 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+#include <math.h>
+#include "flatgeobuf.h"
+#include "flatbuf.h"
+#include "utils/memutils.h"
+
+/**
+ * @file
+ * FlatGeobuf encoder (https://github.com/flatgeobuf/flatgeobuf)
+ *
+ * A FlatGeobuf file is the magic bytes, a size prefixed Header
+ * flatbuffer, an optional packed Hilbert R-tree and the size prefixed
+ * Feature flatbuffers.
+ */
+
+#define FEATURES_CAPACITY_INITIAL 50
+
+/* Geometry types, numbered as the liblwgeom ones */
+#define FGB_GEOMETRY_UNKNOWN 0
+
+/* Column types */
+#define FGB_COLUMN_BOOL 2
+#define FGB_COLUMN_SHORT 3
+#define FGB_COLUMN_INT 5
+#define FGB_COLUMN_LONG 7
+#define FGB_COLUMN_FLOAT 9
+#define FGB_COLUMN_DOUBLE 10
+#define FGB_COLUMN_STRING 11
+#define FGB_COLUMN_JSON 12
+#define FGB_COLUMN_DATETIME 13
+#define FGB_COLUMN_BINARY 14
+
+/* Header fields */
+#define FGB_HEADER_ENVELOPE 1
+#define FGB_HEADER_GEOMETRY_TYPE 2
+#define FGB_HEADER_HAS_Z 3
+#define FGB_HEADER_HAS_M 4
+#define FGB_HEADER_COLUMNS 7
+#define FGB_HEADER_FEATURES_COUNT 8
+#define FGB_HEADER_INDEX_NODE_SIZE 9
+#define FGB_HEADER_CRS 10
+
+/* Column fields */
+#define FGB_COLUMN_NAME 0
+#define FGB_COLUMN_TYPE 1
+
+/* Crs fields */
+#define FGB_CRS_CODE 1
+
+/* Feature fields */
+#define FGB_FEATURE_GEOMETRY 0
+#define FGB_FEATURE_PROPERTIES 1
+
+/* Geometry fields */
+#define FGB_GEOMETRY_ENDS 0
+#define FGB_GEOMETRY_XY 1
+#define FGB_GEOMETRY_Z 2
+#define FGB_GEOMETRY_M 3
+#define FGB_GEOMETRY_TYPE 6
+#define FGB_GEOMETRY_PARTS 7
+
+#define FGB_NODE_BYTES 40
+
+static const uint8_t fgb_magic[] = { 'f', 'g', 'b', 3, 'f', 'g', 'b', 0 };
+
+static void get_pointarrays(const LWGEOM *lwgeom, const POINTARRAY ***pas,
+	uint32_t *npas)
+{
+	const LWCOLLECTION *lwcollection;
+	uint32_t i;
+
+	switch (lwgeom->type) {
+	case POINTTYPE:
+	case LINETYPE:
+		*pas = palloc(sizeof(**pas));
+		(*pas)[0] = ((LWLINE *) lwgeom)->points;
+		*npas = 1;
+		break;
+	case POLYGONTYPE:
+		*pas = (const POINTARRAY **) ((LWPOLY *) lwgeom)->rings;
+		*npas = ((LWPOLY *) lwgeom)->nrings;
+		break;
+	case MULTIPOINTTYPE:
+	case MULTILINETYPE:
+		lwcollection = (LWCOLLECTION *) lwgeom;
+		*pas = palloc(sizeof(**pas) * Max(lwcollection->ngeoms, 1));
+		for (i = 0; i < lwcollection->ngeoms; i++)
+			(*pas)[i] = ((LWLINE *) lwcollection->geoms[i])->points;
+		*npas = lwcollection->ngeoms;
+		break;
+	default:
+		*pas = NULL;
+		*npas = 0;
+	}
+}
+
+/**
+ * Write a Geometry table. Points, lines and rings are flattened into
+ * xy (z, m) arrays with ends marking where each line or ring stops;
+ * multipolygons and collections are written as parts.
+ */
+static uint32_t encode_geometry(struct flatgeobuf_agg_context *ctx,
+	StringInfo b, const LWGEOM *lwgeom)
+{
+	struct flatbuf_field fields[FLATBUF_MAX_FIELDS];
+	struct flatbuf_field *ends = NULL, *xy = NULL, *z = NULL, *m = NULL;
+	struct flatbuf_field *parts = NULL;
+	const POINTARRAY **pas;
+	const LWCOLLECTION *lwcollection = NULL;
+	uint32_t npas, npoints = 0, table_pos, pos, i, j, end;
+	POINT4D pt;
+	int n = 0;
+
+	switch (lwgeom->type) {
+	case POINTTYPE:
+	case LINETYPE:
+	case POLYGONTYPE:
+	case MULTIPOINTTYPE:
+	case MULTILINETYPE:
+		break;
+	case MULTIPOLYGONTYPE:
+	case COLLECTIONTYPE:
+		lwcollection = (LWCOLLECTION *) lwgeom;
+		break;
+	default:
+		lwerror("encode_geometry: '%s' geometry type not supported",
+			lwtype_name(lwgeom->type));
+	}
+
+	get_pointarrays(lwgeom, &pas, &npas);
+	for (i = 0; i < npas; i++)
+		npoints += pas[i]->npoints;
+
+	flatbuf_field_add(fields, &n, FGB_GEOMETRY_TYPE, 1, lwgeom->type);
+	if (npoints > 0) {
+		xy = flatbuf_field_add(fields, &n, FGB_GEOMETRY_XY, 4, 0);
+		if (ctx->has_z)
+			z = flatbuf_field_add(fields, &n, FGB_GEOMETRY_Z, 4, 0);
+		if (ctx->has_m)
+			m = flatbuf_field_add(fields, &n, FGB_GEOMETRY_M, 4, 0);
+		if (npas > 1 && lwgeom->type != MULTIPOINTTYPE)
+			ends = flatbuf_field_add(fields, &n, FGB_GEOMETRY_ENDS, 4, 0);
+	}
+	if (lwcollection && lwcollection->ngeoms > 0)
+		parts = flatbuf_field_add(fields, &n, FGB_GEOMETRY_PARTS, 4, 0);
+
+	table_pos = flatbuf_table(b, fields, n);
+
+	if (ends) {
+		pos = flatbuf_vector(b, npas, 4);
+		flatbuf_patch(b, ends->pos, pos);
+		for (i = 0, end = 0; i < npas; i++) {
+			end += pas[i]->npoints;
+			flatbuf_put(b, end, 4);
+		}
+	}
+	if (xy) {
+		pos = flatbuf_vector(b, npoints * 2, 8);
+		flatbuf_patch(b, xy->pos, pos);
+		for (i = 0; i < npas; i++)
+			for (j = 0; j < pas[i]->npoints; j++) {
+				getPoint4d_p(pas[i], j, &pt);
+				flatbuf_put_double(b, pt.x);
+				flatbuf_put_double(b, pt.y);
+			}
+	}
+	if (z) {
+		pos = flatbuf_vector(b, npoints, 8);
+		flatbuf_patch(b, z->pos, pos);
+		for (i = 0; i < npas; i++)
+			for (j = 0; j < pas[i]->npoints; j++) {
+				getPoint4d_p(pas[i], j, &pt);
+				flatbuf_put_double(b, pt.z);
+			}
+	}
+	if (m) {
+		pos = flatbuf_vector(b, npoints, 8);
+		flatbuf_patch(b, m->pos, pos);
+		for (i = 0; i < npas; i++)
+			for (j = 0; j < pas[i]->npoints; j++) {
+				getPoint4d_p(pas[i], j, &pt);
+				flatbuf_put_double(b, pt.m);
+			}
+	}
+	if (parts) {
+		pos = flatbuf_vector(b, lwcollection->ngeoms, 4);
+		flatbuf_patch(b, parts->pos, pos);
+		for (i = 0; i < lwcollection->ngeoms; i++)
+			flatbuf_put(b, 0, 4);
+		for (i = 0; i < lwcollection->ngeoms; i++)
+			flatbuf_patch(b, pos + 4 + 4 * i,
+				encode_geometry(ctx, b, lwcollection->geoms[i]));
+	}
+
+	return table_pos;
+}
+
+static uint8_t column_type(Oid typoid)
+{
+	switch (typoid) {
+	case BOOLOID:
+		return FGB_COLUMN_BOOL;
+	case INT2OID:
+		return FGB_COLUMN_SHORT;
+	case INT4OID:
+		return FGB_COLUMN_INT;
+	case INT8OID:
+		return FGB_COLUMN_LONG;
+	case FLOAT4OID:
+		return FGB_COLUMN_FLOAT;
+	case FLOAT8OID:
+		return FGB_COLUMN_DOUBLE;
+	case JSONOID:
+#if POSTGIS_PGSQL_VERSION >= 94
+	case JSONBOID:
+#endif
+		return FGB_COLUMN_JSON;
+	case DATEOID:
+	case TIMESTAMPOID:
+	case TIMESTAMPTZOID:
+		return FGB_COLUMN_DATETIME;
+	case BYTEAOID:
+		return FGB_COLUMN_BINARY;
+	default:
+		return FGB_COLUMN_STRING;
+	}
+}
+
+/**
+ * Map the row type to header columns, assuming static schema.
+ */
+static void encode_columns(struct flatgeobuf_agg_context *ctx)
+{
+	Oid tupType = HeapTupleHeaderGetTypeId(ctx->row);
+	int32 tupTypmod = HeapTupleHeaderGetTypMod(ctx->row);
+	TupleDesc tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
+	int natts = tupdesc->natts;
+	struct flatgeobuf_column *columns;
+	bool geom_name_found = false;
+	bool typisvarlena;
+	uint32_t i, k = 0;
+
+	columns = palloc(sizeof(*columns) * Max(natts, 1));
+	for (i = 0; i < natts; i++) {
+		char *key = tupdesc->attrs[i]->attname.data;
+		Oid typoid;
+		if (tupdesc->attrs[i]->attisdropped)
+			continue;
+		if (strcmp(key, ctx->geom_name) == 0) {
+			ctx->geom_index = i;
+			geom_name_found = true;
+			continue;
+		}
+		typoid = getBaseType(tupdesc->attrs[i]->atttypid);
+		columns[k].name = pstrdup(key);
+		columns[k].attnum = i + 1;
+		columns[k].type = column_type(typoid);
+		getTypeOutputInfo(typoid, &columns[k].foutoid, &typisvarlena);
+		k++;
+	}
+	ReleaseTupleDesc(tupdesc);
+
+	if (!geom_name_found)
+		lwerror("flatgeobuf_agg_transfn: no column '%s' found",
+			ctx->geom_name);
+
+	ctx->columns = columns;
+	ctx->n_columns = k;
+}
+
+/**
+ * Write the non null values of the row as a column index followed
+ * by the value, little endian; strings and binaries are length prefixed.
+ */
+static void encode_properties(struct flatgeobuf_agg_context *ctx,
+	StringInfo props)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctx->n_columns; i++) {
+		struct flatgeobuf_column *column = &ctx->columns[i];
+		bool isnull;
+		Datum datum;
+		float4 f;
+		uint32_t u;
+		bytea *ba;
+		char *s;
+
+		datum = GetAttributeByNum(ctx->row, column->attnum, &isnull);
+		if (isnull)
+			continue;
+
+		flatbuf_put(props, i, 2);
+		switch (column->type) {
+		case FGB_COLUMN_BOOL:
+			flatbuf_put(props, DatumGetBool(datum) ? 1 : 0, 1);
+			break;
+		case FGB_COLUMN_SHORT:
+			flatbuf_put(props, (uint16_t) DatumGetInt16(datum), 2);
+			break;
+		case FGB_COLUMN_INT:
+			flatbuf_put(props, (uint32_t) DatumGetInt32(datum), 4);
+			break;
+		case FGB_COLUMN_LONG:
+			flatbuf_put(props, (uint64_t) DatumGetInt64(datum), 8);
+			break;
+		case FGB_COLUMN_FLOAT:
+			f = DatumGetFloat4(datum);
+			memcpy(&u, &f, sizeof(u));
+			flatbuf_put(props, u, 4);
+			break;
+		case FGB_COLUMN_DOUBLE:
+			flatbuf_put_double(props, DatumGetFloat8(datum));
+			break;
+		case FGB_COLUMN_BINARY:
+			ba = DatumGetByteaPP(datum);
+			flatbuf_put(props, VARSIZE_ANY_EXHDR(ba), 4);
+			appendBinaryStringInfo(props, VARDATA_ANY(ba),
+				VARSIZE_ANY_EXHDR(ba));
+			break;
+		default:
+			s = OidOutputFunctionCall(column->foutoid, datum);
+			flatbuf_put(props, strlen(s), 4);
+			appendBinaryStringInfo(props, s, strlen(s));
+		}
+	}
+}
+
+/**
+ * Write a Feature flatbuffer for the geometry and row values.
+ */
+static void encode_feature(struct flatgeobuf_agg_context *ctx,
+	StringInfo b, const LWGEOM *lwgeom)
+{
+	struct flatbuf_field fields[FLATBUF_MAX_FIELDS];
+	struct flatbuf_field *geometry = NULL, *properties = NULL;
+	StringInfoData props;
+	uint32_t pos;
+	int n = 0;
+
+	initStringInfo(&props);
+	encode_properties(ctx, &props);
+
+	/* Empty geometries have no representation, leave them out */
+	flatbuf_put(b, 0, 4);
+	if (!lwgeom_is_empty(lwgeom))
+		geometry = flatbuf_field_add(fields, &n, FGB_FEATURE_GEOMETRY, 4, 0);
+	if (props.len > 0)
+		properties = flatbuf_field_add(fields, &n, FGB_FEATURE_PROPERTIES, 4, 0);
+	flatbuf_patch(b, 0, flatbuf_table(b, fields, n));
+
+	if (geometry)
+		flatbuf_patch(b, geometry->pos, encode_geometry(ctx, b, lwgeom));
+	if (properties) {
+		pos = flatbuf_vector(b, props.len, 1);
+		flatbuf_patch(b, properties->pos, pos);
+		appendBinaryStringInfo(b, props.data, props.len);
+	}
+}
+
+/**
+ * Write the Header flatbuffer.
+ */
+static void encode_header(struct flatgeobuf_agg_context *ctx, StringInfo b)
+{
+	struct flatbuf_field fields[FLATBUF_MAX_FIELDS], column_fields[FLATBUF_MAX_FIELDS];
+	struct flatbuf_field *envelope = NULL, *columns = NULL, *crs = NULL;
+	struct flatbuf_field *name;
+	uint32_t pos, i;
+	int n = 0, k;
+
+	flatbuf_put(b, 0, 4);
+	if (ctx->has_extent)
+		envelope = flatbuf_field_add(fields, &n, FGB_HEADER_ENVELOPE, 4, 0);
+	flatbuf_field_add(fields, &n, FGB_HEADER_GEOMETRY_TYPE, 1, ctx->geometry_type);
+	if (ctx->has_z)
+		flatbuf_field_add(fields, &n, FGB_HEADER_HAS_Z, 1, 1);
+	if (ctx->has_m)
+		flatbuf_field_add(fields, &n, FGB_HEADER_HAS_M, 1, 1);
+	if (ctx->n_columns > 0)
+		columns = flatbuf_field_add(fields, &n, FGB_HEADER_COLUMNS, 4, 0);
+	flatbuf_field_add(fields, &n, FGB_HEADER_FEATURES_COUNT, 8, ctx->n_features);
+	flatbuf_field_add(fields, &n, FGB_HEADER_INDEX_NODE_SIZE, 2,
+		ctx->create_index ? FLATGEOBUF_NODE_SIZE : 0);
+	if (ctx->srid > 0)
+		crs = flatbuf_field_add(fields, &n, FGB_HEADER_CRS, 4, 0);
+	flatbuf_patch(b, 0, flatbuf_table(b, fields, n));
+
+	if (envelope) {
+		pos = flatbuf_vector(b, 4, 8);
+		flatbuf_patch(b, envelope->pos, pos);
+		flatbuf_put_double(b, ctx->extent.xmin);
+		flatbuf_put_double(b, ctx->extent.ymin);
+		flatbuf_put_double(b, ctx->extent.xmax);
+		flatbuf_put_double(b, ctx->extent.ymax);
+	}
+
+	if (columns) {
+		pos = flatbuf_vector(b, ctx->n_columns, 4);
+		flatbuf_patch(b, columns->pos, pos);
+		for (i = 0; i < ctx->n_columns; i++)
+			flatbuf_put(b, 0, 4);
+		for (i = 0; i < ctx->n_columns; i++) {
+			k = 0;
+			name = flatbuf_field_add(column_fields, &k, FGB_COLUMN_NAME, 4, 0);
+			flatbuf_field_add(column_fields, &k, FGB_COLUMN_TYPE, 1,
+				ctx->columns[i].type);
+			flatbuf_patch(b, pos + 4 + 4 * i, flatbuf_table(b, column_fields, k));
+			flatbuf_patch(b, name->pos, flatbuf_string(b, ctx->columns[i].name));
+		}
+	}
+
+	if (crs) {
+		k = 0;
+		flatbuf_field_add(column_fields, &k, FGB_CRS_CODE, 4, (uint32_t) ctx->srid);
+		flatbuf_patch(b, crs->pos, flatbuf_table(b, column_fields, k));
+	}
+}
+
+static int item_cmp(const void *a, const void *b)
+{
+	const struct flatgeobuf_item *ia = a, *ib = b;
+	if (ia->key != ib->key)
+		return ia->key < ib->key ? -1 : 1;
+	if (ia->offset != ib->offset)
+		return ia->offset < ib->offset ? -1 : 1;
+	return 0;
+}
+
+/**
+ * Sort the features along the Hilbert curve over the extent and
+ * write the packed R-tree above them. Nodes are laid out root first,
+ * level by level, with the leaves last; a leaf points to its feature
+ * by byte offset into the features section, an inner node to its
+ * first child by node index.
+ */
+static void encode_index(struct flatgeobuf_agg_context *ctx, StringInfo b)
+{
+	struct flatgeobuf_item *nodes, *node;
+	size_t level_offsets[64], level_counts[64];
+	size_t num_nodes, count, pos, end, newpos, offset, i;
+	int levels = 0, level, j;
+	GBOX box;
+
+	gbox_init(&box);
+	for (i = 0; i < ctx->n_features; i++) {
+		/*
+		 * Empty geometries have no center and no part in the extent,
+		 * which is unset when all of them are empty: sort them last.
+		 */
+		if (ctx->items[i].xmin > ctx->items[i].xmax) {
+			ctx->items[i].key = UINT64_MAX;
+			continue;
+		}
+		box.xmin = ctx->items[i].xmin;
+		box.ymin = ctx->items[i].ymin;
+		box.xmax = ctx->items[i].xmax;
+		box.ymax = ctx->items[i].ymax;
+		ctx->items[i].key = gbox_hilbert_key(&box, &ctx->extent);
+	}
+	qsort(ctx->items, ctx->n_features, sizeof(*ctx->items), item_cmp);
+
+	count = num_nodes = ctx->n_features;
+	level_counts[levels++] = count;
+	do {
+		count = (count + FLATGEOBUF_NODE_SIZE - 1) / FLATGEOBUF_NODE_SIZE;
+		num_nodes += count;
+		level_counts[levels++] = count;
+	} while (count != 1);
+
+	pos = num_nodes;
+	for (level = 0; level < levels; level++)
+		level_offsets[level] = pos -= level_counts[level];
+
+	nodes = palloc(sizeof(*nodes) * num_nodes);
+	offset = 0;
+	for (i = 0; i < ctx->n_features; i++) {
+		node = &nodes[level_offsets[0] + i];
+		*node = ctx->items[i];
+		node->offset = offset;
+		offset += ctx->items[i].size;
+	}
+
+	for (level = 0; level < levels - 1; level++) {
+		pos = level_offsets[level];
+		end = pos + level_counts[level];
+		newpos = level_offsets[level + 1];
+		while (pos < end) {
+			node = &nodes[newpos++];
+			node->xmin = node->ymin = INFINITY;
+			node->xmax = node->ymax = -INFINITY;
+			node->offset = pos;
+			for (j = 0; j < FLATGEOBUF_NODE_SIZE && pos < end; j++, pos++) {
+				node->xmin = Min(node->xmin, nodes[pos].xmin);
+				node->ymin = Min(node->ymin, nodes[pos].ymin);
+				node->xmax = Max(node->xmax, nodes[pos].xmax);
+				node->ymax = Max(node->ymax, nodes[pos].ymax);
+			}
+		}
+	}
+
+	enlargeStringInfo(b, num_nodes * FGB_NODE_BYTES);
+	for (i = 0; i < num_nodes; i++) {
+		flatbuf_put_double(b, nodes[i].xmin);
+		flatbuf_put_double(b, nodes[i].ymin);
+		flatbuf_put_double(b, nodes[i].xmax);
+		flatbuf_put_double(b, nodes[i].ymax);
+		flatbuf_put(b, nodes[i].offset, 8);
+	}
+	pfree(nodes);
+}
+
+/**
+ * Initialize aggregation context.
+ */
+void flatgeobuf_agg_init_context(struct flatgeobuf_agg_context *ctx)
+{
+	ctx->columns = NULL;
+	ctx->n_columns = 0;
+	ctx->geometry_type = FGB_GEOMETRY_UNKNOWN;
+	ctx->has_z = false;
+	ctx->has_m = false;
+	ctx->srid = 0;
+	ctx->has_extent = false;
+	initStringInfo(&ctx->features);
+	ctx->n_features = 0;
+	ctx->items = NULL;
+	ctx->items_capacity = 0;
+	if (ctx->create_index) {
+		ctx->items_capacity = FEATURES_CAPACITY_INITIAL;
+		ctx->items = palloc(ctx->items_capacity * sizeof(*ctx->items));
+	}
+	ctx->row_context = AllocSetContextCreate(CurrentMemoryContext,
+		"ST_AsFlatGeobuf row context",
+		ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE,
+		ALLOCSET_DEFAULT_MAXSIZE);
+}
+
+/**
+ * Aggregation step.
+ *
+ * Encodes the row into a Feature flatbuffer and appends it size
+ * prefixed to the features buffer; only its bounds are kept besides.
+ */
+void flatgeobuf_agg_transfn(struct flatgeobuf_agg_context *ctx)
+{
+	MemoryContext oldcontext;
+	struct flatgeobuf_item *item;
+	StringInfoData b;
+	GSERIALIZED *gs;
+	LWGEOM *lwgeom;
+	bool isnull, empty;
+	Datum datum;
+	GBOX box;
+
+	/* inspect row and encode columns assuming static schema */
+	if (!ctx->columns)
+		encode_columns(ctx);
+
+	oldcontext = MemoryContextSwitchTo(ctx->row_context);
+
+	datum = GetAttributeByNum(ctx->row, ctx->geom_index + 1, &isnull);
+	if (isnull)
+		lwerror("flatgeobuf_agg_transfn: geometry column cannot be null");
+	gs = (GSERIALIZED *) PG_DETOAST_DATUM(datum);
+	lwgeom = lwgeom_from_gserialized(gs);
+
+	/* inspect geometry flags assuming static schema */
+	if (ctx->n_features == 0) {
+		ctx->geometry_type = lwgeom->type;
+		ctx->has_z = FLAGS_GET_Z(lwgeom->flags);
+		ctx->has_m = FLAGS_GET_M(lwgeom->flags);
+		ctx->srid = lwgeom->srid;
+	} else if (ctx->geometry_type != lwgeom->type) {
+		ctx->geometry_type = FGB_GEOMETRY_UNKNOWN;
+	}
+
+	empty = gserialized_get_gbox_p(gs, &box) != LW_SUCCESS;
+
+	initStringInfo(&b);
+	encode_feature(ctx, &b, lwgeom);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (ctx->create_index) {
+		if (ctx->n_features >= ctx->items_capacity) {
+			ctx->items_capacity *= 2;
+			ctx->items = repalloc(ctx->items,
+				ctx->items_capacity * sizeof(*ctx->items));
+		}
+		item = &ctx->items[ctx->n_features];
+		/* Empty geometries get bounds no search box intersects */
+		item->xmin = empty ? INFINITY : box.xmin;
+		item->ymin = empty ? INFINITY : box.ymin;
+		item->xmax = empty ? -INFINITY : box.xmax;
+		item->ymax = empty ? -INFINITY : box.ymax;
+		item->offset = ctx->features.len;
+		item->size = 4 + b.len;
+	}
+
+	if (!empty) {
+		if (ctx->has_extent) {
+			gbox_merge(&box, &ctx->extent);
+		} else {
+			ctx->extent = box;
+			ctx->has_extent = true;
+		}
+	}
+
+	flatbuf_put(&ctx->features, b.len, 4);
+	appendBinaryStringInfo(&ctx->features, b.data, b.len);
+	ctx->n_features++;
+
+	MemoryContextReset(ctx->row_context);
+}
+
+/**
+ * Finalize aggregation.
+ *
+ * Writes magic bytes, header, index and features into a bytea.
+ */
+uint8_t *flatgeobuf_agg_finalfn(struct flatgeobuf_agg_context *ctx)
+{
+	StringInfoData header, index;
+	size_t len, i;
+	uint8_t *buf, *p;
+
+	initStringInfo(&header);
+	encode_header(ctx, &header);
+
+	initStringInfo(&index);
+	if (ctx->create_index && ctx->n_features > 0)
+		encode_index(ctx, &index);
+
+	len = sizeof(fgb_magic) + 4 + header.len + index.len + ctx->features.len;
+	buf = palloc(sizeof(*buf) * (len + VARHDRSZ));
+	p = buf + VARHDRSZ;
+
+	memcpy(p, fgb_magic, sizeof(fgb_magic));
+	p += sizeof(fgb_magic);
+	for (i = 0; i < 4; i++)
+		*p++ = (header.len >> (8 * i)) & 0xFF;
+	memcpy(p, header.data, header.len);
+	p += header.len;
+	memcpy(p, index.data, index.len);
+	p += index.len;
+
+	/* Indexed features go in Hilbert order, as the leaves */
+	if (index.len > 0) {
+		for (i = 0; i < ctx->n_features; i++) {
+			memcpy(p, ctx->features.data + ctx->items[i].offset,
+				ctx->items[i].size);
+			p += ctx->items[i].size;
+		}
+	} else {
+		memcpy(p, ctx->features.data, ctx->features.len);
+	}
+
+	SET_VARSIZE(buf, VARHDRSZ + len);
+
+	return buf;
+}
@@ -0,0 +1,81 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+#ifndef FLATGEOBUF_H_
+#define FLATGEOBUF_H_ 1
+
+#include <stdlib.h>
+#include "postgres.h"
+#include "utils/builtins.h"
+#include "utils/typcache.h"
+#include "utils/lsyscache.h"
+#include "catalog/pg_type.h"
+#include "access/htup_details.h"
+#include "access/htup.h"
+#include "lib/stringinfo.h"
+#include "../postgis_config.h"
+#include "liblwgeom.h"
+#include "lwgeom_pg.h"
+#include "lwgeom_log.h"
+
+/** Fan out of the packed Hilbert R-tree */
+#define FLATGEOBUF_NODE_SIZE 16
+
+struct flatgeobuf_column {
+	char *name;
+	uint32_t attnum;
+	uint8_t type;
+	Oid foutoid;
+};
+
+/** Bounds and location of an encoded feature, used to build the index */
+struct flatgeobuf_item {
+	double xmin, ymin, xmax, ymax;
+	uint64_t key;
+	size_t offset;
+	size_t size;
+};
+
+struct flatgeobuf_agg_context {
+	char *geom_name;
+	uint32_t geom_index;
+	bool create_index;
+	HeapTupleHeader row;
+	struct flatgeobuf_column *columns;
+	uint32_t n_columns;
+	uint8_t geometry_type;
+	bool has_z;
+	bool has_m;
+	int32_t srid;
+	bool has_extent;
+	GBOX extent;
+	/* Size prefixed Feature buffers, in arrival order */
+	StringInfoData features;
+	uint64_t n_features;
+	struct flatgeobuf_item *items;
+	size_t items_capacity;
+	MemoryContext row_context;
+};
+
+void flatgeobuf_agg_init_context(struct flatgeobuf_agg_context *ctx);
+void flatgeobuf_agg_transfn(struct flatgeobuf_agg_context *ctx);
+uint8_t *flatgeobuf_agg_finalfn(struct flatgeobuf_agg_context *ctx);
+
+#endif
@@ -0,0 +1,938 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+#include <math.h>
+#include "geoarrow.h"
+#include "flatbuf.h"
+#include "utils/memutils.h"
+
+/**
+ * @file
+ * Arrow IPC stream encoder with GeoArrow native geometries
+ * (https://arrow.apache.org/docs/format/Columnar.html,
+ * https://geoarrow.org/format)
+ *
+ * The stream is a Schema message followed by RecordBatch messages of up
+ * to GEOARROW_BATCH_ROWS rows and the end of stream marker. Each message
+ * is a continuation marker, the size of its Message flatbuffer and the
+ * flatbuffer itself, padded to 8 bytes, followed by the message body.
+ *
+ * Geometries are written in the separated coordinate layout: a
+ * Struct<x: double, y: double[, z: double][, m: double]> of vertices,
+ * nested into as many List levels as the geometry type needs.
+ */
+
+/* Column types */
+#define GEOARROW_BOOL 1
+#define GEOARROW_INT16 2
+#define GEOARROW_INT32 3
+#define GEOARROW_INT64 4
+#define GEOARROW_FLOAT 5
+#define GEOARROW_DOUBLE 6
+#define GEOARROW_BINARY 7
+#define GEOARROW_UTF8 8
+#define GEOARROW_LIST 9
+#define GEOARROW_STRUCT 10
+#define GEOARROW_GEOMETRY 11
+
+/* Arrow Type union */
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_BINARY 4
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_BOOL 6
+#define ARROW_TYPE_LIST 12
+#define ARROW_TYPE_STRUCT 13
+
+#define ARROW_PRECISION_SINGLE 1
+#define ARROW_PRECISION_DOUBLE 2
+
+/* Arrow MessageHeader union */
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+
+#define ARROW_METADATA_V5 4
+
+/* Message fields */
+#define ARROW_MESSAGE_VERSION 0
+#define ARROW_MESSAGE_HEADER_TYPE 1
+#define ARROW_MESSAGE_HEADER 2
+#define ARROW_MESSAGE_BODY_LENGTH 3
+
+/* Schema fields */
+#define ARROW_SCHEMA_FIELDS 1
+
+/* Field fields */
+#define ARROW_FIELD_NAME 0
+#define ARROW_FIELD_NULLABLE 1
+#define ARROW_FIELD_TYPE_TYPE 2
+#define ARROW_FIELD_TYPE 3
+#define ARROW_FIELD_CHILDREN 5
+#define ARROW_FIELD_CUSTOM_METADATA 6
+
+/* KeyValue fields */
+#define ARROW_KEY_VALUE_KEY 0
+#define ARROW_KEY_VALUE_VALUE 1
+
+/* Int fields */
+#define ARROW_INT_BIT_WIDTH 0
+#define ARROW_INT_IS_SIGNED 1
+
+/* FloatingPoint fields */
+#define ARROW_FLOATING_POINT_PRECISION 0
+
+/* RecordBatch fields */
+#define ARROW_RECORD_BATCH_LENGTH 0
+#define ARROW_RECORD_BATCH_NODES 1
+#define ARROW_RECORD_BATCH_BUFFERS 2
+
+#define ARROW_CONTINUATION 0xFFFFFFFF
+
+/** List levels of each native layout, by liblwgeom type number */
+static const int geoarrow_depth[] = { 0, 0, 1, 2, 1, 2, 3 };
+
+static const char *geoarrow_extension_name[] = {
+	NULL,
+	"geoarrow.point",
+	"geoarrow.linestring",
+	"geoarrow.polygon",
+	"geoarrow.multipoint",
+	"geoarrow.multilinestring",
+	"geoarrow.multipolygon"
+};
+
+static const char *geoarrow_child_name[][GEOARROW_MAX_DEPTH] = {
+	{ NULL },
+	{ NULL },
+	{ "vertices" },
+	{ "rings", "vertices" },
+	{ "points" },
+	{ "linestrings", "vertices" },
+	{ "polygons", "rings", "vertices" }
+};
+
+static const char *geoarrow_dim_name[] = { "x", "y", "z", "m" };
+
+/** Schema field, with its children for nested types */
+struct geoarrow_field {
+	const char *name;
+	bool nullable;
+	uint8_t type;
+	const char *extension_name;
+	char *extension_metadata;
+	int n_children;
+	struct geoarrow_field *children;
+};
+
+/** Append a bit to a validity or boolean bitmap of i bits */
+static void append_bit(StringInfo b, uint32_t i, bool bit)
+{
+	if (i % 8 == 0)
+		flatbuf_put(b, 0, 1);
+	if (bit)
+		b->data[b->len - 1] |= 1 << (i % 8);
+}
+
+static uint8_t column_type(Oid typoid)
+{
+	switch (typoid) {
+	case BOOLOID:
+		return GEOARROW_BOOL;
+	case INT2OID:
+		return GEOARROW_INT16;
+	case INT4OID:
+		return GEOARROW_INT32;
+	case INT8OID:
+		return GEOARROW_INT64;
+	case FLOAT4OID:
+		return GEOARROW_FLOAT;
+	case FLOAT8OID:
+		return GEOARROW_DOUBLE;
+	case BYTEAOID:
+		return GEOARROW_BINARY;
+	default:
+		return GEOARROW_UTF8;
+	}
+}
+
+/**
+ * Map the row type to columns, assuming static schema.
+ */
+static void encode_columns(struct geoarrow_agg_context *ctx)
+{
+	Oid tupType = HeapTupleHeaderGetTypeId(ctx->row);
+	int32 tupTypmod = HeapTupleHeaderGetTypMod(ctx->row);
+	TupleDesc tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
+	int natts = tupdesc->natts;
+	struct geoarrow_column *columns;
+	bool geom_name_found = false;
+	bool typisvarlena;
+	uint32_t i, k = 0;
+
+	columns = palloc(sizeof(*columns) * Max(natts, 1));
+	for (i = 0; i < natts; i++) {
+		char *key = tupdesc->attrs[i]->attname.data;
+		Oid typoid;
+		if (tupdesc->attrs[i]->attisdropped)
+			continue;
+		columns[k].name = pstrdup(key);
+		columns[k].attnum = i + 1;
+		columns[k].null_count = 0;
+		initStringInfo(&columns[k].validity);
+		initStringInfo(&columns[k].offsets);
+		initStringInfo(&columns[k].values);
+		if (strcmp(key, ctx->geom_name) == 0) {
+			ctx->geom_index = k;
+			columns[k].type = GEOARROW_GEOMETRY;
+			geom_name_found = true;
+		} else {
+			typoid = getBaseType(tupdesc->attrs[i]->atttypid);
+			columns[k].type = column_type(typoid);
+			getTypeOutputInfo(typoid, &columns[k].foutoid, &typisvarlena);
+		}
+		k++;
+	}
+	ReleaseTupleDesc(tupdesc);
+
+	if (!geom_name_found)
+		lwerror("geoarrow_agg_transfn: no column '%s' found",
+			ctx->geom_name);
+
+	ctx->columns = columns;
+	ctx->n_columns = k;
+}
+
+/**
+ * Close a list at the given level: its end is the current length of
+ * the level below, or the number of vertices for the deepest one.
+ */
+static void push_offset(struct geoarrow_agg_context *ctx, int level)
+{
+	uint32_t end = level == ctx->depth - 1 ?
+		ctx->n_coords : ctx->geom_lengths[level + 1];
+	flatbuf_put(&ctx->geom_offsets[level], end, 4);
+	ctx->geom_lengths[level]++;
+}
+
+static void append_point(struct geoarrow_agg_context *ctx, const POINT4D *pt)
+{
+	flatbuf_put_double(&ctx->coords[0], pt->x);
+	flatbuf_put_double(&ctx->coords[1], pt->y);
+	if (ctx->has_z)
+		flatbuf_put_double(&ctx->coords[2], pt->z);
+	if (ctx->has_m)
+		flatbuf_put_double(&ctx->coords[3], pt->m);
+	ctx->n_coords++;
+}
+
+static void append_pointarray(struct geoarrow_agg_context *ctx,
+	const POINTARRAY *pa)
+{
+	POINT4D pt;
+	uint32_t i;
+
+	for (i = 0; i < pa->npoints; i++) {
+		getPoint4d_p(pa, i, &pt);
+		append_point(ctx, &pt);
+	}
+}
+
+/** Empty points have no vertex, they are written as NaN */
+static void append_empty_point(struct geoarrow_agg_context *ctx)
+{
+	POINT4D pt;
+	pt.x = pt.y = pt.z = pt.m = NAN;
+	append_point(ctx, &pt);
+}
+
+/**
+ * Append the vertices of lwgeom, closing the lists it makes up from
+ * the given level down.
+ */
+static void append_geometry(struct geoarrow_agg_context *ctx,
+	const LWGEOM *lwgeom, int level)
+{
+	const LWCOLLECTION *lwcollection;
+	const LWPOLY *lwpoly;
+	uint32_t i;
+
+	switch (lwgeom->type) {
+	case POINTTYPE:
+		if (lwgeom_is_empty(lwgeom))
+			append_empty_point(ctx);
+		else
+			append_pointarray(ctx, ((LWPOINT *) lwgeom)->point);
+		break;
+	case LINETYPE:
+		append_pointarray(ctx, ((LWLINE *) lwgeom)->points);
+		push_offset(ctx, level);
+		break;
+	case POLYGONTYPE:
+		lwpoly = (LWPOLY *) lwgeom;
+		for (i = 0; i < lwpoly->nrings; i++) {
+			append_pointarray(ctx, lwpoly->rings[i]);
+			push_offset(ctx, level + 1);
+		}
+		push_offset(ctx, level);
+		break;
+	default:
+		lwcollection = (LWCOLLECTION *) lwgeom;
+		for (i = 0; i < lwcollection->ngeoms; i++)
+			append_geometry(ctx, lwcollection->geoms[i], level + 1);
+		push_offset(ctx, level);
+	}
+}
+
+static void append_null_geometry(struct geoarrow_agg_context *ctx)
+{
+	if (ctx->depth == 0)
+		append_empty_point(ctx);
+	else
+		push_offset(ctx, 0);
+}
+
+/**
+ * Fix the native layout, writing the null geometries seen so far.
+ */
+static void set_layout(struct geoarrow_agg_context *ctx, uint8_t type)
+{
+	ctx->geometry_type = type;
+	ctx->depth = geoarrow_depth[type];
+	for (; ctx->pending_nulls > 0; ctx->pending_nulls--)
+		append_null_geometry(ctx);
+}
+
+/** Little endian value of size bytes at pos, as written by flatbuf_put */
+static uint64_t get_value(StringInfo b, uint32_t pos, int size)
+{
+	uint64_t value = 0;
+	int i;
+	for (i = 0; i < size; i++)
+		value |= (uint64_t) (uint8_t) b->data[pos + i] << (8 * i);
+	return value;
+}
+
+static void set_offset(StringInfo b, uint32_t pos, uint32_t value)
+{
+	int i;
+	for (i = 0; i < 4; i++)
+		b->data[pos + i] = (char) ((value >> (8 * i)) & 0xFF);
+}
+
+/**
+ * Move the rows buffered so far from a single layout to its multi
+ * layout, under a new outer list level. Null and empty geometries
+ * become empty lists, other ones one member lists.
+ */
+static void promote_layout(struct geoarrow_agg_context *ctx)
+{
+	StringInfoData outer;
+	StringInfo inner;
+	uint32_t i, k = 0, n, end;
+	int level, j;
+	uint64_t value;
+	double x;
+
+	/* The level the multi layout adds is unused so far */
+	outer = ctx->geom_offsets[ctx->depth];
+	resetStringInfo(&outer);
+	flatbuf_put(&outer, 0, 4);
+
+	if (ctx->depth == 0) {
+		/* Empty points are NaN vertices, drop them */
+		n = ctx->n_coords;
+		for (i = 0; i < n; i++) {
+			value = get_value(&ctx->coords[0], 8 * i, 8);
+			memcpy(&x, &value, sizeof(x));
+			if (!isnan(x)) {
+				for (j = 0; j < 4; j++)
+					if (ctx->coords[j].len > 0)
+						memmove(ctx->coords[j].data + 8 * k,
+							ctx->coords[j].data + 8 * i, 8);
+				k++;
+			}
+			flatbuf_put(&outer, k, 4);
+		}
+		for (j = 0; j < 4; j++)
+			if (ctx->coords[j].len > 0)
+				ctx->coords[j].len = 8 * k;
+		ctx->n_coords = k;
+	} else {
+		/* Drop the empty lists, the kept ones move down in place */
+		inner = &ctx->geom_offsets[0];
+		n = ctx->geom_lengths[0];
+		for (i = 0; i < n; i++) {
+			end = get_value(inner, 4 * (i + 1), 4);
+			if (end != get_value(inner, 4 * k, 4))
+				set_offset(inner, 4 * ++k, end);
+			flatbuf_put(&outer, k, 4);
+		}
+		inner->len = 4 * (k + 1);
+		ctx->geom_lengths[0] = k;
+	}
+
+	for (level = ctx->depth; level > 0; level--) {
+		ctx->geom_offsets[level] = ctx->geom_offsets[level - 1];
+		ctx->geom_lengths[level] = ctx->geom_lengths[level - 1];
+	}
+	ctx->geom_offsets[0] = outer;
+	ctx->geom_lengths[0] = n;
+	ctx->geometry_type = lwtype_get_collectiontype(ctx->geometry_type);
+	ctx->depth++;
+}
+
+static void encode_geometry(struct geoarrow_agg_context *ctx,
+	const LWGEOM *lwgeom)
+{
+	uint8_t type = lwgeom->type;
+
+	if (type < POINTTYPE || type > MULTIPOLYGONTYPE)
+		lwerror("geoarrow_agg_transfn: '%s' geometry type not supported",
+			lwtype_name(type));
+
+	if (!ctx->geometry_type) {
+		ctx->has_z = FLAGS_GET_Z(lwgeom->flags);
+		ctx->has_m = FLAGS_GET_M(lwgeom->flags);
+		ctx->srid = lwgeom->srid;
+		set_layout(ctx, type);
+	} else if (!ctx->schema_written &&
+		type == lwtype_get_collectiontype(ctx->geometry_type)) {
+		/* Still free to change, singles go into the multi layout */
+		promote_layout(ctx);
+	}
+
+	if (FLAGS_GET_Z(lwgeom->flags) != ctx->has_z ||
+		FLAGS_GET_M(lwgeom->flags) != ctx->has_m)
+		lwerror("geoarrow_agg_transfn: geometries must have the same dimensions");
+
+	/* Single geometries go into the multi layout as one member lists */
+	if (type == ctx->geometry_type) {
+		append_geometry(ctx, lwgeom, 0);
+	} else if (lwtype_get_collectiontype(type) == ctx->geometry_type) {
+		if (!lwgeom_is_empty(lwgeom))
+			append_geometry(ctx, lwgeom, 1);
+		push_offset(ctx, 0);
+	} else {
+		lwerror("geoarrow_agg_transfn: cannot mix %s with %s geometries, use ST_Multi",
+			lwtype_name(type), lwtype_name(ctx->geometry_type));
+	}
+}
+
+/**
+ * Append the row values to the column buffers.
+ */
+static void encode_row(struct geoarrow_agg_context *ctx)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctx->n_columns; i++) {
+		struct geoarrow_column *column = &ctx->columns[i];
+		bool isnull;
+		Datum datum;
+		float4 f;
+		uint32_t u;
+		bytea *ba;
+		char *s;
+
+		datum = GetAttributeByNum(ctx->row, column->attnum, &isnull);
+		append_bit(&column->validity, ctx->n_rows, !isnull);
+		if (isnull)
+			column->null_count++;
+
+		switch (column->type) {
+		case GEOARROW_BOOL:
+			append_bit(&column->values, ctx->n_rows,
+				!isnull && DatumGetBool(datum));
+			break;
+		case GEOARROW_INT16:
+			flatbuf_put(&column->values,
+				isnull ? 0 : (uint16_t) DatumGetInt16(datum), 2);
+			break;
+		case GEOARROW_INT32:
+			flatbuf_put(&column->values,
+				isnull ? 0 : (uint32_t) DatumGetInt32(datum), 4);
+			break;
+		case GEOARROW_INT64:
+			flatbuf_put(&column->values,
+				isnull ? 0 : (uint64_t) DatumGetInt64(datum), 8);
+			break;
+		case GEOARROW_FLOAT:
+			f = isnull ? 0 : DatumGetFloat4(datum);
+			memcpy(&u, &f, sizeof(u));
+			flatbuf_put(&column->values, u, 4);
+			break;
+		case GEOARROW_DOUBLE:
+			flatbuf_put_double(&column->values,
+				isnull ? 0 : DatumGetFloat8(datum));
+			break;
+		case GEOARROW_BINARY:
+			if (!isnull) {
+				ba = DatumGetByteaPP(datum);
+				appendBinaryStringInfo(&column->values, VARDATA_ANY(ba),
+					VARSIZE_ANY_EXHDR(ba));
+			}
+			flatbuf_put(&column->offsets, column->values.len, 4);
+			break;
+		case GEOARROW_UTF8:
+			if (!isnull) {
+				s = OidOutputFunctionCall(column->foutoid, datum);
+				appendBinaryStringInfo(&column->values, s, strlen(s));
+			}
+			flatbuf_put(&column->offsets, column->values.len, 4);
+			break;
+		case GEOARROW_GEOMETRY:
+			if (!isnull)
+				encode_geometry(ctx, lwgeom_from_gserialized(
+					(GSERIALIZED *) PG_DETOAST_DATUM(datum)));
+			else if (ctx->geometry_type)
+				append_null_geometry(ctx);
+			else
+				ctx->pending_nulls++;
+			break;
+		}
+	}
+}
+
+/**
+ * Build the schema field of the geometry column, its List levels
+ * down to the vertex Struct.
+ */
+static void geometry_field(struct geoarrow_agg_context *ctx,
+	struct geoarrow_field *field, int level)
+{
+	int i;
+
+	field->nullable = level == 0;
+	field->extension_name = NULL;
+	field->extension_metadata = NULL;
+	if (level < ctx->depth) {
+		field->type = GEOARROW_LIST;
+		field->n_children = 1;
+		field->children = palloc(sizeof(*field->children));
+		field->children[0].name =
+			geoarrow_child_name[ctx->geometry_type][level];
+		geometry_field(ctx, &field->children[0], level + 1);
+	} else {
+		field->type = GEOARROW_STRUCT;
+		field->n_children = 0;
+		field->children = palloc(sizeof(*field->children) * 4);
+		for (i = 0; i < 4; i++) {
+			struct geoarrow_field *child;
+			if ((i == 2 && !ctx->has_z) || (i == 3 && !ctx->has_m))
+				continue;
+			child = &field->children[field->n_children++];
+			child->name = geoarrow_dim_name[i];
+			child->nullable = false;
+			child->type = GEOARROW_DOUBLE;
+			child->extension_name = NULL;
+			child->extension_metadata = NULL;
+			child->n_children = 0;
+		}
+	}
+}
+
+/**
+ * Write a Field table with its type, children and extension metadata.
+ */
+static uint32_t encode_field(StringInfo b, const struct geoarrow_field *f)
+{
+	struct flatbuf_field fields[FLATBUF_MAX_FIELDS], type_fields[FLATBUF_MAX_FIELDS];
+	struct flatbuf_field *name, *type, *children, *metadata = NULL;
+	const char *keys[2], *values[2];
+	uint32_t table_pos, pos;
+	uint8_t type_type;
+	int n = 0, k = 0, i;
+
+	switch (f->type) {
+	case GEOARROW_BOOL:
+		type_type = ARROW_TYPE_BOOL;
+		break;
+	case GEOARROW_INT16:
+	case GEOARROW_INT32:
+	case GEOARROW_INT64:
+		type_type = ARROW_TYPE_INT;
+		flatbuf_field_add(type_fields, &k, ARROW_INT_BIT_WIDTH, 4,
+			f->type == GEOARROW_INT16 ? 16 : f->type == GEOARROW_INT32 ? 32 : 64);
+		flatbuf_field_add(type_fields, &k, ARROW_INT_IS_SIGNED, 1, 1);
+		break;
+	case GEOARROW_FLOAT:
+	case GEOARROW_DOUBLE:
+		type_type = ARROW_TYPE_FLOATING_POINT;
+		flatbuf_field_add(type_fields, &k, ARROW_FLOATING_POINT_PRECISION, 2,
+			f->type == GEOARROW_FLOAT ? ARROW_PRECISION_SINGLE : ARROW_PRECISION_DOUBLE);
+		break;
+	case GEOARROW_BINARY:
+		type_type = ARROW_TYPE_BINARY;
+		break;
+	case GEOARROW_LIST:
+		type_type = ARROW_TYPE_LIST;
+		break;
+	case GEOARROW_STRUCT:
+		type_type = ARROW_TYPE_STRUCT;
+		break;
+	default:
+		type_type = ARROW_TYPE_UTF8;
+	}
+
+	name = flatbuf_field_add(fields, &n, ARROW_FIELD_NAME, 4, 0);
+	flatbuf_field_add(fields, &n, ARROW_FIELD_NULLABLE, 1, f->nullable);
+	flatbuf_field_add(fields, &n, ARROW_FIELD_TYPE_TYPE, 1, type_type);
+	type = flatbuf_field_add(fields, &n, ARROW_FIELD_TYPE, 4, 0);
+	children = flatbuf_field_add(fields, &n, ARROW_FIELD_CHILDREN, 4, 0);
+	if (f->extension_name)
+		metadata = flatbuf_field_add(fields, &n, ARROW_FIELD_CUSTOM_METADATA, 4, 0);
+	table_pos = flatbuf_table(b, fields, n);
+
+	flatbuf_patch(b, name->pos, flatbuf_string(b, f->name));
+	flatbuf_patch(b, type->pos, flatbuf_table(b, type_fields, k));
+
+	pos = flatbuf_vector(b, f->n_children, 4);
+	flatbuf_patch(b, children->pos, pos);
+	for (i = 0; i < f->n_children; i++)
+		flatbuf_put(b, 0, 4);
+	for (i = 0; i < f->n_children; i++)
+		flatbuf_patch(b, pos + 4 + 4 * i, encode_field(b, &f->children[i]));
+
+	if (metadata) {
+		keys[0] = "ARROW:extension:name";
+		values[0] = f->extension_name;
+		keys[1] = "ARROW:extension:metadata";
+		values[1] = f->extension_metadata;
+		pos = flatbuf_vector(b, 2, 4);
+		flatbuf_patch(b, metadata->pos, pos);
+		flatbuf_put(b, 0, 4);
+		flatbuf_put(b, 0, 4);
+		for (i = 0; i < 2; i++) {
+			struct flatbuf_field *key, *value;
+			k = 0;
+			key = flatbuf_field_add(type_fields, &k, ARROW_KEY_VALUE_KEY, 4, 0);
+			value = flatbuf_field_add(type_fields, &k, ARROW_KEY_VALUE_VALUE, 4, 0);
+			flatbuf_patch(b, pos + 4 + 4 * i, flatbuf_table(b, type_fields, k));
+			flatbuf_patch(b, key->pos, flatbuf_string(b, keys[i]));
+			flatbuf_patch(b, value->pos, flatbuf_string(b, values[i]));
+		}
+	}
+
+	return table_pos;
+}
+
+/**
+ * Start a Message flatbuffer, returning the position of its header
+ * offset for the caller to patch.
+ */
+static uint32_t encode_message(StringInfo b, uint8_t header_type,
+	uint64_t body_length)
+{
+	struct flatbuf_field fields[FLATBUF_MAX_FIELDS];
+	struct flatbuf_field *header;
+	int n = 0;
+
+	flatbuf_put(b, 0, 4);
+	flatbuf_field_add(fields, &n, ARROW_MESSAGE_VERSION, 2, ARROW_METADATA_V5);
+	flatbuf_field_add(fields, &n, ARROW_MESSAGE_HEADER_TYPE, 1, header_type);
+	header = flatbuf_field_add(fields, &n, ARROW_MESSAGE_HEADER, 4, 0);
+	flatbuf_field_add(fields, &n, ARROW_MESSAGE_BODY_LENGTH, 8, body_length);
+	flatbuf_patch(b, 0, flatbuf_table(b, fields, n));
+	return header->pos;
+}
+
+/**
+ * Append an encapsulated message to the stream: continuation marker,
+ * metadata size, Message flatbuffer padded to 8 bytes and body.
+ */
+static void write_message(struct geoarrow_agg_context *ctx,
+	StringInfo metadata, StringInfo body)
+{
+	flatbuf_pad_to(metadata, flatbuf_align(metadata->len, 8));
+	flatbuf_put(&ctx->stream, ARROW_CONTINUATION, 4);
+	flatbuf_put(&ctx->stream, metadata->len, 4);
+	appendBinaryStringInfo(&ctx->stream, metadata->data, metadata->len);
+	if (body)
+		appendBinaryStringInfo(&ctx->stream, body->data, body->len);
+}
+
+static void write_schema(struct geoarrow_agg_context *ctx)
+{
+	struct flatbuf_field fields[FLATBUF_MAX_FIELDS];
+	struct flatbuf_field *schema_fields;
+	struct geoarrow_field *f;
+	StringInfoData b;
+	uint32_t header, pos, i;
+	int n = 0;
+
+	f = palloc(sizeof(*f) * ctx->n_columns);
+	for (i = 0; i < ctx->n_columns; i++) {
+		f[i].name = ctx->columns[i].name;
+		if (ctx->columns[i].type == GEOARROW_GEOMETRY) {
+			geometry_field(ctx, &f[i], 0);
+			f[i].extension_name = geoarrow_extension_name[ctx->geometry_type];
+			if (ctx->srid > 0)
+				f[i].extension_metadata = psprintf(
+					"{\"crs\":\"EPSG:%d\",\"crs_type\":\"authority_code\"}",
+					ctx->srid);
+			else
+				f[i].extension_metadata = "{}";
+		} else {
+			f[i].nullable = true;
+			f[i].type = ctx->columns[i].type;
+			f[i].extension_name = NULL;
+			f[i].extension_metadata = NULL;
+			f[i].n_children = 0;
+		}
+	}
+
+	initStringInfo(&b);
+	header = encode_message(&b, ARROW_HEADER_SCHEMA, 0);
+	schema_fields = flatbuf_field_add(fields, &n, ARROW_SCHEMA_FIELDS, 4, 0);
+	flatbuf_patch(&b, header, flatbuf_table(&b, fields, n));
+	pos = flatbuf_vector(&b, ctx->n_columns, 4);
+	flatbuf_patch(&b, schema_fields->pos, pos);
+	for (i = 0; i < ctx->n_columns; i++)
+		flatbuf_put(&b, 0, 4);
+	for (i = 0; i < ctx->n_columns; i++)
+		flatbuf_patch(&b, pos + 4 + 4 * i, encode_field(&b, &f[i]));
+
+	write_message(ctx, &b, NULL);
+	ctx->schema_written = true;
+}
+
+/** Field node and buffer descriptions of a record batch, and its body */
+struct geoarrow_batch {
+	StringInfoData nodes;
+	uint32_t n_nodes;
+	StringInfoData buffers;
+	uint32_t n_buffers;
+	StringInfoData body;
+};
+
+static void add_node(struct geoarrow_batch *batch, uint32_t length,
+	uint32_t null_count)
+{
+	flatbuf_put(&batch->nodes, length, 8);
+	flatbuf_put(&batch->nodes, null_count, 8);
+	batch->n_nodes++;
+}
+
+/** Buffers start 8 byte aligned in the body */
+static void add_buffer(struct geoarrow_batch *batch, const StringInfo data)
+{
+	uint32_t len = data ? data->len : 0;
+	flatbuf_pad_to(&batch->body, flatbuf_align(batch->body.len, 8));
+	flatbuf_put(&batch->buffers, batch->body.len, 8);
+	flatbuf_put(&batch->buffers, len, 8);
+	if (len > 0)
+		appendBinaryStringInfo(&batch->body, data->data, len);
+	batch->n_buffers++;
+}
+
+/**
+ * Geometry column nodes and buffers, in depth first order: a List node
+ * per level with its offsets, the vertex Struct and its coordinates.
+ * Only the outermost level can be null.
+ */
+static void add_geometry(struct geoarrow_agg_context *ctx,
+	struct geoarrow_batch *batch, struct geoarrow_column *column)
+{
+	int level, i;
+
+	for (level = 0; level < ctx->depth; level++) {
+		add_node(batch, ctx->geom_lengths[level],
+			level == 0 ? column->null_count : 0);
+		add_buffer(batch, level == 0 && column->null_count > 0 ?
+			&column->validity : NULL);
+		add_buffer(batch, &ctx->geom_offsets[level]);
+	}
+	add_node(batch, ctx->n_coords, ctx->depth == 0 ? column->null_count : 0);
+	add_buffer(batch, ctx->depth == 0 && column->null_count > 0 ?
+		&column->validity : NULL);
+	for (i = 0; i < 4; i++) {
+		if ((i == 2 && !ctx->has_z) || (i == 3 && !ctx->has_m))
+			continue;
+		add_node(batch, ctx->n_coords, 0);
+		add_buffer(batch, NULL);
+		add_buffer(batch, &ctx->coords[i]);
+	}
+}
+
+/**
+ * Clear the column buffers for the next record batch, keeping their
+ * allocations.
+ */
+static void reset_batch(struct geoarrow_agg_context *ctx)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctx->n_columns; i++) {
+		struct geoarrow_column *column = &ctx->columns[i];
+		resetStringInfo(&column->validity);
+		resetStringInfo(&column->offsets);
+		resetStringInfo(&column->values);
+		column->null_count = 0;
+		if (column->type == GEOARROW_BINARY || column->type == GEOARROW_UTF8)
+			flatbuf_put(&column->offsets, 0, 4);
+	}
+	for (i = 0; i < GEOARROW_MAX_DEPTH; i++) {
+		resetStringInfo(&ctx->geom_offsets[i]);
+		flatbuf_put(&ctx->geom_offsets[i], 0, 4);
+		ctx->geom_lengths[i] = 0;
+	}
+	for (i = 0; i < 4; i++)
+		resetStringInfo(&ctx->coords[i]);
+	ctx->n_coords = 0;
+	ctx->n_rows = 0;
+}
+
+/**
+ * Write the buffered rows as a RecordBatch message, preceded by the
+ * Schema message for the first one.
+ */
+static void write_batch(struct geoarrow_agg_context *ctx)
+{
+	struct flatbuf_field fields[FLATBUF_MAX_FIELDS];
+	struct flatbuf_field *nodes, *buffers;
+	struct geoarrow_batch batch;
+	StringInfoData b;
+	uint32_t header, pos, i;
+	int n = 0;
+
+	/* Only null geometries in the whole stream, settle for points */
+	if (!ctx->geometry_type)
+		set_layout(ctx, POINTTYPE);
+
+	if (!ctx->schema_written)
+		write_schema(ctx);
+
+	initStringInfo(&batch.nodes);
+	initStringInfo(&batch.buffers);
+	initStringInfo(&batch.body);
+	batch.n_nodes = batch.n_buffers = 0;
+
+	for (i = 0; i < ctx->n_columns; i++) {
+		struct geoarrow_column *column = &ctx->columns[i];
+		if (column->type == GEOARROW_GEOMETRY) {
+			add_geometry(ctx, &batch, column);
+			continue;
+		}
+		add_node(&batch, ctx->n_rows, column->null_count);
+		add_buffer(&batch, column->null_count > 0 ? &column->validity : NULL);
+		if (column->type == GEOARROW_BINARY || column->type == GEOARROW_UTF8)
+			add_buffer(&batch, &column->offsets);
+		add_buffer(&batch, &column->values);
+	}
+	flatbuf_pad_to(&batch.body, flatbuf_align(batch.body.len, 8));
+
+	initStringInfo(&b);
+	header = encode_message(&b, ARROW_HEADER_RECORD_BATCH, batch.body.len);
+	flatbuf_field_add(fields, &n, ARROW_RECORD_BATCH_LENGTH, 8, ctx->n_rows);
+	nodes = flatbuf_field_add(fields, &n, ARROW_RECORD_BATCH_NODES, 4, 0);
+	buffers = flatbuf_field_add(fields, &n, ARROW_RECORD_BATCH_BUFFERS, 4, 0);
+	flatbuf_patch(&b, header, flatbuf_table(&b, fields, n));
+
+	pos = flatbuf_vector(&b, batch.n_nodes, 8);
+	flatbuf_patch(&b, nodes->pos, pos);
+	appendBinaryStringInfo(&b, batch.nodes.data, batch.nodes.len);
+	pos = flatbuf_vector(&b, batch.n_buffers, 8);
+	flatbuf_patch(&b, buffers->pos, pos);
+	appendBinaryStringInfo(&b, batch.buffers.data, batch.buffers.len);
+
+	write_message(ctx, &b, &batch.body);
+
+	pfree(b.data);
+	pfree(batch.nodes.data);
+	pfree(batch.buffers.data);
+	pfree(batch.body.data);
+
+	reset_batch(ctx);
+}
+
+/**
+ * Initialize aggregation context.
+ */
+void geoarrow_agg_init_context(struct geoarrow_agg_context *ctx)
+{
+	int i;
+
+	ctx->columns = NULL;
+	ctx->n_columns = 0;
+	ctx->geometry_type = 0;
+	ctx->depth = 0;
+	ctx->has_z = false;
+	ctx->has_m = false;
+	ctx->srid = 0;
+	ctx->pending_nulls = 0;
+	for (i = 0; i < GEOARROW_MAX_DEPTH; i++)
+		initStringInfo(&ctx->geom_offsets[i]);
+	for (i = 0; i < 4; i++)
+		initStringInfo(&ctx->coords[i]);
+	ctx->schema_written = false;
+	initStringInfo(&ctx->stream);
+	flatbuf_pad_to(&ctx->stream, VARHDRSZ);
+	ctx->row_context = AllocSetContextCreate(CurrentMemoryContext,
+		"ST_AsGeoArrow row context",
+		ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE,
+		ALLOCSET_DEFAULT_MAXSIZE);
+}
+
+/**
+ * Aggregation step.
+ *
+ * Appends the row to the column buffers, writing them out as a record
+ * batch every GEOARROW_BATCH_ROWS rows once the layout is known.
+ */
+void geoarrow_agg_transfn(struct geoarrow_agg_context *ctx)
+{
+	MemoryContext oldcontext;
+
+	/* inspect row and encode columns assuming static schema */
+	if (!ctx->columns) {
+		encode_columns(ctx);
+		reset_batch(ctx);
+	}
+
+	/* Column buffers grow in the aggregate context they were made in */
+	oldcontext = MemoryContextSwitchTo(ctx->row_context);
+	encode_row(ctx);
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextReset(ctx->row_context);
+
+	/* Batches of null geometries grow until one fixes the layout */
+	if (++ctx->n_rows >= GEOARROW_BATCH_ROWS && ctx->geometry_type)
+		write_batch(ctx);
+}
+
+/**
+ * Finalize aggregation.
+ *
+ * Writes the last record batch and the end of stream marker, the
+ * stream buffer becomes the bytea.
+ */
+uint8_t *geoarrow_agg_finalfn(struct geoarrow_agg_context *ctx)
+{
+	if (ctx->n_rows > 0 || !ctx->schema_written)
+		write_batch(ctx);
+
+	flatbuf_put(&ctx->stream, ARROW_CONTINUATION, 4);
+	flatbuf_put(&ctx->stream, 0, 4);
+
+	SET_VARSIZE(ctx->stream.data, ctx->stream.len);
+
+	return (uint8_t *) ctx->stream.data;
+}
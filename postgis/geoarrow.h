@@ -0,0 +1,85 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+#ifndef GEOARROW_H_
+#define GEOARROW_H_ 1
+
+#include <stdlib.h>
+#include "postgres.h"
+#include "utils/builtins.h"
+#include "utils/typcache.h"
+#include "utils/lsyscache.h"
+#include "catalog/pg_type.h"
+#include "access/htup_details.h"
+#include "access/htup.h"
+#include "lib/stringinfo.h"
+#include "../postgis_config.h"
+#include "liblwgeom.h"
+#include "lwgeom_pg.h"
+#include "lwgeom_log.h"
+
+/** Number of rows buffered before a record batch is written */
+#define GEOARROW_BATCH_ROWS 65536
+
+/** Deepest list nesting of the native layouts (multipolygon) */
+#define GEOARROW_MAX_DEPTH 3
+
+/** Column buffers of the record batch being built */
+struct geoarrow_column {
+	char *name;
+	uint32_t attnum;
+	uint8_t type;
+	Oid foutoid;
+	StringInfoData validity;
+	StringInfoData offsets;
+	StringInfoData values;
+	uint32_t null_count;
+};
+
+struct geoarrow_agg_context {
+	char *geom_name;
+	uint32_t geom_index;
+	HeapTupleHeader row;
+	struct geoarrow_column *columns;
+	uint32_t n_columns;
+	/* Native layout, a liblwgeom type number, 0 until known */
+	uint8_t geometry_type;
+	int depth;
+	bool has_z;
+	bool has_m;
+	int32_t srid;
+	/* Null geometries seen before the layout was known */
+	uint32_t pending_nulls;
+	StringInfoData geom_offsets[GEOARROW_MAX_DEPTH];
+	uint32_t geom_lengths[GEOARROW_MAX_DEPTH];
+	StringInfoData coords[4];
+	uint32_t n_coords;
+	uint32_t n_rows;
+	bool schema_written;
+	/* IPC stream written so far, behind room for the varlena header */
+	StringInfoData stream;
+	MemoryContext row_context;
+};
+
+void geoarrow_agg_init_context(struct geoarrow_agg_context *ctx);
+void geoarrow_agg_transfn(struct geoarrow_agg_context *ctx);
+uint8_t *geoarrow_agg_finalfn(struct geoarrow_agg_context *ctx);
+
+#endif
@@ -24,15 +24,107 @@
 
 #include <math.h>
 #include "geobuf.h"
+#include "utils/memutils.h"
 
 #ifdef HAVE_LIBPROTOBUF
 
 #define FEATURES_CAPACITY_INITIAL 50
 #define MAX_PRECISION 1e6
 
+/* Protocol buffers wire format, used to stream features */
+#define GEOBUF_WIRE_VARINT 0
+#define GEOBUF_WIRE_FIXED64 1
+#define GEOBUF_WIRE_LENGTH 2
+#define GEOBUF_WIRE_FIXED32 5
+#define GEOBUF_KEY(field, wire) (((field) << 3) | (wire))
+
+/* Field numbers from geobuf.proto */
+#define GEOBUF_DATA_KEYS 1
+#define GEOBUF_DATA_DIMENSIONS 2
+#define GEOBUF_DATA_PRECISION 3
+#define GEOBUF_DATA_FEATURE_COLLECTION 4
+#define GEOBUF_FEATURE_COLLECTION_FEATURES 1
+
+struct geobuf_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+};
+
 static Data__Geometry *encode_geometry(struct geobuf_agg_context *ctx,
 	LWGEOM *lwgeom);
 
+static inline size_t varint_len(uint64_t value)
+{
+	size_t len = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		len++;
+	}
+	return len;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t value)
+{
+	while (value >= 0x80) {
+		*p++ = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (uint8_t) value;
+	return p;
+}
+
+static void write_varint(StringInfo s, uint64_t value)
+{
+	uint8_t *p;
+	enlargeStringInfo(s, 10);
+	p = (uint8_t *) s->data + s->len;
+	s->len += put_varint(p, value) - p;
+}
+
+static uint64_t read_varint(struct geobuf_reader *r)
+{
+	uint64_t value = 0;
+	int shift = 0;
+	while (r->p < r->end && shift < 64) {
+		uint8_t b = *r->p++;
+		value |= (uint64_t) (b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return value;
+		shift += 7;
+	}
+	lwerror("read_varint: truncated geobuf");
+	return 0;
+}
+
+static const uint8_t *read_bytes(struct geobuf_reader *r, size_t len)
+{
+	const uint8_t *p = r->p;
+	if (len > (size_t) (r->end - r->p))
+		lwerror("read_bytes: truncated geobuf");
+	r->p += len;
+	return p;
+}
+
+static void skip_field(struct geobuf_reader *r, int wire)
+{
+	switch (wire) {
+	case GEOBUF_WIRE_VARINT:
+		read_varint(r);
+		break;
+	case GEOBUF_WIRE_FIXED64:
+		read_bytes(r, 8);
+		break;
+	case GEOBUF_WIRE_LENGTH:
+		read_bytes(r, read_varint(r));
+		break;
+	case GEOBUF_WIRE_FIXED32:
+		read_bytes(r, 4);
+		break;
+	default:
+		lwerror("skip_field: unknown wire type %d", wire);
+	}
+}
+
 static Data__Geometry *galloc(Data__Geometry__Type type) {
 	Data__Geometry *geometry;
 	geometry = palloc (sizeof (Data__Geometry));
@@ -63,7 +155,7 @@ static void encode_keys(struct geobuf_agg_context *ctx)
 			geom_name_found = true;
 			continue;
 		}
-		keys[k++] = key;
+		keys[k++] = pstrdup(key);
 	}
 	if (!geom_name_found)
 		lwerror("encode_keys: no column with specificed geom_name found");
@@ -165,9 +257,9 @@ static int64_t *encode_coords(struct geobuf_agg_context *ctx, POINTARRAY *pa,
 		getPoint4d_p(pa, i, &pt);
 		sum[0] += coords[c++] = ceil(pt.x * ctx->e) - sum[0];
 		sum[1] += coords[c++] = ceil(pt.y * ctx->e) - sum[1];
-		if (ctx->dimensions == 3)
+		if (ctx->dimensions >= 3)
 			sum[2] += coords[c++] = ceil(pt.z * ctx->e) - sum[2];
-		else if (ctx->dimensions == 4)
+		if (ctx->dimensions == 4)
 			sum[3] += coords[c++] = ceil(pt.m * ctx->e) - sum[3];
 	}
 	return coords;
@@ -513,6 +605,9 @@ void geobuf_agg_init_context(struct geobuf_agg_context *ctx)
 	ctx->precision = MAX_PRECISION;
 	ctx->e = 1;
 	ctx->features_capacity = FEATURES_CAPACITY_INITIAL;
+	ctx->stream = false;
+	ctx->n_features = 0;
+	ctx->row_context = NULL;
 
 	data = palloc(sizeof(*data));
 	data__init(data);
@@ -532,6 +627,91 @@ void geobuf_agg_init_context(struct geobuf_agg_context *ctx)
 	ctx->data = data;
 }
 
+/**
+ * Initialize streaming aggregation context.
+ *
+ * Precision and dimensions are fixed up front, so features can be
+ * packed as they arrive.
+ */
+void geobuf_agg_init_stream_context(struct geobuf_agg_context *ctx,
+	uint32_t precision, uint32_t dimensions)
+{
+	Data *data;
+	uint32_t i;
+
+	ctx->has_dimensions = 1;
+	ctx->dimensions = dimensions;
+	ctx->has_precision = 1;
+	ctx->precision = precision;
+	ctx->e = 1;
+	for (i = 0; i < precision; i++)
+		ctx->e *= 10;
+	ctx->features_capacity = 0;
+	ctx->lwgeoms = NULL;
+	ctx->stream = true;
+	initStringInfo(&ctx->features);
+	ctx->n_features = 0;
+	ctx->row_context = AllocSetContextCreate(CurrentMemoryContext,
+		"ST_AsGeobuf row context",
+		ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE,
+		ALLOCSET_DEFAULT_MAXSIZE);
+
+	data = palloc(sizeof(*data));
+	data__init(data);
+	data->data_type_case = DATA__DATA_TYPE_FEATURE_COLLECTION;
+
+	ctx->data = data;
+}
+
+/**
+ * Streaming aggregation step.
+ *
+ * Encodes the row into a Feature in the row context and appends it
+ * packed, as a FeatureCollection features field, to the features
+ * buffer.
+ */
+static void geobuf_agg_stream_transfn(struct geobuf_agg_context *ctx)
+{
+	MemoryContext oldcontext;
+	Data__Feature *feature;
+	LWGEOM *lwgeom;
+	GSERIALIZED *gs;
+	bool isnull;
+	Datum datum;
+	uint8_t *buf;
+	size_t len;
+
+	/* inspect row and encode keys assuming static schema */
+	if (ctx->n_features == 0)
+		encode_keys(ctx);
+
+	oldcontext = MemoryContextSwitchTo(ctx->row_context);
+
+	datum = GetAttributeByNum(ctx->row, ctx->geom_index + 1, &isnull);
+	if (isnull)
+		lwerror("geobuf_agg_transfn: geometry column cannot be null");
+	gs = (GSERIALIZED *) PG_DETOAST_DATUM(datum);
+	lwgeom = lwgeom_from_gserialized(gs);
+
+	feature = encode_feature(ctx);
+	feature->geometry = encode_geometry(ctx, lwgeom);
+
+	len = protobuf_c_message_get_packed_size(&feature->base);
+	buf = palloc(len);
+	protobuf_c_message_pack(&feature->base, buf);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	appendStringInfoChar(&ctx->features, (char) GEOBUF_KEY(
+		GEOBUF_FEATURE_COLLECTION_FEATURES, GEOBUF_WIRE_LENGTH));
+	write_varint(&ctx->features, len);
+	appendBinaryStringInfo(&ctx->features, (const char *) buf, len);
+	ctx->n_features++;
+
+	MemoryContextReset(ctx->row_context);
+}
+
 /**
  * Aggregation step.
  *
@@ -544,10 +724,17 @@ void geobuf_agg_transfn(struct geobuf_agg_context *ctx)
 	LWGEOM *lwgeom;
 	bool isnull;
 	Datum datum;
-	Data__FeatureCollection *fc = ctx->data->feature_collection;
-	Data__Feature **features = fc->features;
+	Data__FeatureCollection *fc;
 	Data__Feature *feature;
 	GSERIALIZED *gs;
+
+	if (ctx->stream) {
+		geobuf_agg_stream_transfn(ctx);
+		return;
+	}
+
+	fc = ctx->data->feature_collection;
+
 	if (fc->n_features >= ctx->features_capacity) {
 		size_t new_capacity = ctx->features_capacity * 2;
 		fc->features = repalloc(fc->features, new_capacity *
@@ -579,6 +766,53 @@ void geobuf_agg_transfn(struct geobuf_agg_context *ctx)
 	fc->features[fc->n_features++] = feature;
 }
 
+/**
+ * Write the Data message around the streamed features.
+ *
+ * Fields go in field number order, as protobuf-c packs them.
+ */
+static uint8_t *geobuf_agg_stream_finalfn(struct geobuf_agg_context *ctx)
+{
+	Data *data = ctx->data;
+	size_t i, len = 0, key_len;
+	uint8_t *buf, *p;
+
+	for (i = 0; i < data->n_keys; i++) {
+		key_len = strlen(data->keys[i]);
+		len += 1 + varint_len(key_len) + key_len;
+	}
+	if (ctx->dimensions != 2)
+		len += 1 + varint_len(ctx->dimensions);
+	if (ctx->precision != 6)
+		len += 1 + varint_len(ctx->precision);
+	len += 1 + varint_len(ctx->features.len) + ctx->features.len;
+
+	buf = palloc(sizeof(*buf) * (len + VARHDRSZ));
+	p = buf + VARHDRSZ;
+	for (i = 0; i < data->n_keys; i++) {
+		key_len = strlen(data->keys[i]);
+		*p++ = GEOBUF_KEY(GEOBUF_DATA_KEYS, GEOBUF_WIRE_LENGTH);
+		p = put_varint(p, key_len);
+		memcpy(p, data->keys[i], key_len);
+		p += key_len;
+	}
+	if (ctx->dimensions != 2) {
+		*p++ = GEOBUF_KEY(GEOBUF_DATA_DIMENSIONS, GEOBUF_WIRE_VARINT);
+		p = put_varint(p, ctx->dimensions);
+	}
+	if (ctx->precision != 6) {
+		*p++ = GEOBUF_KEY(GEOBUF_DATA_PRECISION, GEOBUF_WIRE_VARINT);
+		p = put_varint(p, ctx->precision);
+	}
+	*p++ = GEOBUF_KEY(GEOBUF_DATA_FEATURE_COLLECTION, GEOBUF_WIRE_LENGTH);
+	p = put_varint(p, ctx->features.len);
+	memcpy(p, ctx->features.data, ctx->features.len);
+
+	SET_VARSIZE(buf, VARHDRSZ + len);
+
+	return buf;
+}
+
 /**
  * Finalize aggregation.
  *
@@ -590,6 +824,9 @@ uint8_t *geobuf_agg_finalfn(struct geobuf_agg_context *ctx)
 	Data *data;
 	Data__FeatureCollection *fc;
 
+	if (ctx->stream)
+		return geobuf_agg_stream_finalfn(ctx);
+
 	data = ctx->data;
 	fc = data->feature_collection;
 
@@ -621,4 +858,110 @@ uint8_t *geobuf_agg_finalfn(struct geobuf_agg_context *ctx)
 	return buf;
 }
 
+/**
+ * Merge two streaming states.
+ *
+ * Both states see the same row type, so keys indexes agree and the
+ * packed features of ctx2 can be appended as they are.
+ */
+struct geobuf_agg_context *geobuf_agg_combine(struct geobuf_agg_context *ctx1,
+	struct geobuf_agg_context *ctx2)
+{
+	if (!ctx1->stream || !ctx2->stream)
+		lwerror("geobuf_agg_combine: only states with fixed precision and dimensions can be combined");
+	if (ctx1->precision != ctx2->precision ||
+		ctx1->dimensions != ctx2->dimensions)
+		lwerror("geobuf_agg_combine: precision and dimensions differ");
+
+	if (!ctx1->data->keys) {
+		ctx1->data->keys = ctx2->data->keys;
+		ctx1->data->n_keys = ctx2->data->n_keys;
+	}
+
+	appendBinaryStringInfo(&ctx1->features, ctx2->features.data,
+		ctx2->features.len);
+	ctx1->n_features += ctx2->n_features;
+
+	return ctx1;
+}
+
+/**
+ * Serialize a streaming state as the Data message it would finalize to.
+ */
+uint8_t *geobuf_agg_serialize(struct geobuf_agg_context *ctx)
+{
+	if (!ctx->stream)
+		lwerror("geobuf_agg_serialize: only states with fixed precision and dimensions can be serialized");
+	return geobuf_agg_stream_finalfn(ctx);
+}
+
+/**
+ * Rebuild a streaming state from a serialized Data message.
+ *
+ * Features are kept packed, only keys and header fields are decoded.
+ */
+struct geobuf_agg_context *geobuf_agg_deserialize(const uint8_t *buf,
+	size_t len)
+{
+	struct geobuf_agg_context *ctx;
+	struct geobuf_reader r, fc;
+	uint32_t precision = 6, dimensions = 2;
+	size_t n_keys = 0, keys_capacity = 8, n;
+	char **keys = palloc(keys_capacity * sizeof(*keys));
+	const uint8_t *p;
+	uint64_t key;
+
+	fc.p = fc.end = NULL;
+	r.p = buf;
+	r.end = buf + len;
+	while (r.p < r.end) {
+		key = read_varint(&r);
+		switch (key) {
+		case GEOBUF_KEY(GEOBUF_DATA_KEYS, GEOBUF_WIRE_LENGTH):
+			n = read_varint(&r);
+			p = read_bytes(&r, n);
+			if (n_keys >= keys_capacity) {
+				keys_capacity *= 2;
+				keys = repalloc(keys, keys_capacity * sizeof(*keys));
+			}
+			keys[n_keys++] = pnstrdup((const char *) p, n);
+			break;
+		case GEOBUF_KEY(GEOBUF_DATA_DIMENSIONS, GEOBUF_WIRE_VARINT):
+			dimensions = read_varint(&r);
+			break;
+		case GEOBUF_KEY(GEOBUF_DATA_PRECISION, GEOBUF_WIRE_VARINT):
+			precision = read_varint(&r);
+			break;
+		case GEOBUF_KEY(GEOBUF_DATA_FEATURE_COLLECTION, GEOBUF_WIRE_LENGTH):
+			n = read_varint(&r);
+			fc.p = read_bytes(&r, n);
+			fc.end = fc.p + n;
+			break;
+		default:
+			skip_field(&r, key & 0x7);
+		}
+	}
+
+	ctx = palloc(sizeof(*ctx));
+	ctx->geom_name = NULL;
+	geobuf_agg_init_stream_context(ctx, precision, dimensions);
+	if (n_keys > 0 || fc.p != fc.end) {
+		ctx->data->keys = keys;
+		ctx->data->n_keys = n_keys;
+	}
+
+	if (fc.p)
+		appendBinaryStringInfo(&ctx->features, (const char *) fc.p,
+			fc.end - fc.p);
+	while (fc.p < fc.end) {
+		key = read_varint(&fc);
+		if (key == GEOBUF_KEY(GEOBUF_FEATURE_COLLECTION_FEATURES,
+			GEOBUF_WIRE_LENGTH))
+			ctx->n_features++;
+		skip_field(&fc, key & 0x7);
+	}
+
+	return ctx;
+}
+
 #endif
@@ -36,6 +36,7 @@
 #include "executor/executor.h"
 #include "access/htup_details.h"
 #include "access/htup.h"
+#include "lib/stringinfo.h"
 #include "../postgis_config.h"
 #include "liblwgeom.h"
 #include "lwgeom_pg.h"
@@ -58,11 +59,23 @@ struct geobuf_agg_context {
         uint32_t precision;
         protobuf_c_boolean has_dimensions;
         uint32_t dimensions;
+	/* Streaming mode, features are packed as they arrive */
+	bool stream;
+	StringInfoData features;
+	uint32_t n_features;
+	MemoryContext row_context;
 };
 
 void geobuf_agg_init_context(struct geobuf_agg_context *ctx);
+void geobuf_agg_init_stream_context(struct geobuf_agg_context *ctx,
+	uint32_t precision, uint32_t dimensions);
 void geobuf_agg_transfn(struct geobuf_agg_context *ctx);
 uint8_t *geobuf_agg_finalfn(struct geobuf_agg_context *ctx);
+struct geobuf_agg_context *geobuf_agg_combine(struct geobuf_agg_context *ctx1,
+	struct geobuf_agg_context *ctx2);
+uint8_t *geobuf_agg_serialize(struct geobuf_agg_context *ctx);
+struct geobuf_agg_context *geobuf_agg_deserialize(const uint8_t *buf,
+	size_t len);
 
 #endif  /* HAVE_LIBPROTOBUF */
 
@@ -40,6 +40,7 @@ Datum geography_eq(PG_FUNCTION_ARGS);
 Datum geography_ge(PG_FUNCTION_ARGS);
 Datum geography_gt(PG_FUNCTION_ARGS);
 Datum geography_cmp(PG_FUNCTION_ARGS);
+Datum geography_hash(PG_FUNCTION_ARGS);
 
 
 /*
@@ -232,7 +233,8 @@ Datum geography_eq(PG_FUNCTION_ARGS)
 	geography_gidx_center(gbox1, &p1);
 	geography_gidx_center(gbox2, &p2);
 
-	if ( FP_EQUALS(p1.x, p2.x) && FP_EQUALS(p1.y, p2.y) && FP_EQUALS(p1.z, p2.z) )
+	/* Exact test, so that equality is transitive and hashable */
+	if ( p1.x == p2.x && p1.y == p2.y && p1.z == p2.z )
 		PG_RETURN_BOOL(TRUE);
 
 	PG_RETURN_BOOL(FALSE);
@@ -263,7 +265,7 @@ Datum geography_cmp(PG_FUNCTION_ARGS)
 	geography_gidx_center(gbox1, &p1);
 	geography_gidx_center(gbox2, &p2);
 
-	if  ( ! FP_EQUALS(p1.x, p2.x) )
+	if  ( p1.x != p2.x )
 	{
 		if  (p1.x < p2.x)
 		{
@@ -272,7 +274,7 @@ Datum geography_cmp(PG_FUNCTION_ARGS)
 		PG_RETURN_INT32(1);
 	}
 
-	if  ( ! FP_EQUALS(p1.y, p2.y) )
+	if  ( p1.y != p2.y )
 	{
 		if  (p1.y < p2.y)
 		{
@@ -281,7 +283,7 @@ Datum geography_cmp(PG_FUNCTION_ARGS)
 		PG_RETURN_INT32(1);
 	}
 
-	if  ( ! FP_EQUALS(p1.z, p2.z) )
+	if  ( p1.z != p2.z )
 	{
 		if  (p1.z < p2.z)
 		{
@@ -293,3 +295,28 @@ Datum geography_cmp(PG_FUNCTION_ARGS)
 	PG_RETURN_INT32(0);
 }
 
+/*
+** Hash support function. Equality only looks at the center of the
+** geocentric box, so that is what goes into the hash.
+*/
+PG_FUNCTION_INFO_V1(geography_hash);
+Datum geography_hash(PG_FUNCTION_ARGS)
+{
+	/* Put aside some stack memory and use it for GIDX pointers. */
+	char gboxmem[GIDX_MAX_SIZE];
+	GIDX *gbox = (GIDX*)gboxmem;
+	POINT3D p;
+
+	/* Empty geographies are never equal to anything */
+	if ( ! gserialized_datum_get_gidx_p(PG_GETARG_DATUM(0), gbox) )
+		PG_RETURN_UINT32(0);
+
+	geography_gidx_center(gbox, &p);
+
+	/* Adding zero folds -0.0 into 0.0, which compare equal */
+	p.x += 0.0;
+	p.y += 0.0;
+	p.z += 0.0;
+
+	PG_RETURN_DATUM(hash_any((unsigned char *)&p, sizeof(POINT3D)));
+}
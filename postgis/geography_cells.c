@@ -0,0 +1,147 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+
+#include "postgres.h"
+#include "catalog/pg_type.h"
+#include "utils/array.h"
+
+#include "../postgis_config.h"
+
+#include "liblwgeom.h"         /* For standard geometry types. */
+#include "liblwgeom_internal.h"         /* For FP comparators. */
+#include "lwgeom_pg.h"       /* For debugging macros. */
+#include "geography.h"	     /* For utility functions. */
+#include "lwgeom_transform.h" /* For SRID functions */
+#include "lwgeodetic_cells.h"
+
+Datum geography_cell_id(PG_FUNCTION_ARGS);
+Datum geography_cell_covering(PG_FUNCTION_ARGS);
+Datum geography_cell_range_min(PG_FUNCTION_ARGS);
+Datum geography_cell_range_max(PG_FUNCTION_ARGS);
+
+
+static int
+geography_cell_level(int level)
+{
+	if ( level < 0 || level > CELL_MAX_LEVEL )
+		elog(ERROR, "Cell level must be between 0 and %d, got %d", CELL_MAX_LEVEL, level);
+	return level;
+}
+
+static uint64_t
+geography_cell_arg(int64 id)
+{
+	if ( cell_id_level((uint64_t)id) < 0 )
+		elog(ERROR, "%lld is not a cell id", (long long)id);
+	return (uint64_t)id;
+}
+
+/*
+** geography_cell_id(geography point, int level) returns int8
+** the id of the cell holding the point at the level
+*/
+PG_FUNCTION_INFO_V1(geography_cell_id);
+Datum geography_cell_id(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *g = PG_GETARG_GSERIALIZED_P(0);
+	int level = geography_cell_level(PG_GETARG_INT32(1));
+	POINT4D pt;
+	POINT2D p2d;
+	POINT3D p;
+
+	if ( gserialized_get_type(g) != POINTTYPE )
+		elog(ERROR, "ST_CellId: only point geographies are supported, got %s",
+		     lwtype_name(gserialized_get_type(g)));
+
+	/* Empty points are nowhere */
+	if ( gserialized_peek_first_point(g, &pt) == LW_FAILURE )
+		PG_RETURN_NULL();
+
+	p2d.x = pt.x;
+	p2d.y = pt.y;
+	ll2cart(&p2d, &p);
+
+	PG_FREE_IF_COPY(g, 0);
+	PG_RETURN_INT64((int64)cell_id_from_point(&p, level));
+}
+
+/*
+** geography_cell_covering(geography g, double distance, int maxcells, int maxlevel)
+** returns int8[] of the cells covering everything within distance (meters)
+** of g, on the sphere or the spheroid of its SRID
+*/
+PG_FUNCTION_INFO_V1(geography_cell_covering);
+Datum geography_cell_covering(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *g = PG_GETARG_GSERIALIZED_P(0);
+	double distance = PG_GETARG_FLOAT8(1);
+	int max_cells = PG_GETARG_INT32(2);
+	int max_level = geography_cell_level(PG_GETARG_INT32(3));
+	LWGEOM *lwgeom;
+	uint64_t *cells;
+	Datum *elems;
+	SPHEROID s;
+	double lo, hi;
+	int num_cells, i;
+
+	if ( distance < 0.0 )
+		elog(ERROR, "ST_CellCovering: distance must not be negative");
+	if ( max_cells < 1 )
+		elog(ERROR, "ST_CellCovering: maxcells must be at least 1");
+
+	/* The spheroid distance is never shorter than lo times the sphere distance */
+	spheroid_init_from_srid(fcinfo, gserialized_get_srid(g), &s);
+	spheroid_distance_bounds(&s, &lo, &hi);
+
+	lwgeom = lwgeom_from_gserialized(g);
+	num_cells = lwgeom_cell_covering(lwgeom, distance / (FP_MIN(lo, 1.0) * s.radius), max_cells, max_level, &cells);
+	lwgeom_free(lwgeom);
+	PG_FREE_IF_COPY(g, 0);
+
+	if ( ! num_cells )
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT8OID));
+
+	elems = palloc(num_cells * sizeof(Datum));
+	for ( i = 0; i < num_cells; i++ )
+		elems[i] = Int64GetDatum((int64)cells[i]);
+	lwfree(cells);
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(elems, num_cells, INT8OID,
+	                      sizeof(int64), FLOAT8PASSBYVAL, 'd'));
+}
+
+/*
+** geography_cell_range_min(int8 id) and geography_cell_range_max(int8 id)
+** return the first and last leaf cell ids inside the cell
+*/
+PG_FUNCTION_INFO_V1(geography_cell_range_min);
+Datum geography_cell_range_min(PG_FUNCTION_ARGS)
+{
+	uint64_t id = geography_cell_arg(PG_GETARG_INT64(0));
+	PG_RETURN_INT64((int64)cell_id_range_min(id));
+}
+
+PG_FUNCTION_INFO_V1(geography_cell_range_max);
+Datum geography_cell_range_max(PG_FUNCTION_ARGS)
+{
+	uint64_t id = geography_cell_arg(PG_GETARG_INT64(0));
+	PG_RETURN_INT64((int64)cell_id_range_max(id));
+}
@@ -24,6 +24,8 @@
 
 
 #include "postgres.h"
+#include "catalog/pg_type.h"
+#include "utils/array.h"
 
 #include "../postgis_config.h"
 
@@ -52,6 +54,7 @@ Datum geography_distance(PG_FUNCTION_ARGS);
 Datum geography_distance_uncached(PG_FUNCTION_ARGS);
 Datum geography_distance_knn(PG_FUNCTION_ARGS);
 Datum geography_distance_tree(PG_FUNCTION_ARGS);
+Datum geography_distance_matrix(PG_FUNCTION_ARGS);
 Datum geography_dwithin(PG_FUNCTION_ARGS);
 Datum geography_dwithin_uncached(PG_FUNCTION_ARGS);
 Datum geography_area(PG_FUNCTION_ARGS);
@@ -66,11 +69,40 @@ Datum geography_azimuth(PG_FUNCTION_ARGS);
 Datum geography_segmentize(PG_FUNCTION_ARGS);
 
 
+/**
+* Distance between two non-empty serialized points, read in place. Same
+* answer as lwgeom_distance_spheroid on the deserialized points.
+*/
+static double geography_distance_point_point(const GSERIALIZED *g1, const GSERIALIZED *g2, const SPHEROID *s, double tolerance)
+{
+	POINT4D p1, p2;
+	GEOGRAPHIC_POINT gp1, gp2;
+	double distance;
+
+	gserialized_peek_first_point(g1, &p1);
+	gserialized_peek_first_point(g2, &p2);
+	geographic_point_init(p1.x, p1.y, &gp1);
+	geographic_point_init(p2.x, p2.y, &gp2);
+
+	/* Sphere special case, axes equal */
+	distance = s->radius * sphere_distance(&gp1, &gp2);
+	if ( s->a == s->b )
+		return distance;
+	/* Below tolerance, actual distance isn't of interest */
+	if ( distance < 0.95 * tolerance )
+		return distance;
+	/* Close or greater than tolerance, get the real answer to be sure */
+	return spheroid_distance(&gp1, &gp2, s);
+}
+
+/*
+** geography_distance_knn(GSERIALIZED *g1, GSERIALIZED *g2)
+** returns double distance in meters over the sphere, the exact
+** value the GiST index rechecks its box-based ordering against
+*/
 PG_FUNCTION_INFO_V1(geography_distance_knn);
 Datum geography_distance_knn(PG_FUNCTION_ARGS)
 {
-	LWGEOM *lwgeom1 = NULL;
-	LWGEOM *lwgeom2 = NULL;
 	GSERIALIZED *g1 = NULL;
 	GSERIALIZED *g2 = NULL;
 	double distance;
@@ -91,28 +123,38 @@ Datum geography_distance_knn(PG_FUNCTION_ARGS)
 	if ( ! use_spheroid )
 		s.a = s.b = s.radius;
 
-	lwgeom1 = lwgeom_from_gserialized(g1);
-	lwgeom2 = lwgeom_from_gserialized(g2);
-
 	/* Return NULL on empty arguments. */
-	if ( lwgeom_is_empty(lwgeom1) || lwgeom_is_empty(lwgeom2) )
+	if ( gserialized_is_empty(g1) || gserialized_is_empty(g2) )
 	{
 		PG_FREE_IF_COPY(g1, 0);
 		PG_FREE_IF_COPY(g2, 1);
 		PG_RETURN_NULL();
 	}
 
-	/* Make sure we have boxes attached */
-	lwgeom_add_bbox_deep(lwgeom1, NULL);
-	lwgeom_add_bbox_deep(lwgeom2, NULL);
-	
-	distance = lwgeom_distance_spheroid(lwgeom1, lwgeom2, &s, tolerance);
+	/* Point/point needs neither a tree nor a deserialization */
+	if ( gserialized_get_type(g1) == POINTTYPE && gserialized_get_type(g2) == POINTTYPE )
+	{
+		distance = geography_distance_point_point(g1, g2, &s, tolerance);
+	}
+	/* An index scan repeats the query argument for every recheck, */
+	/* so its circular tree is built once and kept in the cache */
+	else if ( LW_FAILURE == geography_distance_cache(fcinfo, g1, g2, &s, &distance) )
+	{
+		LWGEOM *lwgeom1 = lwgeom_from_gserialized(g1);
+		LWGEOM *lwgeom2 = lwgeom_from_gserialized(g2);
+
+		/* Make sure we have boxes attached */
+		lwgeom_add_bbox_deep(lwgeom1, NULL);
+		lwgeom_add_bbox_deep(lwgeom2, NULL);
+
+		distance = lwgeom_distance_spheroid(lwgeom1, lwgeom2, &s, tolerance);
+		lwgeom_free(lwgeom1);
+		lwgeom_free(lwgeom2);
+	}
 
 	POSTGIS_DEBUGF(2, "[GIST] '%s' got distance %g", __func__, distance);
 
 	/* Clean up */
-	lwgeom_free(lwgeom1);
-	lwgeom_free(lwgeom2);
 	PG_FREE_IF_COPY(g1, 0);
 	PG_FREE_IF_COPY(g2, 1);
 
@@ -240,8 +282,13 @@ Datum geography_distance(PG_FUNCTION_ARGS)
 		PG_RETURN_NULL();
 	}
 	
+	/* Point/point needs neither a tree nor a deserialization */
+	if ( gserialized_get_type(g1) == POINTTYPE && gserialized_get_type(g2) == POINTTYPE )
+	{
+		distance = geography_distance_point_point(g1, g2, &s, tolerance);
+	}
 	/* Do the brute force calculation if the cached calculation doesn't tick over */
-	if ( LW_FAILURE == geography_distance_cache(fcinfo, g1, g2, &s, &distance) )
+	else if ( LW_FAILURE == geography_distance_cache(fcinfo, g1, g2, &s, &distance) )
 	{
 		LWGEOM* lwgeom1 = lwgeom_from_gserialized(g1);
 		LWGEOM* lwgeom2 = lwgeom_from_gserialized(g2);
@@ -268,6 +315,143 @@ Datum geography_distance(PG_FUNCTION_ARGS)
 }
 
 
+/**
+* Collect the points of a geography[] into pa, recording in index the
+* position in pa of each array element, or -1 for NULLs and empties.
+* All elements must be points sharing one SRID, which is returned in srid.
+*/
+static void geography_array_points(ArrayType *array, POINTARRAY *pa, int *index, int *srid)
+{
+	ArrayIterator iterator;
+	Datum value;
+	bool isnull;
+	int i = 0;
+
+#if POSTGIS_PGSQL_VERSION >= 95
+	iterator = array_create_iterator(array, 0, NULL);
+#else
+	iterator = array_create_iterator(array, 0);
+#endif
+
+	while( array_iterate(iterator, &value, &isnull) )
+	{
+		GSERIALIZED *g;
+		POINT4D pt;
+
+		index[i] = -1;
+		if ( ! isnull )
+		{
+			g = (GSERIALIZED *)DatumGetPointer(value);
+
+			if ( gserialized_get_type(g) != POINTTYPE )
+				elog(ERROR, "ST_DistanceMatrix: only point geographies are supported, got %s",
+				     lwtype_name(gserialized_get_type(g)));
+
+			if ( *srid == SRID_UNKNOWN )
+				*srid = gserialized_get_srid(g);
+			else
+				error_if_srid_mismatch(gserialized_get_srid(g), *srid);
+
+			if ( gserialized_peek_first_point(g, &pt) == LW_SUCCESS )
+			{
+				ptarray_append_point(pa, &pt, LW_TRUE);
+				index[i] = pa->npoints - 1;
+			}
+		}
+		i++;
+	}
+	array_free_iterator(iterator);
+}
+
+/*
+** geography_distance_matrix(geography[] a1, geography[] a2, boolean use_spheroid)
+** returns a two dimensional double[] of the distances in meters between
+** every point of a1 (rows) and every point of a2 (columns)
+*/
+PG_FUNCTION_INFO_V1(geography_distance_matrix);
+Datum geography_distance_matrix(PG_FUNCTION_ARGS)
+{
+	ArrayType *array1 = PG_GETARG_ARRAYTYPE_P(0);
+	ArrayType *array2 = PG_GETARG_ARRAYTYPE_P(1);
+	bool use_spheroid = true;
+	int n1, n2;
+	int *index1, *index2;
+	int srid = SRID_UNKNOWN;
+	POINTARRAY *pa1, *pa2;
+	double *matrix;
+	Datum *cells;
+	bool *nulls;
+	int dims[2], lbs[2] = {1, 1};
+	int i, j;
+	SPHEROID s;
+
+	if ( PG_NARGS() > 2 && ! PG_ARGISNULL(2) )
+		use_spheroid = PG_GETARG_BOOL(2);
+
+	n1 = ArrayGetNItems(ARR_NDIM(array1), ARR_DIMS(array1));
+	n2 = ArrayGetNItems(ARR_NDIM(array2), ARR_DIMS(array2));
+
+	if ( n1 == 0 || n2 == 0 )
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT8OID));
+
+	if ( (Size)n1 * n2 > MaxAllocSize / sizeof(Datum) )
+		elog(ERROR, "ST_DistanceMatrix: %d by %d matrix is too large", n1, n2);
+
+	/* Gather the coordinates of both arguments into point arrays */
+	index1 = palloc(n1 * sizeof(int));
+	index2 = palloc(n2 * sizeof(int));
+	pa1 = ptarray_construct_empty(0, 0, n1);
+	pa2 = ptarray_construct_empty(0, 0, n2);
+	geography_array_points(array1, pa1, index1, &srid);
+	geography_array_points(array2, pa2, index2, &srid);
+
+	/* Only NULLs and empties on one side? Nothing to measure */
+	matrix = NULL;
+	if ( pa1->npoints > 0 && pa2->npoints > 0 )
+	{
+		/* Initialize spheroid */
+		spheroid_init_from_srid(fcinfo, srid, &s);
+
+		/* Set to sphere if requested */
+		if ( ! use_spheroid )
+			s.a = s.b = s.radius;
+
+		matrix = palloc((Size)pa1->npoints * pa2->npoints * sizeof(double));
+		if ( ptarray_distance_matrix_spheroid(pa1, pa2, &s, matrix) == LW_FAILURE )
+			PG_RETURN_NULL();
+	}
+
+	/* Spread the point distances over the cells, NULL for NULLs and empties */
+	cells = palloc((Size)n1 * n2 * sizeof(Datum));
+	nulls = palloc((Size)n1 * n2 * sizeof(bool));
+	for ( i = 0; i < n1; i++ )
+	{
+		for ( j = 0; j < n2; j++ )
+		{
+			Size k = (Size)i * n2 + j;
+			double distance;
+
+			if ( index1[i] < 0 || index2[j] < 0 )
+			{
+				cells[k] = (Datum) 0;
+				nulls[k] = true;
+				continue;
+			}
+
+			distance = matrix[(Size)index1[i] * pa2->npoints + index2[j]];
+			/* Knock off any funny business at the nanometer level, ticket #2168 */
+			distance = round(distance * INVMINDIST) / INVMINDIST;
+			cells[k] = Float8GetDatum(distance);
+			nulls[k] = false;
+		}
+	}
+
+	dims[0] = n1;
+	dims[1] = n2;
+	PG_RETURN_ARRAYTYPE_P(construct_md_array(cells, nulls, 2, dims, lbs,
+	                      FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd'));
+}
+
 /*
 ** geography_dwithin(GSERIALIZED *g1, GSERIALIZED *g2, double tolerance, boolean use_spheroid)
 ** returns double distance in meters
@@ -278,7 +462,6 @@ Datum geography_dwithin(PG_FUNCTION_ARGS)
 	GSERIALIZED *g1 = NULL;
 	GSERIALIZED *g2 = NULL;
 	double tolerance = 0.0;
-	double distance;
 	bool use_spheroid = true;
 	SPHEROID s;
 	int dwithin = LW_FALSE;
@@ -317,11 +500,10 @@ Datum geography_dwithin(PG_FUNCTION_ARGS)
 	{
 		LWGEOM* lwgeom1 = lwgeom_from_gserialized(g1);
 		LWGEOM* lwgeom2 = lwgeom_from_gserialized(g2);
-		distance = lwgeom_distance_spheroid(lwgeom1, lwgeom2, &s, tolerance);
+		dwithin = lwgeom_dwithin_spheroid(lwgeom1, lwgeom2, &s, tolerance);
 		/* Something went wrong... */
-		if ( distance < 0.0 )
-			elog(ERROR, "lwgeom_distance_spheroid returned negative!");
-		dwithin = (distance <= tolerance);
+		if ( dwithin < 0 )
+			elog(ERROR, "lwgeom_dwithin_spheroid returned negative!");
 		lwgeom_free(lwgeom1);
 		lwgeom_free(lwgeom2);
 	}
@@ -500,7 +682,6 @@ Datum geography_area(PG_FUNCTION_ARGS)
 {
 	LWGEOM *lwgeom = NULL;
 	GSERIALIZED *g = NULL;
-	GBOX gbox;
 	double area;
 	bool use_spheroid = LW_TRUE;
 	SPHEROID s;
@@ -522,24 +703,6 @@ Datum geography_area(PG_FUNCTION_ARGS)
 		lwgeom_free(lwgeom);
 		PG_RETURN_FLOAT8(0.0);
 	}
-	
-	if ( lwgeom->bbox )
-		gbox = *(lwgeom->bbox);
-	else
-		lwgeom_calculate_gbox_geodetic(lwgeom, &gbox);
-
-#if ! PROJ_GEODESIC
-	/* Test for cases that are currently not handled by spheroid code */
-	if ( use_spheroid )
-	{
-		/* We can't circle the poles right now */
-		if ( FP_GTEQ(gbox.zmax,1.0) || FP_LTEQ(gbox.zmin,-1.0) )
-			use_spheroid = LW_FALSE;
-		/* We can't cross the equator right now */
-		if ( gbox.zmax > 0.0 && gbox.zmin < 0.0 )
-			use_spheroid = LW_FALSE;
-	}
-#endif /* if ! PROJ_GEODESIC */
 
 	/* User requests spherical calculation, turn our spheroid into a sphere */
 	if ( ! use_spheroid )
@@ -750,12 +913,20 @@ Datum geography_covers(PG_FUNCTION_ARGS)
 		PG_RETURN_NULL();
 	}
 
+	error_if_srid_mismatch(gserialized_get_srid(g1), gserialized_get_srid(g2));
+
+	/* Repeated polygons are answered from their cell index */
+	if ( LW_SUCCESS == geography_covers_cache(fcinfo, g1, g2, &result) )
+	{
+		PG_FREE_IF_COPY(g1, 0);
+		PG_FREE_IF_COPY(g2, 1);
+		PG_RETURN_BOOL(result);
+	}
+
 	/* Construct our working geometries */
 	lwgeom1 = lwgeom_from_gserialized(g1);
 	lwgeom2 = lwgeom_from_gserialized(g2);
 
-	error_if_srid_mismatch(lwgeom1->srid, lwgeom2->srid);
-
 	/* EMPTY never intersects with another geometry */
 	if ( lwgeom_is_empty(lwgeom1) || lwgeom_is_empty(lwgeom2) )
 	{
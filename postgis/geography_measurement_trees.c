@@ -22,8 +22,30 @@
  *
  **********************************************************************/
 
+#include "postgres.h"
+#include "access/hash.h"
+#include "miscadmin.h"
+
 #include "geography_measurement_trees.h"
+#include "lwgeodetic_cells.h"
+
+/**
+* Number of slots for trees on the uncached side of a call.
+* Slots are addressed directly by the geometry hash.
+*/
+#define CIRC_TREE_CACHE_ITEMS 64
 
+/**
+* A tree built for a geometry on the uncached side of a call,
+* keyed by a copy of the geometry, which the tree points into.
+*/
+typedef struct {
+	uint32                      hash;
+	bool                        seen;
+	GSERIALIZED*                geom;
+	size_t                      geom_size;
+	CIRC_NODE*                  index;
+} CircTreeCacheItem;
 
 /*
 * Specific tree types include all the generic slots and
@@ -40,6 +62,8 @@ typedef struct {
 	size_t                      geom2_size; //
 	int32                       argnum;     // </GeomCache>
 	CIRC_NODE*                  index;
+	CircTreeCacheItem           items[CIRC_TREE_CACHE_ITEMS];
+	size_t                      items_size;
 } CircTreeGeomCache;
 
 
@@ -101,6 +125,67 @@ GetCircTreeGeomCache(FunctionCallInfoData* fcinfo, const GSERIALIZED* g1, const
 }
 
 
+/**
+* Look up a tree for a geometry on the uncached side of the call.
+* Geometries only get a tree once they show up a second time, so
+* a stream of unique values does not pay for building and copying,
+* while the repeating side of a join keeps its trees, up to
+* work_mem. Slots are first come, first served. Returns NULL when
+* no tree is available, the caller then builds a throwaway tree.
+*/
+static CIRC_NODE*
+CircTreeCacheLookup(FunctionCallInfoData* fcinfo, CircTreeGeomCache* cache, const GSERIALIZED* g)
+{
+	size_t size = VARSIZE(g);
+	uint32 hash = DatumGetUInt32(hash_any((unsigned char*)g, size));
+	CircTreeCacheItem* item = &(cache->items[hash % CIRC_TREE_CACHE_ITEMS]);
+	MemoryContext old_context;
+	LWGEOM* lwgeom;
+	size_t tree_size;
+
+	if ( item->index )
+	{
+		if ( item->hash == hash && item->geom_size == size && memcmp(item->geom, g, size) == 0 )
+			return item->index;
+		return NULL;
+	}
+
+	/* First sighting, remember it */
+	if ( ! item->seen || item->hash != hash )
+	{
+		item->hash = hash;
+		item->seen = true;
+		return NULL;
+	}
+
+	/* Repeated, build a tree on a copy, if it fits in the budget */
+	lwgeom = lwgeom_from_gserialized(g);
+	tree_size = size + lwgeom_count_vertices(lwgeom) * (2 * (sizeof(CIRC_NODE) + sizeof(CIRC_NODE*)) + sizeof(POINT3D));
+	lwgeom_free(lwgeom);
+	if ( cache->items_size + tree_size > (size_t) work_mem * 1024L )
+		return NULL;
+
+	old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+	item->geom = palloc(size);
+	memcpy(item->geom, g, size);
+	item->geom_size = size;
+	lwgeom = lwgeom_from_gserialized(item->geom);
+	item->index = lwgeom_calculate_circ_tree(lwgeom);
+	lwgeom_free(lwgeom);
+	MemoryContextSwitchTo(old_context);
+
+	if ( ! item->index )
+	{
+		pfree(item->geom);
+		item->geom = NULL;
+		item->geom_size = 0;
+		return NULL;
+	}
+	cache->items_size += tree_size;
+	POSTGIS_DEBUGF(3, "cached tree for uncached argument in slot %u, %zu bytes in use", hash % CIRC_TREE_CACHE_ITEMS, cache->items_size);
+	return item->index;
+}
+
 static int
 CircTreePIP(const CIRC_NODE* tree1, const GSERIALIZED* g1, const POINT4D* in_point)
 {
@@ -180,6 +265,7 @@ geography_distance_cache_tolerance(FunctionCallInfoData* fcinfo, const GSERIALIZ
 	{
 		CIRC_NODE* circtree_cached = tree_cache->index;
 		CIRC_NODE* circtree = NULL;
+		int circtree_owned = LW_FALSE;
 		const GSERIALIZED* g_cached;
 		const GSERIALIZED* g;
 		LWGEOM* lwgeom = NULL;
@@ -220,7 +306,13 @@ geography_distance_cache_tolerance(FunctionCallInfoData* fcinfo, const GSERIALIZ
 			}
 		}
 		
-		circtree = lwgeom_calculate_circ_tree(lwgeom);
+		/* Reuse the tree of the other side too, when it repeats */
+		circtree = CircTreeCacheLookup(fcinfo, tree_cache, g);
+		if ( ! circtree )
+		{
+			circtree = lwgeom_calculate_circ_tree(lwgeom);
+			circtree_owned = LW_TRUE;
+		}
 		if ( geomtype == POLYGONTYPE || geomtype == MULTIPOLYGONTYPE )
 		{
 			POINT2D p2d;
@@ -230,14 +322,16 @@ geography_distance_cache_tolerance(FunctionCallInfoData* fcinfo, const GSERIALIZ
 			if ( CircTreePIP(circtree, g, &p4d) )
 			{
 				*distance = 0.0;
-				circ_tree_free(circtree);
+				if ( circtree_owned )
+					circ_tree_free(circtree);
 				lwgeom_free(lwgeom);
 				return LW_SUCCESS;
 			}
 		}
 
 		*distance = circ_tree_distance_tree(circtree_cached, circtree, s, tolerance);
-		circ_tree_free(circtree);
+		if ( circtree_owned )
+			circ_tree_free(circtree);
 		lwgeom_free(lwgeom);	
 		return LW_SUCCESS;
 	}
@@ -272,6 +366,186 @@ geography_dwithin_cache(FunctionCallInfoData* fcinfo, const GSERIALIZED* g1, con
 	return LW_FAILURE;
 }
 	
+/**
+* Number of exact covers tests run against a repeated polygon before
+* its cell index is built, roughly what building the index costs
+* relative to one exact test, so polygons that only repeat a few
+* times never pay for it.
+*/
+#define CELL_INDEX_PROBES 128
+
+typedef struct {
+	int                     type;       // <GeomCache>
+	GSERIALIZED*                geom1;      //
+	GSERIALIZED*                geom2;      //
+	size_t                      geom1_size; //
+	size_t                      geom2_size; //
+	int32                       argnum;     // </GeomCache>
+	CELL_INDEX*                 index;
+	int                         probes;
+} CellIndexGeomCache;
+
+/**
+* The index is built lazily by geography_covers_cache, the builder
+* only starts counting the calls on a newly repeated polygon. A
+* negative count means the index of this polygon does not fit in
+* work_mem.
+*/
+static int
+CellIndexBuilder(const LWGEOM* lwgeom, GeomCache* cache)
+{
+	CellIndexGeomCache* cell_cache = (CellIndexGeomCache*)cache;
+	if ( cell_cache->index )
+	{
+		cell_index_free(cell_cache->index);
+		cell_cache->index = NULL;
+	}
+	cell_cache->probes = 0;
+	return LW_SUCCESS;
+}
+
+static int
+CellIndexFreer(GeomCache* cache)
+{
+	CellIndexGeomCache* cell_cache = (CellIndexGeomCache*)cache;
+	if ( cell_cache->index )
+	{
+		cell_index_free(cell_cache->index);
+		cell_cache->index = NULL;
+	}
+	cell_cache->probes = 0;
+	cell_cache->argnum = 0;
+	return LW_SUCCESS;
+}
+
+static GeomCache*
+CellIndexAllocator(void)
+{
+	CellIndexGeomCache* cache = palloc(sizeof(CellIndexGeomCache));
+	memset(cache, 0, sizeof(CellIndexGeomCache));
+	return (GeomCache*)cache;
+}
+
+static GeomCacheMethods CellIndexCacheMethods =
+{
+	CELL_CACHE_ENTRY,
+	CellIndexBuilder,
+	CellIndexFreer,
+	CellIndexAllocator
+};
+
+/**
+* Answer polygon covers (multi)point and multipolygon covers point
+* from the cell index of a repeated first argument. Returns LW_FAILURE
+* when there is no index (yet) or a point is too close to the boundary
+* to call, and the caller should run the exact test.
+*/
+int
+geography_covers_cache(FunctionCallInfoData* fcinfo, const GSERIALIZED* g1, const GSERIALIZED* g2, int* covers)
+{
+	CellIndexGeomCache* cache;
+	int type1 = gserialized_get_type(g1);
+	int type2 = gserialized_get_type(g2);
+	POINT4D p4d;
+	POINT2D pt;
+	size_t index_size;
+	int rv;
+
+	if ( ! (type1 == POLYGONTYPE || type1 == MULTIPOLYGONTYPE) ||
+	     ! (type2 == POINTTYPE || type2 == MULTIPOINTTYPE) ||
+	     gserialized_is_empty(g1) || gserialized_is_empty(g2) )
+		return LW_FAILURE;
+
+	/* The index covers the union of the parts, while the exact test */
+	/* wants all the points in a single part */
+	if ( type1 == MULTIPOLYGONTYPE && type2 == MULTIPOINTTYPE )
+		return LW_FAILURE;
+
+	/* Only the polygon side is worth an index */
+	cache = (CellIndexGeomCache*)GetGeomCache(fcinfo, &CellIndexCacheMethods, g1, NULL);
+	if ( ! cache || cache->argnum != 1 )
+		return LW_FAILURE;
+
+	if ( ! cache->index )
+	{
+		MemoryContext old_context;
+		LWGEOM* lwgeom;
+
+		if ( cache->probes < 0 || ++(cache->probes) < CELL_INDEX_PROBES )
+			return LW_FAILURE;
+
+		/* Edge ends alone take this much, give up before building */
+		lwgeom = lwgeom_from_gserialized(cache->geom1);
+		index_size = 2 * sizeof(POINT3D) * lwgeom_count_vertices(lwgeom);
+		lwgeom_free(lwgeom);
+		if ( index_size > (size_t) work_mem * 1024L )
+		{
+			cache->probes = -1;
+			return LW_FAILURE;
+		}
+
+		old_context = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+		lwgeom = lwgeom_from_gserialized(cache->geom1);
+		cache->index = lwgeom_calculate_cell_index(lwgeom);
+		lwgeom_free(lwgeom);
+		MemoryContextSwitchTo(old_context);
+
+		if ( ! cache->index )
+			return LW_FAILURE;
+
+		/* Keep it only if it fits in work_mem, like the circle trees */
+		index_size = sizeof(CELL_INDEX) +
+		             2 * sizeof(POINT3D) * cache->index->num_edges +
+		             sizeof(CELL_NODE) * cache->index->max_nodes +
+		             sizeof(int) * cache->index->max_edge_ids;
+		if ( index_size > (size_t) work_mem * 1024L )
+		{
+			cell_index_free(cache->index);
+			cache->index = NULL;
+			cache->probes = -1;
+			return LW_FAILURE;
+		}
+		POSTGIS_DEBUGF(3, "built cell index of %d nodes", cache->index->num_nodes);
+	}
+
+	if ( type2 == POINTTYPE )
+	{
+		gserialized_peek_first_point(g2, &p4d);
+		pt.x = p4d.x;
+		pt.y = p4d.y;
+		rv = cell_index_contains_point(cache->index, &pt);
+		if ( rv < 0 )
+			return LW_FAILURE;
+		*covers = rv;
+	}
+	else
+	{
+		/* Covered only if every point is */
+		LWMPOINT* mpoint = lwgeom_as_lwmpoint(lwgeom_from_gserialized(g2));
+		int i;
+		*covers = LW_TRUE;
+		for ( i = 0; i < mpoint->ngeoms; i++ )
+		{
+			if ( lwgeom_is_empty(lwpoint_as_lwgeom(mpoint->geoms[i])) )
+				continue;
+			pt = getPoint2d(mpoint->geoms[i]->point, 0);
+			rv = cell_index_contains_point(cache->index, &pt);
+			if ( rv < 0 )
+			{
+				lwmpoint_free(mpoint);
+				return LW_FAILURE;
+			}
+			if ( ! rv )
+			{
+				*covers = LW_FALSE;
+				break;
+			}
+		}
+		lwmpoint_free(mpoint);
+	}
+	return LW_SUCCESS;
+}
+
 int
 geography_tree_distance(const GSERIALIZED* g1, const GSERIALIZED* g2, const SPHEROID* s, double tolerance, double* distance)
 {
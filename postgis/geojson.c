@@ -0,0 +1,263 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+#include "geojson.h"
+#include "lwgeom_export.h"
+#include "utils/json.h"
+#include "utils/memutils.h"
+
+/**
+ * @file
+ * GeoJSON FeatureCollection encoder
+ *
+ * Rows are written as Features one after the other into the collection
+ * buffer, geometries straight through the liblwgeom GeoJSON writer, so
+ * that the finished buffer is the result text.
+ */
+
+/**
+ * Map the row type to properties, assuming static schema.
+ */
+static void encode_columns(struct geojson_agg_context *ctx)
+{
+	Oid tupType = HeapTupleHeaderGetTypeId(ctx->row);
+	int32 tupTypmod = HeapTupleHeaderGetTypMod(ctx->row);
+	TupleDesc tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
+	int natts = tupdesc->natts;
+	struct geojson_column *columns;
+	bool geom_name_found = false;
+	bool typisvarlena;
+	StringInfoData key;
+	uint32_t i, k = 0;
+
+	columns = palloc(sizeof(*columns) * Max(natts, 1));
+	for (i = 0; i < natts; i++) {
+		char *name = tupdesc->attrs[i]->attname.data;
+		if (tupdesc->attrs[i]->attisdropped)
+			continue;
+		if (strcmp(name, ctx->geom_name) == 0) {
+			ctx->geom_index = i;
+			geom_name_found = true;
+			continue;
+		}
+		initStringInfo(&key);
+		escape_json(&key, name);
+		appendStringInfoChar(&key, ':');
+		columns[k].key = key.data;
+		columns[k].attnum = i + 1;
+		columns[k].typoid = getBaseType(tupdesc->attrs[i]->atttypid);
+		getTypeOutputInfo(columns[k].typoid, &columns[k].foutoid, &typisvarlena);
+		k++;
+	}
+	ReleaseTupleDesc(tupdesc);
+
+	if (!geom_name_found)
+		lwerror("geojson_agg_transfn: no column '%s' found",
+			ctx->geom_name);
+
+	ctx->columns = columns;
+	ctx->n_columns = k;
+}
+
+/**
+ * Write the FeatureCollection members ahead of the features, with the
+ * crs of the first geometry when asked for.
+ */
+static void encode_header(struct geojson_agg_context *ctx, int srid)
+{
+	StringInfo s = &ctx->collection;
+	char *srs = NULL;
+
+	appendStringInfoString(s, "{\"type\":\"FeatureCollection\",");
+
+	if ((ctx->options & 2 || ctx->options & 4) && srid != SRID_UNKNOWN) {
+		if (ctx->options & 2)
+			srs = getSRSbySRID(srid, true);
+		if (ctx->options & 4)
+			srs = getSRSbySRID(srid, false);
+		if (!srs)
+			lwerror("SRID %i unknown in spatial_ref_sys table", srid);
+		appendStringInfoString(s, "\"crs\":{\"type\":\"name\",\"properties\":{\"name\":");
+		escape_json(s, srs);
+		appendStringInfoString(s, "}},");
+	}
+
+	appendStringInfoString(s, "\"features\":[");
+}
+
+/**
+ * Write the geometry with the liblwgeom writer, straight into the
+ * collection buffer.
+ */
+static void encode_geometry(struct geojson_agg_context *ctx,
+	const LWGEOM *lwgeom)
+{
+	StringInfo s = &ctx->collection;
+	int has_bbox = ctx->options & 1;
+
+	enlargeStringInfo(s, lwgeom_to_geojson_size(lwgeom, NULL,
+		ctx->precision, has_bbox));
+	s->len += lwgeom_to_geojson_buf(lwgeom, NULL, s->data + s->len,
+		ctx->precision, has_bbox);
+}
+
+/**
+ * Numbers are written as is, except the non finite ones JSON has no
+ * literal for, which are quoted as to_json does.
+ */
+static void encode_number(StringInfo s, const char *number)
+{
+	if (strcmp(number, "NaN") == 0 || strstr(number, "Infinity"))
+		escape_json(s, number);
+	else
+		appendStringInfoString(s, number);
+}
+
+/**
+ * Write the row values other than the geometry as the properties
+ * object, in column order.
+ */
+static void encode_properties(struct geojson_agg_context *ctx)
+{
+	StringInfo s = &ctx->collection;
+	uint32_t i;
+
+	appendStringInfoChar(s, '{');
+	for (i = 0; i < ctx->n_columns; i++) {
+		struct geojson_column *column = &ctx->columns[i];
+		bool isnull;
+		Datum datum;
+
+		if (i > 0)
+			appendStringInfoChar(s, ',');
+		appendStringInfoString(s, column->key);
+
+		datum = GetAttributeByNum(ctx->row, column->attnum, &isnull);
+		if (isnull) {
+			appendStringInfoString(s, "null");
+			continue;
+		}
+
+		switch (column->typoid) {
+		case BOOLOID:
+			appendStringInfoString(s, DatumGetBool(datum) ? "true" : "false");
+			break;
+		case INT2OID:
+			appendStringInfo(s, "%d", DatumGetInt16(datum));
+			break;
+		case INT4OID:
+			appendStringInfo(s, "%d", DatumGetInt32(datum));
+			break;
+		case INT8OID:
+			appendStringInfo(s, INT64_FORMAT, DatumGetInt64(datum));
+			break;
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+			encode_number(s, OidOutputFunctionCall(column->foutoid, datum));
+			break;
+		case JSONOID:
+#if POSTGIS_PGSQL_VERSION >= 94
+		case JSONBOID:
+#endif
+			appendStringInfoString(s,
+				OidOutputFunctionCall(column->foutoid, datum));
+			break;
+		case TEXTOID:
+			escape_json(s, TextDatumGetCString(datum));
+			break;
+		default:
+			escape_json(s, OidOutputFunctionCall(column->foutoid, datum));
+		}
+	}
+	appendStringInfoChar(s, '}');
+}
+
+/**
+ * Initialize aggregation context.
+ */
+void geojson_agg_init_context(struct geojson_agg_context *ctx)
+{
+	ctx->columns = NULL;
+	ctx->n_columns = 0;
+	initStringInfo(&ctx->collection);
+	appendBinaryStringInfo(&ctx->collection, "\0\0\0\0", VARHDRSZ);
+	ctx->n_features = 0;
+	ctx->row_context = AllocSetContextCreate(CurrentMemoryContext,
+		"ST_AsGeoJSONFeatureCollection row context",
+		ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE,
+		ALLOCSET_DEFAULT_MAXSIZE);
+}
+
+/**
+ * Aggregation step.
+ *
+ * Appends the row as a Feature to the collection buffer.
+ */
+void geojson_agg_transfn(struct geojson_agg_context *ctx)
+{
+	MemoryContext oldcontext;
+	LWGEOM *lwgeom = NULL;
+	bool isnull;
+	Datum datum;
+
+	/* inspect row and encode columns assuming static schema */
+	if (!ctx->columns)
+		encode_columns(ctx);
+
+	/* The collection buffer grows in the aggregate context it was made in */
+	oldcontext = MemoryContextSwitchTo(ctx->row_context);
+
+	datum = GetAttributeByNum(ctx->row, ctx->geom_index + 1, &isnull);
+	if (!isnull)
+		lwgeom = lwgeom_from_gserialized((GSERIALIZED *) PG_DETOAST_DATUM(datum));
+
+	if (ctx->n_features == 0)
+		encode_header(ctx, lwgeom ? lwgeom->srid : SRID_UNKNOWN);
+	else
+		appendStringInfoChar(&ctx->collection, ',');
+
+	appendStringInfoString(&ctx->collection,
+		"{\"type\":\"Feature\",\"geometry\":");
+	if (lwgeom)
+		encode_geometry(ctx, lwgeom);
+	else
+		appendStringInfoString(&ctx->collection, "null");
+	appendStringInfoString(&ctx->collection, ",\"properties\":");
+	encode_properties(ctx);
+	appendStringInfoChar(&ctx->collection, '}');
+	ctx->n_features++;
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextReset(ctx->row_context);
+}
+
+/**
+ * Finalize aggregation.
+ *
+ * Closes the collection, whose buffer becomes the result text.
+ */
+text *geojson_agg_finalfn(struct geojson_agg_context *ctx)
+{
+	appendStringInfoString(&ctx->collection, "]}");
+	SET_VARSIZE(ctx->collection.data, ctx->collection.len);
+	return (text *) ctx->collection.data;
+}
@@ -0,0 +1,64 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+#ifndef GEOJSON_H_
+#define GEOJSON_H_ 1
+
+#include <stdlib.h>
+#include "postgres.h"
+#include "utils/builtins.h"
+#include "utils/typcache.h"
+#include "utils/lsyscache.h"
+#include "catalog/pg_type.h"
+#include "access/htup_details.h"
+#include "access/htup.h"
+#include "lib/stringinfo.h"
+#include "../postgis_config.h"
+#include "liblwgeom.h"
+#include "lwgeom_pg.h"
+#include "lwgeom_log.h"
+
+struct geojson_column {
+	/* Escaped member name, with its colon */
+	char *key;
+	uint32_t attnum;
+	Oid typoid;
+	Oid foutoid;
+};
+
+struct geojson_agg_context {
+	char *geom_name;
+	uint32_t geom_index;
+	int precision;
+	int options;
+	HeapTupleHeader row;
+	struct geojson_column *columns;
+	uint32_t n_columns;
+	/* FeatureCollection written so far, behind room for the varlena header */
+	StringInfoData collection;
+	uint64_t n_features;
+	MemoryContext row_context;
+};
+
+void geojson_agg_init_context(struct geojson_agg_context *ctx);
+void geojson_agg_transfn(struct geojson_agg_context *ctx);
+text *geojson_agg_finalfn(struct geojson_agg_context *ctx);
+
+#endif
@@ -63,11 +63,20 @@ dimensionality cases. (2D geometry) &&& (3D column), etc.
 #include "executor/spi.h"
 #include "fmgr.h"
 #include "commands/vacuum.h"
+#include "nodes/nodeFuncs.h"
 #include "nodes/relation.h"
+#include "optimizer/cost.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
 #include "parser/parsetree.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
 #include "utils/array.h"
 #include "utils/lsyscache.h"
 #include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
 #include "utils/syscache.h"
 #include "utils/rel.h"
 #include "utils/selfuncs.h"
@@ -105,10 +114,15 @@ Datum gserialized_estimated_extent(PG_FUNCTION_ARGS);
 Datum _postgis_gserialized_sel(PG_FUNCTION_ARGS);
 Datum _postgis_gserialized_joinsel(PG_FUNCTION_ARGS);
 Datum _postgis_gserialized_stats(PG_FUNCTION_ARGS);
+Datum _postgis_gserialized_vertex_stats(PG_FUNCTION_ARGS);
 
 /* Old Prototype */
 Datum geometry_estimated_extent(PG_FUNCTION_ARGS);
 
+/* Planner hook, installed at module load */
+void gserialized_cost_hook_install(void);
+void gserialized_cost_hook_uninstall(void);
+
 /**
 * Assign a number to the n-dimensional statistics kind
 *
@@ -121,8 +135,10 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS);
 */
 #define STATISTIC_KIND_ND 102
 #define STATISTIC_KIND_2D 103
+#define STATISTIC_KIND_VERTICES 104
 #define STATISTIC_SLOT_ND 0
 #define STATISTIC_SLOT_2D 1
+#define STATISTIC_SLOT_VERTICES 2
 
 /*
 * The SD factor restricts the side of the statistics histogram
@@ -221,6 +237,28 @@ typedef struct ND_STATS_T
 	float4 value[1];
 } ND_STATS;
 
+/**
+* Vertex count statistics, gathered at ANALYZE time next to the
+* histograms so the planner knows how expensive per-row geometry
+* processing on a column is going to be.
+*/
+typedef struct VERTEX_STATS_T
+{
+	/* How many not-Null/Empty features were in the sample? */
+	float4 sample_features;
+
+	/* Average number of vertices per feature */
+	float4 avg;
+
+	/* Vertex count percentiles */
+	float4 p50;
+	float4 p90;
+	float4 p99;
+
+	/* Largest vertex count in the sample */
+	float4 max;
+} VERTEX_STATS;
+
 
 
 
@@ -449,6 +487,29 @@ nd_stats_to_json(const ND_STATS *nd_stats)
 	return str;
 }	
 
+/**
+* Convert a #VERTEX_STATS to JSON for easy printing
+*/
+static char*
+vertex_stats_to_json(const VERTEX_STATS *vx_stats)
+{
+	char *str;
+	stringbuffer_t *sb = stringbuffer_create();
+
+	stringbuffer_append(sb, "{");
+	stringbuffer_aprintf(sb, "\"sample_features\":%d,", (int)roundf(vx_stats->sample_features));
+	stringbuffer_aprintf(sb, "\"avg\":%g,", vx_stats->avg);
+	stringbuffer_aprintf(sb, "\"p50\":%d,", (int)roundf(vx_stats->p50));
+	stringbuffer_aprintf(sb, "\"p90\":%d,", (int)roundf(vx_stats->p90));
+	stringbuffer_aprintf(sb, "\"p99\":%d,", (int)roundf(vx_stats->p99));
+	stringbuffer_aprintf(sb, "\"max\":%d", (int)roundf(vx_stats->max));
+	stringbuffer_append(sb, "}");
+
+	str = stringbuffer_getstringcopy(sb);
+	stringbuffer_destroy(sb);
+	return str;
+}
+
 
 /**
 * Create a printable view of the #ND_STATS histogram.
@@ -845,17 +906,25 @@ pg_nd_stats_from_tuple(HeapTuple stats_tuple, int mode)
 }
 
 /**
-* Pull the stats object from the PgSQL system catalogs. Used
-* by the selectivity functions and the debugging functions.
+* Which pg_statistic row of an inheritance parent to read.
+* STATS_TREE is what examine_variable picks for an inherited
+* scan, the planner has no parent only fallback there.
 */
-static ND_STATS*
-pg_get_nd_stats(const Oid table_oid, AttrNumber att_num, int mode, bool only_parent)
+#define STATS_TREE_OR_PARENT 0 /* whole tree, else parent only */
+#define STATS_PARENT 1         /* parent only */
+#define STATS_TREE 2           /* whole tree only */
+
+/**
+* Pull the pg_statistic row for a column, as selected by scope.
+* Caller must release the tuple with ReleaseSysCache.
+*/
+static HeapTuple
+pg_get_stats_tuple(const Oid table_oid, AttrNumber att_num, int scope)
 {
 	HeapTuple stats_tuple = NULL;
-	ND_STATS *nd_stats;
 
 	/* First pull the stats tuple for the whole tree */
-	if ( ! only_parent )
+	if ( scope != STATS_PARENT )
 	{
 		POSTGIS_DEBUGF(2, "searching whole tree stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
 		stats_tuple = SearchSysCache3(STATRELATT, table_oid, att_num, TRUE);
@@ -863,7 +932,7 @@ pg_get_nd_stats(const Oid table_oid, AttrNumber att_num, int mode, bool only_par
 			POSTGIS_DEBUGF(2, "found whole tree stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
 	}
 	/* Fall-back to main table stats only, if not found for whole tree or explicitly ignored */
-	if ( only_parent || ! stats_tuple )
+	if ( scope == STATS_PARENT || ( scope == STATS_TREE_OR_PARENT && ! stats_tuple ) )
 	{
 		POSTGIS_DEBUGF(2, "searching parent table stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
 		stats_tuple = SearchSysCache2(STATRELATT, table_oid, att_num);
@@ -873,9 +942,25 @@ pg_get_nd_stats(const Oid table_oid, AttrNumber att_num, int mode, bool only_par
 	if ( ! stats_tuple )
 	{
 		POSTGIS_DEBUGF(2, "stats for \"%s\" do not exist", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
-		return NULL;
 	}
 
+	return stats_tuple;
+}
+
+/**
+* Pull the stats object from the PgSQL system catalogs. Used
+* by the selectivity functions and the debugging functions.
+*/
+static ND_STATS*
+pg_get_nd_stats(const Oid table_oid, AttrNumber att_num, int mode, int scope)
+{
+	HeapTuple stats_tuple;
+	ND_STATS *nd_stats;
+
+	stats_tuple = pg_get_stats_tuple(table_oid, att_num, scope);
+	if ( ! stats_tuple )
+		return NULL;
+
 	nd_stats = pg_nd_stats_from_tuple(stats_tuple, mode);
 	ReleaseSysCache(stats_tuple);
 	if ( ! nd_stats )
@@ -918,7 +1003,213 @@ pg_get_nd_stats_by_name(const Oid table_oid, const text *att_text, int mode, boo
 		return NULL;
 	}
 	
-	return pg_get_nd_stats(table_oid, att_num, mode, only_parent);
+	return pg_get_nd_stats(table_oid, att_num, mode, only_parent ? STATS_PARENT : STATS_TREE_OR_PARENT);
+}
+
+/**
+* Pull the vertex count statistics from the PgSQL system catalogs.
+* Returns NULL when the column was analyzed by an older PostGIS
+* or has not been analyzed at all.
+*/
+static VERTEX_STATS*
+pg_get_vertex_stats(const Oid table_oid, AttrNumber att_num, int scope)
+{
+	HeapTuple stats_tuple;
+	VERTEX_STATS *vx_stats = NULL;
+	float4 *floatptr;
+	int nvalues;
+
+	stats_tuple = pg_get_stats_tuple(table_oid, att_num, scope);
+	if ( ! stats_tuple )
+		return NULL;
+
+	if ( get_attstatsslot(stats_tuple, 0, 0, STATISTIC_KIND_VERTICES, InvalidOid,
+	                      NULL, NULL, NULL, &floatptr, &nvalues) )
+	{
+		if ( nvalues * sizeof(float4) == sizeof(VERTEX_STATS) )
+		{
+			vx_stats = palloc(sizeof(VERTEX_STATS));
+			memcpy(vx_stats, floatptr, sizeof(VERTEX_STATS));
+		}
+		free_attstatsslot(0, NULL, 0, floatptr, nvalues);
+	}
+	ReleaseSysCache(stats_tuple);
+
+	return vx_stats;
+}
+
+/**
+* Backend cache of the decoded histograms, keyed on relation,
+* attribute, mode and inheritance. Planning a query with many
+* spatial clauses would otherwise fetch and copy the same
+* histograms for every clause and join path.
+*
+* Any change to pg_statistic (ANALYZE, column drops, ...) flags the
+* whole cache as invalid, and it is flushed on the next lookup.
+* Lookups hand out palloc'ed copies, so a flush in the middle of an
+* estimate never pulls a histogram from under its caller.
+*/
+typedef struct
+{
+	Oid relid;
+	AttrNumber attnum;
+	int16 mode;
+	int16 scope;
+} ND_STATS_CACHE_KEY;
+
+typedef struct
+{
+	ND_STATS_CACHE_KEY key;   /* must be first */
+	ND_STATS *nd_stats;       /* NULL when there are no stats */
+	VERTEX_STATS *vx_stats;   /* Only used under ND_STATS_CACHE_VERTICES */
+} ND_STATS_CACHE_ENTRY;
+
+#define ND_STATS_CACHE_SIZE 32
+
+/* Cache key mode for the vertex count statistics */
+#define ND_STATS_CACHE_VERTICES -1
+
+static HTAB *nd_stats_cache = NULL;
+static MemoryContext nd_stats_cache_context = NULL;
+static bool nd_stats_cache_valid = FALSE;
+
+static void
+nd_stats_cache_invalidate(Datum arg, int cacheid, uint32 hashvalue)
+{
+	/* Entries may be in use by the running estimate, just flag them */
+	nd_stats_cache_valid = FALSE;
+}
+
+static void
+nd_stats_cache_reset(void)
+{
+	HASHCTL ctl;
+
+	if ( ! nd_stats_cache_context )
+	{
+		nd_stats_cache_context = AllocSetContextCreate(CacheMemoryContext,
+		                                               "PostGIS ND_STATS cache",
+		                                               ALLOCSET_SMALL_MINSIZE,
+		                                               ALLOCSET_SMALL_INITSIZE,
+		                                               ALLOCSET_SMALL_MAXSIZE);
+		CacheRegisterSyscacheCallback(STATRELATT, nd_stats_cache_invalidate, (Datum) 0);
+	}
+	else
+	{
+		/* Takes the hash table down along with the histograms */
+		MemoryContextReset(nd_stats_cache_context);
+	}
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(ND_STATS_CACHE_KEY);
+	ctl.entrysize = sizeof(ND_STATS_CACHE_ENTRY);
+	ctl.hash = tag_hash;
+	ctl.hcxt = nd_stats_cache_context;
+
+	nd_stats_cache = hash_create("PostGIS ND_STATS cache", ND_STATS_CACHE_SIZE, &ctl,
+	                             HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+	nd_stats_cache_valid = TRUE;
+}
+
+static size_t
+nd_stats_size(const ND_STATS *nd_stats)
+{
+	return sizeof(ND_STATS) + ((int)(nd_stats->histogram_cells) - 1) * sizeof(float4);
+}
+
+/**
+* Cached version of pg_get_nd_stats. The caller gets its own
+* palloc'ed copy of the histogram, and should pfree it.
+*/
+static ND_STATS*
+pg_get_nd_stats_cached(const Oid table_oid, AttrNumber att_num, int mode, int scope)
+{
+	ND_STATS_CACHE_KEY key;
+	ND_STATS_CACHE_ENTRY *entry;
+	ND_STATS *nd_stats;
+
+	if ( ! nd_stats_cache_valid )
+		nd_stats_cache_reset();
+
+	/* Padding is part of the hashed key */
+	memset(&key, 0, sizeof(key));
+	key.relid = table_oid;
+	key.attnum = att_num;
+	key.mode = mode;
+	key.scope = scope;
+
+	entry = hash_search(nd_stats_cache, &key, HASH_FIND, NULL);
+	if ( entry )
+	{
+		POSTGIS_DEBUGF(3, "cached stats for attribute %d of \"%s\"", att_num, get_rel_name(table_oid));
+		if ( ! entry->nd_stats )
+			return NULL;
+		nd_stats = palloc(nd_stats_size(entry->nd_stats));
+		memcpy(nd_stats, entry->nd_stats, nd_stats_size(entry->nd_stats));
+		return nd_stats;
+	}
+
+	/* Reading the catalogs can process invalidations */
+	nd_stats = pg_get_nd_stats(table_oid, att_num, mode, scope);
+	if ( ! nd_stats_cache_valid )
+		return nd_stats;
+
+	entry = hash_search(nd_stats_cache, &key, HASH_ENTER, NULL);
+	entry->nd_stats = NULL;
+	entry->vx_stats = NULL;
+	if ( nd_stats )
+	{
+		entry->nd_stats = MemoryContextAlloc(nd_stats_cache_context, nd_stats_size(nd_stats));
+		memcpy(entry->nd_stats, nd_stats, nd_stats_size(nd_stats));
+	}
+
+	return nd_stats;
+}
+
+/**
+* Cached version of pg_get_vertex_stats, same ownership rules
+* as pg_get_nd_stats_cached.
+*/
+static VERTEX_STATS*
+pg_get_vertex_stats_cached(const Oid table_oid, AttrNumber att_num, int scope)
+{
+	ND_STATS_CACHE_KEY key;
+	ND_STATS_CACHE_ENTRY *entry;
+	VERTEX_STATS *vx_stats;
+
+	if ( ! nd_stats_cache_valid )
+		nd_stats_cache_reset();
+
+	memset(&key, 0, sizeof(key));
+	key.relid = table_oid;
+	key.attnum = att_num;
+	key.mode = ND_STATS_CACHE_VERTICES;
+	key.scope = scope;
+
+	entry = hash_search(nd_stats_cache, &key, HASH_FIND, NULL);
+	if ( entry )
+	{
+		if ( ! entry->vx_stats )
+			return NULL;
+		vx_stats = palloc(sizeof(VERTEX_STATS));
+		memcpy(vx_stats, entry->vx_stats, sizeof(VERTEX_STATS));
+		return vx_stats;
+	}
+
+	vx_stats = pg_get_vertex_stats(table_oid, att_num, scope);
+	if ( ! nd_stats_cache_valid )
+		return vx_stats;
+
+	entry = hash_search(nd_stats_cache, &key, HASH_ENTER, NULL);
+	entry->nd_stats = NULL;
+	entry->vx_stats = NULL;
+	if ( vx_stats )
+	{
+		entry->vx_stats = MemoryContextAlloc(nd_stats_cache_context, sizeof(VERTEX_STATS));
+		memcpy(entry->vx_stats, vx_stats, sizeof(VERTEX_STATS));
+	}
+
+	return vx_stats;
 }
 
 /**
@@ -1218,24 +1509,26 @@ Datum gserialized_gist_joinsel(PG_FUNCTION_ARGS)
 	                 get_rel_name(relid1) ? get_rel_name(relid1) : "NULL", relid1, get_rel_name(relid2) ? get_rel_name(relid2) : "NULL", relid2);
 
 	/* Pull the stats from the stats system. */
-	stats1 = pg_get_nd_stats(relid1, var1->varattno, mode, FALSE);
-	stats2 = pg_get_nd_stats(relid2, var2->varattno, mode, FALSE);
+	stats1 = pg_get_nd_stats_cached(relid1, var1->varattno, mode, STATS_TREE_OR_PARENT);
+	stats2 = pg_get_nd_stats_cached(relid2, var2->varattno, mode, STATS_TREE_OR_PARENT);
 
 	/* If we can't get stats, we have to stop here! */
 	if ( ! stats1 )
 	{
 		POSTGIS_DEBUGF(3, "unable to retrieve stats for \"%s\" Oid(%d)", get_rel_name(relid1) ? get_rel_name(relid1) : "NULL" , relid1);
+		if ( stats2 ) pfree(stats2);
 		PG_RETURN_FLOAT8(DEFAULT_ND_JOINSEL);
 	}
 	else if ( ! stats2 )
 	{
 		POSTGIS_DEBUGF(3, "unable to retrieve stats for \"%s\" Oid(%d)", get_rel_name(relid2) ? get_rel_name(relid2) : "NULL", relid2);
+		pfree(stats1);
 		PG_RETURN_FLOAT8(DEFAULT_ND_JOINSEL);
 	}
 
 	selectivity = estimate_join_selectivity(stats1, stats2);
 	POSTGIS_DEBUGF(2, "got selectivity %g", selectivity);
-	
+
 	pfree(stats1);
 	pfree(stats2);
 	PG_RETURN_FLOAT8(selectivity);
@@ -1737,6 +2030,99 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 }
 
 
+/**
+* Sort callback for the sampled vertex counts
+*/
+static int
+cmp_int_asc(const void *a, const void *b)
+{
+	int ia = *((const int*)a);
+	int ib = *((const int*)b);
+	return (ia > ib) - (ia < ib);
+}
+
+/**
+* Gather vertex count statistics (average, percentiles, maximum)
+* for the sample rows, so the planner can tell a column of points
+* from a column of huge polygons when costing per-row functions.
+* Geometries are deserialized without copying the coordinates,
+* so this stays cheap next to the histogram building.
+*/
+static void
+compute_gserialized_vertex_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+                                 int sample_rows)
+{
+	MemoryContext old_context;
+	VERTEX_STATS *vx_stats;
+	int *counts;
+	int notnull_cnt = 0;
+	double total_vertices = 0.0;
+	int i;
+
+	counts = palloc(sizeof(int) * sample_rows);
+
+	for ( i = 0; i < sample_rows; i++ )
+	{
+		Datum datum;
+		GSERIALIZED *geom;
+		LWGEOM *lwgeom;
+		bool is_null;
+
+		datum = fetchfunc(stats, i, &is_null);
+		if ( is_null )
+			continue;
+
+		geom = (GSERIALIZED *)PG_DETOAST_DATUM(datum);
+		if ( gserialized_is_empty(geom) )
+		{
+			if ( (Pointer)geom != DatumGetPointer(datum) )
+				pfree(geom);
+			continue;
+		}
+
+		lwgeom = lwgeom_from_gserialized(geom);
+		counts[notnull_cnt] = lwgeom_count_vertices(lwgeom);
+		total_vertices += counts[notnull_cnt];
+		notnull_cnt++;
+		lwgeom_free(lwgeom);
+
+		if ( (Pointer)geom != DatumGetPointer(datum) )
+			pfree(geom);
+
+		/* Give backend a chance of interrupting us */
+		vacuum_delay_point();
+	}
+
+	if ( ! notnull_cnt )
+	{
+		pfree(counts);
+		return;
+	}
+
+	qsort(counts, notnull_cnt, sizeof(int), cmp_int_asc);
+
+	/* Stats must live in the analyze context to get stored */
+	old_context = MemoryContextSwitchTo(stats->anl_context);
+	vx_stats = palloc0(sizeof(VERTEX_STATS));
+	MemoryContextSwitchTo(old_context);
+
+	vx_stats->sample_features = notnull_cnt;
+	vx_stats->avg = total_vertices / notnull_cnt;
+	vx_stats->p50 = counts[(int)((notnull_cnt - 1) * 0.50)];
+	vx_stats->p90 = counts[(int)((notnull_cnt - 1) * 0.90)];
+	vx_stats->p99 = counts[(int)((notnull_cnt - 1) * 0.99)];
+	vx_stats->max = counts[notnull_cnt - 1];
+	pfree(counts);
+
+	POSTGIS_DEBUGF(3, " vertex stats: %s", vertex_stats_to_json(vx_stats));
+
+	stats->stakind[STATISTIC_SLOT_VERTICES] = STATISTIC_KIND_VERTICES;
+	stats->staop[STATISTIC_SLOT_VERTICES] = InvalidOid;
+	stats->stanumbers[STATISTIC_SLOT_VERTICES] = (float4*)vx_stats;
+	stats->numnumbers[STATISTIC_SLOT_VERTICES] = sizeof(VERTEX_STATS)/sizeof(float4);
+}
+
+
 /**
 * In order to do useful selectivity calculations in both 2-D and N-D
 * modes, we actually have to generate two stats objects, one for 2-D
@@ -1761,7 +2147,10 @@ compute_gserialized_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	/* 2D Mode */
 	compute_gserialized_stats_mode(stats, fetchfunc, sample_rows, total_rows, 2);
 	/* ND Mode */
-	compute_gserialized_stats_mode(stats, fetchfunc, sample_rows, total_rows, 0);	
+	compute_gserialized_stats_mode(stats, fetchfunc, sample_rows, total_rows, 0);
+	/* Vertex counts, only worth storing along with usable histograms */
+	if ( stats->stats_valid )
+		compute_gserialized_vertex_stats(stats, fetchfunc, sample_rows);
 }
 
 
@@ -1985,6 +2374,42 @@ Datum _postgis_gserialized_stats(PG_FUNCTION_ARGS)
 }
 
 
+/**
+* Utility function to print the vertex count statistics for a
+* given table/column in JSON.
+*/
+PG_FUNCTION_INFO_V1(_postgis_gserialized_vertex_stats);
+Datum _postgis_gserialized_vertex_stats(PG_FUNCTION_ARGS)
+{
+	Oid table_oid = PG_GETARG_OID(0);
+	text *att_text = PG_GETARG_TEXT_P(1);
+	const char *att_name = text2cstring(att_text);
+	AttrNumber att_num;
+	VERTEX_STATS *vx_stats;
+	bool only_parent = FALSE; /* default to whole tree stats */
+	char *str;
+	text *json;
+
+	/* Check if we've been asked to only use stats from parent */
+	if ( ! PG_ARGISNULL(2) )
+		only_parent = PG_GETARG_BOOL(2);
+
+	att_num = get_attnum(table_oid, att_name);
+	if ( ! att_num )
+		elog(ERROR, "attribute \"%s\" does not exist", att_name);
+
+	vx_stats = pg_get_vertex_stats(table_oid, att_num, only_parent ? STATS_PARENT : STATS_TREE_OR_PARENT);
+	if ( ! vx_stats )
+		elog(ERROR, "vertex stats for \"%s.%s\" do not exist", get_rel_name(table_oid), att_name);
+
+	str = vertex_stats_to_json(vx_stats);
+	json = cstring2text(str);
+	pfree(str);
+	pfree(vx_stats);
+	PG_RETURN_TEXT_P(json);
+}
+
+
 /**
 * Utility function to read the calculated selectivity for a given search
 * box and table/column. Used for debugging the selectivity code.
@@ -2121,6 +2546,7 @@ Datum gserialized_gist_sel(PG_FUNCTION_ARGS)
 	
 	VariableStatData vardata;
 	ND_STATS *nd_stats = NULL;
+	RangeTblEntry *rte;
 
 	Node *other;
 	Var *self;
@@ -2171,12 +2597,24 @@ Datum gserialized_gist_sel(PG_FUNCTION_ARGS)
 	}
 	POSTGIS_DEBUGF(4, " requested search box is: %s", gbox_to_string(&search_box));
 
-	/* Get pg_statistic row */
-	examine_variable(root, (Node*)self, 0, &vardata);
-	if ( vardata.statsTuple ) {
-		nd_stats = pg_nd_stats_from_tuple(vardata.statsTuple, mode);
+	/* Plain table columns go through the backend cache */
+	if ( IsA(self, Var) && self->varlevelsup == 0 &&
+	     (rte = planner_rt_fetch(self->varno, root)) &&
+	     rte->rtekind == RTE_RELATION )
+	{
+		/* Same row examine_variable would pick, no parent fallback */
+		nd_stats = pg_get_nd_stats_cached(rte->relid, self->varattno, mode,
+		                                  rte->inh ? STATS_TREE : STATS_PARENT);
+	}
+	else
+	{
+		/* Get pg_statistic row */
+		examine_variable(root, (Node*)self, 0, &vardata);
+		if ( vardata.statsTuple ) {
+			nd_stats = pg_nd_stats_from_tuple(vardata.statsTuple, mode);
+		}
+		ReleaseVariableStats(vardata);
 	}
-	ReleaseVariableStats(vardata);
 
 	if ( ! nd_stats )
 	{
@@ -2300,3 +2738,235 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS)
 	elog(ERROR, "geometry_estimated_extent() called with wrong number of arguments");
 	PG_RETURN_NULL();
 }
+
+
+/**
+* Planner cost feedback from the vertex count statistics.
+*
+* Functions like ST_Intersects or ST_Distance are declared with a
+* flat COST, which is fine for points and badly off for columns of
+* complex polygons. Once the paths of a base relation are built, we
+* scale the declared cost of the expensive functions in its
+* restriction clauses by the average vertex count of the geometry
+* columns they read, charge the difference to the cached cost of the
+* clause, and build the paths again so they compete on those costs.
+*/
+static set_rel_pathlist_hook_type prev_set_rel_pathlist_hook = NULL;
+
+/* Functions whose run time grows with the input vertex count */
+static const char *vertex_cost_funcs[] = {
+	"_st_contains", "_st_containsproperly", "_st_coveredby", "_st_covers",
+	"_st_crosses", "_st_dfullywithin", "_st_distance", "_st_distanceuncached",
+	"_st_dwithin", "_st_dwithinuncached", "_st_equals", "_st_intersects",
+	"_st_overlaps", "_st_touches", "_st_within", "st_disjoint",
+	"st_distance", "st_distancesphere", "st_distancespheroid",
+	"st_hausdorffdistance", "st_maxdistance", "st_relate", NULL
+};
+
+/* Total input vertices the declared COST of those functions pays for */
+#define VERTEX_COST_NOMINAL 50
+
+typedef struct
+{
+	Index rti;
+	int scope;
+	Oid relid;
+	Cost per_tuple;
+} VERTEX_COST_CONTEXT;
+
+/**
+* Is this one of our vertex bound functions? The name has to match
+* and the function has to live in the schema of the PostGIS type it
+* is called on, so same named user functions are left alone.
+*/
+static bool
+vertex_cost_func(Oid funcid, Oid argtype)
+{
+	char *name;
+	HeapTuple tp;
+	Oid typnamespace;
+	int i;
+	bool found = FALSE;
+
+	tp = SearchSysCache1(TYPEOID, ObjectIdGetDatum(argtype));
+	if ( ! HeapTupleIsValid(tp) )
+		return FALSE;
+	typnamespace = ((Form_pg_type) GETSTRUCT(tp))->typnamespace;
+	ReleaseSysCache(tp);
+
+	if ( get_func_namespace(funcid) != typnamespace )
+		return FALSE;
+
+	name = get_func_name(funcid);
+	if ( ! name )
+		return FALSE;
+
+	for ( i = 0; vertex_cost_funcs[i]; i++ )
+	{
+		if ( strcmp(name, vertex_cost_funcs[i]) == 0 )
+		{
+			found = TRUE;
+			break;
+		}
+	}
+	pfree(name);
+	return found;
+}
+
+static bool
+vertex_cost_walker(Node *node, VERTEX_COST_CONTEXT *context)
+{
+	if ( ! node )
+		return FALSE;
+
+	if ( IsA(node, FuncExpr) )
+	{
+		FuncExpr *func = (FuncExpr*)node;
+		double vertices = 0.0;
+		Oid argtype = InvalidOid;
+		ListCell *lc;
+
+		foreach(lc, func->args)
+		{
+			Var *var = (Var*)lfirst(lc);
+			VERTEX_STATS *vx_stats;
+
+			/* Only columns of this relation with vertex statistics count */
+			if ( ! IsA(var, Var) || var->varno != context->rti || var->varlevelsup != 0 )
+				continue;
+
+			vx_stats = pg_get_vertex_stats_cached(context->relid, var->varattno, context->scope);
+			if ( vx_stats )
+			{
+				vertices += vx_stats->avg;
+				argtype = var->vartype;
+				pfree(vx_stats);
+			}
+		}
+
+		/* Scale the declared cost, which covers the nominal vertex count */
+		if ( vertices > VERTEX_COST_NOMINAL && vertex_cost_func(func->funcid, argtype) )
+		{
+			context->per_tuple += get_func_cost(func->funcid) * cpu_operator_cost *
+			                      (vertices / VERTEX_COST_NOMINAL - 1.0);
+		}
+	}
+
+	return expression_tree_walker(node, vertex_cost_walker, (void*)context);
+}
+
+/**
+* Build the scan paths of a plain relation again, the way
+* set_plain_rel_pathlist does, once the clause costs are final.
+*/
+static void
+vertex_cost_rebuild_paths(PlannerInfo *root, RelOptInfo *rel)
+{
+	Relids required_outer = rel->lateral_relids;
+	ListCell *lc;
+#if POSTGIS_PGSQL_VERSION >= 96
+	int parallel_workers = 0;
+	bool gathered = FALSE;
+
+	/* Keep the worker count the core planner settled on */
+	foreach(lc, rel->partial_pathlist)
+	{
+		Path *path = (Path*)lfirst(lc);
+		if ( path->pathtype == T_SeqScan )
+			parallel_workers = path->parallel_workers;
+	}
+	/* Gather paths made before the hook need making again */
+	foreach(lc, rel->pathlist)
+	{
+		Path *path = (Path*)lfirst(lc);
+		if ( IsA(path, GatherPath) )
+			gathered = TRUE;
+#if POSTGIS_PGSQL_VERSION >= 100
+		if ( IsA(path, GatherMergePath) )
+			gathered = TRUE;
+#endif
+	}
+	rel->partial_pathlist = NIL;
+#endif
+	rel->pathlist = NIL;
+
+#if POSTGIS_PGSQL_VERSION >= 96
+	add_path(rel, create_seqscan_path(root, rel, required_outer, 0));
+	if ( parallel_workers > 0 )
+		add_partial_path(rel, create_seqscan_path(root, rel, NULL, parallel_workers));
+#else
+	add_path(rel, create_seqscan_path(root, rel, required_outer));
+#endif
+	create_index_paths(root, rel);
+	create_tidscan_paths(root, rel);
+
+#if POSTGIS_PGSQL_VERSION >= 96
+	if ( gathered )
+		generate_gather_paths(root, rel);
+#endif
+}
+
+static void
+gserialized_set_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, Index rti, RangeTblEntry *rte)
+{
+	VERTEX_COST_CONTEXT context;
+	Cost per_tuple = 0.0;
+	ListCell *lc;
+
+	/* Inheritance parents are costed through their children */
+	if ( rte->rtekind != RTE_RELATION || rte->inh || ! rel->baserestrictinfo ||
+#if POSTGIS_PGSQL_VERSION >= 95
+	     rte->tablesample ||
+#endif
+	     ! ( rte->relkind == RELKIND_RELATION || rte->relkind == RELKIND_MATVIEW ) )
+	{
+		if ( prev_set_rel_pathlist_hook )
+			prev_set_rel_pathlist_hook(root, rel, rti, rte);
+		return;
+	}
+
+	context.rti = rti;
+	context.relid = rte->relid;
+	context.scope = STATS_PARENT;
+
+	/* Charge each clause through its cached cost, which every path costing reads */
+	foreach(lc, rel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo*)lfirst(lc);
+		QualCost qcost;
+
+		context.per_tuple = 0.0;
+		vertex_cost_walker((Node*)rinfo->clause, &context);
+		if ( context.per_tuple <= 0.0 )
+			continue;
+
+		if ( rinfo->eval_cost.startup < 0 )
+			cost_qual_eval_node(&qcost, (Node*)rinfo, root);
+		rinfo->eval_cost.per_tuple += context.per_tuple;
+		per_tuple += context.per_tuple;
+	}
+
+	if ( per_tuple > 0.0 )
+	{
+		POSTGIS_DEBUGF(3, "extra per tuple cost for \"%s\": %g", get_rel_name(rte->relid), per_tuple);
+		rel->baserestrictcost.per_tuple += per_tuple;
+		vertex_cost_rebuild_paths(root, rel);
+	}
+
+	/* Other hooks see, and may add to, the final paths */
+	if ( prev_set_rel_pathlist_hook )
+		prev_set_rel_pathlist_hook(root, rel, rti, rte);
+}
+
+void
+gserialized_cost_hook_install(void)
+{
+	prev_set_rel_pathlist_hook = set_rel_pathlist_hook;
+	set_rel_pathlist_hook = gserialized_set_rel_pathlist;
+}
+
+void
+gserialized_cost_hook_uninstall(void)
+{
+	set_rel_pathlist_hook = prev_set_rel_pathlist_hook;
+}
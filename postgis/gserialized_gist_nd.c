@@ -49,6 +49,7 @@
 #include "lwgeom_pg.h"       /* For debugging macros. */
 #include "gserialized_gist.h"	     /* For utility functions. */
 #include "geography.h"
+#include "lwgeom_transform.h" /* For SRID functions */
 
 #include <assert.h>
 
@@ -1354,6 +1355,8 @@ Datum gserialized_gist_geog_distance(PG_FUNCTION_ARGS)
 	char query_box_mem[GIDX_MAX_SIZE];
 	GIDX *query_box = (GIDX*)query_box_mem;
 	GIDX *entry_box;
+	GSERIALIZED *query_head;
+	SPHEROID s;
 	double distance;
 
 	POSTGIS_DEBUGF(3, "[GIST] '%s' function called", __func__);
@@ -1385,10 +1388,20 @@ Datum gserialized_gist_geog_distance(PG_FUNCTION_ARGS)
 
 	/* Return distances from key-based tests should always be */
 	/* the minimum possible distance, box-to-box */
+	/* Boxes are on the unit sphere, so the box-to-box distance is */
+	/* a lower bound on the chord between the nearest points. The */
+	/* arc over that chord is still a lower bound, and much closer */
+	/* to the over-the-sphere distance the recheck process will turn */
+	/* up, so fewer leaves are fetched before the nearest are known */
 	/* We scale up to "world units" so that the box-to-box distances */
-	/* compare reasonably with the over-the-spheroid distances that */
-	/* the recheck process will turn up */
-	distance = WGS84_RADIUS * gidx_distance(entry_box, query_box, 0);
+	/* compare reasonably with the over-the-spheroid distances. The */
+	/* recheck uses the sphere of the query SRID, a bigger radius */
+	/* would put the bound over the recheck distance */
+	query_head = (GSERIALIZED*)PG_DETOAST_DATUM_SLICE(query_datum, 0, gserialized_max_header_size());
+	if ( spheroid_init_from_srid(fcinfo, gserialized_get_srid(query_head), &s) == LW_FAILURE )
+		s.radius = WGS84_RADIUS;
+	distance = gidx_distance(entry_box, query_box, 0);
+	distance = s.radius * 2.0 * asin(Min(distance / 2.0, 1.0));
 	POSTGIS_DEBUGF(2, "[GIST] '%s' got distance %g", __func__, distance);
 
 	PG_RETURN_FLOAT8(distance);
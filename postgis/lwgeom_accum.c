@@ -30,6 +30,7 @@
 #include "utils/datum.h"
 #include "utils/array.h"
 #include "utils/lsyscache.h"
+#include "miscadmin.h"
 
 #include "../postgis_config.h"
 
@@ -51,6 +52,13 @@ Datum pgis_geometry_clusterintersecting_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_clusterwithin_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_abs_in(PG_FUNCTION_ARGS);
 Datum pgis_abs_out(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_parallel_transfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_parallel_combinefn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_parallel_serialfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_parallel_deserialfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_parallel_finalfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_makeline_transfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_makeline_points_finalfn(PG_FUNCTION_ARGS);
 
 /* External prototypes */
 Datum pgis_union_geometry_array(PG_FUNCTION_ARGS);
@@ -376,6 +384,359 @@ pgis_geometry_clusterwithin_finalfn(PG_FUNCTION_ARGS)
 	PG_RETURN_DATUM(result);
 }
 
+/**
+** ST_Union keeps its inputs in an "internal" state instead of pgis_abs.
+** Whenever the pending inputs grow past work_mem they get cascaded-unioned
+** into a single geometry, so memory stays bounded on large dissolves.
+** On PostgreSQL 9.6+ the state can also be serialized for parallel
+** aggregation: each worker unions its own share in the serial function,
+** the combine step gathers the partial results and the final function
+** unions them.
+**
+** The serialized state is the element type Oid followed by the
+** partial union, if any.
+*/
+typedef struct
+{
+	ArrayBuildState *a;   /* Geometries waiting to be unioned */
+	Oid element_type;
+	Size size;            /* Bytes held in a */
+	Size reduced_size;    /* Bytes left over by the last batch union */
+}
+pgis_union_state;
+
+static pgis_union_state *
+pgis_union_state_create(Oid element_type, MemoryContext aggcontext)
+{
+	pgis_union_state *state = MemoryContextAllocZero(aggcontext, sizeof(pgis_union_state));
+	state->element_type = element_type;
+	return state;
+}
+
+/**
+* Run the pending geometries through a cascaded union.
+* Returns a "NULL" Datum when there is nothing to union.
+*/
+static Datum
+pgis_union_state_union(pgis_union_state *state)
+{
+	int dims[1];
+	int lbs[1];
+	Datum geometry_array;
+
+	if ( ! state->a || ! state->a->nelems )
+		return (Datum) 0;
+
+	dims[0] = state->a->nelems;
+	lbs[0] = 1;
+	geometry_array = makeMdArrayResult(state->a, 1, dims, lbs, CurrentMemoryContext, false);
+	return PGISDirectFunctionCall1( pgis_union_geometry_array, geometry_array );
+}
+
+/**
+* Replace the pending geometries with their union
+*/
+static void
+pgis_union_state_reduce(pgis_union_state *state, MemoryContext aggcontext)
+{
+	ArrayBuildState *old = state->a;
+	Datum partial = pgis_union_state_union(state);
+
+	state->a = NULL;
+	state->size = 0;
+	if ( partial )
+	{
+		state->a = accumArrayResult(NULL, partial, false, state->element_type, aggcontext);
+		state->size = VARSIZE(DatumGetPointer(state->a->dvalues[0]));
+	}
+	state->reduced_size = state->size;
+
+	/* accumArrayResult keeps every build state in a context of its own */
+	if ( old )
+		MemoryContextDelete(old->mcontext);
+}
+
+static void
+pgis_union_state_add(pgis_union_state *state, Datum geom, MemoryContext aggcontext)
+{
+	Size budget = (Size) work_mem * 1024L;
+
+	/* Stores a detoasted copy */
+	state->a = accumArrayResult(state->a, geom, false, state->element_type, aggcontext);
+	state->size += VARSIZE(DatumGetPointer(state->a->dvalues[state->a->nelems - 1]));
+
+	/*
+	* Union in batches once over budget, and at least double the
+	* previous union result, so a large partial union does not get
+	* unioned again for every new row.
+	*/
+	if ( state->size > Max(budget, 2 * state->reduced_size) )
+		pgis_union_state_reduce(state, aggcontext);
+}
+
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_transfn);
+Datum
+pgis_geometry_union_parallel_transfn(PG_FUNCTION_ARGS)
+{
+	Oid arg1_typeid = get_fn_expr_argtype(fcinfo->flinfo, 1);
+	MemoryContext aggcontext;
+	pgis_union_state *state;
+
+	if (arg1_typeid == InvalidOid)
+		ereport(ERROR,
+		        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		         errmsg("could not determine input data type")));
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	state = PG_ARGISNULL(0) ? NULL : (pgis_union_state*) PG_GETARG_POINTER(0);
+
+	/* Nulls do not take part in the union */
+	if ( PG_ARGISNULL(1) )
+	{
+		if ( ! state )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(state);
+	}
+
+	if ( ! state )
+		state = pgis_union_state_create(arg1_typeid, aggcontext);
+
+	pgis_union_state_add(state, PG_GETARG_DATUM(1), aggcontext);
+	PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_finalfn);
+Datum
+pgis_geometry_union_parallel_finalfn(PG_FUNCTION_ARGS)
+{
+	Datum result;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	result = pgis_union_state_union((pgis_union_state*) PG_GETARG_POINTER(0));
+	if (!result)
+		PG_RETURN_NULL();
+
+	PG_RETURN_DATUM(result);
+}
+
+#if POSTGIS_PGSQL_VERSION >= 96
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_combinefn);
+Datum
+pgis_geometry_union_parallel_combinefn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	pgis_union_state *state1, *state2;
+	int i;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	state1 = PG_ARGISNULL(0) ? NULL : (pgis_union_state*) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (pgis_union_state*) PG_GETARG_POINTER(1);
+
+	if ( ! state2 || ! state2->a )
+	{
+		if ( ! state1 )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(state1);
+	}
+
+	if ( ! state1 )
+		state1 = pgis_union_state_create(state2->element_type, aggcontext);
+
+	/* Partial results get unioned in the final function, or once over budget */
+	for ( i = 0; i < state2->a->nelems; i++ )
+		pgis_union_state_add(state1, state2->a->dvalues[i], aggcontext);
+
+	PG_RETURN_POINTER(state1);
+}
+
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_serialfn);
+Datum
+pgis_geometry_union_parallel_serialfn(PG_FUNCTION_ARGS)
+{
+	pgis_union_state *state;
+	Datum partial;
+	size_t partial_size = 0;
+	bytea *result;
+
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
+
+	state = (pgis_union_state*) PG_GETARG_POINTER(0);
+
+	/* This is the worker side, union its share right here */
+	partial = pgis_union_state_union(state);
+	if ( partial )
+		partial_size = VARSIZE(DatumGetPointer(partial));
+
+	result = palloc(VARHDRSZ + sizeof(Oid) + partial_size);
+	SET_VARSIZE(result, VARHDRSZ + sizeof(Oid) + partial_size);
+	memcpy(VARDATA(result), &(state->element_type), sizeof(Oid));
+	if ( partial )
+		memcpy(VARDATA(result) + sizeof(Oid), DatumGetPointer(partial), partial_size);
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_deserialfn);
+Datum
+pgis_geometry_union_parallel_deserialfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	pgis_union_state *state;
+	bytea *serialized;
+	Oid element_type;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	serialized = PG_GETARG_BYTEA_P(0);
+	memcpy(&element_type, VARDATA(serialized), sizeof(Oid));
+
+	state = pgis_union_state_create(element_type, aggcontext);
+	if ( VARSIZE(serialized) > VARHDRSZ + sizeof(Oid) )
+	{
+		Datum partial = PointerGetDatum(VARDATA(serialized) + sizeof(Oid));
+		pgis_union_state_add(state, partial, aggcontext);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+#endif /* POSTGIS_PGSQL_VERSION >= 96 */
+
+/**
+** ST_MakeLine only needs the coordinates of its inputs, so rather than
+** keeping every input geometry around it appends them to a single
+** point buffer as they come in. Coordinates are buffered in 4D since
+** the output dimensionality is only known at the end.
+*/
+typedef struct
+{
+	POINTARRAY *pa;
+	int32_t srid;
+	int ngeoms;   /* # of point/line/multipoint inputs */
+	int hasz;
+	int hasm;
+}
+pgis_makeline_state;
+
+PG_FUNCTION_INFO_V1(pgis_geometry_makeline_transfn);
+Datum
+pgis_geometry_makeline_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, old;
+	pgis_makeline_state *state;
+	GSERIALIZED *geom;
+	LWGEOM *lwgeom;
+	LWPOINTITERATOR *it;
+	POINT4D pt;
+	int type;
+	int first;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	if ( PG_ARGISNULL(0) )
+	{
+		state = MemoryContextAllocZero(aggcontext, sizeof(pgis_makeline_state));
+		state->srid = SRID_UNKNOWN;
+	}
+	else
+	{
+		state = (pgis_makeline_state*) PG_GETARG_POINTER(0);
+	}
+
+	if ( PG_ARGISNULL(1) )
+		PG_RETURN_POINTER(state);
+
+	/* Only points, lines and multipoints make it into the line */
+	geom = PG_GETARG_GSERIALIZED_P(1);
+	type = gserialized_get_type(geom);
+	if ( type != POINTTYPE && type != LINETYPE && type != MULTIPOINTTYPE )
+		PG_RETURN_POINTER(state);
+
+	if ( state->ngeoms++ )
+		error_if_srid_mismatch(gserialized_get_srid(geom), state->srid);
+	else
+		state->srid = gserialized_get_srid(geom);
+
+	state->hasz |= gserialized_has_z(geom);
+	state->hasm |= gserialized_has_m(geom);
+
+	if ( gserialized_is_empty(geom) )
+		PG_RETURN_POINTER(state);
+
+	old = MemoryContextSwitchTo(aggcontext);
+	if ( ! state->pa )
+		state->pa = ptarray_construct_empty(LW_TRUE, LW_TRUE, 64);
+	MemoryContextSwitchTo(old);
+
+	lwgeom = lwgeom_from_gserialized(geom);
+	it = lwpointiterator_create(lwgeom);
+	first = LW_TRUE;
+	while ( lwpointiterator_next(it, &pt) )
+	{
+		/* A line starting where the previous input ended does not repeat that point */
+		if ( first && type == LINETYPE && state->pa->npoints )
+		{
+			POINT2D last;
+			getPoint2d_p(state->pa, state->pa->npoints - 1, &last);
+			if ( last.x == pt.x && last.y == pt.y )
+			{
+				first = LW_FALSE;
+				continue;
+			}
+		}
+		first = LW_FALSE;
+		ptarray_append_point(state->pa, &pt, LW_TRUE);
+	}
+	lwpointiterator_destroy(it);
+	lwgeom_free(lwgeom);
+
+	PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(pgis_geometry_makeline_points_finalfn);
+Datum
+pgis_geometry_makeline_points_finalfn(PG_FUNCTION_ARGS)
+{
+	pgis_makeline_state *state;
+	POINTARRAY *pa;
+	LWLINE *line;
+	POINT4D pt;
+	int i;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	state = (pgis_makeline_state*) PG_GETARG_POINTER(0);
+
+	if ( ! state->ngeoms )
+	{
+		elog(NOTICE, "No points or linestrings in input array");
+		PG_RETURN_NULL();
+	}
+
+	if ( ! state->pa )
+		PG_RETURN_POINTER(geometry_serialize(lwline_as_lwgeom(lwline_construct_empty(state->srid, state->hasz, state->hasm))));
+
+	/* Drop the dimensions no input had */
+	pa = ptarray_construct_empty(state->hasz, state->hasm, state->pa->npoints);
+	for ( i = 0; i < state->pa->npoints; i++ )
+	{
+		getPoint4d_p(state->pa, i, &pt);
+		ptarray_append_point(pa, &pt, LW_TRUE);
+	}
+
+	line = lwline_construct(state->srid, NULL, pa);
+	PG_RETURN_POINTER(geometry_serialize(lwline_as_lwgeom(line)));
+}
+
 /**
 * A modified version of PostgreSQL's DirectFunctionCall1 which allows NULL results; this
 * is required for aggregates that return NULL.
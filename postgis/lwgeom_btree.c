@@ -27,9 +27,14 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "access/hash.h"
 #include "utils/geo_decls.h"
 
 #include "../postgis_config.h"
+#if POSTGIS_PGSQL_VERSION >= 95
+#include "lib/hyperloglog.h"
+#include "utils/sortsupport.h"
+#endif
 #include "liblwgeom.h"
 #include "lwgeom_pg.h"
 
@@ -45,54 +50,74 @@ Datum lwgeom_eq(PG_FUNCTION_ARGS);
 Datum lwgeom_ge(PG_FUNCTION_ARGS);
 Datum lwgeom_gt(PG_FUNCTION_ARGS);
 Datum lwgeom_cmp(PG_FUNCTION_ARGS);
+Datum lwgeom_hash(PG_FUNCTION_ARGS);
+#if POSTGIS_PGSQL_VERSION >= 95
+Datum lwgeom_sortsupport(PG_FUNCTION_ARGS);
+#endif
+
+/**
+* Compare two boxes in btree order: empties first, then xmin, ymin,
+* xmax and ymax. The comparison is exact, so that equality is
+* transitive and can be backed by a hash function.
+*/
+static int
+lwgeom_box_cmp(const GBOX *box1, int empty1, const GBOX *box2, int empty2)
+{
+	if ( empty1 || empty2 )
+		return empty2 - empty1;
 
-PG_FUNCTION_INFO_V1(lwgeom_lt);
-Datum lwgeom_lt(PG_FUNCTION_ARGS)
+	if  ( box1->xmin != box2->xmin )
+		return box1->xmin < box2->xmin ? -1 : 1;
+
+	if  ( box1->ymin != box2->ymin )
+		return box1->ymin < box2->ymin ? -1 : 1;
+
+	if  ( box1->xmax != box2->xmax )
+		return box1->xmax < box2->xmax ? -1 : 1;
+
+	if  ( box1->ymax != box2->ymax )
+		return box1->ymax < box2->ymax ? -1 : 1;
+
+	return 0;
+}
+
+/**
+* Compare two geometries on their bounding boxes, erroring out
+* on mixed SRIDs.
+*/
+static int
+lwgeom_cmp_internal(GSERIALIZED *geom1, GSERIALIZED *geom2)
 {
-	GSERIALIZED *geom1 = PG_GETARG_GSERIALIZED_P(0);
-	GSERIALIZED *geom2 = PG_GETARG_GSERIALIZED_P(1);
 	GBOX box1;
 	GBOX box2;
-
-	POSTGIS_DEBUG(2, "lwgeom_lt called");
+	int empty1, empty2;
 
 	error_if_srid_mismatch(gserialized_get_srid(geom1), gserialized_get_srid(geom2));
 
-	POSTGIS_DEBUG(3, "lwgeom_lt passed getSRID test");
-
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
+	gbox_init(&box1);
+	gbox_init(&box2);
 
-	PG_FREE_IF_COPY(geom1, 0);
-	PG_FREE_IF_COPY(geom2, 1);
+	empty1 = ( gserialized_get_gbox_p(geom1, &box1) == LW_FAILURE );
+	empty2 = ( gserialized_get_gbox_p(geom2, &box2) == LW_FAILURE );
 
-	POSTGIS_DEBUG(3, "lwgeom_lt getbox2d_p passed");
+	return lwgeom_box_cmp(&box1, empty1, &box2, empty2);
+}
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if  (box1.xmin < box2.xmin)
-			PG_RETURN_BOOL(TRUE);
-	}
+PG_FUNCTION_INFO_V1(lwgeom_lt);
+Datum lwgeom_lt(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *geom1 = PG_GETARG_GSERIALIZED_P(0);
+	GSERIALIZED *geom2 = PG_GETARG_GSERIALIZED_P(1);
+	int cmp;
 
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
-	{
-		if  (box1.ymin < box2.ymin)
-			PG_RETURN_BOOL(TRUE);
-	}
+	POSTGIS_DEBUG(2, "lwgeom_lt called");
 
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
-	{
-		if  (box1.xmax < box2.xmax)
-			PG_RETURN_BOOL(TRUE);
-	}
+	cmp = lwgeom_cmp_internal(geom1, geom2);
 
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
-	{
-		if  (box1.ymax < box2.ymax)
-			PG_RETURN_BOOL(TRUE);
-	}
+	PG_FREE_IF_COPY(geom1, 0);
+	PG_FREE_IF_COPY(geom2, 1);
 
-	PG_RETURN_BOOL(FALSE);
+	PG_RETURN_BOOL(cmp < 0);
 }
 
 PG_FUNCTION_INFO_V1(lwgeom_le);
@@ -100,56 +125,16 @@ Datum lwgeom_le(PG_FUNCTION_ARGS)
 {
 	GSERIALIZED *geom1 = PG_GETARG_GSERIALIZED_P(0);
 	GSERIALIZED *geom2 = PG_GETARG_GSERIALIZED_P(1);
-	GBOX box1;
-	GBOX box2;
+	int cmp;
 
 	POSTGIS_DEBUG(2, "lwgeom_le called");
 
-	error_if_srid_mismatch(gserialized_get_srid(geom1), gserialized_get_srid(geom2));
-
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
+	cmp = lwgeom_cmp_internal(geom1, geom2);
 
 	PG_FREE_IF_COPY(geom1, 0);
 	PG_FREE_IF_COPY(geom2, 1);
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if  (box1.xmin < box2.xmin)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
-	}
-
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
-	{
-		if  (box1.ymin < box2.ymin)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
-	}
-
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
-	{
-		if  (box1.xmax < box2.xmax)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
-	}
-
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
-	{
-		if  (box1.ymax < box2.ymax)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
-	}
-
-	PG_RETURN_BOOL(TRUE);
+	PG_RETURN_BOOL(cmp <= 0);
 }
 
 PG_FUNCTION_INFO_V1(lwgeom_eq);
@@ -157,38 +142,16 @@ Datum lwgeom_eq(PG_FUNCTION_ARGS)
 {
 	GSERIALIZED *geom1 = PG_GETARG_GSERIALIZED_P(0);
 	GSERIALIZED *geom2 = PG_GETARG_GSERIALIZED_P(1);
-	GBOX box1;
-	GBOX box2;
-  bool empty1, empty2;
-	bool result;
+	int cmp;
 
 	POSTGIS_DEBUG(2, "lwgeom_eq called");
 
-	error_if_srid_mismatch(gserialized_get_srid(geom1), gserialized_get_srid(geom2));
+	cmp = lwgeom_cmp_internal(geom1, geom2);
 
-	gbox_init(&box1);
-	gbox_init(&box2);
-	
-	empty1 = ( gserialized_get_gbox_p(geom1, &box1) == LW_FAILURE );
-	empty2 = ( gserialized_get_gbox_p(geom2, &box2) == LW_FAILURE );
 	PG_FREE_IF_COPY(geom1, 0);
 	PG_FREE_IF_COPY(geom2, 1);
 
-	if  ( empty1 != empty2 )
-	{
-    result = FALSE;
-	}
-  else if  ( ! (FPeq(box1.xmin, box2.xmin) && FPeq(box1.ymin, box2.ymin) &&
-	         FPeq(box1.xmax, box2.xmax) && FPeq(box1.ymax, box2.ymax)) )
-	{
-		result = FALSE;
-	}
-	else
-	{
-		result = TRUE;
-	}
-
-	PG_RETURN_BOOL(result);
+	PG_RETURN_BOOL(cmp == 0);
 }
 
 PG_FUNCTION_INFO_V1(lwgeom_ge);
@@ -196,56 +159,16 @@ Datum lwgeom_ge(PG_FUNCTION_ARGS)
 {
 	GSERIALIZED *geom1 = PG_GETARG_GSERIALIZED_P(0);
 	GSERIALIZED *geom2 = PG_GETARG_GSERIALIZED_P(1);
-	GBOX box1;
-	GBOX box2;
+	int cmp;
 
 	POSTGIS_DEBUG(2, "lwgeom_ge called");
 
-	error_if_srid_mismatch(gserialized_get_srid(geom1), gserialized_get_srid(geom2));
-
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
+	cmp = lwgeom_cmp_internal(geom1, geom2);
 
 	PG_FREE_IF_COPY(geom1, 0);
 	PG_FREE_IF_COPY(geom2, 1);
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if  (box1.xmin > box2.xmin)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
-	}
-
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
-	{
-		if  (box1.ymin > box2.ymin)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
-	}
-
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
-	{
-		if  (box1.xmax > box2.xmax)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
-	}
-
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
-	{
-		if  (box1.ymax > box2.ymax)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-		PG_RETURN_BOOL(FALSE);
-	}
-
-	PG_RETURN_BOOL(TRUE);
+	PG_RETURN_BOOL(cmp >= 0);
 }
 
 PG_FUNCTION_INFO_V1(lwgeom_gt);
@@ -253,108 +176,219 @@ Datum lwgeom_gt(PG_FUNCTION_ARGS)
 {
 	GSERIALIZED *geom1 = PG_GETARG_GSERIALIZED_P(0);
 	GSERIALIZED *geom2 = PG_GETARG_GSERIALIZED_P(1);
-	GBOX box1;
-	GBOX box2;
+	int cmp;
 
 	POSTGIS_DEBUG(2, "lwgeom_gt called");
 
-	error_if_srid_mismatch(gserialized_get_srid(geom1), gserialized_get_srid(geom2));
+	cmp = lwgeom_cmp_internal(geom1, geom2);
 
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
+	PG_FREE_IF_COPY(geom1, 0);
+	PG_FREE_IF_COPY(geom2, 1);
+
+	PG_RETURN_BOOL(cmp > 0);
+}
+
+PG_FUNCTION_INFO_V1(lwgeom_cmp);
+Datum lwgeom_cmp(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *geom1 = PG_GETARG_GSERIALIZED_P(0);
+	GSERIALIZED *geom2 = PG_GETARG_GSERIALIZED_P(1);
+	int cmp;
+
+	POSTGIS_DEBUG(2, "lwgeom_cmp called");
+
+	cmp = lwgeom_cmp_internal(geom1, geom2);
 
 	PG_FREE_IF_COPY(geom1, 0);
 	PG_FREE_IF_COPY(geom2, 1);
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
-	{
-		if  (box1.xmin > box2.xmin)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-	}
+	PG_RETURN_INT32(cmp);
+}
 
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
+/**
+* Hash support for the = operator. Equality looks at the SRID and
+* the bounding box only, so that is what goes into the hash.
+*/
+PG_FUNCTION_INFO_V1(lwgeom_hash);
+Datum lwgeom_hash(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *geom = PG_GETARG_GSERIALIZED_P(0);
+	struct
 	{
-		if  (box1.ymin > box2.ymin)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-	}
-
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
+		int32 srid;
+		int32 empty;
+		double coords[4];
+	} key;
+	GBOX box;
+	Datum hval;
+
+	/* Zero the padding too, it goes into the hash */
+	memset(&key, 0, sizeof(key));
+	gbox_init(&box);
+
+	key.srid = gserialized_get_srid(geom);
+	key.empty = ( gserialized_get_gbox_p(geom, &box) == LW_FAILURE );
+
+	/* Adding zero folds -0.0 into 0.0, which compare equal */
+	if ( ! key.empty )
 	{
-		if  (box1.xmax > box2.xmax)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
+		key.coords[0] = box.xmin + 0.0;
+		key.coords[1] = box.ymin + 0.0;
+		key.coords[2] = box.xmax + 0.0;
+		key.coords[3] = box.ymax + 0.0;
 	}
 
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
-	{
-		if  (box1.ymax > box2.ymax)
-		{
-			PG_RETURN_BOOL(TRUE);
-		}
-	}
+	hval = hash_any((unsigned char *)&key, sizeof(key));
 
-	PG_RETURN_BOOL(FALSE);
+	PG_FREE_IF_COPY(geom, 0);
+	PG_RETURN_DATUM(hval);
 }
 
-PG_FUNCTION_INFO_V1(lwgeom_cmp);
-Datum lwgeom_cmp(PG_FUNCTION_ARGS)
+#if POSTGIS_PGSQL_VERSION >= 95
+
+/*
+* Sort support for the btree opclass. The full comparator is
+* lwgeom_cmp without the fmgr overhead. The abbreviated key is the
+* xmin of the box, which is the leading key of the btree order, so
+* two abbreviated keys that differ give the final answer and only
+* ties go through the full comparison.
+*/
+
+typedef union
 {
-	GSERIALIZED *geom1 = PG_GETARG_GSERIALIZED_P(0);
-	GSERIALIZED *geom2 = PG_GETARG_GSERIALIZED_P(1);
-	GBOX box1;
-	GBOX box2;
+	double xmin;
+	Datum datum;
+} lwgeom_abbrev_key;
+
+/*
+* Distinct abbreviated keys seen so far, to give up on abbreviation
+* when most of them tie, such as points all on one meridian.
+*/
+typedef struct
+{
+	int64 input_count;
+	bool estimating;
+	hyperLogLogState abbr_card;
+} lwgeom_abbrev_state;
 
-	POSTGIS_DEBUG(2, "lwgeom_cmp called");
+static int
+lwgeom_sort_cmp(Datum a, Datum b, SortSupport ssup)
+{
+	GSERIALIZED *geom1 = (GSERIALIZED *)PG_DETOAST_DATUM(a);
+	GSERIALIZED *geom2 = (GSERIALIZED *)PG_DETOAST_DATUM(b);
+	int result;
 
-	error_if_srid_mismatch(gserialized_get_srid(geom1), gserialized_get_srid(geom2));
+	result = lwgeom_cmp_internal(geom1, geom2);
 
-	gserialized_get_gbox_p(geom1, &box1);
-	gserialized_get_gbox_p(geom2, &box2);
+	if ( (Pointer)geom1 != DatumGetPointer(a) ) pfree(geom1);
+	if ( (Pointer)geom2 != DatumGetPointer(b) ) pfree(geom2);
 
-	PG_FREE_IF_COPY(geom1, 0);
-	PG_FREE_IF_COPY(geom2, 1);
+	return result;
+}
+
+static Datum
+lwgeom_abbrev_convert(Datum original, SortSupport ssup)
+{
+	GSERIALIZED *geom = (GSERIALIZED *)PG_DETOAST_DATUM(original);
+	lwgeom_abbrev_state *state = (lwgeom_abbrev_state *)ssup->ssup_extra;
+	lwgeom_abbrev_key key;
+	GBOX box;
+
+	key.datum = 0;
+
+	/* Empties sort first, as in lwgeom_box_cmp */
+	if ( gserialized_get_gbox_p(geom, &box) == LW_FAILURE )
+		key.xmin = -1 * INFINITY;
+	else
+		key.xmin = box.xmin;
 
-	if  ( ! FPeq(box1.xmin , box2.xmin) )
+	if ( (Pointer)geom != DatumGetPointer(original) ) pfree(geom);
+
+	/* Fold the double into 32 bits for the cardinality estimate */
+	if ( state->estimating )
 	{
-		if  (box1.xmin < box2.xmin)
-		{
-			PG_RETURN_INT32(-1);
-		}
-		PG_RETURN_INT32(1);
+		uint64 bits = (uint64)key.datum;
+		uint32 tmp = (uint32)bits ^ (uint32)(bits >> 32);
+		addHyperLogLog(&state->abbr_card, DatumGetUInt32(hash_uint32(tmp)));
 	}
+	state->input_count++;
+
+	return key.datum;
+}
+
+static int
+lwgeom_abbrev_cmp(Datum a, Datum b, SortSupport ssup)
+{
+	lwgeom_abbrev_key key1, key2;
+
+	key1.datum = a;
+	key2.datum = b;
+
+	/* Ties have to be settled on the rest of the box */
+	if ( key1.xmin == key2.xmin )
+		return 0;
+
+	return key1.xmin < key2.xmin ? -1 : 1;
+}
 
-	if  ( ! FPeq(box1.ymin , box2.ymin) )
+/*
+* Same policy as the core numeric abbreviation: once enough rows are
+* in, give up when almost all the keys tie, and stop estimating when
+* they are clearly distinct enough.
+*/
+static bool
+lwgeom_abbrev_abort(int memtupcount, SortSupport ssup)
+{
+	lwgeom_abbrev_state *state = (lwgeom_abbrev_state *)ssup->ssup_extra;
+	double abbr_card;
+
+	if ( memtupcount < 10000 || state->input_count < 10000 || ! state->estimating )
+		return false;
+
+	abbr_card = estimateHyperLogLog(&state->abbr_card);
+
+	if ( abbr_card > 100000.0 )
 	{
-		if  (box1.ymin < box2.ymin)
-		{
-			PG_RETURN_INT32(-1);
-		}
-		PG_RETURN_INT32(1);
+		state->estimating = false;
+		return false;
 	}
 
-	if  ( ! FPeq(box1.xmax , box2.xmax) )
+	if ( abbr_card < state->input_count / 10000.0 + 0.5 )
 	{
-		if  (box1.xmax < box2.xmax)
-		{
-			PG_RETURN_INT32(-1);
-		}
-		PG_RETURN_INT32(1);
+		POSTGIS_DEBUGF(2, "abbreviation aborted, %g distinct keys in %ld rows",
+		               abbr_card, (long)state->input_count);
+		return true;
 	}
 
-	if  ( ! FPeq(box1.ymax , box2.ymax) )
+	return false;
+}
+
+PG_FUNCTION_INFO_V1(lwgeom_sortsupport);
+Datum lwgeom_sortsupport(PG_FUNCTION_ARGS)
+{
+	SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+	ssup->comparator = lwgeom_sort_cmp;
+
+	/* Abbreviated keys need the whole double to fit in a Datum */
+	if ( ssup->abbreviate && sizeof(Datum) >= sizeof(double) )
 	{
-		if  (box1.ymax < box2.ymax)
-		{
-			PG_RETURN_INT32(-1);
-		}
-		PG_RETURN_INT32(1);
+		MemoryContext oldcontext = MemoryContextSwitchTo(ssup->ssup_cxt);
+		lwgeom_abbrev_state *state = palloc(sizeof(lwgeom_abbrev_state));
+
+		state->input_count = 0;
+		state->estimating = true;
+		initHyperLogLog(&state->abbr_card, 10);
+		ssup->ssup_extra = state;
+		MemoryContextSwitchTo(oldcontext);
+
+		ssup->comparator = lwgeom_abbrev_cmp;
+		ssup->abbrev_converter = lwgeom_abbrev_convert;
+		ssup->abbrev_abort = lwgeom_abbrev_abort;
+		ssup->abbrev_full_comparator = lwgeom_sort_cmp;
 	}
 
-	PG_RETURN_INT32(0);
+	PG_RETURN_VOID();
 }
 
+#endif /* POSTGIS_PGSQL_VERSION >= 95 */
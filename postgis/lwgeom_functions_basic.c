@@ -2552,6 +2552,39 @@ Datum ST_GeoHash(PG_FUNCTION_ARGS)
 	PG_RETURN_TEXT_P(result);
 }
 
+/**
+* Return an int8 space filling curve key for the center of the geometry
+* bounds, over the extent given as a box2d. Only the bounding box is read,
+* so the geometry is never deserialized.
+*/
+Datum ST_HilbertKey(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_HilbertKey);
+Datum ST_HilbertKey(PG_FUNCTION_ARGS)
+{
+	GBOX gbox;
+	GBOX *extent = (GBOX *)PG_GETARG_POINTER(1);
+
+	/* Empty geometries have no key */
+	if ( gserialized_datum_get_gbox_p(PG_GETARG_DATUM(0), &gbox) == LW_FAILURE )
+		PG_RETURN_NULL();
+
+	PG_RETURN_INT64((int64)gbox_hilbert_key(&gbox, extent));
+}
+
+Datum ST_ZOrderKey(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_ZOrderKey);
+Datum ST_ZOrderKey(PG_FUNCTION_ARGS)
+{
+	GBOX gbox;
+	GBOX *extent = (GBOX *)PG_GETARG_POINTER(1);
+
+	/* Empty geometries have no key */
+	if ( gserialized_datum_get_gbox_p(PG_GETARG_DATUM(0), &gbox) == LW_FAILURE )
+		PG_RETURN_NULL();
+
+	PG_RETURN_INT64((int64)gbox_zorder_key(&gbox, extent));
+}
+
 PG_FUNCTION_INFO_V1(ST_CollectionExtract);
 Datum ST_CollectionExtract(PG_FUNCTION_ARGS)
 {
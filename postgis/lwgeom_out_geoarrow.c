@@ -0,0 +1,87 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+/**
+ * @file
+ * GeoArrow export functions
+ */
+
+#include "postgres.h"
+#include "utils/builtins.h"
+#include "fmgr.h"
+
+#include "../postgis_config.h"
+#include "lwgeom_pg.h"
+#include "lwgeom_log.h"
+#include "liblwgeom.h"
+#include "geoarrow.h"
+
+/**
+ * Process input parameters and row data into state
+ */
+PG_FUNCTION_INFO_V1(pgis_asgeoarrow_transfn);
+Datum pgis_asgeoarrow_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, oldcontext;
+	struct geoarrow_agg_context *ctx;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		lwerror("pgis_asgeoarrow_transfn: called in non-aggregate context");
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+
+	if (PG_ARGISNULL(0)) {
+		ctx = palloc(sizeof(*ctx));
+		if (PG_ARGISNULL(1))
+			lwerror("pgis_asgeoarrow_transfn: parameter geom_name cannot be null");
+		ctx->geom_name = text_to_cstring(PG_GETARG_TEXT_P(1));
+		geoarrow_agg_init_context(ctx);
+	} else {
+		ctx = (struct geoarrow_agg_context *) PG_GETARG_POINTER(0);
+	}
+
+	if (!type_is_rowtype(get_fn_expr_argtype(fcinfo->flinfo, 2)))
+		lwerror("pgis_asgeoarrow_transfn: parameter row cannot be other than a rowtype");
+	ctx->row = PG_GETARG_HEAPTUPLEHEADER(2);
+
+	geoarrow_agg_transfn(ctx);
+	PG_FREE_IF_COPY(ctx->row, 2);
+	MemoryContextSwitchTo(oldcontext);
+	PG_RETURN_POINTER(ctx);
+}
+
+/**
+ * Encode final state to an Arrow IPC stream
+ */
+PG_FUNCTION_INFO_V1(pgis_asgeoarrow_finalfn);
+Datum pgis_asgeoarrow_finalfn(PG_FUNCTION_ARGS)
+{
+	struct geoarrow_agg_context *ctx;
+	uint8_t *buf;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		lwerror("pgis_asgeoarrow_finalfn: called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	ctx = (struct geoarrow_agg_context *) PG_GETARG_POINTER(0);
+	buf = geoarrow_agg_finalfn(ctx);
+	PG_RETURN_BYTEA_P(buf);
+}
@@ -40,7 +40,10 @@
 #include "geobuf.h"
 
 /**
- * Process input parameters and row data into state
+ * Process input parameters and row data into state.
+ *
+ * When precision and dimensions are given features are encoded
+ * as they arrive instead of being held until the final call.
  */
 PG_FUNCTION_INFO_V1(pgis_asgeobuf_transfn);
 Datum pgis_asgeobuf_transfn(PG_FUNCTION_ARGS)
@@ -61,7 +64,22 @@ Datum pgis_asgeobuf_transfn(PG_FUNCTION_ARGS)
 		if (PG_ARGISNULL(1))
 			lwerror("pgis_asgeobuf_transfn: parameter geom_name cannot be null");
 		ctx->geom_name = text_to_cstring(PG_GETARG_TEXT_P(1));
-		geobuf_agg_init_context(ctx);
+		if (PG_NARGS() > 3) {
+			int32 precision, dimensions;
+			if (PG_ARGISNULL(3))
+				lwerror("pgis_asgeobuf_transfn: parameter precision cannot be null");
+			if (PG_ARGISNULL(4))
+				lwerror("pgis_asgeobuf_transfn: parameter dimensions cannot be null");
+			precision = PG_GETARG_INT32(3);
+			dimensions = PG_GETARG_INT32(4);
+			if (precision < 0 || precision > 6)
+				lwerror("pgis_asgeobuf_transfn: precision must be between 0 and 6");
+			if (dimensions < 2 || dimensions > 4)
+				lwerror("pgis_asgeobuf_transfn: dimensions must be between 2 and 4");
+			geobuf_agg_init_stream_context(ctx, precision, dimensions);
+		} else {
+			geobuf_agg_init_context(ctx);
+		}
 	} else {
 		ctx = (struct geobuf_agg_context *) PG_GETARG_POINTER(0);
 	}
@@ -71,6 +89,7 @@ Datum pgis_asgeobuf_transfn(PG_FUNCTION_ARGS)
 	ctx->row = PG_GETARG_HEAPTUPLEHEADER(2);
 
 	geobuf_agg_transfn(ctx);
+	PG_FREE_IF_COPY(ctx->row, 2);
 	PG_RETURN_POINTER(ctx);
 #endif
 }
@@ -97,3 +116,84 @@ Datum pgis_asgeobuf_finalfn(PG_FUNCTION_ARGS)
 	PG_RETURN_BYTEA_P(buf);
 #endif
 }
+
+/**
+ * Combine two streaming partial states
+ */
+PG_FUNCTION_INFO_V1(pgis_asgeobuf_combinefn);
+Datum pgis_asgeobuf_combinefn(PG_FUNCTION_ARGS)
+{
+#ifndef HAVE_LIBPROTOBUF
+	lwerror("Missing libprotobuf-c");
+	PG_RETURN_NULL();
+#else
+	MemoryContext aggcontext, oldcontext;
+	struct geobuf_agg_context *ctx1, *ctx2;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		lwerror("pgis_asgeobuf_combinefn: called in non-aggregate context");
+
+	ctx1 = PG_ARGISNULL(0) ? NULL : (struct geobuf_agg_context *) PG_GETARG_POINTER(0);
+	ctx2 = PG_ARGISNULL(1) ? NULL : (struct geobuf_agg_context *) PG_GETARG_POINTER(1);
+
+	if (!ctx2) {
+		if (!ctx1)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(ctx1);
+	}
+	/* Deserialized states already live in the aggregate context */
+	if (!ctx1)
+		PG_RETURN_POINTER(ctx2);
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	ctx1 = geobuf_agg_combine(ctx1, ctx2);
+	MemoryContextSwitchTo(oldcontext);
+	PG_RETURN_POINTER(ctx1);
+#endif
+}
+
+/**
+ * Serialize a streaming partial state as a packed Data message
+ */
+PG_FUNCTION_INFO_V1(pgis_asgeobuf_serialfn);
+Datum pgis_asgeobuf_serialfn(PG_FUNCTION_ARGS)
+{
+#ifndef HAVE_LIBPROTOBUF
+	lwerror("Missing libprotobuf-c");
+	PG_RETURN_NULL();
+#else
+	struct geobuf_agg_context *ctx;
+	if (!AggCheckCallContext(fcinfo, NULL))
+		lwerror("pgis_asgeobuf_serialfn: called in non-aggregate context");
+
+	ctx = (struct geobuf_agg_context *) PG_GETARG_POINTER(0);
+	uint8_t *buf = geobuf_agg_serialize(ctx);
+	PG_RETURN_BYTEA_P(buf);
+#endif
+}
+
+/**
+ * Unpack a partial state serialized by pgis_asgeobuf_serialfn
+ */
+PG_FUNCTION_INFO_V1(pgis_asgeobuf_deserialfn);
+Datum pgis_asgeobuf_deserialfn(PG_FUNCTION_ARGS)
+{
+#ifndef HAVE_LIBPROTOBUF
+	lwerror("Missing libprotobuf-c");
+	PG_RETURN_NULL();
+#else
+	MemoryContext aggcontext, oldcontext;
+	struct geobuf_agg_context *ctx;
+	bytea *ba;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		lwerror("pgis_asgeobuf_deserialfn: called in non-aggregate context");
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	ba = PG_GETARG_BYTEA_P(0);
+	ctx = geobuf_agg_deserialize((uint8_t *) VARDATA(ba), VARSIZE(ba) - VARHDRSZ);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_POINTER(ctx);
+#endif
+}
@@ -25,6 +25,9 @@
 #include "postgres.h"
 #include "utils/builtins.h"
 #include "executor/spi.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/tuplestore.h"
 #include "../postgis_config.h"
 #include "lwgeom_pg.h"
 #include "lwgeom_log.h"
@@ -136,3 +139,209 @@ Datum pgis_asmvt_finalfn(PG_FUNCTION_ARGS)
 	PG_RETURN_BYTEA_P(buf);
 #endif
 }
+
+/**
+ * Combine two partial states, merging their features and dictionaries
+ */
+PG_FUNCTION_INFO_V1(pgis_asmvt_combinefn);
+Datum pgis_asmvt_combinefn(PG_FUNCTION_ARGS)
+{
+#ifndef HAVE_LIBPROTOBUF
+	lwerror("Missing libprotobuf-c");
+	PG_RETURN_NULL();
+#else
+	MemoryContext aggcontext, oldcontext;
+	struct mvt_agg_context *ctx1, *ctx2;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		lwerror("pgis_asmvt_combinefn: called in non-aggregate context");
+
+	ctx1 = PG_ARGISNULL(0) ? NULL : (struct mvt_agg_context *) PG_GETARG_POINTER(0);
+	ctx2 = PG_ARGISNULL(1) ? NULL : (struct mvt_agg_context *) PG_GETARG_POINTER(1);
+
+	if (!ctx2) {
+		if (!ctx1)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(ctx1);
+	}
+	/* Deserialized states already live in the aggregate context */
+	if (!ctx1)
+		PG_RETURN_POINTER(ctx2);
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	ctx1 = mvt_agg_combine(ctx1, ctx2);
+	MemoryContextSwitchTo(oldcontext);
+	PG_RETURN_POINTER(ctx1);
+#endif
+}
+
+/**
+ * Serialize a partial state as a packed single layer tile
+ */
+PG_FUNCTION_INFO_V1(pgis_asmvt_serialfn);
+Datum pgis_asmvt_serialfn(PG_FUNCTION_ARGS)
+{
+#ifndef HAVE_LIBPROTOBUF
+	lwerror("Missing libprotobuf-c");
+	PG_RETURN_NULL();
+#else
+	struct mvt_agg_context *ctx;
+	if (!AggCheckCallContext(fcinfo, NULL))
+		lwerror("pgis_asmvt_serialfn: called in non-aggregate context");
+
+	ctx = (struct mvt_agg_context *) PG_GETARG_POINTER(0);
+	uint8_t *buf = mvt_agg_serialize(ctx);
+	PG_RETURN_BYTEA_P(buf);
+#endif
+}
+
+/**
+ * Unpack a partial state serialized by pgis_asmvt_serialfn
+ */
+PG_FUNCTION_INFO_V1(pgis_asmvt_deserialfn);
+Datum pgis_asmvt_deserialfn(PG_FUNCTION_ARGS)
+{
+#ifndef HAVE_LIBPROTOBUF
+	lwerror("Missing libprotobuf-c");
+	PG_RETURN_NULL();
+#else
+	MemoryContext aggcontext, oldcontext;
+	struct mvt_agg_context *ctx;
+	bytea *ba;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		lwerror("pgis_asmvt_deserialfn: called in non-aggregate context");
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	ba = PG_GETARG_BYTEA_P(0);
+	ctx = mvt_agg_deserialize((uint8_t *) VARDATA(ba), VARSIZE(ba) - VARHDRSZ);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_POINTER(ctx);
+#endif
+}
+
+/**
+ * Encode the rows of query into every tile of zoom levels zmin to zmax
+ * they touch, returning one (z, x, y, mvt) row per tile with features.
+ *
+ * The query is run once per zoom level, and the tiles of a level are
+ * written to the result tuplestore, which spills to disk past work_mem,
+ * before the next level is started. Only the tiles of one zoom level
+ * are held in memory at a time.
+ */
+PG_FUNCTION_INFO_V1(ST_AsMVTTiles);
+Datum ST_AsMVTTiles(PG_FUNCTION_ARGS)
+{
+#ifndef HAVE_LIBPROTOBUF
+	lwerror("Missing libprotobuf-c");
+	PG_RETURN_NULL();
+#else
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext oldcontext, tiles_context;
+	Tuplestorestate *tupstore;
+	TupleDesc tupdesc;
+	TupleDesc rowdesc = NULL;
+	struct mvt_tiles_context *tiles;
+	char *query, *name, *geom_name;
+	int zmin, zmax, extent, buffer;
+	GBOX *bounds;
+	SPIPlanPtr plan;
+	uint32_t zoom;
+	uint32 i;
+
+	if (!rsinfo || !IsA(rsinfo, ReturnSetInfo) ||
+	    !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			errmsg("set-valued function called in context that cannot accept a set")));
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	query = text_to_cstring(PG_GETARG_TEXT_P(0));
+	name = text_to_cstring(PG_GETARG_TEXT_P(1));
+	zmin = PG_GETARG_INT32(2);
+	zmax = PG_GETARG_INT32(3);
+	extent = PG_GETARG_INT32(4);
+	buffer = PG_GETARG_INT32(5);
+	geom_name = text_to_cstring(PG_GETARG_TEXT_P(6));
+	bounds = (GBOX *) PG_GETARG_POINTER(7);
+
+	if (zmin < 0 || zmax < 0)
+		lwerror("ST_AsMVTTiles: zoom levels cannot be negative");
+	if (extent <= 0)
+		lwerror("ST_AsMVTTiles: extent must be positive");
+	if (buffer < 0)
+		lwerror("ST_AsMVTTiles: buffer cannot be negative");
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+		false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+	MemoryContextSwitchTo(oldcontext);
+
+	/* Tiles outlive the SPI memory of each scan */
+	tiles_context = AllocSetContextCreate(CurrentMemoryContext,
+		"ST_AsMVTTiles",
+		ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE,
+		ALLOCSET_DEFAULT_MAXSIZE);
+	oldcontext = MemoryContextSwitchTo(tiles_context);
+	tiles = mvt_tiles_init(name, extent, buffer, geom_name, zmin, zmax,
+		bounds);
+	MemoryContextSwitchTo(oldcontext);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		lwerror("ST_AsMVTTiles: could not connect to SPI manager");
+	plan = SPI_prepare(query, 0, NULL);
+	if (!plan)
+		lwerror("ST_AsMVTTiles: could not prepare query: %s",
+			SPI_result_code_string(SPI_result));
+
+	for (zoom = zmin; zoom <= zmax; zoom++) {
+		Portal portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
+		uint32_t z, x, y;
+		uint8_t *mvt;
+
+		for (;;) {
+			SPI_cursor_fetch(portal, true, 1000);
+			if (SPI_processed == 0)
+				break;
+			/* Give the row type a typmod once, rows are read as composites */
+			if (!rowdesc) {
+				oldcontext = MemoryContextSwitchTo(tiles_context);
+				rowdesc = CreateTupleDescCopy(SPI_tuptable->tupdesc);
+				BlessTupleDesc(rowdesc);
+				MemoryContextSwitchTo(oldcontext);
+			}
+			for (i = 0; i < SPI_processed; i++)
+				mvt_tiles_add(tiles, zoom, SPI_tuptable->vals[i], rowdesc);
+			SPI_freetuptable(SPI_tuptable);
+		}
+		SPI_cursor_close(portal);
+
+		/* The zoom level is done, hand its tiles over */
+		oldcontext = MemoryContextSwitchTo(tiles->row_context);
+		while (mvt_tiles_next(tiles, &z, &x, &y, &mvt)) {
+			Datum values[4];
+			bool nulls[4] = { false, false, false, false };
+
+			values[0] = Int32GetDatum(z);
+			values[1] = Int32GetDatum(x);
+			values[2] = Int32GetDatum(y);
+			values[3] = PointerGetDatum(mvt);
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			MemoryContextReset(tiles->row_context);
+		}
+		MemoryContextSwitchTo(oldcontext);
+		mvt_tiles_reset(tiles);
+	}
+
+	SPI_finish();
+	MemoryContextDelete(tiles_context);
+
+	return (Datum) 0;
+#endif
+}
@@ -22,14 +22,17 @@
  *
  **********************************************************************/
 
+#include <math.h>
 #include "mvt.h"
 
 #ifdef HAVE_LIBPROTOBUF
 
+#include "utils/memutils.h"
+#if POSTGIS_PGSQL_VERSION < 94
+#include "access/tuptoaster.h"
+#endif
 #include "uthash.h"
 
-#define FEATURES_CAPACITY_INITIAL 50
-
 enum mvt_cmd_id {
 	CMD_MOVE_TO = 1,
 	CMD_LINE_TO = 2,
@@ -78,6 +81,18 @@ struct mvt_kv_bool_value {
 	UT_hash_handle hh;
 };
 
+struct mvt_tile_key {
+	uint32_t z;
+	uint32_t x;
+	uint32_t y;
+};
+
+struct mvt_tile {
+	struct mvt_tile_key key;
+	struct mvt_agg_context *ctx;
+	UT_hash_handle hh;
+};
+
 static inline uint32_t c_int(enum mvt_cmd_id id, uint32_t count)
 {
 	return (id & 0x7) | (count << 3);
@@ -88,6 +103,173 @@ static inline uint32_t p_int(int32_t value)
 	return (value << 1) ^ (value >> 31);
 }
 
+/* Field numbers and wire types of the vector tile protobuf schema */
+#define MVT_WIRE_VARINT 0
+#define MVT_WIRE_FIXED64 1
+#define MVT_WIRE_LENGTH 2
+#define MVT_WIRE_FIXED32 5
+#define MVT_KEY(field, wire) (((field) << 3) | (wire))
+
+#define MVT_TILE_LAYERS 3
+#define MVT_LAYER_NAME 1
+#define MVT_LAYER_FEATURES 2
+#define MVT_LAYER_KEYS 3
+#define MVT_LAYER_VALUES 4
+#define MVT_LAYER_EXTENT 5
+#define MVT_LAYER_VERSION 15
+#define MVT_FEATURE_TAGS 2
+#define MVT_FEATURE_TYPE 3
+#define MVT_FEATURE_GEOMETRY 4
+#define MVT_VALUE_STRING 1
+#define MVT_VALUE_FLOAT 2
+#define MVT_VALUE_DOUBLE 3
+#define MVT_VALUE_UINT 5
+#define MVT_VALUE_SINT 6
+#define MVT_VALUE_BOOL 7
+
+struct mvt_value_ref {
+	uint8_t field;
+	const void *kv;
+};
+
+struct mvt_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+};
+
+static inline size_t varint_len(uint64_t value)
+{
+	size_t len = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		len++;
+	}
+	return len;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t value)
+{
+	while (value >= 0x80) {
+		*p++ = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (uint8_t) value;
+	return p;
+}
+
+static inline uint8_t *put_fixed32(uint8_t *p, uint32_t value)
+{
+	int i;
+	for (i = 0; i < 4; i++, value >>= 8)
+		*p++ = (uint8_t) value;
+	return p;
+}
+
+static inline uint8_t *put_fixed64(uint8_t *p, uint64_t value)
+{
+	int i;
+	for (i = 0; i < 8; i++, value >>= 8)
+		*p++ = (uint8_t) value;
+	return p;
+}
+
+static inline uint8_t *put_bytes(uint8_t *p, const void *bytes, size_t len)
+{
+	p = put_varint(p, len);
+	memcpy(p, bytes, len);
+	return p + len;
+}
+
+static void write_varint(StringInfo s, uint64_t value)
+{
+	enlargeStringInfo(s, 10);
+	s->len = (char *) put_varint((uint8_t *) s->data + s->len, value) - s->data;
+	s->data[s->len] = '\0';
+}
+
+static void write_bytes(StringInfo s, const void *bytes, size_t len)
+{
+	write_varint(s, len);
+	appendBinaryStringInfo(s, bytes, len);
+}
+
+static size_t packed_len(const uint32_t *values, size_t n)
+{
+	size_t i, len = 0;
+	for (i = 0; i < n; i++)
+		len += varint_len(values[i]);
+	return len;
+}
+
+static void write_packed(StringInfo s, uint32_t field, const uint32_t *values,
+			 size_t n, size_t len)
+{
+	size_t i;
+	uint8_t *p;
+	write_varint(s, MVT_KEY(field, MVT_WIRE_LENGTH));
+	write_varint(s, len);
+	enlargeStringInfo(s, len);
+	p = (uint8_t *) s->data + s->len;
+	for (i = 0; i < n; i++)
+		p = put_varint(p, values[i]);
+	s->len += len;
+	s->data[s->len] = '\0';
+}
+
+static uint64_t read_varint(struct mvt_reader *r)
+{
+	uint64_t value = 0;
+	int shift;
+	for (shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+		uint8_t b = *r->p++;
+		value |= (uint64_t) (b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return value;
+	}
+	lwerror("mvt: invalid varint in partial tile");
+	return 0;
+}
+
+static const uint8_t *read_bytes(struct mvt_reader *r, size_t len)
+{
+	const uint8_t *p = r->p;
+	if (len > (size_t) (r->end - r->p))
+		lwerror("mvt: truncated partial tile");
+	r->p += len;
+	return p;
+}
+
+static uint64_t read_fixed(struct mvt_reader *r, int size)
+{
+	const uint8_t *p = read_bytes(r, size);
+	uint64_t value = 0;
+	int i;
+	for (i = size - 1; i >= 0; i--)
+		value = (value << 8) | p[i];
+	return value;
+}
+
+static void skip_field(struct mvt_reader *r, int wire)
+{
+	switch (wire) {
+	case MVT_WIRE_VARINT:
+		read_varint(r);
+		break;
+	case MVT_WIRE_FIXED64:
+		read_bytes(r, 8);
+		break;
+	case MVT_WIRE_LENGTH:
+		read_bytes(r, read_varint(r));
+		break;
+	case MVT_WIRE_FIXED32:
+		read_bytes(r, 4);
+		break;
+	default:
+		lwerror("mvt: unsupported wire type %d in partial tile", wire);
+	}
+}
+
+
 static uint32_t encode_ptarray(struct mvt_agg_context *ctx, enum mvt_type type,
 			       POINTARRAY *pa, uint32_t *buffer,
 			       int32_t *px, int32_t *py)
@@ -142,40 +324,49 @@ static uint32_t encode_ptarray_initial(struct mvt_agg_context *ctx,
 	return encode_ptarray(ctx, type, pa, buffer, &px, &py);
 }
 
+
+/**
+ * Returns the per feature geometry scratch buffer, grown to hold c
+ * commands and parameters.
+ */
+static uint32_t *geometry_buffer(struct mvt_agg_context *ctx, size_t c)
+{
+	if (c > ctx->geometry_capacity) {
+		size_t new_capacity = Max(c, ctx->geometry_capacity * 2);
+		ctx->geometry = ctx->geometry ?
+			repalloc(ctx->geometry, new_capacity * sizeof(*ctx->geometry)) :
+			palloc(new_capacity * sizeof(*ctx->geometry));
+		ctx->geometry_capacity = new_capacity;
+	}
+	return ctx->geometry;
+}
+
 static void encode_point(struct mvt_agg_context *ctx, LWPOINT *point)
 {
-	VectorTile__Tile__Feature *feature = ctx->feature;
-	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__POINT;
-	feature->has_type = 1;
-	feature->n_geometry = 3;
-	feature->geometry = palloc(sizeof(*feature->geometry) * 3);
-	encode_ptarray_initial(ctx, MVT_POINT, point->point, feature->geometry);
+	ctx->feature_type = VECTOR_TILE__TILE__GEOM_TYPE__POINT;
+	ctx->n_geometry = encode_ptarray_initial(ctx, MVT_POINT, point->point,
+		geometry_buffer(ctx, 3));
 }
 
 static void encode_mpoint(struct mvt_agg_context *ctx, LWMPOINT *mpoint)
 {
 	size_t c;
-	VectorTile__Tile__Feature *feature = ctx->feature;
 	// NOTE: inefficient shortcut LWMPOINT->LWLINE
 	LWLINE *lwline = lwline_from_lwmpoint(mpoint->srid, mpoint);
-	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__POINT;
-	feature->has_type = 1;
+	ctx->feature_type = VECTOR_TILE__TILE__GEOM_TYPE__POINT;
 	c = 1 + lwline->points->npoints * 2;
-	feature->geometry = palloc(sizeof(*feature->geometry) * c);
-	feature->n_geometry = encode_ptarray_initial(ctx, MVT_POINT,
-		lwline->points, feature->geometry);
+	ctx->n_geometry = encode_ptarray_initial(ctx, MVT_POINT,
+		lwline->points, geometry_buffer(ctx, c));
+	lwline_free(lwline);
 }
 
 static void encode_line(struct mvt_agg_context *ctx, LWLINE *lwline)
 {
 	size_t c;
-	VectorTile__Tile__Feature *feature = ctx->feature;
-	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING;
-	feature->has_type = 1;
+	ctx->feature_type = VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING;
 	c = 2 + lwline->points->npoints * 2;
-	feature->geometry = palloc(sizeof(*feature->geometry) * c);
-	feature->n_geometry = encode_ptarray_initial(ctx, MVT_LINE,
-		lwline->points, feature->geometry);
+	ctx->n_geometry = encode_ptarray_initial(ctx, MVT_LINE,
+		lwline->points, geometry_buffer(ctx, c));
 }
 
 static void encode_mline(struct mvt_agg_context *ctx, LWMLINE *lwmline)
@@ -183,17 +374,16 @@ static void encode_mline(struct mvt_agg_context *ctx, LWMLINE *lwmline)
 	uint32_t i;
 	int32_t px = 0, py = 0;
 	size_t c = 0, offset = 0;
-	VectorTile__Tile__Feature *feature = ctx->feature;
-	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING;
-	feature->has_type = 1;
+	uint32_t *buffer;
+	ctx->feature_type = VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING;
 	for (i = 0; i < lwmline->ngeoms; i++)
 		c += 2 + lwmline->geoms[i]->points->npoints * 2;
-	feature->geometry = palloc(sizeof(*feature->geometry) * c);
+	buffer = geometry_buffer(ctx, c);
 	for (i = 0; i < lwmline->ngeoms; i++)
-		offset += encode_ptarray(ctx, MVT_LINE, 
+		offset += encode_ptarray(ctx, MVT_LINE,
 			lwmline->geoms[i]->points,
-			feature->geometry + offset, &px, &py);
-	feature->n_geometry = offset;
+			buffer + offset, &px, &py);
+	ctx->n_geometry = offset;
 }
 
 static void encode_poly(struct mvt_agg_context *ctx, LWPOLY *lwpoly)
@@ -201,17 +391,16 @@ static void encode_poly(struct mvt_agg_context *ctx, LWPOLY *lwpoly)
 	uint32_t i;
 	int32_t px = 0, py = 0;
 	size_t c = 0, offset = 0;
-	VectorTile__Tile__Feature *feature = ctx->feature;
-	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__POLYGON;
-	feature->has_type = 1;
+	uint32_t *buffer;
+	ctx->feature_type = VECTOR_TILE__TILE__GEOM_TYPE__POLYGON;
 	for (i = 0; i < lwpoly->nrings; i++)
 		c += 3 + ((lwpoly->rings[i]->npoints - 1) * 2);
-	feature->geometry = palloc(sizeof(*feature->geometry) * c);
+	buffer = geometry_buffer(ctx, c);
 	for (i = 0; i < lwpoly->nrings; i++)
 		offset += encode_ptarray(ctx, MVT_RING,
 			lwpoly->rings[i],
-			feature->geometry + offset, &px, &py);
-	feature->n_geometry = offset;
+			buffer + offset, &px, &py);
+	ctx->n_geometry = offset;
 }
 
 static void encode_mpoly(struct mvt_agg_context *ctx, LWMPOLY *lwmpoly)
@@ -220,19 +409,18 @@ static void encode_mpoly(struct mvt_agg_context *ctx, LWMPOLY *lwmpoly)
 	int32_t px = 0, py = 0;
 	size_t c = 0, offset = 0;
 	LWPOLY *poly;
-	VectorTile__Tile__Feature *feature = ctx->feature;
-	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__POLYGON;
-	feature->has_type = 1;
+	uint32_t *buffer;
+	ctx->feature_type = VECTOR_TILE__TILE__GEOM_TYPE__POLYGON;
 	for (i = 0; i < lwmpoly->ngeoms; i++)
 		for (j = 0; poly = lwmpoly->geoms[i], j < poly->nrings; j++)
 			c += 3 + ((poly->rings[j]->npoints - 1) * 2);
-	feature->geometry = palloc(sizeof(*feature->geometry) * c);
+	buffer = geometry_buffer(ctx, c);
 	for (i = 0; i < lwmpoly->ngeoms; i++)
 		for (j = 0; poly = lwmpoly->geoms[i], j < poly->nrings; j++)
 			offset += encode_ptarray(ctx, MVT_RING,
-				poly->rings[j],	feature->geometry + offset,
+				poly->rings[j],	buffer + offset,
 				&px, &py);
-	feature->n_geometry = offset;
+	ctx->n_geometry = offset;
 }
 
 static void encode_geometry(struct mvt_agg_context *ctx, LWGEOM *lwgeom)
@@ -279,55 +467,108 @@ static void encode_keys(struct mvt_agg_context *ctx)
 			geom_name_found = 1;
 			continue;
 		}
-		keys[k++] = key;
+		keys[k++] = pstrdup(key);
 	}
 	if (!geom_name_found)
 		lwerror("encode_keys: no column '%s' found", ctx->geom_name);
-	ctx->layer->n_keys = k;
-	ctx->layer->keys = keys;
+	ctx->n_keys = k;
+	ctx->keys = keys;
+	ctx->tags = palloc(Max(k, 1) * 2 * sizeof(*ctx->tags));
 	ReleaseTupleDesc(tupdesc);
 }
 
-static VectorTile__Tile__Value *create_value() {
-	VectorTile__Tile__Value *value = palloc(sizeof(*value));
-	vector_tile__tile__value__init(value);
-	return value;
-}
-
-#define MVT_CREATE_VALUES(kvtype, hash, hasfield, valuefield) \
+#define MVT_COLLECT_VALUES(kvtype, hash, valuetype) \
 { \
 	struct kvtype *kv; \
 	for (kv = ctx->hash; kv != NULL; kv=kv->hh.next) { \
-		VectorTile__Tile__Value *value = create_value(); \
-		value->hasfield = 1; \
-		value->valuefield = kv->valuefield; \
-		values[kv->id] = value; \
+		refs[kv->id].field = valuetype; \
+		refs[kv->id].kv = kv; \
 	} \
 }
 
-static void encode_values(struct mvt_agg_context *ctx)
+/**
+ * Append a Value message to the encoded layer values.
+ */
+static void write_value(StringInfo s, const struct mvt_value_ref *ref)
 {
-	VectorTile__Tile__Value **values;
-	values = palloc(ctx->values_hash_i * sizeof(*values));
-	struct mvt_kv_string_value *kv;
-	for (kv = ctx->string_values_hash; kv != NULL; kv=kv->hh.next) {
-		VectorTile__Tile__Value *value = create_value();
-		value->string_value = kv->string_value;
-		values[kv->id] = value;
-	}
-	MVT_CREATE_VALUES(mvt_kv_float_value,
-		float_values_hash, has_float_value, float_value);
-	MVT_CREATE_VALUES(mvt_kv_double_value,
-		double_values_hash, has_double_value, double_value);
-	MVT_CREATE_VALUES(mvt_kv_uint_value,
-		uint_values_hash, has_uint_value, uint_value);
-	MVT_CREATE_VALUES(mvt_kv_sint_value,
-		sint_values_hash, has_sint_value, sint_value);
-	MVT_CREATE_VALUES(mvt_kv_bool_value,
-		bool_values_hash, has_bool_value, bool_value);
-
-	ctx->layer->n_values = ctx->values_hash_i;
-	ctx->layer->values = values;
+	uint8_t buf[16], *p = buf;
+	uint32_t f;
+	uint64_t d;
+
+	switch (ref->field) {
+	case MVT_VALUE_STRING: {
+		const char *str = ((struct mvt_kv_string_value *) ref->kv)->string_value;
+		size_t len = strlen(str);
+		write_varint(s, MVT_KEY(MVT_LAYER_VALUES, MVT_WIRE_LENGTH));
+		write_varint(s, 1 + varint_len(len) + len);
+		write_varint(s, MVT_KEY(MVT_VALUE_STRING, MVT_WIRE_LENGTH));
+		write_bytes(s, str, len);
+		return;
+	}
+	case MVT_VALUE_FLOAT:
+		memcpy(&f, &((struct mvt_kv_float_value *) ref->kv)->float_value,
+			sizeof(f));
+		*p++ = MVT_KEY(MVT_VALUE_FLOAT, MVT_WIRE_FIXED32);
+		p = put_fixed32(p, f);
+		break;
+	case MVT_VALUE_DOUBLE:
+		memcpy(&d, &((struct mvt_kv_double_value *) ref->kv)->double_value,
+			sizeof(d));
+		*p++ = MVT_KEY(MVT_VALUE_DOUBLE, MVT_WIRE_FIXED64);
+		p = put_fixed64(p, d);
+		break;
+	case MVT_VALUE_UINT:
+		*p++ = MVT_KEY(MVT_VALUE_UINT, MVT_WIRE_VARINT);
+		p = put_varint(p, ((struct mvt_kv_uint_value *) ref->kv)->uint_value);
+		break;
+	case MVT_VALUE_SINT: {
+		int64_t v = ((struct mvt_kv_sint_value *) ref->kv)->sint_value;
+		*p++ = MVT_KEY(MVT_VALUE_SINT, MVT_WIRE_VARINT);
+		p = put_varint(p, ((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+		break;
+	}
+	case MVT_VALUE_BOOL:
+		*p++ = MVT_KEY(MVT_VALUE_BOOL, MVT_WIRE_VARINT);
+		p = put_varint(p, ((struct mvt_kv_bool_value *) ref->kv)->bool_value);
+		break;
+	default:
+		lwerror("write_value: unknown value type %d", ref->field);
+	}
+
+	write_varint(s, MVT_KEY(MVT_LAYER_VALUES, MVT_WIRE_LENGTH));
+	write_bytes(s, buf, p - buf);
+}
+
+/**
+ * Encode the value dictionaries as Value messages, in id order.
+ */
+static void encode_values(struct mvt_agg_context *ctx, StringInfo values)
+{
+	struct mvt_value_ref *refs;
+	uint32_t i;
+
+	refs = palloc(Max(ctx->values_hash_i, 1) * sizeof(*refs));
+	{
+		struct mvt_kv_string_value *kv;
+		for (kv = ctx->string_values_hash; kv != NULL; kv=kv->hh.next) {
+			refs[kv->id].field = MVT_VALUE_STRING;
+			refs[kv->id].kv = kv;
+		}
+	}
+	MVT_COLLECT_VALUES(mvt_kv_float_value, float_values_hash,
+		MVT_VALUE_FLOAT);
+	MVT_COLLECT_VALUES(mvt_kv_double_value, double_values_hash,
+		MVT_VALUE_DOUBLE);
+	MVT_COLLECT_VALUES(mvt_kv_uint_value, uint_values_hash,
+		MVT_VALUE_UINT);
+	MVT_COLLECT_VALUES(mvt_kv_sint_value, sint_values_hash,
+		MVT_VALUE_SINT);
+	MVT_COLLECT_VALUES(mvt_kv_bool_value, bool_values_hash,
+		MVT_VALUE_BOOL);
+
+	for (i = 0; i < ctx->values_hash_i; i++)
+		write_value(values, &refs[i]);
+	pfree(refs);
 }
 
 #define MVT_PARSE_VALUE(value, kvtype, hash, valuefield, size) \
@@ -364,30 +605,39 @@ static void encode_values(struct mvt_agg_context *ctx)
 	} \
 }
 
-static void parse_value_as_string(struct mvt_agg_context *ctx, Oid typoid,
-	Datum datum, uint32_t *tags, uint32_t c, uint32_t k)
+/**
+ * Find or add a string value. Strings are hashed on their characters,
+ * not on the pointer to them.
+ */
+static uint32_t add_string_value(struct mvt_agg_context *ctx, char *value)
 {
 	struct mvt_kv_string_value *kv;
-	Oid foutoid;
-	bool typisvarlena;
-	getTypeOutputInfo(typoid, &foutoid, &typisvarlena);
-	char *value = OidOutputFunctionCall(foutoid, datum);
 	size_t size = strlen(value);
-	HASH_FIND(hh, ctx->string_values_hash, &value, size, kv);
+	HASH_FIND(hh, ctx->string_values_hash, value, size, kv);
 	if (!kv) {
 		kv = palloc(sizeof(*kv));
 		kv->id = ctx->values_hash_i++;
 		kv->string_value = value;
-		HASH_ADD(hh, ctx->string_values_hash, string_value, size, kv);
+		HASH_ADD_KEYPTR(hh, ctx->string_values_hash, kv->string_value,
+			size, kv);
 	}
+	return kv->id;
+}
+
+static void parse_value_as_string(struct mvt_agg_context *ctx, Oid typoid,
+	Datum datum, uint32_t *tags, uint32_t c, uint32_t k)
+{
+	Oid foutoid;
+	bool typisvarlena;
+	getTypeOutputInfo(typoid, &foutoid, &typisvarlena);
+	char *value = OidOutputFunctionCall(foutoid, datum);
 	tags[c*2] = k - 1;
-	tags[c*2+1] = kv->id;
+	tags[c*2+1] = add_string_value(ctx, value);
 }
 
 static void parse_values(struct mvt_agg_context *ctx)
 {
-	uint32_t n_keys = ctx->layer->n_keys;
-	uint32_t *tags = palloc(n_keys * 2 * sizeof(*tags));
+	uint32_t *tags = ctx->tags;
 	bool isnull;
 	uint32_t i, k = 0, c = 0;
 	TupleDesc tupdesc = get_tuple_desc(ctx);
@@ -427,9 +677,9 @@ static void parse_values(struct mvt_agg_context *ctx)
 				DatumGetFloat8, sizeof(double));
 			break;
 		case TEXTOID:
-			MVT_PARSE_DATUM(char *, mvt_kv_string_value,
-				string_values_hash, string_value,
-				TextDatumGetCString, strlen(value));
+			tags[c*2] = k - 1;
+			tags[c*2+1] = add_string_value(ctx,
+				TextDatumGetCString(datum));
 			break;
 		default:
 			parse_value_as_string(ctx, typoid, datum, tags, c, k);
@@ -440,10 +690,38 @@ static void parse_values(struct mvt_agg_context *ctx)
 
 	ReleaseTupleDesc(tupdesc);
 
-	ctx->feature->n_tags = c * 2;
-	ctx->feature->tags = tags;
+	ctx->n_tags = c * 2;
+}
+
+/**
+ * Append the current feature, tags and geometry from the scratch
+ * buffers, to the encoded layer features.
+ */
+static void write_feature(struct mvt_agg_context *ctx)
+{
+	size_t tags_len = packed_len(ctx->tags, ctx->n_tags);
+	size_t geometry_len = packed_len(ctx->geometry, ctx->n_geometry);
+	size_t len = 2;
+	StringInfo s = &ctx->features;
+
+	if (ctx->n_tags > 0)
+		len += 1 + varint_len(tags_len) + tags_len;
+	if (ctx->n_geometry > 0)
+		len += 1 + varint_len(geometry_len) + geometry_len;
+
+	write_varint(s, MVT_KEY(MVT_LAYER_FEATURES, MVT_WIRE_LENGTH));
+	write_varint(s, len);
+	if (ctx->n_tags > 0)
+		write_packed(s, MVT_FEATURE_TAGS, ctx->tags, ctx->n_tags, tags_len);
+	write_varint(s, MVT_KEY(MVT_FEATURE_TYPE, MVT_WIRE_VARINT));
+	write_varint(s, ctx->feature_type);
+	if (ctx->n_geometry > 0)
+		write_packed(s, MVT_FEATURE_GEOMETRY, ctx->geometry,
+			ctx->n_geometry, geometry_len);
+	ctx->n_features++;
 }
 
+
 static int max_dim(LWCOLLECTION *lwcoll)
 {
 	int i, dim = 1;
@@ -457,6 +735,62 @@ static int max_dim(LWCOLLECTION *lwcoll)
 	return dim;
 }
 
+/**
+ * Clip a geometry to the box x0 y0, x1 y1.
+ */
+static LWGEOM *mvt_clip(LWGEOM *lwgeom, double x0, double y0, double x1,
+	double y1)
+{
+#if POSTGIS_GEOS_VERSION < 35
+	GBOX clip_box;
+	LWGEOM *lwgeom_clipped;
+	memset(&clip_box, 0, sizeof(clip_box));
+	clip_box.xmin = x0;
+	clip_box.ymin = y0;
+	clip_box.xmax = x1;
+	clip_box.ymax = y1;
+	lwgeom_clipped = lwgeom_rectclip(lwgeom, &clip_box);
+	if (!lwgeom_clipped) {
+		LWPOLY *lwenv = lwpoly_construct_envelope(0, x0, y0, x1, y1);
+		lwgeom_clipped = lwgeom_intersection(lwgeom, lwpoly_as_lwgeom(lwenv));
+		lwpoly_free(lwenv);
+	}
+	return lwgeom_clipped;
+#else
+	return lwgeom_clip_by_rect(lwgeom, x0, y0, x1, y1);
+#endif
+}
+
+/**
+ * Snap a geometry in tile coordinate space to the integer grid.
+ * Returns NULL if the geometry collapses.
+ */
+static LWGEOM *mvt_grid(LWGEOM *lwgeom)
+{
+	gridspec grid;
+	memset(&grid, 0, sizeof(gridspec));
+	grid.ipx = 0;
+	grid.ipy = 0;
+	grid.xsize = 1;
+	grid.ysize = 1;
+	return lwgeom_grid(lwgeom, &grid);
+}
+
+/**
+ * Keep the highest dimension parts of a collection, which a tile
+ * feature cannot hold.
+ */
+static LWGEOM *mvt_homogenize(LWGEOM *lwgeom_out)
+{
+	if (lwgeom_out->type == COLLECTIONTYPE) {
+		LWCOLLECTION *lwcoll = (LWCOLLECTION*) lwgeom_out;
+		lwgeom_out = lwcollection_as_lwgeom(
+			lwcollection_extract(lwcoll, max_dim(lwcoll)));
+		lwgeom_out = lwgeom_homogenize(lwgeom_out);
+	}
+	return lwgeom_out;
+}
+
 /**
  * Transform a geometry into vector tile coordinate space.
  *
@@ -486,13 +820,7 @@ LWGEOM *mvt_geom(LWGEOM *lwgeom, GBOX *gbox, uint32_t extent, uint32_t buffer,
 		double y0 = gbox->ymin - buffer_map_yunits;
 		double x1 = gbox->xmax + buffer_map_xunits;
 		double y1 = gbox->ymax + buffer_map_yunits;
-#if POSTGIS_GEOS_VERSION < 35
-		LWPOLY *lwenv = lwpoly_construct_envelope(0, x0, y0, x1, y1);
-		lwgeom = lwgeom_intersection(lwgeom, lwpoly_as_lwgeom(lwenv));
-		lwpoly_free(lwenv);
-#else
-		lwgeom = lwgeom_clip_by_rect(lwgeom, x0, y0, x1, y1);
-#endif
+		lwgeom = mvt_clip(lwgeom, x0, y0, x1, y1);
 	}
 
 	AFFINE affine;
@@ -505,29 +833,15 @@ LWGEOM *mvt_geom(LWGEOM *lwgeom, GBOX *gbox, uint32_t extent, uint32_t buffer,
 
 	lwgeom_affine(lwgeom, &affine);
 
-	gridspec grid;
-	memset(&grid, 0, sizeof(gridspec));
-	grid.ipx = 0;
-	grid.ipy = 0;
-	grid.xsize = 1;
-	grid.ysize = 1;
-
-	LWGEOM *lwgeom_out = lwgeom_grid(lwgeom, &grid);
+	LWGEOM *lwgeom_out = mvt_grid(lwgeom);
 
 	if (lwgeom_out == NULL)
-		lwgeom_out = lwgeom_grid(lwgeom_centroid(lwgeom), &grid);
+		lwgeom_out = mvt_grid(lwgeom_centroid(lwgeom));
 
 	lwgeom_force_clockwise(lwgeom_out);
 	lwgeom_out = lwgeom_make_valid(lwgeom_out);
 
-	if (lwgeom_out->type == COLLECTIONTYPE) {
-		LWCOLLECTION *lwcoll = (LWCOLLECTION*) lwgeom_out;
-		lwgeom_out = lwcollection_as_lwgeom(
-			lwcollection_extract(lwcoll, max_dim(lwcoll)));
-		lwgeom_out = lwgeom_homogenize(lwgeom_out);
-	}
-
-	return lwgeom_out;
+	return mvt_homogenize(lwgeom_out);
 }
 
 /**
@@ -535,56 +849,48 @@ LWGEOM *mvt_geom(LWGEOM *lwgeom, GBOX *gbox, uint32_t extent, uint32_t buffer,
  */
 void mvt_agg_init_context(struct mvt_agg_context *ctx) 
 {
-	VectorTile__Tile__Layer *layer;
-
 	if (ctx->extent == 0)
 		lwerror("mvt_agg_init_context: extent cannot be 0");
 
-	ctx->features_capacity = FEATURES_CAPACITY_INITIAL;
+	initStringInfo(&ctx->features);
+	ctx->n_features = 0;
+	ctx->keys = NULL;
+	ctx->n_keys = 0;
+	ctx->tags = NULL;
+	ctx->n_tags = 0;
+	ctx->geometry = NULL;
+	ctx->n_geometry = 0;
+	ctx->geometry_capacity = 0;
 	ctx->string_values_hash = NULL;
 	ctx->float_values_hash = NULL;
 	ctx->double_values_hash = NULL;
-	ctx->int_values_hash = NULL;
 	ctx->uint_values_hash = NULL;
 	ctx->sint_values_hash = NULL;
 	ctx->bool_values_hash = NULL;
 	ctx->values_hash_i = 0;
+}
 
-	layer = palloc(sizeof(*layer));
-	vector_tile__tile__layer__init(layer);
-	layer->version = 2;
-	layer->name = ctx->name;
-	layer->has_extent = 1;
-	layer->extent = ctx->extent;
-	layer->features = palloc (ctx->features_capacity *
-		sizeof(*layer->features));
-
-	ctx->layer = layer;
+/**
+ * Encode a feature and append it to the layer, properties being
+ * taken from ctx->row.
+ */
+static void add_feature(struct mvt_agg_context *ctx, LWGEOM *lwgeom)
+{
+	encode_geometry(ctx, lwgeom);
+	parse_values(ctx);
+	write_feature(ctx);
 }
 
 /**
  * Aggregation step.
  *
- * Expands features array if needed by a factor of 2.
- * Allocates a new feature, increment feature counter and
- * encode geometry and properties into it.
- */
+ * Encodes geometry and properties of the row into reused scratch
+ * buffers and appends the resulting Feature message, in protobuf wire
+ * format, to the layer features buffer.
+ */
 void mvt_agg_transfn(struct mvt_agg_context *ctx)
 {
-	VectorTile__Tile__Layer *layer = ctx->layer;
-	VectorTile__Tile__Feature **features = layer->features;
-	if (layer->n_features >= ctx->features_capacity) {
-		size_t new_capacity = ctx->features_capacity * 2;
-		layer->features = repalloc(layer->features, new_capacity *
-			sizeof(*layer->features));
-		ctx->features_capacity = new_capacity;
-	}
-
-	VectorTile__Tile__Feature *feature = palloc(sizeof(*feature));
-	vector_tile__tile__feature__init(feature);
-
-	ctx->feature = feature;
-	if (layer->n_features == 0)
+	if (ctx->n_features == 0)
 		encode_keys(ctx);
 
 	bool isnull;
@@ -594,38 +900,690 @@ void mvt_agg_transfn(struct mvt_agg_context *ctx)
 	GSERIALIZED *gs = (GSERIALIZED *) PG_DETOAST_DATUM(datum);
 	LWGEOM *lwgeom = lwgeom_from_gserialized(gs);
 
-	layer->features[layer->n_features++] = feature;
-
-	encode_geometry(ctx, lwgeom);
+	add_feature(ctx, lwgeom);
 	lwgeom_free(lwgeom);
-	// TODO: free detoasted datum?
-	parse_values(ctx);
+	if ((Pointer) gs != DatumGetPointer(datum))
+		pfree(gs);
 }
 
 /**
  * Finalize aggregation.
  *
- * Encode keys and values and put the aggregated Layer message into
- * a Tile message and returns it packed as a bytea.
+ * Encodes keys and values after the streamed features and wraps them
+ * into a single Layer Tile message, returned as a bytea. Fields are
+ * written in field number order, as a protobuf encoder would.
  */
 uint8_t *mvt_agg_finalfn(struct mvt_agg_context *ctx)
 {
-	encode_values(ctx);
-
-	VectorTile__Tile__Layer *layers[1];
-	layers[0] = ctx->layer;
+	StringInfoData values;
+	size_t name_len = strlen(ctx->name);
+	size_t layer_len, len;
+	uint32_t i;
+	uint8_t *buf, *p;
 
-	VectorTile__Tile tile = VECTOR_TILE__TILE__INIT;
-	tile.n_layers = 1;
-	tile.layers = layers;
+	initStringInfo(&values);
+	encode_values(ctx, &values);
 
-	size_t len = vector_tile__tile__get_packed_size(&tile);
-	uint8_t *buf = palloc(sizeof(*buf) * (len + VARHDRSZ));
-	vector_tile__tile__pack(&tile, buf + VARHDRSZ);
+	layer_len = 1 + varint_len(name_len) + name_len;
+	layer_len += ctx->features.len;
+	for (i = 0; i < ctx->n_keys; i++) {
+		size_t key_len = strlen(ctx->keys[i]);
+		layer_len += 1 + varint_len(key_len) + key_len;
+	}
+	layer_len += values.len;
+	layer_len += 1 + varint_len(ctx->extent);
+	layer_len += 2;
+	len = 1 + varint_len(layer_len) + layer_len;
+
+	buf = palloc(sizeof(*buf) * (len + VARHDRSZ));
+	p = buf + VARHDRSZ;
+	*p++ = MVT_KEY(MVT_TILE_LAYERS, MVT_WIRE_LENGTH);
+	p = put_varint(p, layer_len);
+	*p++ = MVT_KEY(MVT_LAYER_NAME, MVT_WIRE_LENGTH);
+	p = put_bytes(p, ctx->name, name_len);
+	memcpy(p, ctx->features.data, ctx->features.len);
+	p += ctx->features.len;
+	for (i = 0; i < ctx->n_keys; i++) {
+		*p++ = MVT_KEY(MVT_LAYER_KEYS, MVT_WIRE_LENGTH);
+		p = put_bytes(p, ctx->keys[i], strlen(ctx->keys[i]));
+	}
+	memcpy(p, values.data, values.len);
+	p += values.len;
+	*p++ = MVT_KEY(MVT_LAYER_EXTENT, MVT_WIRE_VARINT);
+	p = put_varint(p, ctx->extent);
+	p = put_varint(p, MVT_KEY(MVT_LAYER_VERSION, MVT_WIRE_VARINT));
+	*p++ = 2;
+	Assert(p == buf + VARHDRSZ + len);
+	pfree(values.data);
 
 	SET_VARSIZE(buf, VARHDRSZ + len);
 
 	return buf;
 }
 
-#endif
\ No newline at end of file
+/**
+ * Serialize aggregation state.
+ *
+ * The partial layer travels as a packed Tile, same as the final output.
+ */
+uint8_t *mvt_agg_serialize(struct mvt_agg_context *ctx)
+{
+	return mvt_agg_finalfn(ctx);
+}
+
+#define MVT_ADD_VALUE(value, kvtype, hash, valuefield, size) \
+{ \
+	struct kvtype *kv = palloc(sizeof(*kv)); \
+	kv->id = ctx->values_hash_i++; \
+	kv->valuefield = value; \
+	HASH_ADD(hh, ctx->hash, valuefield, size, kv); \
+}
+
+/**
+ * Add a Value message of a partial tile to the value dictionaries.
+ */
+static void parse_tile_value(struct mvt_agg_context *ctx, struct mvt_reader *r)
+{
+	uint64_t key = read_varint(r);
+	uint64_t v;
+	size_t len;
+
+	switch (key) {
+	case MVT_KEY(MVT_VALUE_STRING, MVT_WIRE_LENGTH): {
+		struct mvt_kv_string_value *kv = palloc(sizeof(*kv));
+		len = read_varint(r);
+		kv->id = ctx->values_hash_i++;
+		kv->string_value = pnstrdup((const char *) read_bytes(r, len), len);
+		HASH_ADD_KEYPTR(hh, ctx->string_values_hash, kv->string_value,
+			len, kv);
+		break;
+	}
+	case MVT_KEY(MVT_VALUE_FLOAT, MVT_WIRE_FIXED32): {
+		uint32_t u = read_fixed(r, 4);
+		float value;
+		memcpy(&value, &u, sizeof(value));
+		MVT_ADD_VALUE(value, mvt_kv_float_value, float_values_hash,
+			float_value, sizeof(float));
+		break;
+	}
+	case MVT_KEY(MVT_VALUE_DOUBLE, MVT_WIRE_FIXED64): {
+		uint64_t u = read_fixed(r, 8);
+		double value;
+		memcpy(&value, &u, sizeof(value));
+		MVT_ADD_VALUE(value, mvt_kv_double_value, double_values_hash,
+			double_value, sizeof(double));
+		break;
+	}
+	case MVT_KEY(MVT_VALUE_UINT, MVT_WIRE_VARINT):
+		v = read_varint(r);
+		MVT_ADD_VALUE(v, mvt_kv_uint_value, uint_values_hash,
+			uint_value, sizeof(uint64_t));
+		break;
+	case MVT_KEY(MVT_VALUE_SINT, MVT_WIRE_VARINT): {
+		int64_t value;
+		v = read_varint(r);
+		value = (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+		MVT_ADD_VALUE(value, mvt_kv_sint_value, sint_values_hash,
+			sint_value, sizeof(int64_t));
+		break;
+	}
+	case MVT_KEY(MVT_VALUE_BOOL, MVT_WIRE_VARINT): {
+		bool value = read_varint(r) != 0;
+		MVT_ADD_VALUE(value, mvt_kv_bool_value, bool_values_hash,
+			bool_value, sizeof(bool));
+		break;
+	}
+	default:
+		lwerror("mvt_agg_deserialize: unsupported value type");
+	}
+
+	if (r->p != r->end)
+		lwerror("mvt_agg_deserialize: invalid value in partial tile");
+}
+
+/**
+ * Deserialize aggregation state.
+ *
+ * Walks the partial tile, keeping the encoded features as they are and
+ * rebuilding keys and value dictionaries, so that the state can take
+ * part in further combine steps.
+ */
+struct mvt_agg_context *mvt_agg_deserialize(uint8_t *buf, size_t len)
+{
+	struct mvt_reader tile = { buf, buf + len };
+	struct mvt_reader layer, field;
+	struct mvt_agg_context *ctx;
+	size_t layer_len, field_len;
+	uint32_t keys_capacity = 0;
+
+	if (read_varint(&tile) != MVT_KEY(MVT_TILE_LAYERS, MVT_WIRE_LENGTH))
+		lwerror("mvt_agg_deserialize: invalid partial tile");
+	layer_len = read_varint(&tile);
+	layer.p = read_bytes(&tile, layer_len);
+	layer.end = layer.p + layer_len;
+	if (tile.p != tile.end)
+		lwerror("mvt_agg_deserialize: invalid partial tile");
+
+	ctx = palloc0(sizeof(*ctx));
+	initStringInfo(&ctx->features);
+
+	while (layer.p < layer.end) {
+		const uint8_t *start = layer.p;
+		uint64_t key = read_varint(&layer);
+
+		if (key == MVT_KEY(MVT_LAYER_EXTENT, MVT_WIRE_VARINT)) {
+			ctx->extent = read_varint(&layer);
+			continue;
+		}
+		if ((key & 0x7) != MVT_WIRE_LENGTH) {
+			skip_field(&layer, key & 0x7);
+			continue;
+		}
+
+		field_len = read_varint(&layer);
+		field.p = read_bytes(&layer, field_len);
+		field.end = field.p + field_len;
+
+		switch (key >> 3) {
+		case MVT_LAYER_NAME:
+			ctx->name = pnstrdup((const char *) field.p, field_len);
+			break;
+		case MVT_LAYER_FEATURES:
+			appendBinaryStringInfo(&ctx->features, (const char *) start,
+				field.end - start);
+			ctx->n_features++;
+			break;
+		case MVT_LAYER_KEYS:
+			if (ctx->n_keys == keys_capacity) {
+				keys_capacity = Max(keys_capacity * 2, 8);
+				ctx->keys = ctx->keys ?
+					repalloc(ctx->keys, keys_capacity * sizeof(*ctx->keys)) :
+					palloc(keys_capacity * sizeof(*ctx->keys));
+			}
+			ctx->keys[ctx->n_keys++] = pnstrdup((const char *) field.p,
+				field_len);
+			break;
+		case MVT_LAYER_VALUES:
+			parse_tile_value(ctx, &field);
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (!ctx->name)
+		lwerror("mvt_agg_deserialize: invalid partial tile");
+
+	return ctx;
+}
+
+#define MVT_MERGE_VALUES(kvtype, hash, valuefield, size) \
+{ \
+	struct kvtype *kv, *kv2; \
+	for (kv2 = ctx2->hash; kv2 != NULL; kv2 = kv2->hh.next) { \
+		HASH_FIND(hh, ctx1->hash, &kv2->valuefield, size, kv); \
+		if (!kv) { \
+			kv = palloc(sizeof(*kv)); \
+			kv->id = ctx1->values_hash_i++; \
+			kv->valuefield = kv2->valuefield; \
+			HASH_ADD(hh, ctx1->hash, valuefield, size, kv); \
+		} \
+		values_map[kv2->id] = kv->id; \
+		identity &= kv->id == kv2->id; \
+	} \
+}
+
+/**
+ * Append the encoded features of ctx2 to ctx1, rewriting their tags
+ * through keys_map and values_map. Features are the ones written by
+ * write_feature, so tags, if any, come first and the rest of the
+ * message is copied as is.
+ */
+static void append_features_remapped(struct mvt_agg_context *ctx1,
+	struct mvt_agg_context *ctx2, const uint32_t *keys_map,
+	const uint32_t *values_map)
+{
+	struct mvt_reader r = { (uint8_t *) ctx2->features.data,
+		(uint8_t *) ctx2->features.data + ctx2->features.len };
+	uint32_t *tags = NULL;
+	size_t tags_capacity = 0;
+
+	while (r.p < r.end) {
+		struct mvt_reader feature, t;
+		size_t n_tags = 0, tags_len = 0, len, i;
+
+		if (read_varint(&r) != MVT_KEY(MVT_LAYER_FEATURES, MVT_WIRE_LENGTH))
+			lwerror("mvt_agg_combine: invalid feature");
+		len = read_varint(&r);
+		feature.p = read_bytes(&r, len);
+		feature.end = feature.p + len;
+
+		if (feature.p < feature.end &&
+		    *feature.p == MVT_KEY(MVT_FEATURE_TAGS, MVT_WIRE_LENGTH)) {
+			feature.p++;
+			len = read_varint(&feature);
+			t.p = read_bytes(&feature, len);
+			t.end = t.p + len;
+			while (t.p < t.end) {
+				if (n_tags == tags_capacity) {
+					tags_capacity = Max(tags_capacity * 2, 16);
+					tags = tags ?
+						repalloc(tags, tags_capacity * sizeof(*tags)) :
+						palloc(tags_capacity * sizeof(*tags));
+				}
+				tags[n_tags++] = read_varint(&t);
+			}
+			for (i = 0; i + 1 < n_tags; i += 2) {
+				if (tags[i] >= ctx2->n_keys ||
+				    tags[i+1] >= ctx2->values_hash_i)
+					lwerror("mvt_agg_combine: invalid feature tags");
+				tags[i] = keys_map[tags[i]];
+				tags[i+1] = values_map[tags[i+1]];
+			}
+			tags_len = packed_len(tags, n_tags);
+		}
+
+		len = feature.end - feature.p;
+		if (n_tags > 0)
+			len += 1 + varint_len(tags_len) + tags_len;
+		write_varint(&ctx1->features,
+			MVT_KEY(MVT_LAYER_FEATURES, MVT_WIRE_LENGTH));
+		write_varint(&ctx1->features, len);
+		if (n_tags > 0)
+			write_packed(&ctx1->features, MVT_FEATURE_TAGS, tags, n_tags,
+				tags_len);
+		appendBinaryStringInfo(&ctx1->features, (const char *) feature.p,
+			feature.end - feature.p);
+		ctx1->n_features++;
+	}
+
+	if (tags)
+		pfree(tags);
+}
+
+/**
+ * Combine two aggregation states.
+ *
+ * Features of ctx2 are appended to ctx1, with their tags remapped to
+ * the keys and values of ctx1. Keys are matched on name and values
+ * are merged into the ctx1 dictionaries. When both states agree on
+ * all ids the encoded features are copied without decoding. Returns
+ * ctx1.
+ */
+struct mvt_agg_context *mvt_agg_combine(struct mvt_agg_context *ctx1,
+	struct mvt_agg_context *ctx2)
+{
+	uint32_t *keys_map, *values_map;
+	uint32_t i, j;
+	bool identity = true;
+
+	if (strcmp(ctx1->name, ctx2->name) != 0 ||
+	    ctx1->extent != ctx2->extent)
+		lwerror("mvt_agg_combine: cannot combine different layers");
+
+	/* Match keys on name, adding the ones ctx1 does not have */
+	keys_map = palloc(Max(ctx2->n_keys, 1) * sizeof(*keys_map));
+	for (i = 0; i < ctx2->n_keys; i++) {
+		for (j = 0; j < ctx1->n_keys; j++)
+			if (strcmp(ctx1->keys[j], ctx2->keys[i]) == 0)
+				break;
+		if (j == ctx1->n_keys) {
+			ctx1->keys = ctx1->keys ?
+				repalloc(ctx1->keys, (j + 1) * sizeof(*ctx1->keys)) :
+				palloc(sizeof(*ctx1->keys));
+			ctx1->keys[ctx1->n_keys++] = ctx2->keys[i];
+		}
+		keys_map[i] = j;
+		identity &= i == j;
+	}
+
+	/* Merge the value dictionaries */
+	values_map = palloc(Max(ctx2->values_hash_i, 1) * sizeof(*values_map));
+	{
+		struct mvt_kv_string_value *kv2;
+		for (kv2 = ctx2->string_values_hash; kv2 != NULL; kv2 = kv2->hh.next) {
+			values_map[kv2->id] = add_string_value(ctx1, kv2->string_value);
+			identity &= values_map[kv2->id] == kv2->id;
+		}
+	}
+	MVT_MERGE_VALUES(mvt_kv_float_value, float_values_hash,
+		float_value, sizeof(float));
+	MVT_MERGE_VALUES(mvt_kv_double_value, double_values_hash,
+		double_value, sizeof(double));
+	MVT_MERGE_VALUES(mvt_kv_uint_value, uint_values_hash,
+		uint_value, sizeof(uint64_t));
+	MVT_MERGE_VALUES(mvt_kv_sint_value, sint_values_hash,
+		sint_value, sizeof(int64_t));
+	MVT_MERGE_VALUES(mvt_kv_bool_value, bool_values_hash,
+		bool_value, sizeof(bool));
+
+	/* Append the features */
+	if (identity) {
+		appendBinaryStringInfo(&ctx1->features, ctx2->features.data,
+			ctx2->features.len);
+		ctx1->n_features += ctx2->n_features;
+	} else {
+		append_features_remapped(ctx1, ctx2, keys_map, values_map);
+	}
+
+	pfree(keys_map);
+	pfree(values_map);
+
+	return ctx1;
+}
+
+/**
+ * Initialize a multi tile context, covering zoom levels zmin to zmax of
+ * the tile pyramid whose zoom level 0 tile is bounds. Tiles are built
+ * one zoom level at a time, see mvt_tiles_add.
+ */
+struct mvt_tiles_context *mvt_tiles_init(char *name, uint32_t extent,
+	uint32_t buffer, char *geom_name, uint32_t zmin, uint32_t zmax,
+	GBOX *bounds)
+{
+	struct mvt_tiles_context *tiles;
+
+	if (extent == 0)
+		lwerror("mvt_tiles_init: extent cannot be 0");
+	if (zmin > zmax)
+		lwerror("mvt_tiles_init: zmin cannot be greater than zmax");
+	if (zmax > MVT_TILES_MAX_ZOOM)
+		lwerror("mvt_tiles_init: zoom levels cannot exceed %d",
+			MVT_TILES_MAX_ZOOM);
+	if (bounds->xmax <= bounds->xmin || bounds->ymax <= bounds->ymin)
+		lwerror("mvt_tiles_init: bounds width or height cannot be 0");
+
+	tiles = palloc0(sizeof(*tiles));
+	tiles->name = name;
+	tiles->extent = extent;
+	tiles->buffer = buffer;
+	tiles->geom_name = geom_name;
+	tiles->geom_index = -1;
+	tiles->zmin = zmin;
+	tiles->zmax = zmax;
+	tiles->bounds = *bounds;
+	tiles->context = AllocSetContextCreate(CurrentMemoryContext,
+		"ST_AsMVTTiles tile context",
+		ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE,
+		ALLOCSET_DEFAULT_MAXSIZE);
+	tiles->row_context = AllocSetContextCreate(CurrentMemoryContext,
+		"ST_AsMVTTiles row context",
+		ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE,
+		ALLOCSET_DEFAULT_MAXSIZE);
+
+	return tiles;
+}
+
+/**
+ * Find the layer of a tile, creating it on first use.
+ */
+static struct mvt_agg_context *tile_context(struct mvt_tiles_context *tiles,
+	uint32_t z, uint32_t x, uint32_t y)
+{
+	struct mvt_tile_key key;
+	struct mvt_tile *tile;
+
+	memset(&key, 0, sizeof(key));
+	key.z = z;
+	key.x = x;
+	key.y = y;
+	HASH_FIND(hh, tiles->tiles, &key, sizeof(key), tile);
+	if (!tile) {
+		tile = palloc(sizeof(*tile));
+		tile->key = key;
+		tile->ctx = palloc(sizeof(*tile->ctx));
+		tile->ctx->name = tiles->name;
+		tile->ctx->extent = tiles->extent;
+		tile->ctx->geom_name = tiles->geom_name;
+		mvt_agg_init_context(tile->ctx);
+		HASH_ADD(hh, tiles->tiles, key, sizeof(key), tile);
+	}
+	return tile->ctx;
+}
+
+/**
+ * Transform a geometry into the pixel space of a whole zoom level, in
+ * which tile x, y spans x * extent to (x + 1) * extent across and
+ * y * extent to (y + 1) * extent down. Snapping and validation happen
+ * here once, each tile then only snaps the points its clip adds and
+ * validates again.
+ */
+static LWGEOM *mvt_zoom_geom(struct mvt_tiles_context *tiles,
+	const LWGEOM *lwgeom, uint32_t z)
+{
+	uint32_t n = 1 << z;
+	double fx = (double) tiles->extent * n / (tiles->bounds.xmax - tiles->bounds.xmin);
+	double fy = -((double) tiles->extent * n / (tiles->bounds.ymax - tiles->bounds.ymin));
+	LWGEOM *lwgeom_zoom = lwgeom_clone_deep(lwgeom);
+	LWGEOM *lwgeom_out;
+	AFFINE affine;
+
+	memset(&affine, 0, sizeof(affine));
+	affine.afac = fx;
+	affine.efac = fy;
+	affine.ifac = 1;
+	affine.xoff = -tiles->bounds.xmin * fx;
+	affine.yoff = -tiles->bounds.ymax * fy;
+	lwgeom_affine(lwgeom_zoom, &affine);
+
+	lwgeom_out = mvt_grid(lwgeom_zoom);
+	if (lwgeom_out == NULL)
+		lwgeom_out = mvt_grid(lwgeom_centroid(lwgeom_zoom));
+
+	lwgeom_force_clockwise(lwgeom_out);
+	return lwgeom_make_valid(lwgeom_out);
+}
+
+/**
+ * Cut the geometry of tile x, y out of a zoom level geometry from
+ * mvt_zoom_geom, or out of a strip clipped from it. Returns NULL if
+ * the tile gets nothing.
+ */
+static LWGEOM *mvt_tile_geom(struct mvt_tiles_context *tiles,
+	LWGEOM *lwgeom_zoom, uint32_t x, uint32_t y)
+{
+	double e = tiles->extent;
+	double b = tiles->buffer;
+	LWGEOM *lwgeom_out;
+	AFFINE affine;
+
+	lwgeom_out = mvt_clip(lwgeom_zoom, x * e - b, y * e - b,
+		(x + 1) * e + b, (y + 1) * e + b);
+	if (!lwgeom_out || lwgeom_is_empty(lwgeom_out))
+		return NULL;
+
+	memset(&affine, 0, sizeof(affine));
+	affine.afac = 1;
+	affine.efac = 1;
+	affine.ifac = 1;
+	affine.xoff = -(x * e);
+	affine.yoff = -(y * e);
+	lwgeom_affine(lwgeom_out, &affine);
+
+	/* Only the points the clip added are off the grid, but snapping */
+	/* them can still fold a ring, so validate as mvt_geom does */
+	lwgeom_out = mvt_grid(lwgeom_out);
+	if (!lwgeom_out || lwgeom_is_empty(lwgeom_out))
+		return NULL;
+
+	lwgeom_force_clockwise(lwgeom_out);
+	lwgeom_out = lwgeom_make_valid(lwgeom_out);
+	if (!lwgeom_out || lwgeom_is_empty(lwgeom_out))
+		return NULL;
+
+	return mvt_homogenize(lwgeom_out);
+}
+
+/**
+ * Add a row to every tile of zoom level z its geometry touches.
+ *
+ * The tile range is found from the bounding box of the geometry,
+ * grown by the buffer. The geometry is moved into the pixel space of
+ * the zoom level once, clipped to each row of tiles, and each tile is
+ * clipped from its row. Tiles it does not actually reach get nothing.
+ * Intermediate geometries live in a context reset after each row.
+ */
+void mvt_tiles_add(struct mvt_tiles_context *tiles, uint32_t z,
+	HeapTuple tuple, TupleDesc tupdesc)
+{
+	MemoryContext oldcontext;
+	HeapTupleHeader row;
+	GSERIALIZED *gs;
+	LWGEOM *lwgeom;
+	GBOX gbox;
+	Datum datum;
+	bool isnull;
+	double width = tiles->bounds.xmax - tiles->bounds.xmin;
+	double height = tiles->bounds.ymax - tiles->bounds.ymin;
+
+	oldcontext = MemoryContextSwitchTo(tiles->row_context);
+
+	/* Row as a composite datum, the form parse_values reads. SPI rows */
+	/* can point to toasted values, which a datum cannot hold */
+#if POSTGIS_PGSQL_VERSION >= 94
+	row = DatumGetHeapTupleHeader(heap_copy_tuple_as_datum(tuple, tupdesc));
+#else
+	row = (HeapTupleHeader) palloc(tuple->t_len);
+	memcpy(row, tuple->t_data, tuple->t_len);
+	HeapTupleHeaderSetDatumLength(row, tuple->t_len);
+	HeapTupleHeaderSetTypeId(row, tupdesc->tdtypeid);
+	HeapTupleHeaderSetTypMod(row, tupdesc->tdtypmod);
+	row = DatumGetHeapTupleHeader(toast_flatten_tuple_attribute(
+		PointerGetDatum(row), tupdesc->tdtypeid, tupdesc->tdtypmod));
+#endif
+
+	if (tiles->geom_index < 0) {
+		int i;
+		for (i = 0; i < tupdesc->natts; i++)
+			if (strcmp(tupdesc->attrs[i]->attname.data,
+				   tiles->geom_name) == 0)
+				tiles->geom_index = i;
+		if (tiles->geom_index < 0)
+			lwerror("mvt_tiles_add: no column '%s' found",
+				tiles->geom_name);
+	}
+
+	datum = GetAttributeByNum(row, tiles->geom_index + 1, &isnull);
+	if (isnull) {
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(tiles->row_context);
+		return;
+	}
+	gs = (GSERIALIZED *) PG_DETOAST_DATUM(datum);
+	lwgeom = lwgeom_from_gserialized(gs);
+
+	if (lwgeom_calculate_gbox(lwgeom, &gbox) == LW_SUCCESS) {
+		uint32_t n = 1 << z;
+		double w = width / n;
+		double h = height / n;
+		double bx = w * tiles->buffer / tiles->extent;
+		double by = h * tiles->buffer / tiles->extent;
+		double x0 = floor((gbox.xmin - bx - tiles->bounds.xmin) / w);
+		double x1 = floor((gbox.xmax + bx - tiles->bounds.xmin) / w);
+		double y0 = floor((tiles->bounds.ymax - gbox.ymax - by) / h);
+		double y1 = floor((tiles->bounds.ymax - gbox.ymin + by) / h);
+		double e = tiles->extent;
+		double b = tiles->buffer;
+		LWGEOM *lwgeom_zoom;
+		uint32_t x, y;
+
+		if (x1 < 0 || y1 < 0 || x0 >= n || y0 >= n) {
+			MemoryContextSwitchTo(oldcontext);
+			MemoryContextReset(tiles->row_context);
+			return;
+		}
+		x0 = Max(x0, 0);
+		y0 = Max(y0, 0);
+		x1 = Min(x1, n - 1);
+		y1 = Min(y1, n - 1);
+
+		lwgeom_zoom = mvt_zoom_geom(tiles, lwgeom, z);
+
+		for (y = y0; y <= y1; y++) {
+			LWGEOM *lwgeom_strip = lwgeom_zoom;
+
+			/* Tiles of a row are cut from the row, not the whole */
+			if (x1 > x0) {
+				lwgeom_strip = mvt_clip(lwgeom_zoom, x0 * e - b, y * e - b,
+					(x1 + 1) * e + b, (y + 1) * e + b);
+				if (!lwgeom_strip || lwgeom_is_empty(lwgeom_strip))
+					continue;
+			}
+
+			for (x = x0; x <= x1; x++) {
+				struct mvt_agg_context *ctx;
+				LWGEOM *lwgeom_out;
+
+				lwgeom_out = mvt_tile_geom(tiles, lwgeom_strip, x, y);
+				if (!lwgeom_out)
+					continue;
+
+				MemoryContextSwitchTo(tiles->context);
+				ctx = tile_context(tiles, z, x, y);
+				ctx->row = row;
+				if (ctx->n_features == 0)
+					encode_keys(ctx);
+				add_feature(ctx, lwgeom_out);
+				MemoryContextSwitchTo(tiles->row_context);
+			}
+		}
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextReset(tiles->row_context);
+}
+
+static int tile_cmp(struct mvt_tile *a, struct mvt_tile *b)
+{
+	if (a->key.z != b->key.z)
+		return a->key.z < b->key.z ? -1 : 1;
+	if (a->key.x != b->key.x)
+		return a->key.x < b->key.x ? -1 : 1;
+	if (a->key.y != b->key.y)
+		return a->key.y < b->key.y ? -1 : 1;
+	return 0;
+}
+
+/**
+ * Encode the next tile, in z, x, y order. Returns false once all tiles
+ * have been returned. The encoded tile is allocated in the current
+ * memory context.
+ */
+bool mvt_tiles_next(struct mvt_tiles_context *tiles, uint32_t *z,
+	uint32_t *x, uint32_t *y, uint8_t **mvt)
+{
+	struct mvt_tile *tile;
+
+	if (!tiles->sorted) {
+		HASH_SORT(tiles->tiles, tile_cmp);
+		tiles->next = tiles->tiles;
+		tiles->sorted = true;
+	}
+
+	tile = tiles->next;
+	if (!tile)
+		return false;
+
+	*z = tile->key.z;
+	*x = tile->key.x;
+	*y = tile->key.y;
+	*mvt = mvt_agg_finalfn(tile->ctx);
+	tiles->next = tile->hh.next;
+	return true;
+}
+
+/**
+ * Drop all tiles, once they have been returned, so the next zoom level
+ * starts from an empty context.
+ */
+void mvt_tiles_reset(struct mvt_tiles_context *tiles)
+{
+	MemoryContextReset(tiles->context);
+	tiles->tiles = NULL;
+	tiles->next = NULL;
+	tiles->sorted = false;
+}
+
+#endif
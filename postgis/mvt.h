@@ -35,6 +35,7 @@
 #include "executor/executor.h"
 #include "access/htup_details.h"
 #include "access/htup.h"
+#include "lib/stringinfo.h"
 #include "../postgis_config.h"
 #include "liblwgeom.h"
 #include "liblwgeom_internal.h"
@@ -51,24 +52,60 @@ struct mvt_agg_context {
 	char *geom_name;
 	uint32_t geom_index;
 	HeapTupleHeader row;
-	VectorTile__Tile__Feature *feature;
-	VectorTile__Tile__Layer *layer;
-	size_t features_capacity;
+	StringInfoData features;
+	uint32_t n_features;
+	char **keys;
+	uint32_t n_keys;
+	uint32_t *tags;
+	size_t n_tags;
+	uint32_t feature_type;
+	uint32_t *geometry;
+	size_t n_geometry;
+	size_t geometry_capacity;
 	struct mvt_kv_string_value *string_values_hash;
 	struct mvt_kv_float_value *float_values_hash;
 	struct mvt_kv_double_value *double_values_hash;
-	struct mvt_kv_int_value *int_values_hash;
 	struct mvt_kv_uint_value *uint_values_hash;
 	struct mvt_kv_sint_value *sint_values_hash;
 	struct mvt_kv_bool_value *bool_values_hash;
 	uint32_t values_hash_i;
 } ;
 
+struct mvt_tiles_context {
+	char *name;
+	uint32_t extent;
+	uint32_t buffer;
+	char *geom_name;
+	int geom_index;
+	uint32_t zmin;
+	uint32_t zmax;
+	GBOX bounds;
+	MemoryContext context;
+	MemoryContext row_context;
+	struct mvt_tile *tiles;
+	struct mvt_tile *next;
+	bool sorted;
+} ;
+
+#define MVT_TILES_MAX_ZOOM 30
+
 LWGEOM *mvt_geom(LWGEOM *geom, GBOX *bounds, uint32_t extent, uint32_t buffer,
 	bool clip_geom);
 void mvt_agg_init_context(struct mvt_agg_context *ctx);
 void mvt_agg_transfn(struct mvt_agg_context *ctx);
 uint8_t *mvt_agg_finalfn(struct mvt_agg_context *ctx);
+uint8_t *mvt_agg_serialize(struct mvt_agg_context *ctx);
+struct mvt_agg_context *mvt_agg_deserialize(uint8_t *buf, size_t len);
+struct mvt_agg_context *mvt_agg_combine(struct mvt_agg_context *ctx1,
+	struct mvt_agg_context *ctx2);
+struct mvt_tiles_context *mvt_tiles_init(char *name, uint32_t extent,
+	uint32_t buffer, char *geom_name, uint32_t zmin, uint32_t zmax,
+	GBOX *bounds);
+void mvt_tiles_add(struct mvt_tiles_context *tiles, uint32_t z,
+	HeapTuple tuple, TupleDesc tupdesc);
+bool mvt_tiles_next(struct mvt_tiles_context *tiles, uint32_t *z,
+	uint32_t *x, uint32_t *y, uint8_t **mvt);
+void mvt_tiles_reset(struct mvt_tiles_context *tiles);
 
 #endif  /* HAVE_LIBPROTOBUF */
 
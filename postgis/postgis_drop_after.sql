@@ -170,3 +170,45 @@ DROP FUNCTION IF EXISTS geometry_distance_box_nd(geometry,geometry); -- temporar
 -- pgis_abs type was increased from 8 bytes in 2.1 to 16 bytes in 2.2
 -- See #3460
 UPDATE pg_type SET typlen=16 WHERE typname='pgis_abs' AND typlen=8;
+
+-- = on geometry and geography became exact in 2.4.0, which lets it
+-- hash. CREATE OPERATOR does not run again on upgrade and ALTER
+-- OPERATOR cannot set HASHES, so flip the flag in the catalog.
+UPDATE pg_operator SET oprcanhash = true
+	WHERE oprname = '=' AND NOT oprcanhash
+	AND oprcode IN ( 'geometry_eq(geometry,geometry)'::regprocedure,
+	                 'geography_eq(geography,geography)'::regprocedure );
+
+-- Btree indexes built with the old tolerant comparison may be out of
+-- order for boxes within 1e-6 of each other, and need a REINDEX
+DO LANGUAGE 'plpgsql'
+$$
+DECLARE
+	rec RECORD;
+BEGIN
+	FOR rec IN
+		SELECT DISTINCT i.indexrelid::regclass AS idx
+		FROM pg_index i
+		JOIN pg_class c ON c.oid = i.indexrelid
+		JOIN pg_am am ON am.oid = c.relam
+		JOIN pg_attribute a ON a.attrelid = i.indexrelid
+		WHERE am.amname = 'btree'
+		AND a.atttypid IN ( 'geometry'::regtype, 'geography'::regtype )
+	LOOP
+		RAISE NOTICE 'btree index % compares geometry or geography, REINDEX it after the upgrade', rec.idx;
+	END LOOP;
+END
+$$;
+-- Sort support was added to the geometry btree opclass in 2.4.0,
+-- on PostgreSQL 9.5 and up
+DO LANGUAGE 'plpgsql'
+$$
+BEGIN
+	IF EXISTS ( SELECT 1 FROM pg_proc WHERE proname = 'geometry_sortsupport' )
+	   AND NOT EXISTS ( SELECT 1 FROM pg_amproc p JOIN pg_opfamily f ON p.amprocfamily = f.oid
+	                    WHERE f.opfname = 'btree_geometry_ops' AND p.amprocnum = 2 ) THEN
+		ALTER OPERATOR FAMILY btree_geometry_ops USING btree
+			ADD FUNCTION 2 (geometry, geometry) geometry_sortsupport(internal);
+	END IF;
+END
+$$;
@@ -44,6 +44,10 @@ PG_MODULE_MAGIC;
 static pqsigfunc coreIntHandler = 0;
 static void handleInterrupt(int sig);
 
+/* Planner cost hook, see gserialized_estimate.c */
+void gserialized_cost_hook_install(void);
+void gserialized_cost_hook_uninstall(void);
+
 #ifdef WIN32
 static void interruptCallback() {
   if (UNBLOCKED_SIGNAL_QUEUE())
@@ -110,6 +114,9 @@ _PG_init(void)
 
     /* initialize geometry backend */
     lwgeom_init_backend();
+
+    /* scale spatial function costs by vertex statistics */
+    gserialized_cost_hook_install();
 }
 
 /*
@@ -121,6 +128,7 @@ _PG_fini(void)
 {
   elog(NOTICE, "Goodbye from PostGIS %s", POSTGIS_VERSION);
   pqsignal(SIGINT, coreIntHandler);
+  gserialized_cost_hook_uninstall();
 }
 
 
@@ -23,6 +23,15 @@ CREATE TEMPORARY TABLE t AS SELECT
 SELECT ST_AsEWKT(ST_ClipByBox2d(g, ST_MakeEnvelope(-20,-20,-10,-10))) FROM t;
 -- See http://trac.osgeo.org/postgis/ticket/2954
 SELECT ST_AsEWKT(ST_ClipByBox2D('SRID=4326;POINT(0 0)','BOX3D(-1 -1,1 1)'::box3d::box2d));
+-- Concave polygon entering the box twice
+SELECT 'concave', ST_IsValid(g), ST_NumGeometries(g), ST_Area(g) FROM (SELECT ST_ClipByBox2d(
+  'POLYGON((0 0,10 0,10 10,7 10,7 3,3 3,3 10,0 10,0 0))', ST_MakeEnvelope(1,5,9,12)) g) f;
+-- Concave polygon entering the box once
+SELECT 'notch', ST_AsText(ST_ClipByBox2d(
+  'POLYGON((0 0,10 0,10 10,0 10,0 6,5 6,5 4,0 4,0 0))', ST_MakeEnvelope(3,3,7,7)));
+-- Box inside a hole
+SELECT 'hole', ST_AsText(ST_ClipByBox2d(
+  'POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,8 2,8 8,2 8,2 2))', ST_MakeEnvelope(4,4,6,6)));
 
 SELECT '#3135', st_astext(ST_SubDivide(ST_GeomFromText('POLYGON((1 2,1 2,1 2,1 2))'), 2));
 
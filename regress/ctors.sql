@@ -30,6 +30,22 @@ select 'ST_MakeLine_agg2', ST_AsText(ST_MakeLine(g)) from (
         ('POINT(1 0)')
 ) as foo(g);
 
+select 'ST_MakeLine_agg3', ST_AsEWKT(ST_MakeLine(g)) from (
+ values ('SRID=4326;POINT(0 0)'::geometry),
+        (NULL),
+        ('SRID=4326;POINT(1 1 1)'),
+        ('SRID=4326;POLYGON((0 0,1 0,1 1,0 0))')
+) as foo(g);
+
+select 'ST_MakeLine_agg4', ST_AsText(ST_MakeLine(g)) from (
+ values ('POINT EMPTY'::geometry)
+) as foo(g);
+
+select 'ST_MakeLine_agg5', ST_MakeLine(g) from (
+ values ('SRID=4326;POINT(0 0)'::geometry),
+        ('SRID=3857;POINT(1 1)')
+) as foo(g);
+
 -- postgis-users/2006-July/012788.html
 select ST_makebox2d('SRID=3;POINT(0 0)', 'SRID=3;POINT(1 1)');
 select ST_makebox2d('POINT(0 0)', 'SRID=3;POINT(1 1)');
@@ -0,0 +1,22 @@
+SELECT 'FGB1', encode(ST_AsFlatGeobuf('geom', q), 'base64')
+    FROM (SELECT ST_MakePoint(1, 2) AS geom) AS q;
+SELECT 'FGB2', encode(ST_AsFlatGeobuf('geom', q, true), 'base64')
+    FROM (SELECT 1 AS id, 'one'::text AS name, ST_MakeLine(ST_MakePoint(0, 0), ST_MakePoint(1, 1)) AS geom) AS q;
+-- magic bytes
+SELECT 'FGB3', encode(substring(ST_AsFlatGeobuf('geom', q) from 1 for 8), 'hex')
+    FROM (SELECT ST_MakePoint(1, 2) AS geom) AS q;
+-- 100 leaves, 7 + 1 nodes above them, 40 bytes each
+SELECT 'FGB4', octet_length(ST_AsFlatGeobuf('geom', q, true)) - octet_length(ST_AsFlatGeobuf('geom', q, false))
+    FROM (SELECT i, ST_MakePoint(i % 10, i / 10) AS geom FROM generate_series(0, 99) AS i) AS q;
+SELECT 'FGB5', ST_AsFlatGeobuf('geom', q) IS NULL
+    FROM (SELECT ST_MakePoint(1, 2) AS geom WHERE false) AS q;
+-- only empty geometries, 2 leaves and a root
+SELECT 'FGB6', octet_length(ST_AsFlatGeobuf('geom', q, true)) - octet_length(ST_AsFlatGeobuf('geom', q, false))
+    FROM (SELECT 'POINT EMPTY'::geometry AS geom UNION ALL SELECT 'POINT EMPTY'::geometry) AS q;
+-- unsupported input
+SELECT 'FGBU1', ST_AsFlatGeobuf('the_geom', q)
+    FROM (SELECT ST_MakePoint(1, 2) AS geom) AS q;
+SELECT 'FGBU2', ST_AsFlatGeobuf('geom', q)
+    FROM (SELECT NULL::geometry AS geom) AS q;
+SELECT 'FGBU3', ST_AsFlatGeobuf('geom', q)
+    FROM (SELECT 'CIRCULARSTRING(0 0,1 1,2 0)'::geometry AS geom) AS q;
@@ -0,0 +1,42 @@
+SELECT 'GA1', encode(ST_AsGeoArrow('geom', q), 'base64')
+    FROM (SELECT 1 AS id, ST_MakePoint(1, 2) AS geom) AS q;
+-- continuation marker first, end of stream marker last
+SELECT 'GA2', encode(substring(b from 1 for 4), 'hex'),
+    encode(substring(b from octet_length(b) - 7), 'hex')
+    FROM (SELECT ST_AsGeoArrow('geom', q) AS b
+        FROM (SELECT 'LINESTRING(0 0,1 1)'::geometry AS geom) AS q) AS s;
+SELECT 'GA3', ST_AsGeoArrow('geom', q) IS NULL
+    FROM (SELECT ST_MakePoint(1, 2) AS geom WHERE false) AS q;
+-- two record batches
+SELECT 'GA4', octet_length(ST_AsGeoArrow('geom', q))
+    FROM (SELECT i, ST_MakePoint(i, i) AS geom FROM generate_series(1, 70000) AS i) AS q;
+-- single geometries go into the multi layout, nulls are allowed
+SELECT 'GA5', octet_length(ST_AsGeoArrow('geom', q)) > 0
+    FROM (SELECT 'MULTIPOINT(0 0,1 1)'::geometry AS geom
+        UNION ALL SELECT 'POINT(2 2)'::geometry
+        UNION ALL SELECT NULL::geometry) AS q;
+-- singles before the first multi go into the multi layout
+WITH t(id, geom) AS (VALUES (1, 'POINT(0 0)'::geometry), (2, NULL),
+    (3, 'POINT EMPTY'), (4, 'MULTIPOINT(1 1,2 2)'))
+SELECT 'GA6', (SELECT ST_AsGeoArrow('geom', q) FROM (SELECT geom FROM t ORDER BY id) AS q)
+    = (SELECT ST_AsGeoArrow('geom', q) FROM (SELECT ST_Multi(geom) AS geom FROM t ORDER BY id) AS q);
+WITH t(id, geom) AS (VALUES (1, 'POLYGON((0 0,1 0,1 1,0 0),(0.2 0.1,0.9 0.1,0.9 0.8,0.2 0.1))'::geometry),
+    (2, NULL), (3, 'POLYGON EMPTY'),
+    (4, 'MULTIPOLYGON(((2 2,3 2,3 3,2 2)),((4 4,5 4,5 5,4 4)))'))
+SELECT 'GA7', (SELECT ST_AsGeoArrow('geom', q) FROM (SELECT geom FROM t ORDER BY id) AS q)
+    = (SELECT ST_AsGeoArrow('geom', q) FROM (SELECT ST_Multi(geom) AS geom FROM t ORDER BY id) AS q);
+-- a batch of null geometries does not fix the layout
+SELECT 'GA8', octet_length(ST_AsGeoArrow('geom', q)) > 0
+    FROM (SELECT CASE WHEN i > 65536 THEN 'MULTIPOINT(0 0,1 1)'::geometry END AS geom
+        FROM generate_series(1, 65537) AS i) AS q;
+-- unsupported input
+SELECT 'GAU1', ST_AsGeoArrow('the_geom', q)
+    FROM (SELECT ST_MakePoint(1, 2) AS geom) AS q;
+SELECT 'GAU2', ST_AsGeoArrow('geom', q)
+    FROM (SELECT 'POINT(0 0)'::geometry AS geom
+        UNION ALL SELECT 'LINESTRING(0 0,1 1)'::geometry) AS q;
+SELECT 'GAU3', ST_AsGeoArrow('geom', q)
+    FROM (SELECT 'GEOMETRYCOLLECTION(POINT(0 0))'::geometry AS geom) AS q;
+SELECT 'GAU4', ST_AsGeoArrow('geom', q)
+    FROM (SELECT 'POINT(0 0)'::geometry AS geom
+        UNION ALL SELECT 'POINT Z(0 0 0)'::geometry) AS q;
@@ -17,3 +17,16 @@ SELECT 'T8', encode(ST_AsGeobuf('geom', q), 'base64')
     FROM (SELECT ST_GeomFromText('GEOMETRYCOLLECTION(POINT(4 6),LINESTRING(4 6,7 10))') as geom) AS q;
 SELECT 'T9', encode(ST_AsGeobuf('geom', q), 'base64')
     FROM (SELECT ST_MakePoint(1, 2, 3) as geom) AS q;
+-- streaming with caller supplied precision and dimensions
+SELECT 'TS1', encode(ST_AsGeobuf('geom', q, 1, 2), 'base64')
+    FROM (SELECT ST_MakePoint(1.1, 2.1) AS geom) AS q;
+SELECT 'TS2', encode(ST_AsGeobuf('geom', q, 0, 2), 'base64')
+    FROM (SELECT 'test' as test_str, 1 as test_pos_int, -1 as test_neg_int, 1.1 as test_numeric, 1.1::float as test_float, ST_MakeLine(ST_MakePoint(1,1), ST_MakePoint(2,2)) as geom) AS q;
+SELECT 'TS3', encode(ST_AsGeobuf('geom', q, 0, 3), 'base64')
+    FROM (SELECT ST_MakePoint(1, 2, 3) as geom) AS q;
+SELECT 'TS4', encode(ST_AsGeobuf('geom', q, 0, 2), 'base64')
+    FROM (SELECT ST_MakePoint(x, y) AS geom FROM (VALUES (1, 2), (3, 4)) AS v(x, y)) AS q;
+SELECT 'TS5', encode(ST_AsGeobuf('geom', q, 7, 2), 'base64')
+    FROM (SELECT ST_MakePoint(1, 2) AS geom) AS q;
+SELECT 'TS6', encode(ST_AsGeobuf('geom', q, 6, 5), 'base64')
+    FROM (SELECT ST_MakePoint(1, 2) AS geom) AS q;
@@ -0,0 +1,54 @@
+-- Parallel ST_AsGeobuf, the partial states of the workers go through
+-- the serial, deserial and combine functions of the aggregate
+CREATE TABLE geobuf_parallel AS
+	SELECT i AS id, 'name' || (i % 10) AS name, ST_MakePoint(i % 37, i % 41) AS geom
+	FROM generate_series(1, 10000) i;
+CREATE TABLE geobuf_parallel_same AS
+	SELECT 1 AS id, 'name' AS name, ST_MakePoint(1.5, 2.5) AS geom
+	FROM generate_series(1, 10000) i;
+ANALYZE geobuf_parallel;
+ANALYZE geobuf_parallel_same;
+
+CREATE FUNCTION geobuf_parallel_plan(q text) RETURNS boolean
+AS $$
+DECLARE
+  l TEXT;
+BEGIN
+  FOR l IN EXECUTE 'EXPLAIN (COSTS OFF) ' || q LOOP
+    IF l LIKE '%Partial Aggregate%' THEN RETURN true; END IF;
+  END LOOP;
+  RETURN false;
+END;
+$$ LANGUAGE 'plpgsql' VOLATILE;
+
+-- Serial reference
+SET max_parallel_workers_per_gather = 0;
+CREATE TABLE geobuf_parallel_serial AS SELECT
+	(SELECT ST_AsGeobuf('geom', t, 6, 2) FROM geobuf_parallel t) AS mixed,
+	(SELECT ST_AsGeobuf('geom', t, 6, 2) FROM geobuf_parallel_same t) AS same;
+
+-- Force the parallel plan, the minimum scan size setting was renamed in 10
+SET max_parallel_workers_per_gather = 2;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET force_parallel_mode = on;
+SELECT 'GP0', count(set_config(name, '0', false)) FROM pg_settings
+	WHERE name IN ('min_parallel_table_scan_size', 'min_parallel_relation_size');
+
+SELECT 'GP1', geobuf_parallel_plan('SELECT ST_AsGeobuf(''geom'', t, 6, 2) FROM geobuf_parallel t');
+-- Identical rows encode the same whatever worker they went through
+SELECT 'GP2', p = (SELECT same FROM geobuf_parallel_serial)
+	FROM (SELECT ST_AsGeobuf('geom', t, 6, 2) AS p FROM geobuf_parallel_same t) q;
+-- Feature order depends on the workers, the size does not
+SELECT 'GP3', octet_length(p) = (SELECT octet_length(mixed) FROM geobuf_parallel_serial)
+	FROM (SELECT ST_AsGeobuf('geom', t, 6, 2) AS p FROM geobuf_parallel t) q;
+
+RESET force_parallel_mode;
+RESET parallel_tuple_cost;
+RESET parallel_setup_cost;
+RESET max_parallel_workers_per_gather;
+
+DROP FUNCTION geobuf_parallel_plan(text);
+DROP TABLE geobuf_parallel_serial;
+DROP TABLE geobuf_parallel_same;
+DROP TABLE geobuf_parallel;
@@ -121,6 +121,68 @@ SELECT 'segmentize_geography2', st_dwithin(st_pointn(st_segmentize('linestring(1
 SELECT 'segmentize_geography_3667', abs(ST_Length(geog) - ST_Length(ST_Segmentize(geog, 30000))) < 0.00001
   FROM (SELECT ST_GeographyFromText('LINESTRING(38.769917 10.780694, 38.769917 9.106194)') As geog) AS f;
 
+-- Hash opclass, consistent with =
+SELECT 'geography_hash', geography_hash('POINT(1 2)'::geography) = geography_hash('MULTIPOINT(1 2)'::geography), 'POINT(1 2)'::geography = 'MULTIPOINT(1 2)'::geography;
+
+-- Spheroid area of a square split at the equator is the sum of its halves
+WITH p(g) AS (VALUES ('POLYGON((0 -1,0 1,1 1,1 -1,0 -1))'::geography)),
+h(g1, g2) AS (VALUES ('POLYGON((0 -1,0 0,1 0,1 -1,0 -1))'::geography, 'POLYGON((0 0,0 1,1 1,1 0,0 0))'::geography))
+SELECT 'area_equator_split', abs(ST_Area(p.g) - ST_Area(h.g1) - ST_Area(h.g2)) < 0.1, abs(ST_Area(h.g1) - ST_Area(h.g2)) < 0.1
+  FROM p, h;
+
+-- Point/point fast path agrees with the uncached calculation
+WITH p(g) AS (VALUES ('POINT(-4 1)'::geography), ('POINT(10 60)'), ('POINT(179.5 -30)'), ('POINT(-179.5 30)'), ('POINT(0 90)'))
+SELECT 'distance_point_point', bool_and(abs(_ST_Distance(p1.g, p2.g, 0.0, s) - _ST_DistanceUnCached(p1.g, p2.g, 0.0, s)) < 1e-7)
+  FROM p p1, p p2, (VALUES (true), (false)) AS v(s);
+
+-- Distance matrix, cell by cell the same as ST_Distance
+WITH p(id, g) AS (VALUES (1, 'POINT(-4 1)'::geography), (2, 'POINT(10 60)'), (3, 'POINT(179.5 -30)')),
+q(id, g) AS (VALUES (1, 'POINT(-4 -1)'::geography), (2, 'POINT(10 60)')),
+m AS (SELECT ST_DistanceMatrix(array_agg(g ORDER BY id), (SELECT array_agg(g ORDER BY id) FROM q)) AS sph,
+             ST_DistanceMatrix(array_agg(g ORDER BY id), (SELECT array_agg(g ORDER BY id) FROM q), false) AS sph0
+        FROM p)
+SELECT 'distance_matrix', array_dims(m.sph), bool_and(m.sph[p.id][q.id] = ST_Distance(p.g, q.g)), bool_and(m.sph0[p.id][q.id] = ST_Distance(p.g, q.g, false))
+  FROM m, p, q GROUP BY m.sph;
+SELECT 'distance_matrix_nulls', ST_DistanceMatrix(ARRAY['POINT(0 0)'::geography, NULL, 'POINT EMPTY'], ARRAY['POINT(0 1)'::geography], false)::numeric(12,3)[];
+SELECT 'distance_matrix_empty', ST_DistanceMatrix('{}'::geography[], ARRAY['POINT(0 1)'::geography]);
+SELECT 'distance_matrix_line', ST_DistanceMatrix(ARRAY['LINESTRING(0 0, 1 1)'::geography], ARRAY['POINT(0 1)'::geography]);
+SELECT 'distance_matrix_srid', ST_DistanceMatrix(ARRAY['SRID=4326;POINT(0 0)'::geography], ARRAY['SRID=4269;POINT(0 1)'::geography]);
+
+-- Covers against a repeated polygon, answered from its cell index once
+-- it has been probed enough, agrees with the point-in-polygon of DWithin
+WITH p(g) AS (VALUES ('POLYGON((-10 -10,10 -10,10 10,-10 10,-10 -10),(-3 -3,-3 3,3 3,3 -3,-3 -3))'::geography)),
+q(g) AS (SELECT ST_MakePoint(x + 0.5, y + 0.5)::geography FROM generate_series(-15, 14) x, generate_series(-15, 14) y)
+SELECT 'covers_cell_index', sum(CASE WHEN ST_Covers(p.g, q.g) THEN 1 ELSE 0 END), bool_and(ST_Covers(p.g, q.g) = ST_DWithin(p.g, q.g, 0, false))
+  FROM p, q;
+
+-- A multipoint spread over two parts is not covered, also once the
+-- repeated multipolygon has been probed enough to get a cell index
+WITH p(g) AS (VALUES ('MULTIPOLYGON(((0 0,1 0,1 1,0 1,0 0)),((5 5,6 5,6 6,5 6,5 5)))'::geography)),
+q(i) AS (SELECT generate_series(1, 300))
+SELECT 'covers_cell_index_mpoint', count(DISTINCT ST_Covers(p.g, 'MULTIPOINT(0.5 0.5,5.5 5.5)'::geography)),
+  bool_or(ST_Covers(p.g, 'MULTIPOINT(0.5 0.5,5.5 5.5)'::geography)), bool_and(ST_Covers(p.g, 'POINT(5.5 5.5)'::geography))
+  FROM p, q;
+
+-- Sphere cell ids, nested over levels, including the faces with negative ids
+SELECT 'cell_id', ST_CellId('POINT(0 0)'::geography, 0), ST_CellId('POINT(0 -90)'::geography, 0);
+WITH p(g) AS (VALUES ('POINT(-122.3 47.6)'::geography), ('POINT(0 0)'), ('POINT(90 10)'), ('POINT(0 90)'), ('POINT(180 -10)'), ('POINT(-90 0)'), ('POINT(10 -90)'))
+SELECT 'cell_id_nested', bool_and(ST_CellId(g) BETWEEN ST_CellRangeMin(ST_CellId(g, l)) AND ST_CellRangeMax(ST_CellId(g, l))),
+       bool_and(ST_CellRangeMin(ST_CellId(g, l)) <= ST_CellRangeMin(ST_CellId(g, l + 1)) AND ST_CellRangeMax(ST_CellId(g, l + 1)) <= ST_CellRangeMax(ST_CellId(g, l)))
+  FROM p, generate_series(0, 29) l;
+SELECT 'cell_id_empty', ST_CellId('POINT EMPTY'::geography) IS NULL;
+SELECT 'cell_id_line', ST_CellId('LINESTRING(0 0, 1 1)'::geography);
+SELECT 'cell_id_level', ST_CellId('POINT(0 0)'::geography, 31);
+SELECT 'cell_range_invalid', ST_CellRangeMin(0);
+
+-- Everything within the distance falls in the ranges of the covering
+WITH g(g, d) AS (VALUES ('POLYGON((-10 -10,10 -10,10 10,-10 10,-10 -10),(-3 -3,-3 3,3 3,3 -3,-3 -3))'::geography, 0.0),
+                        ('LINESTRING(-60 -20,30 10,100 80)', 50000.0), ('POINT(-90 0)', 300000.0)),
+q(q) AS (SELECT ST_MakePoint(x + 0.37, y + 0.61)::geography FROM generate_series(-180, 179, 3) x, generate_series(-89, 88, 3) y)
+SELECT 'cell_covering', array_length(ST_CellCovering(g.g, g.d), 1) <= 8,
+       bool_and(EXISTS (SELECT 1 FROM ST_CellRanges(g.g, g.d) r WHERE ST_CellId(q.q) BETWEEN r.cellmin AND r.cellmax))
+  FROM g, q WHERE ST_DWithin(g.g, q.q, g.d) GROUP BY g.g, g.d ORDER BY g.d;
+SELECT 'cell_covering_empty', ST_CellCovering('POLYGON EMPTY'::geography);
+
 -- Clean up spatial_ref_sys
 DELETE FROM spatial_ref_sys WHERE srid IN (4269,4326);
 
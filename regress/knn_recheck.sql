@@ -128,12 +128,39 @@ FROM knn_recheck_geog As a
 	WHERE a.gid IN(500000,500010,1000,2614)
 ORDER BY a.gid;
 
+-- index order is the exact distance order, ties aside
+SELECT '#4g' As t, q.id, ARRAY(SELECT ST_Distance(q.geog, g.geog, false)::numeric(12,4)
+			FROM knn_recheck_geog As g ORDER BY ST_Distance(q.geog, g.geog, false) LIMIT 10) = ARRAY(SELECT (q.geog <-> g.geog)::numeric(12,4)
+			FROM knn_recheck_geog As g ORDER BY q.geog <-> g.geog LIMIT 10) As dist_order_agree
+FROM (VALUES (1, 'POINT(-95.3 10.2)'::geography),
+	(2, 'POINT(170.7 -80.3)'::geography),
+	(3, 'POLYGON((-60.5 40.5, -58.5 40.5, -58.5 42.5, -60.5 40.5))'::geography)) As q(id, geog)
+ORDER BY q.id;
+
 DROP TABLE knn_recheck_geog;
 
+-- same on a sphere smaller than the WGS84 one, the index bound must
+-- stay under the recheck distance
+INSERT INTO "spatial_ref_sys" ("srid","auth_name","auth_srid","proj4text") 
+    VALUES (4267,'EPSG',4267,'+proj=longlat +ellps=clrk66 +no_defs ');
+CREATE TABLE knn_recheck_geog_4267(gid serial primary key, geog geography);
+INSERT INTO knn_recheck_geog_4267(geog)
+SELECT ST_SetSRID(ST_MakePoint(-110 + i, 10 + j), 4267)::geography
+FROM generate_series(1,30) As i, generate_series(1,30) As j;
+CREATE INDEX idx_knn_recheck_geog_4267_gist ON knn_recheck_geog_4267 USING gist(geog);
+vacuum analyze knn_recheck_geog_4267;
+
+SELECT '#5g' As t, ARRAY(SELECT ST_Distance(q, g.geog, false)::numeric(12,4)
+			FROM knn_recheck_geog_4267 As g ORDER BY ST_Distance(q, g.geog, false) LIMIT 10) = ARRAY(SELECT (q <-> g.geog)::numeric(12,4)
+			FROM knn_recheck_geog_4267 As g ORDER BY q <-> g.geog LIMIT 10) As dist_order_agree
+FROM (SELECT 'SRID=4267;POINT(-60.3 5.7)'::geography) As f(q);
+
+DROP TABLE knn_recheck_geog_4267;
+
 --
 -- Delete inserted spatial data
 --
-DELETE FROM spatial_ref_sys WHERE srid = 4326;
+DELETE FROM spatial_ref_sys WHERE srid IN (4267,4326);
 
 --now the nd operator tests
 -- create table and load
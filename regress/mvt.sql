@@ -87,10 +87,49 @@ SELECT 'TA5', encode(ST_AsMVT('test', 4096, 'geom', q), 'base64') FROM (SELECT
 SELECT 'TA6', encode(ST_AsMVT('test', 4096, 'geom', q), 'base64') FROM (SELECT 1 AS c1, -1 AS c2,
     ST_AsMVTGeom(ST_GeomFromText('POINT(25 17)'),
     ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)), 4096, 0, false) AS geom) AS q;
+SELECT 'TA7', encode(ST_AsMVT('test', 4096, 'geom', q), 'base64') FROM (
+    SELECT 1 AS c1, 'abcd'::text AS c2, ST_AsMVTGeom(ST_GeomFromText('POINT(25 17)'),
+    ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)), 4096, 0, false) AS geom
+    UNION ALL
+    SELECT 1 AS c1, 'abcd'::text AS c2, ST_AsMVTGeom(ST_GeomFromText('POINT(25 17)'),
+    ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)), 4096, 0, false) AS geom) AS q;
+
+-- multiple tiles in one scan
+SELECT 'TT1', z, x, y, encode(mvt, 'base64') FROM ST_AsMVTTiles(
+    'SELECT c1, geom FROM (VALUES (1, ST_MakePoint(25, 17)), (2, ST_MakePoint(3000, 3000))) AS t(c1, geom)',
+    'test', 0, 1, 4096, 0, 'geom', ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)));
+SELECT 'TT2', count(*) FROM ST_AsMVTTiles(
+    'SELECT 1 AS c1, ST_MakePoint(5000, 5000) AS geom',
+    'test', 0, 3, 4096, 0, 'geom', ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)));
+SELECT 'TT3', z, x, y FROM ST_AsMVTTiles(
+    'SELECT 1 AS c1, ST_MakePoint(2048, 1000) AS geom',
+    'test', 1, 1, 4096, 64, 'geom', ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)));
+SELECT 'TT4', count(*) FROM ST_AsMVTTiles('SELECT 1 AS c1, NULL::geometry AS geom',
+    'test', 0, 1, 4096, 0, 'geom', ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)));
+SELECT 'TT5', z, count(*) FROM ST_AsMVTTiles(
+    'SELECT 1 AS c1, ''POLYGON((1000 1000,3000 1000,3000 3000,1000 3000,1000 1000))''::geometry AS geom',
+    'test', 0, 2, 4096, 0, 'geom', ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)))
+    GROUP BY z ORDER BY z;
+-- values kept out of line in the table are encoded like ST_AsMVT does
+CREATE TABLE mvt_toast (c1 integer, c2 text, geom geometry);
+ALTER TABLE mvt_toast ALTER COLUMN c2 SET STORAGE EXTERNAL;
+INSERT INTO mvt_toast VALUES (1, repeat('abcd', 2000), ST_MakePoint(25, 17));
+SELECT 'TT6', octet_length(t.mvt) > 8000, t.mvt = (SELECT ST_AsMVT('test', 4096, 'geom', q) FROM (
+    SELECT c1, c2, ST_AsMVTGeom(geom, ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)), 4096, 0, false) AS geom
+    FROM mvt_toast) AS q)
+    FROM ST_AsMVTTiles('SELECT c1, c2, geom FROM mvt_toast',
+    'test', 0, 0, 4096, 0, 'geom', ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096))) AS t;
+DROP TABLE mvt_toast;
 
 -- unsupported input
 SELECT 'TU2';
 SELECT encode(ST_AsMVT('test', 4096, 'geom', 1), 'base64');
 SELECT 'TU3';
 SELECT encode(ST_AsMVT('test', 4096, 'geom', q), 'base64')
-    FROM (SELECT NULL::integer AS c1, NULL AS geom) AS q;
\ No newline at end of file
+    FROM (SELECT NULL::integer AS c1, NULL AS geom) AS q;
+SELECT 'TU4';
+SELECT count(*) FROM ST_AsMVTTiles('SELECT 1 AS c1, ST_MakePoint(1, 1) AS geom',
+    'test', 2, 1);
+SELECT 'TU5';
+SELECT count(*) FROM ST_AsMVTTiles('SELECT 1 AS c1, ST_MakePoint(1, 1) AS g',
+    'test', 0, 1);
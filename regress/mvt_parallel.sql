@@ -0,0 +1,64 @@
+-- Parallel ST_AsMVT, the partial tiles of the workers go through the
+-- serial, deserial and combine functions of the aggregate
+CREATE TABLE mvt_parallel AS
+	SELECT i % 50 AS c1, 'name' || (i % 20) AS c2, ST_MakePoint(i % 37 * 100, i % 41 * 100) AS geom
+	FROM generate_series(1, 10000) i;
+CREATE TABLE mvt_parallel_same AS
+	SELECT 1 AS c1, 'abcd'::text AS c2, ST_MakePoint(25, 17) AS geom
+	FROM generate_series(1, 10000) i;
+ANALYZE mvt_parallel;
+ANALYZE mvt_parallel_same;
+
+CREATE FUNCTION mvt_parallel_plan(q text) RETURNS boolean
+AS $$
+DECLARE
+  l TEXT;
+BEGIN
+  FOR l IN EXECUTE 'EXPLAIN (COSTS OFF) ' || q LOOP
+    IF l LIKE '%Partial Aggregate%' THEN RETURN true; END IF;
+  END LOOP;
+  RETURN false;
+END;
+$$ LANGUAGE 'plpgsql' VOLATILE;
+
+-- Serial reference
+SET max_parallel_workers_per_gather = 0;
+CREATE TABLE mvt_parallel_serial AS SELECT
+	(SELECT ST_AsMVT('test', 4096, 'geom', q) FROM (SELECT c1, c2,
+		ST_AsMVTGeom(geom, ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)), 4096, 0, false) AS geom
+		FROM mvt_parallel) AS q) AS mixed,
+	(SELECT ST_AsMVT('test', 4096, 'geom', q) FROM (SELECT c1, c2,
+		ST_AsMVTGeom(geom, ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)), 4096, 0, false) AS geom
+		FROM mvt_parallel_same) AS q) AS same;
+
+-- Force the parallel plan, the minimum scan size setting was renamed in 10
+SET max_parallel_workers_per_gather = 2;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET force_parallel_mode = on;
+SELECT 'MP0', count(set_config(name, '0', false)) FROM pg_settings
+	WHERE name IN ('min_parallel_table_scan_size', 'min_parallel_relation_size');
+
+SELECT 'MP1', mvt_parallel_plan('SELECT ST_AsMVT(''test'', 4096, ''geom'', q) FROM (SELECT c1, c2,
+	ST_AsMVTGeom(geom, ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)), 4096, 0, false) AS geom
+	FROM mvt_parallel) AS q');
+-- Identical rows encode the same whatever worker they went through
+SELECT 'MP2', t = (SELECT same FROM mvt_parallel_serial)
+	FROM (SELECT ST_AsMVT('test', 4096, 'geom', q) AS t FROM (SELECT c1, c2,
+		ST_AsMVTGeom(geom, ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)), 4096, 0, false) AS geom
+		FROM mvt_parallel_same) AS q) AS p;
+-- Feature and value order depend on the workers, the size does not
+SELECT 'MP3', octet_length(t) = (SELECT octet_length(mixed) FROM mvt_parallel_serial)
+	FROM (SELECT ST_AsMVT('test', 4096, 'geom', q) AS t FROM (SELECT c1, c2,
+		ST_AsMVTGeom(geom, ST_MakeBox2D(ST_Point(0, 0), ST_Point(4096, 4096)), 4096, 0, false) AS geom
+		FROM mvt_parallel) AS q) AS p;
+
+RESET force_parallel_mode;
+RESET parallel_tuple_cost;
+RESET parallel_setup_cost;
+RESET max_parallel_workers_per_gather;
+
+DROP FUNCTION mvt_parallel_plan(text);
+DROP TABLE mvt_parallel_serial;
+DROP TABLE mvt_parallel_same;
+DROP TABLE mvt_parallel;
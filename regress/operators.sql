@@ -141,3 +141,39 @@ SELECT 'ndovm2', array_agg(i) FROM v WHERE g &&& 'POINTZ(0 0 1)'::geometry
 ORDER BY 1;
 
 
+
+-- btree ordering, ties on xmin fall back to ymin
+WITH v(i,g) AS ( VALUES
+ (1,'POINT(2 1)'::geometry),
+ (2,'POINT(1 2)'),
+ (3,'LINESTRING(1 0,3 3)'),
+ (4,'POINT(1.0000000001 1)'),
+ (5,'POINT(0 5)')
+ )
+SELECT 'btree_order', array_agg(i ORDER BY g) FROM v;
+
+-- hash opclass, consistent with =
+SELECT 'hash1', geometry_hash('LINESTRING(0 0,1 1)') = geometry_hash('LINESTRING(1 1,0 0)');
+SELECT 'hash2', geometry_hash('POINT(0 0)') = geometry_hash('POINT(-0 -0)');
+SELECT 'hash3', geometry_hash('POINT(0 0)') = geometry_hash('POINT(0 1)');
+SELECT 'hash4', geometry_hash('POINT EMPTY') = geometry_hash('LINESTRING EMPTY');
+SET enable_sort = off;
+WITH v(g) AS ( VALUES
+ ('POINT(0 0)'::geometry),
+ ('POINT(-0 -0)'),
+ ('POINT(0 1)'),
+ ('LINESTRING(0 0,1 1)'),
+ ('LINESTRING(1 1,0 0)')
+ )
+SELECT 'hashagg', count(*) FROM ( SELECT g FROM v GROUP BY g ) AS f;
+RESET enable_sort;
+
+-- sort support is registered on 9.5 and up, upgrades included
+SELECT 'btree_sortsupport', count(*) = CASE WHEN current_setting('server_version_num')::int >= 90500 THEN 1 ELSE 0 END
+FROM pg_amproc p JOIN pg_opfamily f ON p.amprocfamily = f.oid
+WHERE f.opfname = 'btree_geometry_ops' AND p.amprocnum = 2;
+
+-- = hashes, upgrades included
+SELECT 'eq_hashes', oprleft::regtype, oprcanhash FROM pg_operator
+WHERE oprname = '=' AND oprleft IN ('geometry'::regtype, 'geography'::regtype)
+ORDER BY 2;
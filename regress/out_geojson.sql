@@ -0,0 +1,33 @@
+INSERT INTO spatial_ref_sys (srid, auth_name, auth_srid, proj4text) VALUES (4326, 'EPSG', 4326, '+proj=longlat +ellps=WGS84 +datum=WGS84 +no_defs ');
+
+SELECT 'GJ1', ST_AsGeoJSONFeatureCollection('geom', q)
+    FROM (SELECT 1 AS id, 'one'::text AS name, ST_MakePoint(1, 2) AS geom) AS q;
+-- null geometries and values, escaped names and strings
+SELECT 'GJ2', ST_AsGeoJSONFeatureCollection('geom', q)
+    FROM (SELECT i AS "i""d", CASE WHEN i = 2 THEN NULL ELSE 'a' || chr(10) || i END AS s,
+        i % 2 = 0 AS b, i::float8 / 4 AS f, '{"k": [1]}'::json AS j,
+        CASE WHEN i = 2 THEN NULL ELSE ST_MakeLine(ST_MakePoint(0, 0), ST_MakePoint(i, i)) END AS geom
+        FROM generate_series(1, 3) AS i ORDER BY i) AS q;
+-- non finite numbers are quoted
+SELECT 'GJ3', ST_AsGeoJSONFeatureCollection('geom', q)
+    FROM (SELECT 'NaN'::float8 AS f, '-Infinity'::float4 AS g, 'NaN'::numeric AS n, 1.50::numeric AS m,
+        'POINT EMPTY'::geometry AS geom) AS q;
+-- precision and bbox
+SELECT 'GJ4', ST_AsGeoJSONFeatureCollection('geom', q, 2, 1)
+    FROM (SELECT 'POLYGON((0 0,1.2345 0,1.2345 1,0 0))'::geometry AS geom) AS q;
+-- crs of the first geometry
+SELECT 'GJ5', ST_AsGeoJSONFeatureCollection('geom', q, 0, 2)
+    FROM (SELECT 'SRID=4326;POINT(1 2)'::geometry AS geom) AS q;
+SELECT 'GJ6', ST_AsGeoJSONFeatureCollection('geom', q)
+    FROM (SELECT ST_MakePoint(1, 2) AS geom WHERE false) AS q;
+-- same geometries as ST_AsGeoJson
+SELECT 'GJ7', ST_AsGeoJSONFeatureCollection('geom', q)::json->'features'->0->>'geometry' = ST_AsGeoJson(geom)
+    FROM (SELECT 'GEOMETRYCOLLECTION(POINT(1 2),MULTIPOLYGON(((0 0,1 0,1 1,0 0))))'::geometry AS geom) AS q
+    GROUP BY geom;
+-- unsupported input
+SELECT 'GJU1', ST_AsGeoJSONFeatureCollection('the_geom', q)
+    FROM (SELECT ST_MakePoint(1, 2) AS geom) AS q;
+SELECT 'GJU2', ST_AsGeoJSONFeatureCollection('geom', q)
+    FROM (SELECT 'CIRCULARSTRING(0 0,1 1,2 0)'::geometry AS geom) AS q;
+
+DELETE FROM spatial_ref_sys;
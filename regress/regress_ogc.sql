@@ -189,6 +189,13 @@ select 'intersects', ST_intersects(
 select 'ST_GeometryN', ST_asewkt(ST_GeometryN('LINESTRING(0 0, 1 1)'::geometry, 1));
 select 'ST_NumGeometries', ST_NumGeometries('LINESTRING(0 0, 1 1)'::geometry);
 select 'ST_Union1', ST_AsText(ST_Union(ARRAY['POLYGON((0 0, 0 1, 1 1, 1 0, 0 0))'::geometry, 'POLYGON((0.5 0.5, 1.5 0.5, 1.5 1.5, 0.5 1.5, 0.5 0.5))'::geometry]));
+select 'ST_Union2', ST_AsText(ST_Union(g)) FROM (VALUES ('POLYGON((0 0, 0 1, 1 1, 1 0, 0 0))'::geometry), (NULL), ('POLYGON((0.5 0.5, 1.5 0.5, 1.5 1.5, 0.5 1.5, 0.5 0.5))'::geometry)) AS t(g);
+select 'ST_Union3', ST_AsText(ST_Union(g)) FROM (VALUES (NULL::geometry), (NULL)) AS t(g);
+select 'ST_Union4', ST_AsText(ST_Union(g)) FROM (VALUES ('POINT EMPTY'::geometry), (NULL)) AS t(g);
+-- Low work_mem forces the aggregate to union in batches
+SET work_mem = 64;
+select 'ST_Union5', ST_Area(u), ST_NumGeometries(u) FROM (SELECT ST_Union(ST_MakeEnvelope(i, 0, i + 2, 1)) AS u FROM generate_series(0, 4999) i) AS t;
+RESET work_mem;
 select 'ST_StartPoint1',ST_AsText(ST_StartPoint('LINESTRING(0 0, 1 1, 2 2)'::geometry));
 select 'ST_EndPoint1', ST_AsText(ST_Endpoint('LINESTRING(0 0, 1 1, 2 2)'::geometry));
 select 'ST_PointN1', ST_AsText(ST_PointN('LINESTRING(0 0, 1 1, 2 2)'::geometry,2));
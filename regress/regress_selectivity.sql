@@ -4,6 +4,7 @@ create table no_stats ( g geometry, id integer );
 create table no_stats_join ( g geometry, id integer );
 select _postgis_selectivity('no_stats','g', 'LINESTRING(0 0, 1 1)');
 select _postgis_stats('no_stats','g');
+select _postgis_vertex_stats('no_stats','g');
 select _postgis_join_selectivity('no_stats', 'g', 'no_stats_join', 'g');
 insert into no_stats (g, id) values ('POINT(0 0)', 0);
 analyze no_stats;
@@ -47,6 +48,41 @@ select 'selectivity_09', 'estimated', _postgis_selectivity('regular_overdots','g
 select 'selectivity_10', 'actual', 1;
 select 'selectivity_09', 'estimated', _postgis_selectivity('regular_overdots','g','LINESTRING(0 0, 12 12)');
 
+-- Vertex count statistics
+select 'vertex_stats_01', _postgis_vertex_stats('regular_overdots','g');
+create table vertex_lines as
+select st_makeline(array(select st_makepoint(j, j) from generate_series(0, i) j)) as g
+from generate_series(1, 100) i;
+insert into vertex_lines values (NULL), ('LINESTRING EMPTY');
+analyze vertex_lines;
+select 'vertex_stats_02', _postgis_vertex_stats('vertex_lines','g');
+drop table vertex_lines;
+
+-- Vertex costs move the plan: a filter that is cheap on points is
+-- worth an index scan on 1001 vertex lines
+create function vertex_cost_plan(q text) returns text as $$
+declare
+  p json;
+begin
+  execute 'explain (format json) ' || q into p;
+  return p->0->'Plan'->>'Node Type';
+end
+$$ language plpgsql;
+create table vertex_cost_pts as
+select i as id, st_makepoint(2000, i) as g from generate_series(0, 999) i;
+create table vertex_cost_lines as
+select i as id, st_segmentize(st_makeline(st_makepoint(0, i), st_makepoint(1000, i)), 1) as g
+from generate_series(0, 999) i;
+create index on vertex_cost_pts (id);
+create index on vertex_cost_lines (id);
+analyze vertex_cost_pts;
+analyze vertex_cost_lines;
+select 'vertex_cost_01', vertex_cost_plan('select * from vertex_cost_pts where id < 950 and st_distance(g, ''POINT(0 0)'') < 1');
+select 'vertex_cost_02', vertex_cost_plan('select * from vertex_cost_lines where id < 950 and st_distance(g, ''POINT(0 0)'') < 1') <> 'Seq Scan';
+drop table vertex_cost_pts;
+drop table vertex_cost_lines;
+drop function vertex_cost_plan(text);
+
 -- Clean
 drop table if exists regular_overdots;
 
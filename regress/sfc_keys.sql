@@ -0,0 +1,30 @@
+-- ST_HilbertKey / ST_ZOrderKey
+SELECT 'hilbert_01', ST_HilbertKey('POINT(0 0)'::geometry, 'BOX(0 0,10 10)'::box2d);
+SELECT 'hilbert_02', ST_HilbertKey('POINT(5 5)'::geometry, 'BOX(0 0,10 10)'::box2d);
+SELECT 'hilbert_03', ST_HilbertKey('POINT(-5 50)'::geometry, 'BOX(0 0,10 10)'::box2d);
+SELECT 'hilbert_04', ST_HilbertKey('LINESTRING(0 0,10 10)'::geometry, 'BOX(0 0,10 10)'::box2d);
+SELECT 'hilbert_05', ST_HilbertKey('POINT EMPTY'::geometry, 'BOX(0 0,10 10)'::box2d) IS NULL;
+SELECT 'zorder_01', ST_ZOrderKey('POINT(0 0)'::geometry, 'BOX(0 0,10 10)'::box2d);
+SELECT 'zorder_02', ST_ZOrderKey('POINT(5 5)'::geometry, 'BOX(0 0,10 10)'::box2d);
+SELECT 'zorder_03', ST_ZOrderKey('POINT(-5 50)'::geometry, 'BOX(0 0,10 10)'::box2d);
+SELECT 'zorder_04', ST_ZOrderKey('POINT EMPTY'::geometry, 'BOX(0 0,10 10)'::box2d) IS NULL;
+
+-- Ordering of a 4x4 grid follows the curves
+WITH grid AS (
+	SELECT ST_MakePoint(x + 0.5, y + 0.5) AS g
+	FROM generate_series(0,3) x, generate_series(0,3) y
+)
+SELECT 'hilbert_order', string_agg(floor(ST_X(g)) || '' || floor(ST_Y(g)), ' '
+	ORDER BY ST_HilbertKey(g, 'BOX(0 0,4 4)'::box2d))
+FROM grid;
+WITH grid AS (
+	SELECT ST_MakePoint(x + 0.5, y + 0.5) AS g
+	FROM generate_series(0,3) x, generate_series(0,3) y
+)
+SELECT 'zorder_order', string_agg(floor(ST_X(g)) || '' || floor(ST_Y(g)), ' '
+	ORDER BY ST_ZOrderKey(g, 'BOX(0 0,4 4)'::box2d))
+FROM grid;
+-- Keys from the table statistics change after ANALYZE, not IMMUTABLE
+SELECT 'stats_volatility', proname, provolatile FROM pg_proc
+	WHERE proname IN ('st_hilbertkey', 'st_zorderkey') AND pronargs = 3
+	ORDER BY proname;